@@ -0,0 +1,207 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Arena (bump) allocator
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "list.h"
+
+/** Round size up to allocation granularity.
+ *
+ * @param size Size in bytes
+ * @return Rounded size
+ */
+static size_t arena_round(size_t size)
+{
+	if (size == 0)
+		size = 1;
+	return (size + arena_align - 1) & ~(size_t)(arena_align - 1);
+}
+
+/** Create arena.
+ *
+ * No memory is allocated for the chunks until the first allocation.
+ *
+ * @param chunk_size Default chunk size in bytes
+ * @param rarena Place to store pointer to new arena
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int arena_create(size_t chunk_size, arena_t **rarena)
+{
+	arena_t *arena;
+
+	arena = calloc(1, sizeof(arena_t));
+	if (arena == NULL)
+		return ENOMEM;
+
+	list_initialize(&arena->chunks);
+	arena->chunk_size = arena_round(chunk_size);
+	*rarena = arena;
+	return 0;
+}
+
+/** Destroy arena.
+ *
+ * All objects allocated from the arena are released.
+ *
+ * @param arena Arena or @c NULL
+ */
+void arena_destroy(arena_t *arena)
+{
+	link_t *link;
+	arena_chunk_t *chunk;
+
+	if (arena == NULL)
+		return;
+
+	link = list_first(&arena->chunks);
+	while (link != NULL) {
+		chunk = list_get_instance(link, arena_chunk_t, lchunks);
+		list_remove(&chunk->lchunks);
+		free(chunk->data);
+		free(chunk);
+
+		link = list_first(&arena->chunks);
+	}
+
+	free(arena);
+}
+
+/** Add new chunk to arena.
+ *
+ * @param arena Arena
+ * @param size Minimum number of bytes that must fit in the chunk
+ * @return New chunk or @c NULL if out of memory
+ */
+static arena_chunk_t *arena_add_chunk(arena_t *arena, size_t size)
+{
+	arena_chunk_t *chunk;
+
+	chunk = calloc(1, sizeof(arena_chunk_t));
+	if (chunk == NULL)
+		return NULL;
+
+	if (size < arena->chunk_size)
+		size = arena->chunk_size;
+
+	chunk->data = calloc(1, size);
+	if (chunk->data == NULL) {
+		free(chunk);
+		return NULL;
+	}
+
+	chunk->size = size;
+	list_append(&chunk->lchunks, &arena->chunks);
+	return chunk;
+}
+
+/** Allocate zero-filled object from arena.
+ *
+ * @param arena Arena
+ * @param size Size in bytes
+ * @return Pointer to new object or @c NULL if out of memory
+ */
+void *arena_alloc(arena_t *arena, size_t size)
+{
+	link_t *link;
+	arena_chunk_t *chunk;
+	size_t bin;
+	void *obj;
+
+	size = arena_round(size);
+
+	/* Reuse a previously freed object of the same size if possible */
+	bin = size / arena_align - 1;
+	if (bin < arena_free_bins && arena->free[bin] != NULL) {
+		obj = arena->free[bin];
+		arena->free[bin] = *(void **)obj;
+		memset(obj, 0, size);
+		return obj;
+	}
+
+	chunk = NULL;
+	link = list_last(&arena->chunks);
+	if (link != NULL) {
+		chunk = list_get_instance(link, arena_chunk_t, lchunks);
+		if (chunk->size - chunk->used < size)
+			chunk = NULL;
+	}
+
+	if (chunk == NULL) {
+		chunk = arena_add_chunk(arena, size);
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	obj = chunk->data + chunk->used;
+	chunk->used += size;
+	return obj;
+}
+
+/** Return object to arena.
+ *
+ * The memory is not released to the system, but the object is placed on
+ * a free list so that it can be reused by a later allocation of the same
+ * size. Objects that are too large for any free list are simply
+ * abandoned until the arena is destroyed.
+ *
+ * @param arena Arena
+ * @param obj Object allocated from @a arena
+ * @param size Size of the object as passed to arena_alloc()
+ */
+void arena_free(arena_t *arena, void *obj, size_t size)
+{
+	size_t bin;
+
+	size = arena_round(size);
+	bin = size / arena_align - 1;
+	if (bin >= arena_free_bins)
+		return;
+
+	*(void **)obj = arena->free[bin];
+	arena->free[bin] = obj;
+}
+
+/** Duplicate string into arena.
+ *
+ * @param arena Arena
+ * @param str String
+ * @return Copy of the string or @c NULL if out of memory
+ */
+char *arena_strdup(arena_t *arena, const char *str)
+{
+	size_t len;
+	char *copy;
+
+	len = strlen(str);
+	copy = arena_alloc(arena, len + 1);
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, str, len + 1);
+	return copy;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Arena (bump) allocator
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "list.h"
+
+enum {
+	/** Allocation granularity and alignment */
+	arena_align = 16,
+	/** Number of free-list size classes */
+	arena_free_bins = 16
+};
+
+/** Arena chunk */
+typedef struct {
+	/** Link to @c arena->chunks */
+	link_t lchunks;
+	/** Number of bytes available in the chunk */
+	size_t size;
+	/** Number of bytes already allocated */
+	size_t used;
+	/** Chunk data */
+	char *data;
+} arena_chunk_t;
+
+/** Arena
+ *
+ * Objects are carved out of large chunks sequentially and are all
+ * released at once when the arena is destroyed. Individually released
+ * objects are kept on per-size free lists and reused by later allocations
+ * of the same size.
+ */
+typedef struct {
+	/** Chunks (arena_chunk_t) */
+	list_t chunks;
+	/** Default chunk size */
+	size_t chunk_size;
+	/** Free lists indexed by size class */
+	void *free[arena_free_bins];
+} arena_t;
+
+extern int arena_create(size_t, arena_t **);
+extern void arena_destroy(arena_t *);
+extern void *arena_alloc(arena_t *, size_t);
+extern void arena_free(arena_t *, void *, size_t);
+extern char *arena_strdup(arena_t *, const char *);
+
+#endif
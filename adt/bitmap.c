@@ -0,0 +1,117 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Bitmap
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include "bitmap.h"
+
+/** Create bitmap.
+ *
+ * All bits are initially clear.
+ *
+ * @param nbits Number of bits
+ * @param rbitmap Place to store pointer to new bitmap
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int bitmap_create(size_t nbits, bitmap_t **rbitmap)
+{
+	bitmap_t *bitmap;
+
+	bitmap = calloc(1, sizeof(bitmap_t));
+	if (bitmap == NULL)
+		return ENOMEM;
+
+	bitmap->bits = calloc((nbits + 7) / 8, 1);
+	if (bitmap->bits == NULL && nbits > 0) {
+		free(bitmap);
+		return ENOMEM;
+	}
+
+	bitmap->nbits = nbits;
+	*rbitmap = bitmap;
+	return 0;
+}
+
+/** Destroy bitmap.
+ *
+ * @param bitmap Bitmap or @c NULL
+ */
+void bitmap_destroy(bitmap_t *bitmap)
+{
+	if (bitmap == NULL)
+		return;
+
+	free(bitmap->bits);
+	free(bitmap);
+}
+
+/** Set or clear bit.
+ *
+ * @param bitmap Bitmap
+ * @param idx Bit index
+ * @param value @c true to set bit, @c false to clear it
+ */
+void bitmap_set(bitmap_t *bitmap, size_t idx, bool value)
+{
+	uint8_t mask;
+
+	assert(idx < bitmap->nbits);
+	mask = 1 << (idx % 8);
+
+	if (bitmap_get(bitmap, idx) == value)
+		return;
+
+	if (value) {
+		bitmap->bits[idx / 8] |= mask;
+		++bitmap->count;
+	} else {
+		bitmap->bits[idx / 8] &= ~mask;
+		--bitmap->count;
+	}
+}
+
+/** Get bit.
+ *
+ * @param bitmap Bitmap
+ * @param idx Bit index
+ * @return @c true iff bit is set
+ */
+bool bitmap_get(bitmap_t *bitmap, size_t idx)
+{
+	assert(idx < bitmap->nbits);
+	return (bitmap->bits[idx / 8] & (1 << (idx % 8))) != 0;
+}
+
+/** Get number of set bits.
+ *
+ * @param bitmap Bitmap
+ * @return Number of bits that are set
+ */
+size_t bitmap_count(bitmap_t *bitmap)
+{
+	return bitmap->count;
+}
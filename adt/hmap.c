@@ -0,0 +1,394 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Open-addressing hash map
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hmap.h"
+
+enum {
+	/** Minimum number of slots */
+	hmap_min_size = 16
+};
+
+/** Compute hash of an integer key.
+ *
+ * @param key Key
+ * @return Hash
+ */
+uint64_t hmap_hash_int(uint64_t key)
+{
+	/* SplitMix64 finalizer */
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+/** Compute hash of a string key.
+ *
+ * @param key Key
+ * @return Hash
+ */
+uint64_t hmap_hash_str(const char *key)
+{
+	uint64_t hash;
+
+	/* FNV-1a */
+	hash = 0xcbf29ce484222325ULL;
+	while (*key != '\0') {
+		hash ^= (uint8_t)*key++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/** Create hash map.
+ *
+ * @param ktype Key type
+ * @param rhmap Place to store pointer to new hash map
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int hmap_create(hmap_ktype_t ktype, hmap_t **rhmap)
+{
+	hmap_t *hmap;
+
+	hmap = calloc(1, sizeof(hmap_t));
+	if (hmap == NULL)
+		return ENOMEM;
+
+	hmap->entries = calloc(hmap_min_size, sizeof(hmap_entry_t));
+	if (hmap->entries == NULL) {
+		free(hmap);
+		return ENOMEM;
+	}
+
+	hmap->ktype = ktype;
+	hmap->size = hmap_min_size;
+	*rhmap = hmap;
+	return 0;
+}
+
+/** Destroy hash map.
+ *
+ * The values are not touched.
+ *
+ * @param hmap Hash map or @c NULL
+ */
+void hmap_destroy(hmap_t *hmap)
+{
+	if (hmap == NULL)
+		return;
+
+	hmap_clear(hmap);
+	free(hmap->entries);
+	free(hmap);
+}
+
+/** Determine if entry matches key.
+ *
+ * @param hmap Hash map
+ * @param entry Used entry
+ * @param hash Key hash
+ * @param ikey Integer key
+ * @param skey String key
+ * @return @c true iff the entry has the specified key
+ */
+static bool hmap_entry_match(hmap_t *hmap, hmap_entry_t *entry,
+    uint64_t hash, uint64_t ikey, const char *skey)
+{
+	if (entry->hash != hash)
+		return false;
+
+	if (hmap->ktype == hmk_int)
+		return entry->ikey == ikey;
+
+	return strcmp(entry->skey, skey) == 0;
+}
+
+/** Find entry by key.
+ *
+ * @param hmap Hash map
+ * @param hash Key hash
+ * @param ikey Integer key
+ * @param skey String key
+ * @return Entry or @c NULL if not found
+ */
+static hmap_entry_t *hmap_find(hmap_t *hmap, uint64_t hash, uint64_t ikey,
+    const char *skey)
+{
+	size_t mask = hmap->size - 1;
+	size_t i;
+	hmap_entry_t *entry;
+
+	i = hash & mask;
+	while (true) {
+		entry = &hmap->entries[i];
+		if (entry->state == hms_free)
+			return NULL;
+
+		if (entry->state == hms_used &&
+		    hmap_entry_match(hmap, entry, hash, ikey, skey))
+			return entry;
+
+		i = (i + 1) & mask;
+	}
+}
+
+/** Resize slot table.
+ *
+ * Also drops all tombstones.
+ *
+ * @param hmap Hash map
+ * @param nsize New number of slots (power of two, above entry count)
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int hmap_resize(hmap_t *hmap, size_t nsize)
+{
+	hmap_entry_t *nentries;
+	hmap_entry_t *entry;
+	size_t i, j;
+
+	nentries = calloc(nsize, sizeof(hmap_entry_t));
+	if (nentries == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < hmap->size; i++) {
+		entry = &hmap->entries[i];
+		if (entry->state != hms_used)
+			continue;
+
+		j = entry->hash & (nsize - 1);
+		while (nentries[j].state != hms_free)
+			j = (j + 1) & (nsize - 1);
+
+		nentries[j] = *entry;
+	}
+
+	free(hmap->entries);
+	hmap->entries = nentries;
+	hmap->size = nsize;
+	hmap->used = hmap->count;
+	return 0;
+}
+
+/** Insert new entry.
+ *
+ * @param hmap Hash map
+ * @param hash Key hash
+ * @param ikey Integer key
+ * @param skey String key
+ * @param value Value
+ * @return Zero on success, EEXIST if key is already present,
+ *         ENOMEM if out of memory
+ */
+static int hmap_insert(hmap_t *hmap, uint64_t hash, uint64_t ikey,
+    const char *skey, void *value)
+{
+	hmap_entry_t *entry;
+	size_t nsize;
+	size_t mask;
+	size_t i;
+	int rc;
+
+	if (hmap_find(hmap, hash, ikey, skey) != NULL)
+		return EEXIST;
+
+	/* Keep load factor (including tombstones) below 3/4 */
+	if ((hmap->used + 1) * 4 > hmap->size * 3) {
+		nsize = hmap->size;
+		while ((hmap->count + 1) * 2 > nsize)
+			nsize *= 2;
+
+		rc = hmap_resize(hmap, nsize);
+		if (rc != 0)
+			return rc;
+	}
+
+	mask = hmap->size - 1;
+	i = hash & mask;
+	while (hmap->entries[i].state == hms_used)
+		i = (i + 1) & mask;
+
+	entry = &hmap->entries[i];
+	if (hmap->ktype == hmk_str) {
+		entry->skey = strdup(skey);
+		if (entry->skey == NULL)
+			return ENOMEM;
+	} else {
+		entry->ikey = ikey;
+	}
+
+	if (entry->state == hms_free)
+		++hmap->used;
+
+	entry->state = hms_used;
+	entry->hash = hash;
+	entry->value = value;
+	++hmap->count;
+	return 0;
+}
+
+/** Insert entry with integer key.
+ *
+ * @param hmap Hash map with integer keys
+ * @param key Key
+ * @param value Value
+ * @return Zero on success, EEXIST if key is already present,
+ *         ENOMEM if out of memory
+ */
+int hmap_insert_int(hmap_t *hmap, uint64_t key, void *value)
+{
+	assert(hmap->ktype == hmk_int);
+	return hmap_insert(hmap, hmap_hash_int(key), key, NULL, value);
+}
+
+/** Insert entry with string key.
+ *
+ * @param hmap Hash map with string keys
+ * @param key Key (will be duplicated)
+ * @param value Value
+ * @return Zero on success, EEXIST if key is already present,
+ *         ENOMEM if out of memory
+ */
+int hmap_insert_str(hmap_t *hmap, const char *key, void *value)
+{
+	assert(hmap->ktype == hmk_str);
+	return hmap_insert(hmap, hmap_hash_str(key), 0, key, value);
+}
+
+/** Find entry by integer key.
+ *
+ * @param hmap Hash map with integer keys
+ * @param key Key
+ * @return Entry or @c NULL if not found
+ */
+hmap_entry_t *hmap_find_int(hmap_t *hmap, uint64_t key)
+{
+	assert(hmap->ktype == hmk_int);
+	return hmap_find(hmap, hmap_hash_int(key), key, NULL);
+}
+
+/** Find entry by string key.
+ *
+ * @param hmap Hash map with string keys
+ * @param key Key
+ * @return Entry or @c NULL if not found
+ */
+hmap_entry_t *hmap_find_str(hmap_t *hmap, const char *key)
+{
+	assert(hmap->ktype == hmk_str);
+	return hmap_find(hmap, hmap_hash_str(key), 0, key);
+}
+
+/** Remove entry from hash map.
+ *
+ * @param hmap Hash map
+ * @param entry Entry (as returned by a find or iteration function)
+ */
+void hmap_remove(hmap_t *hmap, hmap_entry_t *entry)
+{
+	assert(entry->state == hms_used);
+
+	free(entry->skey);
+	entry->skey = NULL;
+	entry->value = NULL;
+	entry->state = hms_deleted;
+	--hmap->count;
+}
+
+/** Remove all entries from hash map.
+ *
+ * @param hmap Hash map
+ */
+void hmap_clear(hmap_t *hmap)
+{
+	size_t i;
+
+	for (i = 0; i < hmap->size; i++)
+		free(hmap->entries[i].skey);
+
+	memset(hmap->entries, 0, hmap->size * sizeof(hmap_entry_t));
+	hmap->count = 0;
+	hmap->used = 0;
+}
+
+/** Get number of entries in hash map.
+ *
+ * @param hmap Hash map
+ * @return Number of entries
+ */
+size_t hmap_count(hmap_t *hmap)
+{
+	return hmap->count;
+}
+
+/** Find used slot at or after index.
+ *
+ * @param hmap Hash map
+ * @param i Starting index
+ * @return Entry or @c NULL if there are no more entries
+ */
+static hmap_entry_t *hmap_next_used(hmap_t *hmap, size_t i)
+{
+	while (i < hmap->size) {
+		if (hmap->entries[i].state == hms_used)
+			return &hmap->entries[i];
+		++i;
+	}
+
+	return NULL;
+}
+
+/** Get first hash map entry.
+ *
+ * Entries are returned in no particular order.
+ *
+ * @param hmap Hash map
+ * @return First entry or @c NULL if hash map is empty
+ */
+hmap_entry_t *hmap_first(hmap_t *hmap)
+{
+	return hmap_next_used(hmap, 0);
+}
+
+/** Get next hash map entry.
+ *
+ * The current entry can be removed before calling this function.
+ *
+ * @param hmap Hash map
+ * @param cur Current entry
+ * @return Next entry or @c NULL if @a cur is the last entry
+ */
+hmap_entry_t *hmap_next(hmap_t *hmap, hmap_entry_t *cur)
+{
+	return hmap_next_used(hmap, (size_t)(cur - hmap->entries) + 1);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Open-addressing hash map
+ */
+
+#ifndef HMAP_H
+#define HMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Hash map key type */
+typedef enum {
+	/** Integer keys */
+	hmk_int,
+	/** String keys */
+	hmk_str
+} hmap_ktype_t;
+
+/** Hash map slot state */
+typedef enum {
+	/** Slot was never used */
+	hms_free = 0,
+	/** Slot holds an entry */
+	hms_used,
+	/** Slot held an entry that was removed */
+	hms_deleted
+} hmap_slot_state_t;
+
+/** Hash map entry */
+typedef struct {
+	/** Slot state */
+	hmap_slot_state_t state;
+	/** Key hash */
+	uint64_t hash;
+	/** Integer key (if key type is hmk_int) */
+	uint64_t ikey;
+	/** String key owned by the map (if key type is hmk_str) */
+	char *skey;
+	/** Value */
+	void *value;
+} hmap_entry_t;
+
+/** Hash map
+ *
+ * Linear probing over a power-of-two sized table.
+ */
+typedef struct {
+	/** Key type */
+	hmap_ktype_t ktype;
+	/** Slots */
+	hmap_entry_t *entries;
+	/** Number of slots */
+	size_t size;
+	/** Number of entries */
+	size_t count;
+	/** Number of slots that are not free (entries and tombstones) */
+	size_t used;
+} hmap_t;
+
+extern int hmap_create(hmap_ktype_t, hmap_t **);
+extern void hmap_destroy(hmap_t *);
+extern int hmap_insert_int(hmap_t *, uint64_t, void *);
+extern int hmap_insert_str(hmap_t *, const char *, void *);
+extern hmap_entry_t *hmap_find_int(hmap_t *, uint64_t);
+extern hmap_entry_t *hmap_find_str(hmap_t *, const char *);
+extern void hmap_remove(hmap_t *, hmap_entry_t *);
+extern void hmap_clear(hmap_t *);
+extern size_t hmap_count(hmap_t *);
+extern hmap_entry_t *hmap_first(hmap_t *);
+extern hmap_entry_t *hmap_next(hmap_t *, hmap_entry_t *);
+extern uint64_t hmap_hash_int(uint64_t);
+extern uint64_t hmap_hash_str(const char *);
+
+#endif
@@ -37,6 +37,8 @@ void list_initialize(list_t *list)
 {
 	list->head.prev = &list->head;
 	list->head.next = &list->head;
+	list->head.list = list;
+	list->count = 0;
 }
 
 /** Initialize link.
@@ -47,6 +49,7 @@ void link_initialize(link_t *link)
 {
 	link->prev = NULL;
 	link->next = NULL;
+	link->list = NULL;
 }
 
 /** Insert item before item in list.
@@ -62,6 +65,9 @@ void list_insert_before(link_t *nlink, link_t *olink)
 	nlink->prev = olink->prev;
 	nlink->next = olink;
 	olink->prev = nlink;
+
+	nlink->list = olink->list;
+	++nlink->list->count;
 }
 
 /** Insert item after item in list.
@@ -77,6 +83,9 @@ void list_insert_after(link_t *nlink, link_t *olink)
 	nlink->next = olink->next;
 	nlink->prev = olink;
 	olink->next = nlink;
+
+	nlink->list = olink->list;
+	++nlink->list->count;
 }
 
 /** Insert at beginning of list.
@@ -110,8 +119,12 @@ void list_remove(link_t *link)
 	link->prev->next = link->next;
 	link->next->prev = link->prev;
 
+	assert(link->list->count > 0);
+	--link->list->count;
+
 	link->prev = NULL;
 	link->next = NULL;
+	link->list = NULL;
 }
 
 /** Return true if item is linked to a list.
@@ -145,17 +158,7 @@ bool list_empty(list_t *list)
  */
 unsigned long list_count(list_t *list)
 {
-	link_t *link;
-	unsigned long count;
-
-	count = 0;
-	link = list_first(list);
-	while (link != NULL) {
-		++count;
-		link = list_next(link, list);
-	}
-
-	return count;
+	return list->count;
 }
 
 /** Return first item in a list or @c NULL if list is empty.
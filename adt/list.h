@@ -30,14 +30,20 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+struct list;
+
 /** List link */
 typedef struct link {
 	struct link *prev, *next;
+	/** List the link belongs to or @c NULL */
+	struct list *list;
 } link_t;
 
 /** Doubly linked list */
-typedef struct {
+typedef struct list {
 	link_t head;
+	/** Number of items in the list */
+	unsigned long count;
 } list_t;
 
 #define list_get_instance(link, type, member) \
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Fixed-size object pool
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "list.h"
+#include "pool.h"
+
+enum {
+	/** Object alignment */
+	pool_align = 16,
+	/** Approximate size of a chunk in bytes */
+	pool_chunk_bytes = 16384
+};
+
+/** Create object pool.
+ *
+ * @param osize Object size
+ * @param rpool Place to store pointer to new pool
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int pool_create(size_t osize, pool_t **rpool)
+{
+	pool_t *pool;
+
+	pool = calloc(1, sizeof(pool_t));
+	if (pool == NULL)
+		return ENOMEM;
+
+	/* Every object must be able to hold the free list link */
+	if (osize < sizeof(void *))
+		osize = sizeof(void *);
+
+	pool->osize = (osize + pool_align - 1) & ~(size_t)(pool_align - 1);
+	pool->chunk_objs = pool_chunk_bytes / pool->osize;
+	if (pool->chunk_objs < 1)
+		pool->chunk_objs = 1;
+
+	list_initialize(&pool->chunks);
+	*rpool = pool;
+	return 0;
+}
+
+/** Destroy object pool.
+ *
+ * All objects allocated from the pool are freed.
+ *
+ * @param pool Pool or @c NULL
+ */
+void pool_destroy(pool_t *pool)
+{
+	link_t *link;
+	pool_chunk_t *chunk;
+
+	if (pool == NULL)
+		return;
+
+	link = list_first(&pool->chunks);
+	while (link != NULL) {
+		chunk = list_get_instance(link, pool_chunk_t, lchunks);
+		list_remove(&chunk->lchunks);
+		free(chunk->data);
+		free(chunk);
+		link = list_first(&pool->chunks);
+	}
+
+	free(pool);
+}
+
+/** Add new chunk to pool and put its objects on the free list.
+ *
+ * @param pool Pool
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int pool_grow(pool_t *pool)
+{
+	pool_chunk_t *chunk;
+	size_t i;
+	void **obj;
+
+	chunk = calloc(1, sizeof(pool_chunk_t));
+	if (chunk == NULL)
+		return ENOMEM;
+
+	chunk->data = malloc(pool->chunk_objs * pool->osize);
+	if (chunk->data == NULL) {
+		free(chunk);
+		return ENOMEM;
+	}
+
+	chunk->pool = pool;
+	list_append(&chunk->lchunks, &pool->chunks);
+
+	/* Thread objects in reverse so that they are handed out in order */
+	i = pool->chunk_objs;
+	while (i > 0) {
+		--i;
+		obj = (void **)(chunk->data + i * pool->osize);
+		*obj = pool->free;
+		pool->free = obj;
+	}
+
+	return 0;
+}
+
+/** Allocate object from pool.
+ *
+ * @param pool Pool
+ * @return Pointer to new zero-filled object or @c NULL if out of memory
+ */
+void *pool_alloc(pool_t *pool)
+{
+	void **obj;
+	int rc;
+
+	if (pool->free == NULL) {
+		rc = pool_grow(pool);
+		if (rc != 0)
+			return NULL;
+	}
+
+	obj = pool->free;
+	pool->free = *obj;
+	++pool->nalloc;
+
+	memset(obj, 0, pool->osize);
+	return obj;
+}
+
+/** Return object to pool.
+ *
+ * @param pool Pool
+ * @param obj Object allocated from @a pool or @c NULL
+ */
+void pool_free(pool_t *pool, void *obj)
+{
+	if (obj == NULL)
+		return;
+
+	assert(pool->nalloc > 0);
+	*(void **)obj = pool->free;
+	pool->free = obj;
+	--pool->nalloc;
+}
+
+/** Get number of objects currently allocated from pool.
+ *
+ * @param pool Pool
+ * @return Number of allocated objects
+ */
+size_t pool_count(pool_t *pool)
+{
+	return pool->nalloc;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Fixed-size object pool
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include "list.h"
+
+/** Object pool
+ *
+ * Hands out objects of a single size carved from larger chunks.
+ * Freed objects are kept on a free list and reused.
+ */
+typedef struct {
+	/** Chunks (of pool_chunk_t) */
+	list_t chunks;
+	/** Object size */
+	size_t osize;
+	/** Number of objects per chunk */
+	size_t chunk_objs;
+	/** Free objects */
+	void *free;
+	/** Number of allocated objects */
+	size_t nalloc;
+} pool_t;
+
+/** Object pool chunk */
+typedef struct {
+	/** Containing pool */
+	pool_t *pool;
+	/** Link to pool_t.chunks */
+	link_t lchunks;
+	/** Objects */
+	char *data;
+} pool_chunk_t;
+
+extern int pool_create(size_t, pool_t **);
+extern void pool_destroy(pool_t *);
+extern void *pool_alloc(pool_t *);
+extern void pool_free(pool_t *, void *);
+extern size_t pool_count(pool_t *);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Growable vector
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+
+enum {
+	/** Minimum number of allocated elements */
+	vector_min_alloc = 8
+};
+
+/** Initialize vector.
+ *
+ * @param vector Vector
+ * @param esize Element size
+ */
+void vector_initialize(vector_t *vector, size_t esize)
+{
+	vector->data = NULL;
+	vector->esize = esize;
+	vector->nelems = 0;
+	vector->alloc = 0;
+}
+
+/** Finalize vector.
+ *
+ * Frees the element storage. The vector can be reused after calling
+ * vector_initialize() again.
+ *
+ * @param vector Vector
+ */
+void vector_fini(vector_t *vector)
+{
+	free(vector->data);
+	vector->data = NULL;
+	vector->nelems = 0;
+	vector->alloc = 0;
+}
+
+/** Make sure vector can hold a number of elements without reallocation.
+ *
+ * @param vector Vector
+ * @param cnt Number of elements
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int vector_reserve(vector_t *vector, size_t cnt)
+{
+	void *ndata;
+
+	if (cnt <= vector->alloc)
+		return 0;
+
+	ndata = realloc(vector->data, cnt * vector->esize);
+	if (ndata == NULL)
+		return ENOMEM;
+
+	vector->data = ndata;
+	vector->alloc = cnt;
+	return 0;
+}
+
+/** Grow vector so that at least one more element fits.
+ *
+ * @param vector Vector
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int vector_grow(vector_t *vector)
+{
+	if (vector->nelems < vector->alloc)
+		return 0;
+
+	return vector_reserve(vector, vector->alloc > 0 ? 2 * vector->alloc :
+	    vector_min_alloc);
+}
+
+/** Append element to vector.
+ *
+ * @param vector Vector
+ * @param elem Element to copy into the vector
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int vector_append(vector_t *vector, const void *elem)
+{
+	return vector_insert(vector, vector->nelems, elem);
+}
+
+/** Insert element into vector.
+ *
+ * Elements at position @a idx and above are shifted up by one.
+ *
+ * @param vector Vector
+ * @param idx Position (at most the number of elements)
+ * @param elem Element to copy into the vector
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int vector_insert(vector_t *vector, size_t idx, const void *elem)
+{
+	char *data;
+	int rc;
+
+	assert(idx <= vector->nelems);
+
+	rc = vector_grow(vector);
+	if (rc != 0)
+		return rc;
+
+	data = vector->data;
+	memmove(data + (idx + 1) * vector->esize, data + idx * vector->esize,
+	    (vector->nelems - idx) * vector->esize);
+	memcpy(data + idx * vector->esize, elem, vector->esize);
+	++vector->nelems;
+	return 0;
+}
+
+/** Remove element from vector.
+ *
+ * Elements above @a idx are shifted down by one.
+ *
+ * @param vector Vector
+ * @param idx Element index
+ */
+void vector_remove(vector_t *vector, size_t idx)
+{
+	char *data;
+
+	assert(idx < vector->nelems);
+
+	data = vector->data;
+	memmove(data + idx * vector->esize, data + (idx + 1) * vector->esize,
+	    (vector->nelems - idx - 1) * vector->esize);
+	--vector->nelems;
+}
+
+/** Remove all elements from vector.
+ *
+ * The storage is retained.
+ *
+ * @param vector Vector
+ */
+void vector_clear(vector_t *vector)
+{
+	vector->nelems = 0;
+}
+
+/** Get number of elements in vector.
+ *
+ * @param vector Vector
+ * @return Number of elements
+ */
+size_t vector_count(vector_t *vector)
+{
+	return vector->nelems;
+}
+
+/** Get pointer to vector element.
+ *
+ * The pointer is only valid until the vector is next modified.
+ *
+ * @param vector Vector
+ * @param idx Element index
+ * @return Pointer to element
+ */
+void *vector_get(vector_t *vector, size_t idx)
+{
+	assert(idx < vector->nelems);
+	return (char *)vector->data + idx * vector->esize;
+}
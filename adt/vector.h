@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Growable vector
+ */
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stddef.h>
+
+/** Vector
+ *
+ * Contiguous array of fixed-size elements that grows as needed.
+ * Element addresses are not stable across insertions.
+ */
+typedef struct {
+	/** Element data */
+	void *data;
+	/** Element size in bytes */
+	size_t esize;
+	/** Number of elements */
+	size_t nelems;
+	/** Number of allocated elements */
+	size_t alloc;
+} vector_t;
+
+extern void vector_initialize(vector_t *, size_t);
+extern void vector_fini(vector_t *);
+extern int vector_reserve(vector_t *, size_t);
+extern int vector_append(vector_t *, const void *);
+extern int vector_insert(vector_t *, size_t, const void *);
+extern void vector_remove(vector_t *, size_t);
+extern void vector_clear(vector_t *);
+extern size_t vector_count(vector_t *);
+extern void *vector_get(vector_t *, size_t);
+
+#endif
@@ -0,0 +1,1162 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Batch command interpreter
+ *
+ * Reads line-based commands and executes them against a world (map,
+ * program and robots) without any graphics, so that scenarios can be
+ * scripted and the engine driven from other programs. Every command
+ * produces zero or more lines of data followed by a status line, which
+ * is either 'ok' (possibly followed by values) or 'error <code> <text>'.
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * new <w> <h>       Start with an empty map, program and no robots
+ * load <file>       Load world (map, program, robots) from file
+ * save <file>       Save world to file
+ * tile <x> <y> <t>  Set map tile (see map_tile_t)
+ * robot <x> <y>     Add robot
+ * remove <x> <y>    Remove robot
+ * run <x> <y> <id> [<n>]
+ *                   Start running procedure on robot. With n, run it
+ *                   alone for up to n statements and reply 'ok <finished>
+ *                   <error> <steps> <world hash> <cached>'
+ * step [<n>]        Execute up to n statements (default 1) on each
+ *                   running robot, replies 'ok <steps> <running>'
+ * engine <e>        Select execution engine, 'interp' (interpreter,
+ *                   the default) or 'native' (compiled to native code)
+ * pack <file>       Open level pack, replies 'ok <levels>'
+ * level <n>         Replace map and robots with those of level n
+ *                   (counted from 0), the program is kept
+ * goal              Compare map with goal map of the level,
+ *                   replies 'ok <reached>'. After a run answered from
+ *                   the cache the final map of that run is compared
+ * solve <x> <y> [<t>]
+ *                   Find the shortest sequence of moves, turns and tag
+ *                   actions that takes the robot from the map to the goal
+ *                   map, using t threads (default one per processor).
+ *                   It is added to the program as a new procedure,
+ *                   replies 'ok <id> <steps>'
+ * cache <file>      Use result cache file for 'run' with step limit
+ * dump              Print state of the world
+ * quit              Stop processing commands
+ *
+ * A world file has the same layout as the beginning of karlik.dat,
+ * so the workspace saved by the game can be loaded directly.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "levelpack.h"
+#include "map.h"
+#include "prog.h"
+#include "progc.h"
+#include "rescache.h"
+#include "robot.h"
+#include "robots.h"
+#include "solver.h"
+
+/** Batch command handler */
+typedef int (*batch_cmd_fn_t)(batch_t *, int, char **);
+
+/** Batch command */
+typedef struct {
+	/** Command name */
+	const char *name;
+	/** Minimum number of arguments */
+	int min_args;
+	/** Maximum number of arguments */
+	int max_args;
+	/** Handler */
+	batch_cmd_fn_t fn;
+} batch_cmd_t;
+
+static int batch_world_new(batch_t *, int, int);
+static void batch_world_destroy(batch_t *);
+static int batch_cmd_new(batch_t *, int, char **);
+static int batch_cmd_load(batch_t *, int, char **);
+static int batch_cmd_save(batch_t *, int, char **);
+static int batch_cmd_tile(batch_t *, int, char **);
+static int batch_cmd_robot(batch_t *, int, char **);
+static int batch_cmd_remove(batch_t *, int, char **);
+static int batch_cmd_run(batch_t *, int, char **);
+static int batch_cmd_step(batch_t *, int, char **);
+static int batch_cmd_engine(batch_t *, int, char **);
+static int batch_cmd_pack(batch_t *, int, char **);
+static int batch_cmd_level(batch_t *, int, char **);
+static int batch_cmd_goal(batch_t *, int, char **);
+static int batch_cmd_solve(batch_t *, int, char **);
+static int batch_cmd_cache(batch_t *, int, char **);
+static int batch_cmd_dump(batch_t *, int, char **);
+static int batch_cmd_quit(batch_t *, int, char **);
+
+static batch_cmd_t batch_cmds[] = {
+	{ "new", 2, 2, batch_cmd_new },
+	{ "load", 1, 1, batch_cmd_load },
+	{ "save", 1, 1, batch_cmd_save },
+	{ "tile", 3, 3, batch_cmd_tile },
+	{ "robot", 2, 2, batch_cmd_robot },
+	{ "remove", 2, 2, batch_cmd_remove },
+	{ "run", 3, 4, batch_cmd_run },
+	{ "step", 0, 1, batch_cmd_step },
+	{ "engine", 1, 1, batch_cmd_engine },
+	{ "pack", 1, 1, batch_cmd_pack },
+	{ "level", 1, 1, batch_cmd_level },
+	{ "goal", 0, 0, batch_cmd_goal },
+	{ "solve", 2, 3, batch_cmd_solve },
+	{ "cache", 1, 1, batch_cmd_cache },
+	{ "dump", 0, 0, batch_cmd_dump },
+	{ "quit", 0, 0, batch_cmd_quit },
+	{ NULL, 0, 0, NULL }
+};
+
+/** Create batch command interpreter.
+ *
+ * The interpreter starts with an empty 8x8 map, an empty program
+ * and no robots.
+ *
+ * @param out Output stream for replies
+ * @param rbatch Place to store pointer to new batch command interpreter
+ * @return Zero on success or an error code
+ */
+int batch_create(FILE *out, batch_t **rbatch)
+{
+	batch_t *batch;
+	int rc;
+
+	batch = calloc(1, sizeof(batch_t));
+	if (batch == NULL)
+		return ENOMEM;
+
+	batch->out = out;
+
+	rc = batch_world_new(batch, 8, 8);
+	if (rc != 0) {
+		batch_destroy(batch);
+		return rc;
+	}
+
+	*rbatch = batch;
+	return 0;
+}
+
+
+/** Replace world of batch command interpreter with an empty one.
+ *
+ * @param batch Batch command interpreter
+ * @param w Map width
+ * @param h Map height
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int batch_world_new(batch_t *batch, int w, int h)
+{
+	map_t *map = NULL;
+	prog_module_t *prog = NULL;
+	robots_t *robots = NULL;
+	int rc;
+
+	rc = map_create(w, h, &map);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_module_create(&prog);
+	if (rc != 0)
+		goto error;
+
+	rc = robots_create(prog, map, &robots);
+	if (rc != 0)
+		goto error;
+
+	batch_world_destroy(batch);
+	batch->map = map;
+	batch->prog = prog;
+	batch->robots = robots;
+	return 0;
+error:
+	if (prog != NULL)
+		prog_module_destroy(prog);
+	if (map != NULL)
+		map_destroy(map);
+	return rc;
+}
+
+/** Destroy world of batch command interpreter.
+ *
+ * @param batch Batch command interpreter
+ */
+static void batch_world_destroy(batch_t *batch)
+{
+	if (batch->progc != NULL)
+		progc_destroy(batch->progc);
+	if (batch->robots != NULL)
+		robots_destroy(batch->robots);
+	if (batch->prog != NULL)
+		prog_module_destroy(batch->prog);
+	if (batch->map != NULL)
+		map_destroy(batch->map);
+	if (batch->goal != NULL)
+		map_destroy(batch->goal);
+
+	batch->goal = NULL;
+	batch->progc = NULL;
+	batch->cached_run = false;
+	batch->robots = NULL;
+	batch->prog = NULL;
+	batch->map = NULL;
+}
+
+/** Destroy batch command interpreter.
+ *
+ * @param batch Batch command interpreter
+ */
+void batch_destroy(batch_t *batch)
+{
+	batch_world_destroy(batch);
+	if (batch->levelpack != NULL)
+		levelpack_close(batch->levelpack);
+	if (batch->rescache != NULL)
+		rescache_close(batch->rescache);
+	free(batch);
+}
+
+/** Parse integer argument.
+ *
+ * @param str String
+ * @param rval Place to store value
+ * @return Zero on success, EINVAL if @a str is not a valid integer
+ */
+static int batch_parse_int(const char *str, int *rval)
+{
+	char *endp;
+	long val;
+
+	errno = 0;
+	val = strtol(str, &endp, 10);
+	if (*str == '\0' || *endp != '\0' || errno != 0 || val < INT_MIN ||
+	    val > INT_MAX)
+		return EINVAL;
+
+	*rval = (int) val;
+	return 0;
+}
+
+/** Parse step count argument.
+ *
+ * @param str String
+ * @param rval Place to store value
+ * @return Zero on success, EINVAL if @a str is not a valid count
+ */
+static int batch_parse_count(const char *str, unsigned long *rval)
+{
+	char *endp;
+	unsigned long val;
+
+	errno = 0;
+	val = strtoul(str, &endp, 10);
+	if (*str == '\0' || *str == '-' || *endp != '\0' || errno != 0)
+		return EINVAL;
+
+	*rval = val;
+	return 0;
+}
+
+/** Parse coordinate arguments.
+ *
+ * @param batch Batch command interpreter
+ * @param sx X coordinate string
+ * @param sy Y coordinate string
+ * @param rx Place to store X coordinate
+ * @param ry Place to store Y coordinate
+ * @return Zero on success, EINVAL if the coordinates are not valid
+ *         or lie outside the map
+ */
+static int batch_parse_xy(batch_t *batch, const char *sx, const char *sy,
+    int *rx, int *ry)
+{
+	int x, y;
+
+	if (batch_parse_int(sx, &x) != 0 || batch_parse_int(sy, &y) != 0)
+		return EINVAL;
+
+	if (x < 0 || y < 0 || x >= batch->map->width ||
+	    y >= batch->map->height)
+		return EINVAL;
+
+	*rx = x;
+	*ry = y;
+	return 0;
+}
+
+/** Print error reply.
+ *
+ * @param batch Batch command interpreter
+ * @param rc Error code
+ * @param msg Error message
+ * @return @a rc
+ */
+static int batch_error(batch_t *batch, int rc, const char *msg)
+{
+	fprintf(batch->out, "error %d %s\n", rc, msg);
+	return rc;
+}
+
+/** Print success reply.
+ *
+ * @param batch Batch command interpreter
+ * @return Zero
+ */
+static int batch_ok(batch_t *batch)
+{
+	fprintf(batch->out, "ok\n");
+	return 0;
+}
+
+/** New command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_new(batch_t *batch, int argc, char **argv)
+{
+	int w, h;
+	int rc;
+
+	(void) argc;
+
+	if (batch_parse_int(argv[0], &w) != 0 ||
+	    batch_parse_int(argv[1], &h) != 0 || w <= 0 || h <= 0 ||
+	    w > map_max_dim || h > map_max_dim)
+		return batch_error(batch, EINVAL, "Invalid map size.");
+
+	rc = batch_world_new(batch, w, h);
+	if (rc != 0)
+		return batch_error(batch, rc, "Out of memory.");
+
+	return batch_ok(batch);
+}
+
+/** Load command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_load(batch_t *batch, int argc, char **argv)
+{
+	FILE *f;
+	map_t *map = NULL;
+	prog_module_t *prog = NULL;
+	robots_t *robots = NULL;
+	int rc;
+
+	(void) argc;
+
+	f = fopen(argv[0], "r");
+	if (f == NULL)
+		return batch_error(batch, ENOENT, "Cannot open file.");
+
+	rc = map_load(f, &map);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_module_load(f, &prog);
+	if (rc != 0)
+		goto error;
+
+	rc = robots_load(f, prog, map, &robots);
+	if (rc != 0)
+		goto error;
+
+	(void) fclose(f);
+
+	batch_world_destroy(batch);
+	batch->map = map;
+	batch->prog = prog;
+	batch->robots = robots;
+	return batch_ok(batch);
+error:
+	if (prog != NULL)
+		prog_module_destroy(prog);
+	if (map != NULL)
+		map_destroy(map);
+	(void) fclose(f);
+	return batch_error(batch, rc, "Error loading world.");
+}
+
+/** Save command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_save(batch_t *batch, int argc, char **argv)
+{
+	FILE *f;
+	int rc;
+
+	(void) argc;
+
+	f = fopen(argv[0], "w");
+	if (f == NULL)
+		return batch_error(batch, EIO, "Cannot create file.");
+
+	rc = map_save(batch->map, f);
+	if (rc == 0)
+		rc = prog_module_save(batch->prog, f);
+	if (rc == 0)
+		rc = robots_save(batch->robots, f);
+
+	if (fclose(f) < 0 && rc == 0)
+		rc = EIO;
+
+	if (rc != 0)
+		return batch_error(batch, rc, "Error saving world.");
+
+	return batch_ok(batch);
+}
+
+/** Tile command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_tile(batch_t *batch, int argc, char **argv)
+{
+	int x, y;
+	int tile;
+
+	(void) argc;
+
+	if (batch_parse_xy(batch, argv[0], argv[1], &x, &y) != 0)
+		return batch_error(batch, EINVAL, "Invalid coordinates.");
+
+	if (batch_parse_int(argv[2], &tile) != 0 || tile < 0 ||
+	    tile >= mapt_robot)
+		return batch_error(batch, EINVAL, "Invalid tile.");
+
+	batch->cached_run = false;
+	map_set(batch->map, x, y, (map_tile_t) tile);
+	return batch_ok(batch);
+}
+
+/** Robot command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_robot(batch_t *batch, int argc, char **argv)
+{
+	int x, y;
+	int rc;
+
+	(void) argc;
+
+	if (batch_parse_xy(batch, argv[0], argv[1], &x, &y) != 0)
+		return batch_error(batch, EINVAL, "Invalid coordinates.");
+
+	rc = robots_add(batch->robots, x, y);
+	if (rc == EEXIST)
+		return batch_error(batch, rc, "Tile is occupied.");
+	if (rc != 0)
+		return batch_error(batch, rc, "Out of memory.");
+
+	batch->cached_run = false;
+	return batch_ok(batch);
+}
+
+/** Remove command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_remove(batch_t *batch, int argc, char **argv)
+{
+	int x, y;
+
+	(void) argc;
+
+	if (batch_parse_xy(batch, argv[0], argv[1], &x, &y) != 0)
+		return batch_error(batch, EINVAL, "Invalid coordinates.");
+
+	if (robots_get(batch->robots, x, y) == NULL)
+		return batch_error(batch, ENOENT, "No robot there.");
+
+	batch->cached_run = false;
+	robots_remove(batch->robots, x, y);
+	return batch_ok(batch);
+}
+
+/** Determine if robot can execute statements.
+ *
+ * @param robot Robot
+ * @return @c true iff robot is running and has not stopped due to error
+ */
+static bool batch_robot_running(robot_t *robot)
+{
+	return robot_is_busy(robot) && robot_error(robot) == errt_none;
+}
+
+/** Compile program to native code if the native engine is selected.
+ *
+ * The program is compiled once, when it is first run.
+ *
+ * @param batch Batch command interpreter
+ * @return Zero on success or an error code
+ */
+static int batch_compile(batch_t *batch)
+{
+	if (batch->engine != be_native || batch->progc != NULL)
+		return 0;
+
+	return progc_compile(batch->prog, &batch->progc);
+}
+
+/** Run robot for a number of steps using the selected engine.
+ *
+ * @param batch Batch command interpreter
+ * @param robot Robot
+ * @param max_steps Maximum number of statements to execute
+ * @param rsteps Place to store number of statements executed
+ * @return Zero on success or an error code (as robot_run())
+ */
+static int batch_robot_run(batch_t *batch, robot_t *robot,
+    unsigned long max_steps, unsigned long *rsteps)
+{
+	if (batch->engine == be_native)
+		return progc_run(batch->progc, robot, max_steps, rsteps);
+
+	return robot_run(robot, max_steps, rsteps);
+}
+
+/** Run procedure alone until it finishes or a step limit is reached.
+ *
+ * If a result cache is in use, the outcome is looked up first and
+ * the procedure is only run if it is not found. When the outcome
+ * comes from the cache, the world is left unchanged and the goal
+ * command uses the final map hash from the cache instead.
+ *
+ * @param batch Batch command interpreter
+ * @param robot Robot
+ * @param proc Procedure
+ * @param max_steps Step limit
+ * @return Zero on success or an error code
+ */
+static int batch_run_limit(batch_t *batch, robot_t *robot,
+    prog_proc_t *proc, unsigned long max_steps)
+{
+	rescache_key_t key;
+	rescache_outcome_t outcome;
+	unsigned long steps;
+	bool cached = false;
+	int rc;
+
+	if (robot_is_busy(robot))
+		return batch_error(batch, EBUSY, "Robot is busy.");
+
+	batch->cached_run = false;
+	if (batch->rescache != NULL) {
+		rc = rescache_key_init(&key, proc, batch->map, batch->robots,
+		    robot, max_steps);
+		if (rc != 0)
+			return batch_error(batch, rc, "Out of memory.");
+
+		if (rescache_lookup(batch->rescache, &key, &outcome) == 0) {
+			batch->cached_run = true;
+			batch->cached_map_hash = outcome.map_hash;
+			cached = true;
+			goto done;
+		}
+	}
+
+	rc = batch_compile(batch);
+	if (rc != 0)
+		return batch_error(batch, rc, "Cannot compile program.");
+
+	rc = robot_run_proc(robot, proc);
+	if (rc != 0)
+		return batch_error(batch, rc, "Out of memory.");
+
+	outcome.nsteps = 0;
+	while (outcome.nsteps < max_steps && batch_robot_running(robot)) {
+		/* Stopping at a breakpoint or watchpoint is not a failure */
+		rc = batch_robot_run(batch, robot, max_steps - outcome.nsteps,
+		    &steps);
+		outcome.nsteps += steps;
+		if (rc != 0 && rc != EINTR) {
+			return batch_error(batch, rc, rc == ENOTSUP ?
+			    "Statement not supported." : "Out of memory.");
+		}
+	}
+
+	outcome.finished = !batch_robot_running(robot);
+	outcome.error = robot_error(robot);
+	outcome.world_hash = rescache_world_hash(batch->map, batch->robots);
+	outcome.map_hash = map_hash(batch->map);
+
+	if (batch->rescache != NULL) {
+		rc = rescache_insert(batch->rescache, &key, &outcome);
+		if (rc != 0)
+			return batch_error(batch, rc, "Error writing cache.");
+	}
+done:
+	fprintf(batch->out, "ok %d %d %lu %016" PRIx64 " %d\n",
+	    outcome.finished ? 1 : 0, (int) outcome.error, outcome.nsteps,
+	    outcome.world_hash, cached ? 1 : 0);
+	return 0;
+}
+
+/** Run command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_run(batch_t *batch, int argc, char **argv)
+{
+	robot_t *robot;
+	prog_proc_t *proc;
+	unsigned long max_steps;
+	int x, y;
+	int rc;
+
+	if (batch_parse_xy(batch, argv[0], argv[1], &x, &y) != 0)
+		return batch_error(batch, EINVAL, "Invalid coordinates.");
+
+	if (argc > 3 && batch_parse_count(argv[3], &max_steps) != 0)
+		return batch_error(batch, EINVAL, "Invalid count.");
+
+	robot = robots_get(batch->robots, x, y);
+	if (robot == NULL)
+		return batch_error(batch, ENOENT, "No robot there.");
+
+	proc = prog_module_proc_by_ident(batch->prog, argv[2]);
+	if (proc == NULL)
+		return batch_error(batch, ENOENT, "No such procedure.");
+
+	if (argc > 3)
+		return batch_run_limit(batch, robot, proc, max_steps);
+
+	batch->cached_run = false;
+	rc = robot_run_proc(robot, proc);
+	if (rc == EBUSY)
+		return batch_error(batch, rc, "Robot is busy.");
+	if (rc != 0)
+		return batch_error(batch, rc, "Out of memory.");
+
+	return batch_ok(batch);
+}
+
+/** Step command.
+ *
+ * Running robots take turns executing one statement each, like they
+ * do in the game. If only one robot is running it is simply run for
+ * the whole number of statements, which is much faster.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_step(batch_t *batch, int argc, char **argv)
+{
+	robot_t *robot;
+	robot_t *single = NULL;
+	unsigned long nsteps = 1;
+	unsigned long total = 0;
+	unsigned long steps;
+	unsigned long i;
+	unsigned nrunning;
+	int rc = 0;
+
+	if (argc > 0 && batch_parse_count(argv[0], &nsteps) != 0)
+		return batch_error(batch, EINVAL, "Invalid count.");
+
+	batch->cached_run = false;
+	rc = batch_compile(batch);
+	if (rc != 0)
+		return batch_error(batch, rc, "Cannot compile program.");
+
+	nrunning = 0;
+	robot = robots_first(batch->robots);
+	while (robot != NULL) {
+		if (batch_robot_running(robot)) {
+			single = robot;
+			++nrunning;
+		}
+		robot = robots_next(robot);
+	}
+
+	if (nrunning == 1) {
+		rc = batch_robot_run(batch, single, nsteps, &total);
+	} else {
+		for (i = 0; i < nsteps && nrunning > 0 && rc == 0; i++) {
+			nrunning = 0;
+			robot = robots_first(batch->robots);
+			while (robot != NULL && rc == 0) {
+				if (batch_robot_running(robot)) {
+					rc = batch_robot_run(batch, robot, 1,
+					    &steps);
+					total += steps;
+					++nrunning;
+				}
+				robot = robots_next(robot);
+			}
+		}
+	}
+
+	/* Stopping at a breakpoint or watchpoint is not a failure */
+	if (rc != 0 && rc != EINTR) {
+		return batch_error(batch, rc, rc == ENOTSUP ?
+		    "Statement not supported." : "Out of memory.");
+	}
+
+	nrunning = 0;
+	robot = robots_first(batch->robots);
+	while (robot != NULL) {
+		if (batch_robot_running(robot))
+			++nrunning;
+		robot = robots_next(robot);
+	}
+
+	fprintf(batch->out, "ok %lu %u\n", total, nrunning);
+	return 0;
+}
+
+/** Engine command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_engine(batch_t *batch, int argc, char **argv)
+{
+	(void) argc;
+
+	if (strcmp(argv[0], "interp") == 0)
+		batch->engine = be_interp;
+	else if (strcmp(argv[0], "native") == 0)
+		batch->engine = be_native;
+	else
+		return batch_error(batch, EINVAL, "Unknown engine.");
+
+	return batch_ok(batch);
+}
+
+/** Pack command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_pack(batch_t *batch, int argc, char **argv)
+{
+	levelpack_t *levelpack;
+	int rc;
+
+	(void) argc;
+
+	rc = levelpack_open(argv[0], &levelpack);
+	if (rc == ENOENT)
+		return batch_error(batch, rc, "Cannot open file.");
+	if (rc != 0)
+		return batch_error(batch, rc, "Error opening level pack.");
+
+	if (batch->levelpack != NULL)
+		levelpack_close(batch->levelpack);
+	batch->levelpack = levelpack;
+
+	fprintf(batch->out, "ok %u\n", levelpack_count(levelpack));
+	return 0;
+}
+
+/** Level command.
+ *
+ * Only the requested level is read from the level pack, so iterating
+ * over all levels of a pack takes time proportional to its size.
+ * Like in the game, the levels are played with the current program.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_level(batch_t *batch, int argc, char **argv)
+{
+	level_t *level;
+	robots_t *robots = NULL;
+	robot_t *robot;
+	robot_t *nrobot;
+	int idx;
+	int rc;
+
+	(void) argc;
+
+	if (batch->levelpack == NULL)
+		return batch_error(batch, ENOENT, "No level pack.");
+
+	if (batch_parse_int(argv[0], &idx) != 0 || idx < 0 ||
+	    (unsigned)idx >= levelpack_count(batch->levelpack))
+		return batch_error(batch, EINVAL, "Invalid level.");
+
+	rc = levelpack_load_level(batch->levelpack, idx, &level);
+	if (rc != 0)
+		return batch_error(batch, rc, "Error loading level.");
+
+	rc = robots_create(batch->prog, level->map, &robots);
+	if (rc != 0)
+		goto error;
+
+	robot = robots_first(level->robots);
+	while (robot != NULL) {
+		rc = robots_add(robots, robot->x, robot->y);
+		if (rc != 0)
+			goto error;
+
+		nrobot = robots_get(robots, robot->x, robot->y);
+		nrobot->dir = robot->dir;
+		robot = robots_next(robot);
+	}
+
+	robots_destroy(batch->robots);
+	map_destroy(batch->map);
+	if (batch->goal != NULL)
+		map_destroy(batch->goal);
+
+	batch->map = level->map;
+	batch->robots = robots;
+	batch->goal = level->goal;
+	batch->cached_run = false;
+	level->map = NULL;
+	level->goal = NULL;
+	level_destroy(level);
+	return batch_ok(batch);
+error:
+	if (robots != NULL)
+		robots_destroy(robots);
+	level_destroy(level);
+	return batch_error(batch, rc, "Out of memory.");
+}
+
+/** Goal command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_goal(batch_t *batch, int argc, char **argv)
+{
+	bool reached;
+
+	(void) argc;
+	(void) argv;
+
+	if (batch->goal == NULL)
+		return batch_error(batch, ENOENT, "Level has no goal.");
+
+	if (batch->cached_run) {
+		/* The map is the initial one, compare the final map */
+		reached = batch->goal->width == batch->map->width &&
+		    batch->goal->height == batch->map->height &&
+		    map_hash(batch->goal) == batch->cached_map_hash;
+	} else {
+		reached = map_equal(batch->map, batch->goal);
+	}
+
+	fprintf(batch->out, "ok %d\n", reached ? 1 : 0);
+	return 0;
+}
+
+/** Solve command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_solve(batch_t *batch, int argc, char **argv)
+{
+	robot_t *robot;
+	solver_t *solver;
+	prog_proc_t *proc;
+	unsigned long nthreads = 0;
+	char *ident;
+	int x, y;
+	int rc;
+
+	if (batch_parse_xy(batch, argv[0], argv[1], &x, &y) != 0)
+		return batch_error(batch, EINVAL, "Invalid coordinates.");
+
+	if (argc > 2 && (batch_parse_count(argv[2], &nthreads) != 0 ||
+	    nthreads == 0 || nthreads > UINT_MAX))
+		return batch_error(batch, EINVAL, "Invalid count.");
+
+	robot = robots_get(batch->robots, x, y);
+	if (robot == NULL)
+		return batch_error(batch, ENOENT, "No robot there.");
+
+	if (batch->goal == NULL)
+		return batch_error(batch, ENOENT, "Level has no goal.");
+
+	rc = solver_create(batch->map, batch->goal, &solver);
+	if (rc == EINVAL)
+		return batch_error(batch, rc, "Goal map has different size.");
+	if (rc != 0)
+		return batch_error(batch, rc, "Out of memory.");
+
+	if (nthreads > 0)
+		solver_set_threads(solver, nthreads);
+
+	rc = prog_module_gen_ident(batch->prog, &ident);
+	if (rc != 0) {
+		solver_destroy(solver);
+		return batch_error(batch, rc, "Out of memory.");
+	}
+
+	rc = solver_solve(solver, x, y, robot->dir, ident, &proc);
+	solver_destroy(solver);
+	if (rc != 0) {
+		free(ident);
+		if (rc == ENOENT)
+			return batch_error(batch, rc, "No solution.");
+		if (rc == E2BIG)
+			return batch_error(batch, rc, "Too many tiles differ.");
+		return batch_error(batch, rc, "Out of memory.");
+	}
+
+	rc = prog_module_append(batch->prog, proc);
+	if (rc != 0) {
+		prog_proc_destroy(proc);
+		free(ident);
+		return batch_error(batch, rc, "Out of memory.");
+	}
+
+	/* Compile again so that the new procedure runs as native code too */
+	if (batch->progc != NULL) {
+		progc_destroy(batch->progc);
+		batch->progc = NULL;
+	}
+
+	fprintf(batch->out, "ok %s %u\n", ident, proc->body->nstmts);
+	free(ident);
+	return 0;
+}
+
+/** Cache command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_cache(batch_t *batch, int argc, char **argv)
+{
+	rescache_t *rescache;
+	int rc;
+
+	(void) argc;
+
+	rc = rescache_open(argv[0], &rescache);
+	if (rc != 0)
+		return batch_error(batch, rc, "Cannot open cache.");
+
+	if (batch->rescache != NULL)
+		rescache_close(batch->rescache);
+	batch->rescache = rescache;
+	return batch_ok(batch);
+}
+
+/** Dump command.
+ *
+ * Prints 'map <w> <h> <hash>', one line per map row with tile numbers,
+ * 'robots <count>' and one line 'robot <x> <y> <dir> <error> <busy>
+ * <proc>' per robot, where proc is the identifier of the procedure
+ * being executed or '-'.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_dump(batch_t *batch, int argc, char **argv)
+{
+	map_t *map = batch->map;
+	robot_t *robot;
+	prog_proc_t *proc;
+	unsigned nrobots;
+	int x, y;
+
+	(void) argc;
+	(void) argv;
+
+	fprintf(batch->out, "map %d %d %016" PRIx64 "\n", map->width,
+	    map->height, map_hash(map));
+	for (y = 0; y < map->height; y++) {
+		for (x = 0; x < map->width; x++) {
+			fprintf(batch->out, "%d%c", map_get(map, x, y),
+			    x < map->width - 1 ? ' ' : '\n');
+		}
+	}
+
+	nrobots = 0;
+	robot = robots_first(batch->robots);
+	while (robot != NULL) {
+		++nrobots;
+		robot = robots_next(robot);
+	}
+
+	fprintf(batch->out, "robots %u\n", nrobots);
+
+	robot = robots_first(batch->robots);
+	while (robot != NULL) {
+		proc = robot_is_busy(robot) ? robot_cur_proc(robot) : NULL;
+		fprintf(batch->out, "robot %d %d %d %d %d %s\n", robot->x,
+		    robot->y, (int) robot->dir, (int) robot_error(robot),
+		    robot_is_busy(robot) ? 1 : 0,
+		    proc != NULL ? proc->ident : "-");
+		robot = robots_next(robot);
+	}
+
+	return batch_ok(batch);
+}
+
+/** Quit command.
+ *
+ * @param batch Batch command interpreter
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return Zero on success or an error code
+ */
+static int batch_cmd_quit(batch_t *batch, int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+
+	batch->quit = true;
+	return batch_ok(batch);
+}
+
+/** Execute one command line.
+ *
+ * @param batch Batch command interpreter
+ * @param line Command line (modified by tokenization)
+ * @return Zero on success or an error code (the error has already been
+ *         reported to the output stream)
+ */
+int batch_exec(batch_t *batch, char *line)
+{
+	char *argv[batch_max_args];
+	batch_cmd_t *cmd;
+	char *tok;
+	int argc;
+	int rc;
+
+	argc = 0;
+	tok = strtok(line, " \t\r\n");
+	while (tok != NULL) {
+		if (argc >= batch_max_args) {
+			return batch_error(batch, EINVAL,
+			    "Too many arguments.");
+		}
+
+		argv[argc++] = tok;
+		tok = strtok(NULL, " \t\r\n");
+	}
+
+	/* Empty line or comment */
+	if (argc == 0 || argv[0][0] == '#')
+		return 0;
+
+	cmd = batch_cmds;
+	while (cmd->name != NULL) {
+		if (strcmp(cmd->name, argv[0]) == 0)
+			break;
+		++cmd;
+	}
+
+	if (cmd->name == NULL)
+		return batch_error(batch, EINVAL, "Unknown command.");
+
+	if (argc - 1 < cmd->min_args || argc - 1 > cmd->max_args)
+		return batch_error(batch, EINVAL, "Wrong argument count.");
+
+	rc = cmd->fn(batch, argc - 1, argv + 1);
+	return rc;
+}
+
+/** Execute commands from file until end of file or quit command.
+ *
+ * The output stream is flushed after each command so that another
+ * program can drive the interpreter interactively through pipes.
+ *
+ * @param batch Batch command interpreter
+ * @param f Input file
+ * @param rnerrors Place to store number of commands that failed
+ * @return Zero on success, EIO if a line is too long or on I/O error
+ */
+int batch_run(batch_t *batch, FILE *f, unsigned long *rnerrors)
+{
+	char line[batch_line_size];
+	unsigned long nerrors = 0;
+	size_t len;
+	int rc;
+
+	while (!batch->quit && fgets(line, sizeof(line), f) != NULL) {
+		len = strlen(line);
+		if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+			(void) batch_error(batch, EIO, "Line too long.");
+			*rnerrors = nerrors + 1;
+			return EIO;
+		}
+
+		rc = batch_exec(batch, line);
+		if (rc != 0)
+			++nerrors;
+
+		if (fflush(batch->out) != 0) {
+			*rnerrors = nerrors;
+			return EIO;
+		}
+	}
+
+	*rnerrors = nerrors;
+	return ferror(f) ? EIO : 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Batch command interpreter
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "map.h"
+#include "prog.h"
+#include "levelpack.h"
+#include "progc.h"
+#include "rescache.h"
+#include "robots.h"
+
+enum {
+	/** Maximum length of command line (including newline) */
+	batch_line_size = 1024,
+	/** Maximum number of words in a command */
+	batch_max_args = 8
+};
+
+/** Execution engine */
+typedef enum {
+	/** Interpreter */
+	be_interp,
+	/** Native code */
+	be_native
+} batch_engine_t;
+
+/** Batch command interpreter */
+typedef struct {
+	/** Map */
+	map_t *map;
+	/** Program */
+	prog_module_t *prog;
+	/** Robots */
+	robots_t *robots;
+	/** Execution engine */
+	batch_engine_t engine;
+	/** Native code for program or @c NULL if not compiled yet */
+	progc_t *progc;
+	/** Level pack or @c NULL */
+	levelpack_t *levelpack;
+	/** Goal map of current level or @c NULL */
+	map_t *goal;
+	/** Result cache or @c NULL */
+	rescache_t *rescache;
+	/** Last run was answered from the cache and left the world as is */
+	bool cached_run;
+	/** Hash of the final map of the cached run (if @c cached_run) */
+	uint64_t cached_map_hash;
+	/** Output stream for replies */
+	FILE *out;
+	/** @c true when the quit command was executed */
+	bool quit;
+} batch_t;
+
+extern int batch_create(FILE *, batch_t **);
+extern void batch_destroy(batch_t *);
+extern int batch_exec(batch_t *, char *);
+extern int batch_run(batch_t *, FILE *, unsigned long *);
+
+#endif
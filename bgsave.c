@@ -0,0 +1,315 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Background file writer
+ *
+ * A buffer submitted for saving is written by a separate thread to
+ * a temporary file, which is synced and then renamed over the destination
+ * file. The destination file thus always contains either the old or
+ * the new data. If a new buffer is submitted before the previous one
+ * was written, only the newer one is written.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bgsave.h"
+
+static void *bgsave_thread(void *);
+
+/** Create background file writer.
+ *
+ * @param fname Destination file name
+ * @param rbgsave Place to store pointer to new background writer
+ * @return Zero on success or an error code
+ */
+int bgsave_create(const char *fname, bgsave_t **rbgsave)
+{
+	bgsave_t *bgsave;
+	size_t len;
+	int rc;
+
+	bgsave = calloc(1, sizeof(bgsave_t));
+	if (bgsave == NULL)
+		return ENOMEM;
+
+	bgsave->fname = strdup(fname);
+	if (bgsave->fname == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	len = strlen(fname);
+	bgsave->tmpname = malloc(len + 5);
+	if (bgsave->tmpname == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	memcpy(bgsave->tmpname, fname, len);
+	memcpy(bgsave->tmpname + len, ".tmp", 5);
+
+	pthread_mutex_init(&bgsave->lock, NULL);
+	pthread_cond_init(&bgsave->cv, NULL);
+
+	rc = pthread_create(&bgsave->thread, NULL, bgsave_thread, bgsave);
+	if (rc != 0) {
+		pthread_cond_destroy(&bgsave->cv);
+		pthread_mutex_destroy(&bgsave->lock);
+		goto error;
+	}
+
+	*rbgsave = bgsave;
+	return 0;
+error:
+	free(bgsave->tmpname);
+	free(bgsave->fname);
+	free(bgsave);
+	return rc;
+}
+
+/** Destroy background file writer.
+ *
+ * Waits until any pending buffer is written.
+ *
+ * @param bgsave Background file writer
+ */
+void bgsave_destroy(bgsave_t *bgsave)
+{
+	pthread_mutex_lock(&bgsave->lock);
+	bgsave->quit = true;
+	pthread_cond_broadcast(&bgsave->cv);
+	pthread_mutex_unlock(&bgsave->lock);
+
+	pthread_join(bgsave->thread, NULL);
+
+	pthread_cond_destroy(&bgsave->cv);
+	pthread_mutex_destroy(&bgsave->lock);
+	free(bgsave->tmpname);
+	free(bgsave->fname);
+	free(bgsave);
+}
+
+/** Submit buffer for writing.
+ *
+ * The background writer takes ownership of @a buf (which must have been
+ * allocated with malloc) and frees it when done. A previously submitted
+ * buffer that has not been written yet is discarded.
+ *
+ * @param bgsave Background file writer
+ * @param buf Buffer
+ * @param size Size of @a buf in bytes
+ * @return Zero on success or an error code
+ */
+int bgsave_submit(bgsave_t *bgsave, char *buf, size_t size)
+{
+	pthread_mutex_lock(&bgsave->lock);
+
+	if (bgsave->buf != NULL) {
+		free(bgsave->buf);
+		++bgsave->stats.ndropped;
+	}
+
+	bgsave->buf = buf;
+	bgsave->size = size;
+	clock_gettime(CLOCK_MONOTONIC, &bgsave->submitted);
+
+	pthread_cond_broadcast(&bgsave->cv);
+	pthread_mutex_unlock(&bgsave->lock);
+	return 0;
+}
+
+/** Wait until all submitted buffers are written.
+ *
+ * @param bgsave Background file writer
+ * @return Zero if the last write succeeded or an error code
+ */
+int bgsave_wait(bgsave_t *bgsave)
+{
+	int rc;
+
+	pthread_mutex_lock(&bgsave->lock);
+	while (bgsave->buf != NULL || bgsave->busy)
+		pthread_cond_wait(&bgsave->cv, &bgsave->lock);
+	rc = bgsave->last_rc;
+	pthread_mutex_unlock(&bgsave->lock);
+
+	return rc;
+}
+
+/** Get background save statistics.
+ *
+ * @param bgsave Background file writer
+ * @param stats Place to store statistics
+ */
+void bgsave_get_stats(bgsave_t *bgsave, bgsave_stats_t *stats)
+{
+	pthread_mutex_lock(&bgsave->lock);
+	*stats = bgsave->stats;
+	pthread_mutex_unlock(&bgsave->lock);
+}
+
+/** Sync directory containing a file.
+ *
+ * This makes a rename of the file durable. Errors are ignored.
+ *
+ * @param fname File name
+ */
+static void bgsave_sync_dir(const char *fname)
+{
+	const char *slash;
+	char *dname;
+	int fd;
+
+	slash = strrchr(fname, '/');
+	if (slash != NULL)
+		dname = strndup(fname, slash - fname + 1);
+	else
+		dname = strdup(".");
+	if (dname == NULL)
+		return;
+
+	fd = open(dname, O_RDONLY);
+	if (fd >= 0) {
+		(void) fsync(fd);
+		(void) close(fd);
+	}
+
+	free(dname);
+}
+
+/** Write buffer to destination file.
+ *
+ * @param bgsave Background file writer
+ * @param buf Buffer
+ * @param size Size of @a buf in bytes
+ * @return Zero on success or an error code
+ */
+static int bgsave_write(bgsave_t *bgsave, const char *buf, size_t size)
+{
+	ssize_t nw;
+	size_t pos;
+	int fd;
+	int rc;
+
+	fd = open(bgsave->tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return errno;
+
+	pos = 0;
+	while (pos < size) {
+		nw = write(fd, buf + pos, size - pos);
+		if (nw < 0) {
+			if (errno == EINTR)
+				continue;
+			rc = errno;
+			goto error;
+		}
+
+		pos += nw;
+	}
+
+	if (fsync(fd) < 0) {
+		rc = errno;
+		goto error;
+	}
+
+	if (close(fd) < 0) {
+		fd = -1;
+		rc = errno;
+		goto error;
+	}
+
+	fd = -1;
+	if (rename(bgsave->tmpname, bgsave->fname) < 0) {
+		rc = errno;
+		goto error;
+	}
+
+	bgsave_sync_dir(bgsave->fname);
+	return 0;
+error:
+	if (fd >= 0)
+		(void) close(fd);
+	(void) unlink(bgsave->tmpname);
+	return rc;
+}
+
+/** Background writer thread.
+ *
+ * @param arg Background file writer (bgsave_t *)
+ * @return @c NULL
+ */
+static void *bgsave_thread(void *arg)
+{
+	bgsave_t *bgsave = (bgsave_t *)arg;
+	struct timespec submitted;
+	struct timespec now;
+	unsigned long usec;
+	char *buf;
+	size_t size;
+	int rc;
+
+	pthread_mutex_lock(&bgsave->lock);
+
+	while (true) {
+		while (bgsave->buf == NULL && !bgsave->quit)
+			pthread_cond_wait(&bgsave->cv, &bgsave->lock);
+
+		/* Pending buffer is written even when quitting */
+		if (bgsave->buf == NULL)
+			break;
+
+		buf = bgsave->buf;
+		size = bgsave->size;
+		submitted = bgsave->submitted;
+		bgsave->buf = NULL;
+		bgsave->busy = true;
+		pthread_mutex_unlock(&bgsave->lock);
+
+		rc = bgsave_write(bgsave, buf, size);
+		free(buf);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		usec = (now.tv_sec - submitted.tv_sec) * 1000000L +
+		    (now.tv_nsec - submitted.tv_nsec) / 1000;
+
+		pthread_mutex_lock(&bgsave->lock);
+		bgsave->busy = false;
+		bgsave->last_rc = rc;
+		if (rc == 0)
+			++bgsave->stats.nsaved;
+		else
+			++bgsave->stats.nfailed;
+		bgsave->stats.last_usec = usec;
+		if (usec > bgsave->stats.max_usec)
+			bgsave->stats.max_usec = usec;
+		pthread_cond_broadcast(&bgsave->cv);
+	}
+
+	pthread_mutex_unlock(&bgsave->lock);
+	return NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BGSAVE_H
+#define BGSAVE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/** Background save statistics */
+typedef struct {
+	/** Number of buffers written successfully */
+	unsigned long nsaved;
+	/** Number of buffers that failed to write */
+	unsigned long nfailed;
+	/** Number of buffers replaced by a newer one before being written */
+	unsigned long ndropped;
+	/** Latency of last save (from submission to rename) in microseconds */
+	unsigned long last_usec;
+	/** Maximum save latency in microseconds */
+	unsigned long max_usec;
+} bgsave_stats_t;
+
+/** Background file writer
+ *
+ * Writes buffers to a file from a separate thread, replacing the file
+ * atomically.
+ */
+typedef struct {
+	/** Destination file name */
+	char *fname;
+	/** Temporary file name */
+	char *tmpname;
+	/** Writer thread */
+	pthread_t thread;
+	/** Protects the fields below */
+	pthread_mutex_t lock;
+	/** Signalled when work is submitted or finished */
+	pthread_cond_t cv;
+	/** Buffer waiting to be written or @c NULL */
+	char *buf;
+	/** Size of @c buf */
+	size_t size;
+	/** Submission time of @c buf */
+	struct timespec submitted;
+	/** Is the writer thread writing a buffer? */
+	bool busy;
+	/** Should the writer thread quit? */
+	bool quit;
+	/** Result of the last write */
+	int last_rc;
+	/** Statistics */
+	bgsave_stats_t stats;
+} bgsave_t;
+
+extern int bgsave_create(const char *, bgsave_t **);
+extern void bgsave_destroy(bgsave_t *);
+extern int bgsave_submit(bgsave_t *, char *, size_t);
+extern int bgsave_wait(bgsave_t *);
+extern void bgsave_get_stats(bgsave_t *, bgsave_stats_t *);
+
+#endif
@@ -0,0 +1,767 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Call graph analysis
+ *
+ * Builds the call graph of a program module, finds its strongly connected
+ * components (Tarjan's algorithm) and determines for each procedure
+ * the maximum robot stack depth it can need, or that it can recurse
+ * without bound.
+ *
+ * A call that is the last statement of a procedure body is a tail call
+ * and does not push a stack entry. Calls inside nested blocks are assumed
+ * to push one entry for each enclosing block, too.
+ *
+ * For non-recursive procedures that only move and turn left (directly,
+ * through calls or in counted loops) the movement effect is computed, too,
+ * so that calls to them can be executed without interpreting them.
+ *
+ * Only canonical procedures (see proghash_cons()) are analyzed.
+ * Structurally identical procedures receive copies of their results.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adt/hmap.h"
+#include "adt/vector.h"
+#include "callgraph.h"
+#include "prog.h"
+#include "proghash.h"
+
+static int callgraph_block_edges(callgraph_t *, size_t, prog_block_t *,
+    unsigned);
+
+enum {
+	/** Maximum number of tiles in movement effect path */
+	callgraph_effect_max_path = 1024,
+	/** Maximum number of statements summarized by movement effect */
+	callgraph_effect_max_steps = 1 << 30
+};
+
+/** Get call graph node.
+ *
+ * @param cg Call graph
+ * @param idx Node index
+ * @return Node
+ */
+static callgraph_node_t *callgraph_node(callgraph_t *cg, size_t idx)
+{
+	return (callgraph_node_t *)vector_get(&cg->nodes, idx);
+}
+
+/** Add call graph edge.
+ *
+ * @param cg Call graph
+ * @param idx Index of calling node
+ * @param proc Called procedure
+ * @param weight Number of stack entries the call can push
+ * @return Zero on success, EINVAL if @a proc is not in the module,
+ *         ENOMEM if out of memory
+ */
+static int callgraph_add_edge(callgraph_t *cg, size_t idx, prog_proc_t *proc,
+    unsigned weight)
+{
+	hmap_entry_t *entry;
+	callgraph_edge_t edge;
+
+	entry = hmap_find_int(cg->node_idx, (uintptr_t)proc->canon);
+	if (entry == NULL)
+		return EINVAL;
+
+	edge.target = (size_t)(uintptr_t)entry->value;
+	edge.weight = weight;
+	return vector_append(&callgraph_node(cg, idx)->edges, &edge);
+}
+
+/** Add call graph edges for statement.
+ *
+ * @param cg Call graph
+ * @param idx Index of node of the containing procedure
+ * @param stmt Statement
+ * @param level Number of enclosing nested blocks
+ * @return Zero on success or an error code
+ */
+static int callgraph_stmt_edges(callgraph_t *cg, size_t idx,
+    prog_stmt_t *stmt, unsigned level)
+{
+	unsigned weight;
+	int rc;
+
+	/* Unless this is a tail call, the continuation is pushed */
+	weight = level;
+	if (level > 0 || prog_block_next(stmt) != NULL)
+		++weight;
+
+	switch (stmt->stype) {
+	case progst_call:
+		return callgraph_add_edge(cg, idx, stmt->s.scall.proc, weight);
+	case progst_recurse:
+		return callgraph_add_edge(cg, idx, callgraph_node(cg, idx)->proc,
+		    weight);
+	case progst_if:
+		if (stmt->s.sif.btrue != NULL) {
+			rc = callgraph_block_edges(cg, idx, stmt->s.sif.btrue,
+			    level + 1);
+			if (rc != 0)
+				return rc;
+		}
+
+		if (stmt->s.sif.bfalse != NULL) {
+			rc = callgraph_block_edges(cg, idx, stmt->s.sif.bfalse,
+			    level + 1);
+			if (rc != 0)
+				return rc;
+		}
+		break;
+	case progst_repeat:
+		if (stmt->s.srepeat.body != NULL) {
+			rc = callgraph_block_edges(cg, idx,
+			    stmt->s.srepeat.body, level + 1);
+			if (rc != 0)
+				return rc;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/** Add call graph edges for block.
+ *
+ * @param cg Call graph
+ * @param idx Index of node of the containing procedure
+ * @param block Block
+ * @param level Number of enclosing nested blocks
+ * @return Zero on success or an error code
+ */
+static int callgraph_block_edges(callgraph_t *cg, size_t idx,
+    prog_block_t *block, unsigned level)
+{
+	prog_stmt_t *stmt;
+	int rc;
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		rc = callgraph_stmt_edges(cg, idx, stmt, level);
+		if (rc != 0)
+			return rc;
+
+		stmt = prog_block_next(stmt);
+	}
+
+	return 0;
+}
+
+/** Destroy call graph.
+ *
+ * @param cg Call graph
+ */
+static void callgraph_destroy(callgraph_t *cg)
+{
+	size_t i;
+
+	for (i = 0; i < vector_count(&cg->nodes); i++)
+		vector_fini(&callgraph_node(cg, i)->edges);
+
+	vector_fini(&cg->nodes);
+	vector_fini(&cg->stack);
+	hmap_destroy(cg->node_idx);
+	free(cg);
+}
+
+/** Build call graph of module.
+ *
+ * @param mod Program module
+ * @param rcg Place to store pointer to new call graph
+ * @return Zero on success or an error code
+ */
+static int callgraph_build(prog_module_t *mod, callgraph_t **rcg)
+{
+	callgraph_t *cg;
+	callgraph_node_t node;
+	prog_proc_t *proc;
+	size_t idx;
+	int rc;
+
+	cg = calloc(1, sizeof(callgraph_t));
+	if (cg == NULL)
+		return ENOMEM;
+
+	cg->mod = mod;
+	vector_initialize(&cg->nodes, sizeof(callgraph_node_t));
+	vector_initialize(&cg->stack, sizeof(size_t));
+
+	rc = hmap_create(hmk_int, &cg->node_idx);
+	if (rc != 0)
+		goto error;
+
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		if (proc->canon != proc) {
+			/* Shares results with its canonical procedure */
+			proc = prog_module_next(proc);
+			continue;
+		}
+
+		idx = vector_count(&cg->nodes);
+		rc = hmap_insert_int(cg->node_idx, (uintptr_t)proc,
+		    (void *)(uintptr_t)idx);
+		if (rc != 0)
+			goto error;
+
+		memset(&node, 0, sizeof(node));
+		node.proc = proc;
+		vector_initialize(&node.edges, sizeof(callgraph_edge_t));
+		rc = vector_append(&cg->nodes, &node);
+		if (rc != 0)
+			goto error;
+
+		proc = prog_module_next(proc);
+	}
+
+	/* The SCC stack never holds more than all nodes */
+	rc = vector_reserve(&cg->stack, vector_count(&cg->nodes));
+	if (rc != 0)
+		goto error;
+
+	for (idx = 0; idx < vector_count(&cg->nodes); idx++) {
+		rc = callgraph_block_edges(cg, idx,
+		    callgraph_node(cg, idx)->proc->body, 0);
+		if (rc != 0)
+			goto error;
+	}
+
+	*rcg = cg;
+	return 0;
+error:
+	callgraph_destroy(cg);
+	return rc;
+}
+
+/** Rotate offset by a number of left turns.
+ *
+ * @param rot Number of left turns
+ * @param f Forward offset
+ * @param l Left offset
+ * @param rf Place to store rotated forward offset
+ * @param rl Place to store rotated left offset
+ */
+static void callgraph_rotate(unsigned rot, int f, int l, int *rf, int *rl)
+{
+	switch (rot % 4) {
+	case 0:
+		*rf = f;
+		*rl = l;
+		break;
+	case 1:
+		*rf = -l;
+		*rl = f;
+		break;
+	case 2:
+		*rf = -f;
+		*rl = -l;
+		break;
+	default:
+		*rf = l;
+		*rl = -f;
+		break;
+	}
+}
+
+/** Movement effect being computed */
+typedef struct {
+	/** Offsets of tiles entered (pairs of int) */
+	vector_t path;
+	/** Current forward and left offset */
+	int pos[2];
+	/** Number of left turns (modulo 4) */
+	unsigned rot;
+	/** Number of statements executed */
+	unsigned long nsteps;
+	/** Number of turn left statements executed */
+	unsigned long nturns;
+} callgraph_effect_state_t;
+
+static int callgraph_block_effect(callgraph_effect_state_t *, prog_block_t *);
+
+/** Initialize movement effect state.
+ *
+ * @param state Effect state
+ */
+static void callgraph_effect_init(callgraph_effect_state_t *state)
+{
+	memset(state, 0, sizeof(callgraph_effect_state_t));
+	vector_initialize(&state->path, 2 * sizeof(int));
+}
+
+/** Check that movement effect state is within limits.
+ *
+ * @param state Effect state
+ * @return Zero if within limits, ERANGE otherwise
+ */
+static int callgraph_effect_check(callgraph_effect_state_t *state)
+{
+	if (vector_count(&state->path) > callgraph_effect_max_path ||
+	    state->nsteps > callgraph_effect_max_steps)
+		return ERANGE;
+
+	return 0;
+}
+
+/** Append movement effect to movement effect state.
+ *
+ * @param state Effect state
+ * @param eff Effect to append (relative to current position and direction)
+ * @return Zero on success, ERANGE if limits were exceeded, ENOMEM if
+ *         out of memory
+ */
+static int callgraph_effect_append(callgraph_effect_state_t *state,
+    prog_effect_t *eff)
+{
+	int off[2];
+	unsigned i;
+
+	if (state->nsteps + eff->nsteps > callgraph_effect_max_steps ||
+	    vector_count(&state->path) + eff->npath > callgraph_effect_max_path)
+		return ERANGE;
+
+	for (i = 0; i < eff->npath; i++) {
+		callgraph_rotate(state->rot, eff->path[2 * i],
+		    eff->path[2 * i + 1], &off[0], &off[1]);
+		off[0] += state->pos[0];
+		off[1] += state->pos[1];
+		if (vector_append(&state->path, off) != 0)
+			return ENOMEM;
+	}
+
+	callgraph_rotate(state->rot, eff->df, eff->dl, &off[0], &off[1]);
+	state->pos[0] += off[0];
+	state->pos[1] += off[1];
+	state->rot = (state->rot + eff->rot) % 4;
+	state->nsteps += eff->nsteps;
+	state->nturns += eff->nturns;
+	return 0;
+}
+
+/** Compute movement effect of repeat statement.
+ *
+ * Only loops with a repeat count and no conditions have a movement
+ * effect. The repeat statement itself is not counted as a step, only
+ * the statements of its body are (see robot_run_cost()).
+ *
+ * @param state Effect state
+ * @param stmt Repeat statement
+ * @return Zero on success, ENOTSUP if the loop does not have a movement
+ *         effect, ERANGE if limits were exceeded, ENOMEM if out of memory
+ */
+static int callgraph_repeat_effect(callgraph_effect_state_t *state,
+    prog_stmt_t *stmt)
+{
+	prog_repeat_t *rep = &stmt->s.srepeat;
+	callgraph_effect_state_t bstate;
+	prog_effect_t beff;
+	unsigned long n;
+	unsigned i;
+	int rc;
+
+	if (rep->repcnt == 0 || rep->have_scond || rep->have_econd)
+		return ENOTSUP;
+
+	callgraph_effect_init(&bstate);
+	rc = callgraph_block_effect(&bstate, rep->body);
+	if (rc != 0)
+		goto error;
+
+	memset(&beff, 0, sizeof(beff));
+	beff.npath = vector_count(&bstate.path);
+	if (beff.npath > 0)
+		beff.path = vector_get(&bstate.path, 0);
+	beff.df = bstate.pos[0];
+	beff.dl = bstate.pos[1];
+	beff.rot = bstate.rot;
+	beff.nsteps = bstate.nsteps;
+	beff.nturns = bstate.nturns;
+
+	if (beff.npath == 0) {
+		/* Body only turns, which can be summed up directly */
+		assert(beff.df == 0 && beff.dl == 0);
+		n = rep->repcnt;
+		if (beff.nsteps > 0 && n > (callgraph_effect_max_steps -
+		    state->nsteps) / beff.nsteps) {
+			rc = ERANGE;
+			goto error;
+		}
+
+		state->rot = (state->rot + (n % 4) * beff.rot) % 4;
+		state->nsteps += n * beff.nsteps;
+		state->nturns += n * beff.nturns;
+		vector_fini(&bstate.path);
+		return 0;
+	}
+
+	/* The path limit bounds the number of iterations here */
+	for (i = 0; i < rep->repcnt; i++) {
+		rc = callgraph_effect_append(state, &beff);
+		if (rc != 0)
+			goto error;
+	}
+
+	vector_fini(&bstate.path);
+	return 0;
+error:
+	vector_fini(&bstate.path);
+	return rc;
+}
+
+/** Compute movement effect of statement block.
+ *
+ * @param state Effect state
+ * @param block Statement block
+ * @return Zero on success, ENOTSUP if the block does not have a movement
+ *         effect, ERANGE if limits were exceeded, ENOMEM if out of memory
+ */
+static int callgraph_block_effect(callgraph_effect_state_t *state,
+    prog_block_t *block)
+{
+	prog_effect_t *ceff;
+	prog_stmt_t *stmt;
+	int off[2];
+	int rc;
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		switch (stmt->op) {
+		case progop_turn_left:
+			++state->nsteps;
+			state->rot = (state->rot + 1) % 4;
+			++state->nturns;
+			break;
+		case progop_move:
+			++state->nsteps;
+			callgraph_rotate(state->rot, 1, 0, &off[0], &off[1]);
+			state->pos[0] += off[0];
+			state->pos[1] += off[1];
+			if (vector_append(&state->path, state->pos) != 0)
+				return ENOMEM;
+			break;
+		case progop_call:
+			ceff = stmt->s.scall.proc->canon->effect;
+			if (ceff == NULL)
+				return ENOTSUP;
+
+			++state->nsteps;
+			rc = callgraph_effect_append(state, ceff);
+			if (rc != 0)
+				return rc;
+			break;
+		case progop_repeat:
+			rc = callgraph_repeat_effect(state, stmt);
+			if (rc != 0)
+				return rc;
+			break;
+		default:
+			return ENOTSUP;
+		}
+
+		rc = callgraph_effect_check(state);
+		if (rc != 0)
+			return rc;
+
+		stmt = prog_block_next(stmt);
+	}
+
+	return 0;
+}
+
+/** Compute movement effect of procedure.
+ *
+ * All procedures called by @a proc must have been evaluated already.
+ *
+ * @param proc Procedure
+ * @return Movement effect or @c NULL if procedure does not have one
+ *         (or out of memory)
+ */
+static prog_effect_t *callgraph_proc_effect(prog_proc_t *proc)
+{
+	prog_effect_t *effect = NULL;
+	callgraph_effect_state_t state;
+	size_t npath;
+
+	callgraph_effect_init(&state);
+
+	if (callgraph_block_effect(&state, proc->body) != 0)
+		goto error;
+
+	effect = calloc(1, sizeof(prog_effect_t));
+	if (effect == NULL)
+		goto error;
+
+	npath = vector_count(&state.path);
+	if (npath > 0) {
+		effect->path = malloc(npath * 2 * sizeof(int));
+		if (effect->path == NULL)
+			goto error;
+
+		memcpy(effect->path, vector_get(&state.path, 0),
+		    npath * 2 * sizeof(int));
+	}
+
+	effect->npath = npath;
+	effect->df = state.pos[0];
+	effect->dl = state.pos[1];
+	effect->rot = state.rot;
+	effect->nsteps = state.nsteps;
+	effect->nturns = state.nturns;
+	vector_fini(&state.path);
+	return effect;
+error:
+	prog_effect_destroy(effect);
+	vector_fini(&state.path);
+	return NULL;
+}
+
+/** Copy procedure movement effect.
+ *
+ * @param effect Effect or @c NULL
+ * @return Copy of @a effect or @c NULL if @a effect is @c NULL
+ *         (or out of memory)
+ */
+static prog_effect_t *callgraph_effect_copy(prog_effect_t *effect)
+{
+	prog_effect_t *copy;
+
+	if (effect == NULL)
+		return NULL;
+
+	copy = calloc(1, sizeof(prog_effect_t));
+	if (copy == NULL)
+		return NULL;
+
+	*copy = *effect;
+	if (effect->npath > 0) {
+		copy->path = malloc(effect->npath * 2 * sizeof(int));
+		if (copy->path == NULL) {
+			free(copy);
+			return NULL;
+		}
+
+		memcpy(copy->path, effect->path, effect->npath * 2 *
+		    sizeof(int));
+	}
+
+	return copy;
+}
+
+/** Compute stack depth for strongly connected component.
+ *
+ * All components reachable from this one have already been evaluated.
+ * Procedures in one component can call each other back and forth, so
+ * they share the same result. If any call within the component pushes
+ * a stack entry, the recursion is unbounded.
+ *
+ * @param cg Call graph
+ * @param first Index in SCC stack of first node in component
+ * @param scc Component number
+ */
+static void callgraph_scc_eval(callgraph_t *cg, size_t first, unsigned scc)
+{
+	callgraph_node_t *node;
+	callgraph_node_t *tnode;
+	callgraph_edge_t *edge;
+	bool unbounded = false;
+	bool internal = false;
+	unsigned depth = 0;
+	size_t i, j;
+
+	for (i = first; i < vector_count(&cg->stack); i++) {
+		node = callgraph_node(cg, *(size_t *)vector_get(&cg->stack, i));
+		for (j = 0; j < vector_count(&node->edges); j++) {
+			edge = vector_get(&node->edges, j);
+			tnode = callgraph_node(cg, edge->target);
+
+			if (tnode->scc == scc) {
+				internal = true;
+				if (edge->weight > 0)
+					unbounded = true;
+			} else if (tnode->proc->unbounded) {
+				unbounded = true;
+			} else if (edge->weight + tnode->proc->max_depth >
+			    depth) {
+				depth = edge->weight + tnode->proc->max_depth;
+			}
+		}
+	}
+
+	for (i = first; i < vector_count(&cg->stack); i++) {
+		node = callgraph_node(cg, *(size_t *)vector_get(&cg->stack, i));
+		node->proc->unbounded = unbounded;
+		node->proc->max_depth = unbounded ? 0 : depth;
+
+		/* Only non-recursive procedures can have movement effect */
+		prog_proc_set_effect(node->proc, internal ? NULL :
+		    callgraph_proc_effect(node->proc));
+	}
+}
+
+/** Visit call graph node (Tarjan's strongly connected components).
+ *
+ * @param cg Call graph
+ * @param idx Node index
+ */
+static void callgraph_visit(callgraph_t *cg, size_t idx)
+{
+	callgraph_node_t *node;
+	callgraph_node_t *tnode;
+	callgraph_edge_t *edge;
+	size_t first;
+	size_t j;
+	int rc;
+
+	node = callgraph_node(cg, idx);
+	node->index = ++cg->next_index;
+	node->lowlink = node->index;
+	node->on_stack = true;
+
+	rc = vector_append(&cg->stack, &idx);
+	assert(rc == 0);
+	(void) rc;
+
+	for (j = 0; j < vector_count(&node->edges); j++) {
+		edge = vector_get(&node->edges, j);
+		tnode = callgraph_node(cg, edge->target);
+
+		if (tnode->index == 0) {
+			callgraph_visit(cg, edge->target);
+			if (tnode->lowlink < node->lowlink)
+				node->lowlink = tnode->lowlink;
+		} else if (tnode->on_stack) {
+			if (tnode->index < node->lowlink)
+				node->lowlink = tnode->index;
+		}
+	}
+
+	if (node->lowlink != node->index)
+		return;
+
+	/* Node is the root of a component, members are on top of stack */
+	++cg->next_scc;
+	first = vector_count(&cg->stack);
+	do {
+		--first;
+		tnode = callgraph_node(cg,
+		    *(size_t *)vector_get(&cg->stack, first));
+		tnode->on_stack = false;
+		tnode->scc = cg->next_scc;
+	} while (tnode != node);
+
+	callgraph_scc_eval(cg, first, cg->next_scc);
+
+	while (vector_count(&cg->stack) > first)
+		vector_remove(&cg->stack, vector_count(&cg->stack) - 1);
+}
+
+/** Analyze call graph of module.
+ *
+ * Determines maximum stack depth and movement effect of every procedure
+ * in the module and stores it in the procedure (@c max_depth,
+ * @c unbounded, @c effect).
+ *
+ * @param mod Program module
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int callgraph_analyze(prog_module_t *mod)
+{
+	callgraph_t *cg;
+	prog_proc_t *proc;
+	size_t idx;
+	int rc;
+
+	rc = proghash_cons(mod, NULL);
+	if (rc != 0)
+		return rc;
+
+	rc = callgraph_build(mod, &cg);
+	if (rc != 0)
+		return rc;
+
+	for (idx = 0; idx < vector_count(&cg->nodes); idx++) {
+		if (callgraph_node(cg, idx)->index == 0)
+			callgraph_visit(cg, idx);
+	}
+
+	callgraph_destroy(cg);
+
+	/* Duplicates get the results of their canonical procedures */
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		if (proc->canon != proc) {
+			proc->unbounded = proc->canon->unbounded;
+			proc->max_depth = proc->canon->max_depth;
+			prog_proc_set_effect(proc,
+			    callgraph_effect_copy(proc->canon->effect));
+		}
+
+		proc = prog_module_next(proc);
+	}
+
+	mod->cg_valid = true;
+	return 0;
+}
+
+/** Get maximum stack depth needed to run procedure.
+ *
+ * The module is re-analyzed if it changed since the last analysis.
+ * A procedure that is not part of any module is assumed to be unbounded.
+ *
+ * @param proc Procedure
+ * @param runbounded Place to store @c true if procedure can recurse
+ *                   without bound
+ * @param rdepth Place to store maximum stack depth (if bounded)
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int callgraph_proc_depth(prog_proc_t *proc, bool *runbounded,
+    unsigned *rdepth)
+{
+	int rc;
+
+	if (proc->mod == NULL) {
+		*runbounded = true;
+		*rdepth = 0;
+		return 0;
+	}
+
+	if (!proc->mod->cg_valid) {
+		rc = callgraph_analyze(proc->mod);
+		if (rc != 0)
+			return rc;
+	}
+
+	*runbounded = proc->unbounded;
+	*rdepth = proc->max_depth;
+	return 0;
+}
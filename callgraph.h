@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Call graph analysis
+ */
+
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "adt/hmap.h"
+#include "adt/vector.h"
+#include "prog.h"
+
+/** Call graph edge */
+typedef struct {
+	/** Index of called node */
+	size_t target;
+	/** Number of robot stack entries the call can push */
+	unsigned weight;
+} callgraph_edge_t;
+
+/** Call graph node */
+typedef struct {
+	/** Procedure */
+	prog_proc_t *proc;
+	/** Outgoing edges (callgraph_edge_t) */
+	vector_t edges;
+	/** DFS index (starting at 1) or zero if not visited yet */
+	unsigned index;
+	/** Lowest DFS index reachable from this node */
+	unsigned lowlink;
+	/** Is node on the SCC stack? */
+	bool on_stack;
+	/** Strongly connected component number (starting at 1) */
+	unsigned scc;
+} callgraph_node_t;
+
+/** Call graph */
+typedef struct {
+	/** Program module */
+	prog_module_t *mod;
+	/** Nodes (callgraph_node_t), one per procedure */
+	vector_t nodes;
+	/** Procedure to node index map */
+	hmap_t *node_idx;
+	/** SCC stack (node indices) */
+	vector_t stack;
+	/** Next DFS index */
+	unsigned next_index;
+	/** Next SCC number */
+	unsigned next_scc;
+} callgraph_t;
+
+extern int callgraph_analyze(prog_module_t *);
+extern int callgraph_proc_depth(prog_proc_t *, bool *, unsigned *);
+
+#endif
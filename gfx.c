@@ -137,6 +137,21 @@ void gfx_update(gfx_t *gfx)
 	SDL_UpdateWindowSurface(gfx->win);
 }
 
+/** Get size of graphics output.
+ *
+ * @param gfx Graphics object
+ * @param rw Place to store width (in the same units as drawing coordinates)
+ * @param rh Place to store height
+ */
+void gfx_get_size(gfx_t *gfx, int *rw, int *rh)
+{
+	SDL_Surface *surf;
+
+	surf = SDL_GetWindowSurface(gfx->win);
+	*rw = surf->w / 2;
+	*rh = surf->h / 2;
+}
+
 /** Create new bitmap.
  *
  * @param w Width
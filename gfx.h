@@ -63,6 +63,7 @@ extern void gfx_bmp_set_pixel(gfx_bmp_t *, int, int, uint8_t, uint8_t, uint8_t);
 extern void gfx_set_wnd_icon(gfx_t *, gfx_bmp_t *);
 
 extern void gfx_update(gfx_t *);
+extern void gfx_get_size(gfx_t *, int *, int *);
 extern int gfx_wait_event(SDL_Event *);
 extern int gfx_timer_create(uint32_t, gfx_timer_func_t, void *, gfx_timer_t **);
 extern void gfx_timer_destroy(gfx_timer_t *);
@@ -26,6 +26,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "gfx.h"
 #include "icon.h"
@@ -67,87 +68,193 @@ void icon_destroy(icon_t *icon)
 	free(icon);
 }
 
-/** Load icon from file.
+/** Create icon from packed pixels.
  *
- * @param f File
+ * @param w Width
+ * @param h Height
+ * @param pixels Pixels, three bytes (R, G, B) per pixel, row by row
  * @param ricon Place to store pointer to new icon
  * @return Zero on success or an error code
  */
-int icon_load(FILE *f, icon_t **ricon)
+int icon_from_rgb(int w, int h, const uint8_t *pixels, icon_t **ricon)
 {
+	icon_t *icon;
+	const uint8_t *p;
+	int x, y;
 	int rc;
+
+	rc = icon_create(w, h, &icon);
+	if (rc != 0)
+		return rc;
+
+	p = pixels;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			gfx_bmp_set_pixel(icon->bmp, x, y, p[0], p[1], p[2]);
+			p += 3;
+		}
+	}
+
+	*ricon = icon;
+	return 0;
+}
+
+/** Get icon pixels in packed form.
+ *
+ * @param icon Icon
+ * @param rpixels Place to store pointer to newly allocated pixels,
+ *                three bytes (R, G, B) per pixel, row by row
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int icon_to_rgb(icon_t *icon, uint8_t **rpixels)
+{
+	uint8_t *pixels;
+	uint8_t *p;
+	int x, y;
+
+	pixels = malloc(3 * (size_t) icon->bmp->w * icon->bmp->h);
+	if (pixels == NULL)
+		return ENOMEM;
+
+	p = pixels;
+	for (y = 0; y < icon->bmp->h; y++) {
+		for (x = 0; x < icon->bmp->w; x++) {
+			gfx_bmp_get_pixel(icon->bmp, x, y, &p[0], &p[1],
+			    &p[2]);
+			p += 3;
+		}
+	}
+
+	*rpixels = pixels;
+	return 0;
+}
+
+/** Read color component from file.
+ *
+ * @param f File
+ * @param rval Place to store value
+ * @return Zero on success, EIO if there is no valid value
+ */
+static int icon_read_comp(FILE *f, uint8_t *rval)
+{
+	unsigned val = 0;
+	unsigned ndigits = 0;
+	int c;
+
+	c = getc(f);
+	while (c >= '0' && c <= '9') {
+		val = val * 10 + (c - '0');
+		if (++ndigits > 3)
+			return EIO;
+		c = getc(f);
+	}
+
+	if (ndigits == 0 || val > 255)
+		return EIO;
+
+	(void) ungetc(c, f);
+	*rval = val;
+	return 0;
+}
+
+/** Load icon from file in packed form.
+ *
+ * This only reads the pixels, it does not create a bitmap.
+ *
+ * @param f File
+ * @param rw Place to store width
+ * @param rh Place to store height
+ * @param rpixels Place to store pointer to newly allocated pixels,
+ *                three bytes (R, G, B) per pixel, row by row
+ * @return Zero on success or an error code
+ */
+int icon_load_rgb(FILE *f, int *rw, int *rh, uint8_t **rpixels)
+{
+	uint8_t *pixels;
+	uint8_t *p;
 	int x, y;
 	int w, h;
 	int nitem;
-	icon_t *icon = NULL;
 	int c;
-	unsigned r, g, b;
+	int rc;
 
 	nitem = fscanf(f, "%d %d\n", &w, &h);
-	if (nitem != 2)
+	if (nitem != 2 || w <= 0 || h <= 0 || w > icon_max_dim ||
+	    h > icon_max_dim)
 		return EIO;
 
-	rc = icon_create(w, h, &icon);
-	if (rc != 0)
-		goto error;
+	pixels = malloc(3 * (size_t) w * h);
+	if (pixels == NULL)
+		return ENOMEM;
 
+	p = pixels;
 	for (y = 0; y < h; y++) {
 		for (x = 0; x < w; x++) {
 			if (x > 0) {
-				c = fgetc(f);
+				c = getc(f);
 				if (c != ' ') {
 					rc = EIO;
 					goto error;
 				}
 			}
 
-			nitem = fscanf(f, "%u,%u,%u", &r, &g, &b);
-			if (nitem != 3) {
+			rc = icon_read_comp(f, &p[0]);
+			if (rc == 0 && getc(f) != ',')
+				rc = EIO;
+			if (rc == 0)
+				rc = icon_read_comp(f, &p[1]);
+			if (rc == 0 && getc(f) != ',')
 				rc = EIO;
+			if (rc == 0)
+				rc = icon_read_comp(f, &p[2]);
+			if (rc != 0)
 				goto error;
-			}
 
-			gfx_bmp_set_pixel(icon->bmp, x, y, r, g, b);
+			p += 3;
 		}
 
-		c = fgetc(f);
+		c = getc(f);
 		if (c != '\n') {
 			rc = EIO;
 			goto error;
 		}
 	}
 
-	*ricon = icon;
+	*rw = w;
+	*rh = h;
+	*rpixels = pixels;
 	return 0;
 error:
-	if (icon != NULL)
-		icon_destroy(icon);
+	free(pixels);
 	return rc;
 }
 
-/** Save icon to file.
+/** Save icon in packed form to file.
  *
- * @param icon Icon
+ * @param w Width
+ * @param h Height
+ * @param pixels Pixels, three bytes (R, G, B) per pixel, row by row
  * @param f File
  * @return Zero on success or an error code
  */
-int icon_save(icon_t *icon, FILE *f)
+int icon_save_rgb(int w, int h, const uint8_t *pixels, FILE *f)
 {
+	const uint8_t *p;
 	int rv;
 	int x, y;
-	uint8_t r, g, b;
 
-	rv = fprintf(f, "%d %d\n", icon->bmp->w, icon->bmp->h);
+	rv = fprintf(f, "%d %d\n", w, h);
 	if (rv < 0)
 		return EIO;
 
-	for (y = 0; y < icon->bmp->h; y++) {
-		for (x = 0; x < icon->bmp->w; x++) {
-			gfx_bmp_get_pixel(icon->bmp, x, y, &r, &g, &b);
+	p = pixels;
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
 			rv = fprintf(f, "%s%u,%u,%u", x > 0 ? " " : "",
-			    r, g, b);
+			    p[0], p[1], p[2]);
 			if (rv < 0)
 				return EIO;
+			p += 3;
 		}
 
 		rv = fputc('\n', f);
@@ -157,3 +264,44 @@ int icon_save(icon_t *icon, FILE *f)
 
 	return 0;
 }
+
+/** Load icon from file.
+ *
+ * @param f File
+ * @param ricon Place to store pointer to new icon
+ * @return Zero on success or an error code
+ */
+int icon_load(FILE *f, icon_t **ricon)
+{
+	uint8_t *pixels;
+	int w, h;
+	int rc;
+
+	rc = icon_load_rgb(f, &w, &h, &pixels);
+	if (rc != 0)
+		return rc;
+
+	rc = icon_from_rgb(w, h, pixels, ricon);
+	free(pixels);
+	return rc;
+}
+
+/** Save icon to file.
+ *
+ * @param icon Icon
+ * @param f File
+ * @return Zero on success or an error code
+ */
+int icon_save(icon_t *icon, FILE *f)
+{
+	uint8_t *pixels;
+	int rc;
+
+	rc = icon_to_rgb(icon, &pixels);
+	if (rc != 0)
+		return rc;
+
+	rc = icon_save_rgb(icon->bmp->w, icon->bmp->h, pixels, f);
+	free(pixels);
+	return rc;
+}
@@ -23,9 +23,15 @@
 #ifndef ICON_H
 #define ICON_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include "gfx.h"
 
+enum {
+	/** Maximum icon width or height accepted when loading */
+	icon_max_dim = 1024
+};
+
 /** Icon */
 typedef struct {
 	/** Icon */
@@ -36,5 +42,9 @@ extern int icon_create(int, int, icon_t **);
 extern void icon_destroy(icon_t *);
 extern int icon_load(FILE *, icon_t **);
 extern int icon_save(icon_t *, FILE *);
+extern int icon_from_rgb(int, int, const uint8_t *, icon_t **);
+extern int icon_to_rgb(icon_t *, uint8_t **);
+extern int icon_load_rgb(FILE *, int *, int *, uint8_t **);
+extern int icon_save_rgb(int, int, const uint8_t *, FILE *);
 
 #endif
@@ -22,15 +22,26 @@
 
 /*
  * Icon dictionary - maps identifers to icons
+ *
+ * Entries with identical icons share one reference-counted image, found
+ * through a hash of the icon contents. Images are also saved only once.
+ *
+ * Icons loaded from file are kept in packed form and only decoded into
+ * bitmaps when they are first needed. The number of decoded icons is
+ * limited, the least recently used ones are released first.
  */
 
+#include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include "adt/hmap.h"
 #include "gfx.h"
 #include "icon.h"
 #include "icondict.h"
+#include "journal.h"
 #include "prog.h"
 
 /** Create icon dictionary.
@@ -42,12 +53,22 @@
 int icondict_create(icondict_t **ricondict)
 {
 	icondict_t *icondict;
+	int rc;
 
 	icondict = calloc(1, sizeof(icondict_t));
 	if (icondict == NULL)
 		return ENOMEM;
 
+	rc = hmap_create(hmk_int, &icondict->image_idx);
+	if (rc != 0) {
+		free(icondict);
+		return rc;
+	}
+
 	list_initialize(&icondict->entries);
+	list_initialize(&icondict->images);
+	list_initialize(&icondict->decoded);
+	icondict->max_decoded = icondict_def_max_decoded;
 	*ricondict = icondict;
 	return 0;
 }
@@ -66,18 +87,151 @@ void icondict_destroy(icondict_t *icondict)
 		entry = icondict_first(icondict);
 	}
 
+	assert(list_empty(&icondict->images));
+	hmap_destroy(icondict->image_idx);
 	free(icondict);
 }
 
-/** Add new entry to icon dictionary.
+/** Compute content hash of icon pixels.
+ *
+ * @param w Width
+ * @param h Height
+ * @param pixels Packed pixels
+ * @return Hash
+ */
+static uint64_t icondict_pixels_hash(int w, int h, const uint8_t *pixels)
+{
+	uint64_t hash;
+	size_t size;
+	size_t i;
+
+	/* FNV-1a */
+	hash = 0xcbf29ce484222325ULL;
+	hash = (hash ^ (uint64_t)w) * 0x100000001b3ULL;
+	hash = (hash ^ (uint64_t)h) * 0x100000001b3ULL;
+
+	size = 3 * (size_t)w * (size_t)h;
+	for (i = 0; i < size; i++)
+		hash = (hash ^ pixels[i]) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+/** Get image with the specified contents.
+ *
+ * If an identical image already exists, its reference count is incremented
+ * and @a pixels are freed. Otherwise a new image is created. In both cases
+ * the caller receives one reference to the image.
  *
  * @param icondict Icon dictionary
- * @param ident Identifier (will be duplicated)
- * @param icon Icon (ownership transferred to icon dictionary)
+ * @param w Width
+ * @param h Height
+ * @param pixels Packed pixels (ownership transferred on success)
+ * @param rimage Place to store pointer to image
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int icondict_image_get(icondict_t *icondict, int w, int h,
+    uint8_t *pixels, icondict_image_t **rimage)
+{
+	icondict_image_t *image;
+	hmap_entry_t *hentry;
+	uint64_t hash;
+	int rc;
+
+	hash = icondict_pixels_hash(w, h, pixels);
+	hentry = hmap_find_int(icondict->image_idx, hash);
+
+	image = hentry != NULL ? hentry->value : NULL;
+	while (image != NULL) {
+		if (image->w == w && image->h == h &&
+		    memcmp(image->pixels, pixels, 3 * (size_t)w * h) == 0) {
+			++image->refcnt;
+			free(pixels);
+			*rimage = image;
+			return 0;
+		}
+
+		image = image->hnext;
+	}
+
+	image = calloc(1, sizeof(icondict_image_t));
+	if (image == NULL)
+		return ENOMEM;
+
+	if (hentry != NULL) {
+		/* Prepend to hash chain */
+		image->hnext = hentry->value;
+		hentry->value = image;
+	} else {
+		rc = hmap_insert_int(icondict->image_idx, hash, image);
+		if (rc != 0) {
+			free(image);
+			return rc;
+		}
+	}
+
+	image->icondict = icondict;
+	image->refcnt = 1;
+	image->hash = hash;
+	image->w = w;
+	image->h = h;
+	image->pixels = pixels;
+	list_append(&image->limages, &icondict->images);
+	*rimage = image;
+	return 0;
+}
+
+/** Release reference to image.
+ *
+ * The image is destroyed when the last reference is released.
+ *
+ * @param image Image
+ */
+static void icondict_image_release(icondict_image_t *image)
+{
+	icondict_t *icondict = image->icondict;
+	icondict_image_t **pimage;
+	hmap_entry_t *hentry;
+
+	assert(image->refcnt > 0);
+	if (--image->refcnt > 0)
+		return;
+
+	/* Unlink from hash chain */
+	hentry = hmap_find_int(icondict->image_idx, image->hash);
+	assert(hentry != NULL);
+	if (hentry->value == image) {
+		if (image->hnext != NULL)
+			hentry->value = image->hnext;
+		else
+			hmap_remove(icondict->image_idx, hentry);
+	} else {
+		pimage = (icondict_image_t **)&hentry->value;
+		while (*pimage != image)
+			pimage = &(*pimage)->hnext;
+		*pimage = image->hnext;
+	}
+
+	list_remove(&image->limages);
+	if (image->icon != NULL) {
+		list_remove(&image->ldecoded);
+		icon_destroy(image->icon);
+	}
+
+	free(image->pixels);
+	free(image);
+}
+
+/** Create icon dictionary entry.
  *
+ * @param icondict Icon dictionary
+ * @param ident Identifier (will be duplicated)
+ * @param image Image (reference transferred to the entry on success)
+ * @param rentry Place to store pointer to new entry
  * @return Zero on success, ENOMEM if out of memory
  */
-int icondict_add(icondict_t *icondict, const char *ident, icon_t *icon)
+static int icondict_entry_create(icondict_t *icondict, const char *ident,
+    icondict_image_t *image, icondict_entry_t **rentry)
 {
 	icondict_entry_t *entry;
 
@@ -86,17 +240,141 @@ int icondict_add(icondict_t *icondict, const char *ident, icon_t *icon)
 		return ENOMEM;
 
 	entry->icondict = icondict;
-	list_append(&entry->lidict, &icondict->entries);
 	entry->ident = strdup(ident);
 	if (entry->ident == NULL) {
 		free(entry);
 		return ENOMEM;
 	}
 
-	entry->icon = icon;
+	entry->image = image;
+	list_append(&entry->lidict, &icondict->entries);
+	*rentry = entry;
+	return 0;
+}
+
+/** Release least recently used decoded icons over the limit.
+ *
+ * @param icondict Icon dictionary
+ */
+static void icondict_trim(icondict_t *icondict)
+{
+	icondict_image_t *image;
+	link_t *link;
+
+	while (list_count(&icondict->decoded) > icondict->max_decoded) {
+		link = list_last(&icondict->decoded);
+		image = list_get_instance(link, icondict_image_t, ldecoded);
+
+		/* Pixels are kept so that the icon can be decoded again */
+		list_remove(&image->ldecoded);
+		icon_destroy(image->icon);
+		image->icon = NULL;
+	}
+}
+
+/** Add new entry to icon dictionary.
+ *
+ * If the dictionary already contains an identical icon, the new entry
+ * shares its image and @a icon is destroyed.
+ *
+ * @param icondict Icon dictionary
+ * @param ident Identifier (will be duplicated)
+ * @param icon Icon (ownership transferred to icon dictionary on success)
+ *
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int icondict_add(icondict_t *icondict, const char *ident, icon_t *icon)
+{
+	icondict_entry_t *entry;
+	icondict_image_t *image;
+	uint8_t *pixels;
+	int rc;
+
+	rc = icon_to_rgb(icon, &pixels);
+	if (rc != 0)
+		return rc;
+
+	rc = icondict_image_get(icondict, icon->bmp->w, icon->bmp->h, pixels,
+	    &image);
+	if (rc != 0) {
+		free(pixels);
+		return rc;
+	}
+
+	rc = icondict_entry_create(icondict, ident, image, &entry);
+	if (rc != 0) {
+		icondict_image_release(image);
+		return rc;
+	}
+
+	if (image->icon == NULL) {
+		image->icon = icon;
+		list_prepend(&image->ldecoded, &icondict->decoded);
+		icondict_trim(icondict);
+	} else {
+		icon_destroy(icon);
+	}
+
+	if (icondict->journal != NULL) {
+		journal_icon_add(icondict->journal, ident, image->w, image->h,
+		    image->pixels);
+	}
+
 	return 0;
 }
 
+/** Set maximum number of decoded icons.
+ *
+ * @param icondict Icon dictionary
+ * @param max_decoded Maximum number of decoded icons (at least one)
+ */
+void icondict_set_max_decoded(icondict_t *icondict, unsigned max_decoded)
+{
+	assert(max_decoded > 0);
+	icondict->max_decoded = max_decoded;
+	icondict_trim(icondict);
+}
+
+/** Get entry bitmap.
+ *
+ * Decodes the icon if necessary. The bitmap remains valid until another
+ * icon is decoded.
+ *
+ * @param entry Icon dictionary entry
+ * @return Bitmap or @c NULL if out of memory
+ */
+gfx_bmp_t *icondict_entry_bmp(icondict_entry_t *entry)
+{
+	icondict_t *icondict = entry->icondict;
+	icondict_image_t *image = entry->image;
+	int rc;
+
+	if (image->icon != NULL) {
+		/* Move to the front of the LRU list */
+		list_remove(&image->ldecoded);
+		list_prepend(&image->ldecoded, &icondict->decoded);
+		return image->icon->bmp;
+	}
+
+	rc = icon_from_rgb(image->w, image->h, image->pixels, &image->icon);
+	if (rc != 0)
+		return NULL;
+
+	list_prepend(&image->ldecoded, &icondict->decoded);
+	icondict_trim(icondict);
+	return image->icon->bmp;
+}
+
+/** Set change journal.
+ *
+ * @param icondict Icon dictionary
+ * @param journal Journal to record changes to or @c NULL
+ */
+void icondict_set_journal(icondict_t *icondict, struct journal *journal)
+{
+	icondict->journal = journal;
+}
+
 /** Remove icon dictionary entry.
  *
  * @param entry Entry
@@ -104,11 +382,10 @@ int icondict_add(icondict_t *icondict, const char *ident, icon_t *icon)
 void icondict_remove(icondict_entry_t *entry)
 {
 	list_remove(&entry->lidict);
+	icondict_image_release(entry->image);
 	free(entry->ident);
-	icon_destroy(entry->icon);
 	free(entry);
 }
-
 /** Get first icon dictionary entry.
  *
  * @param icondict Icon dictionary
@@ -164,39 +441,145 @@ icondict_entry_t *icondict_find(icondict_t *icondict, const char *ident)
 	return NULL;
 }
 
-/** Load icon dictionary entry from file.
+
+/** Load icon dictionary entry with its own icon from file.
+ *
+ * This is the format used by older versions, where each entry is
+ * followed by its icon.
  *
  * @param f File
  * @param icondict Icon dictionary to append the entry to
  * @return Zero on success or an error code
  */
-static int icondict_entry_load(FILE *f, icondict_t *icondict)
+static int icondict_entry_load_icon(FILE *f, icondict_t *icondict)
 {
 	int rc;
 	char ident[prog_proc_id_len + 1];
-	icon_t *icon;
+	icondict_entry_t *entry;
+	icondict_image_t *image;
+	uint8_t *pixels;
+	int w, h;
 
 	rc = prog_proc_load_ident(f, ident);
 	if (rc != 0)
 		return rc;
 
-	rc = icon_load(f, &icon);
+	/* Icon is decoded when it is first needed */
+	rc = icon_load_rgb(f, &w, &h, &pixels);
 	if (rc != 0)
 		return rc;
 
-	rc = icondict_add(icondict, ident, icon);
+	rc = icondict_image_get(icondict, w, h, pixels, &image);
+	if (rc != 0) {
+		free(pixels);
+		return rc;
+	}
+
+	rc = icondict_entry_create(icondict, ident, image, &entry);
+	if (rc != 0) {
+		icondict_image_release(image);
+		return rc;
+	}
+
+	return 0;
+}
+
+/** Load icon dictionary entry referencing a shared image from file.
+ *
+ * @param f File
+ * @param icondict Icon dictionary to append the entry to
+ * @param images Images loaded from file
+ * @param nimages Number of images
+ * @return Zero on success or an error code
+ */
+static int icondict_entry_load(FILE *f, icondict_t *icondict,
+    icondict_image_t **images, unsigned nimages)
+{
+	int rc;
+	char ident[prog_proc_id_len + 1];
+	icondict_entry_t *entry;
+	unsigned idx;
+	int nitem;
+
+	rc = prog_proc_load_ident(f, ident);
 	if (rc != 0)
-		goto error;
+		return rc;
+
+	nitem = fscanf(f, "%u\n", &idx);
+	if (nitem != 1 || idx >= nimages)
+		return EIO;
+
+	rc = icondict_entry_create(icondict, ident, images[idx], &entry);
+	if (rc != 0)
+		return rc;
 
+	++images[idx]->refcnt;
 	return 0;
+}
+
+/** Load icon dictionary images and entries from file.
+ *
+ * @param f File
+ * @param icondict Icon dictionary
+ * @param nentries Number of entries
+ * @return Zero on success or an error code
+ */
+static int icondict_load_shared(FILE *f, icondict_t *icondict,
+    unsigned nentries)
+{
+	icondict_image_t **images = NULL;
+	unsigned nimages = 0;
+	unsigned i;
+	uint8_t *pixels;
+	int w, h;
+	int nitem;
+	int rc;
+
+	nitem = fscanf(f, "%u\n", &nimages);
+	if (nitem != 1)
+		return EIO;
+
+	if (nimages > 0) {
+		images = calloc(nimages, sizeof(icondict_image_t *));
+		if (images == NULL)
+			return ENOMEM;
+	}
+
+	for (i = 0; i < nimages; i++) {
+		/* Icon is decoded when it is first needed */
+		rc = icon_load_rgb(f, &w, &h, &pixels);
+		if (rc != 0)
+			goto error;
+
+		rc = icondict_image_get(icondict, w, h, pixels, &images[i]);
+		if (rc != 0) {
+			free(pixels);
+			goto error;
+		}
+	}
+
+	for (i = 0; i < nentries; i++) {
+		rc = icondict_entry_load(f, icondict, images, nimages);
+		if (rc != 0)
+			goto error;
+	}
+
+	rc = 0;
 error:
-	icon_destroy(icon);
+	/* Drop our references, unused images are destroyed */
+	for (i = 0; i < nimages; i++) {
+		if (images[i] != NULL)
+			icondict_image_release(images[i]);
+	}
+
+	free(images);
 	return rc;
 }
 
 /** Load icon dictionary from file.
  *
- * This includes the actual icons.
+ * This includes the actual icons. Both the shared image format and
+ * the older format with one icon per entry are accepted.
  */
 int icondict_load(FILE *f, icondict_t **ricondict)
 {
@@ -204,21 +587,35 @@ int icondict_load(FILE *f, icondict_t **ricondict)
 	int nitem;
 	unsigned nentries;
 	unsigned i;
+	int c;
 	int rc;
 
 	rc = icondict_create(&icondict);
 	if (rc != 0)
 		goto error;
 
-	nitem = fscanf(f, "%u\n", &nentries);
-	if (nitem != 1)
-		return EIO;
+	nitem = fscanf(f, "%u", &nentries);
+	if (nitem != 1) {
+		rc = EIO;
+		goto error;
+	}
 
 	printf("nentries:%u\n", nentries);
-	for (i = 0; i < nentries; i++) {
-		rc = icondict_entry_load(f, icondict);
+
+	c = fgetc(f);
+	if (c == ' ') {
+		rc = icondict_load_shared(f, icondict, nentries);
 		if (rc != 0)
 			goto error;
+	} else if (c == '\n') {
+		for (i = 0; i < nentries; i++) {
+			rc = icondict_entry_load_icon(f, icondict);
+			if (rc != 0)
+				goto error;
+		}
+	} else {
+		rc = EIO;
+		goto error;
 	}
 
 	*ricondict = icondict;
@@ -237,22 +634,24 @@ error:
  */
 static int icondict_entry_save(icondict_entry_t *entry, FILE *f)
 {
+	int rv;
 	int rc;
 
 	rc = prog_proc_save_ident(entry->ident, f);
 	if (rc != 0)
 		return rc;
 
-	rc = icon_save(entry->icon, f);
-	if (rc != 0)
-		return rc;
+	rv = fprintf(f, "%u\n", entry->image->idx);
+	if (rv < 0)
+		return EIO;
 
 	return 0;
 }
 
 /** Save icon dictionary to file.
  *
- * This includes the actual icons.
+ * This includes the actual icons. Each distinct image is saved only once,
+ * followed by the entries referencing images by index.
  *
  * @param icondict Icon dictionary
  * @param f File
@@ -261,13 +660,23 @@ static int icondict_entry_save(icondict_entry_t *entry, FILE *f)
 int icondict_save(icondict_t *icondict, FILE *f)
 {
 	icondict_entry_t *entry;
+	unsigned idx;
 	int rv;
 	int rc;
 
-	rv = fprintf(f, "%u\n", (unsigned)list_count(&icondict->entries));
+	rv = fprintf(f, "%u %u\n", (unsigned)list_count(&icondict->entries),
+	    (unsigned)list_count(&icondict->images));
 	if (rv < 0)
 		return EIO;
 
+	idx = 0;
+	list_foreach(icondict->images, limages, icondict_image_t, image) {
+		image->idx = idx++;
+		rc = icon_save_rgb(image->w, image->h, image->pixels, f);
+		if (rc != 0)
+			return rc;
+	}
+
 	entry = icondict_first(icondict);
 	while (entry != NULL) {
 		rc = icondict_entry_save(entry, f);
@@ -24,12 +24,48 @@
 #define ICONDICT_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "adt/hmap.h"
 #include "adt/list.h"
 #include "gfx.h"
 #include "icon.h"
 
-/** Icon dictionary */
+enum {
+	/** Default maximum number of decoded icons */
+	icondict_def_max_decoded = 64
+};
+
+/** Icon dictionary image
+ *
+ * Icon pixels shared by all entries with identical icons.
+ */
+typedef struct icondict_image {
+	/** Containing icon dictionary */
+	struct icondict *icondict;
+	/** Link to @c icondict->images */
+	link_t limages;
+	/** Number of references (entries using the image) */
+	unsigned refcnt;
+	/** Content hash */
+	uint64_t hash;
+	/** Next image with the same content hash */
+	struct icondict_image *hnext;
+	/** Icon width */
+	int w;
+	/** Icon height */
+	int h;
+	/** Packed icon pixels (see icon_from_rgb()) */
+	uint8_t *pixels;
+	/** Decoded icon or @c NULL */
+	icon_t *icon;
+	/** Link to @c icondict->decoded if icon is decoded */
+	link_t ldecoded;
+	/** Index in file (only valid while saving) */
+	unsigned idx;
+} icondict_image_t;
+
+/** Icon dictionary entry */
 typedef struct {
 	/** Containing icon dictionary */
 	struct icondict *icondict;
@@ -37,23 +73,36 @@ typedef struct {
 	link_t lidict;
 	/** Identifier */
 	char *ident;
-	/** Icon */
-	icon_t *icon;
+	/** Image */
+	icondict_image_t *image;
 } icondict_entry_t;
 
 /** Icon dictionary */
 typedef struct icondict {
 	/** Entries (icondict_entry_t) */
 	list_t entries;
+	/** Images (icondict_image_t) */
+	list_t images;
+	/** Images by content hash (first image in hash chain) */
+	hmap_t *image_idx;
+	/** Images with decoded icon, most recently used first */
+	list_t decoded;
+	/** Maximum number of decoded icons */
+	unsigned max_decoded;
+	/** Change journal or @c NULL */
+	struct journal *journal;
 } icondict_t;
 
 extern int icondict_create(icondict_t **);
 extern void icondict_destroy(icondict_t *);
 extern int icondict_add(icondict_t *, const char *, icon_t *);
+extern void icondict_set_journal(icondict_t *, struct journal *);
 extern void icondict_remove(icondict_entry_t *);
 extern icondict_entry_t *icondict_first(icondict_t *);
 extern icondict_entry_t *icondict_next(icondict_entry_t *);
 extern icondict_entry_t *icondict_find(icondict_t *, const char *);
+extern gfx_bmp_t *icondict_entry_bmp(icondict_entry_t *);
+extern void icondict_set_max_decoded(icondict_t *, unsigned);
 extern int icondict_load(FILE *, icondict_t **);
 extern int icondict_save(icondict_t *, FILE *);
 
@@ -0,0 +1,529 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Change journal
+ *
+ * The journal records changes made to the workspace since the last
+ * snapshot (karlik.dat) as text records. Each record starts with a line
+ * containing the record type and its arguments and ends with a line
+ * containing a single period. A record that was not completely written
+ * (e.g. due to a crash) is ignored during replay, as is anything after it.
+ *
+ * The first line of the journal contains the generation number of the
+ * snapshot the journal applies to.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "icon.h"
+#include "icondict.h"
+#include "journal.h"
+#include "map.h"
+#include "prog.h"
+#include "robot.h"
+#include "robots.h"
+
+/** Create change journal.
+ *
+ * Creates or truncates the journal file.
+ *
+ * @param fname File name
+ * @param gen Generation number of the snapshot the journal applies to
+ * @param rjournal Place to store pointer to new journal
+ * @return Zero on success or an error code
+ */
+int journal_create(const char *fname, unsigned long gen,
+    journal_t **rjournal)
+{
+	journal_t *journal;
+	int rv;
+
+	journal = calloc(1, sizeof(journal_t));
+	if (journal == NULL)
+		return ENOMEM;
+
+	journal->f = fopen(fname, "w");
+	if (journal->f == NULL) {
+		free(journal);
+		return EIO;
+	}
+
+	rv = fprintf(journal->f, "%lu\n", gen);
+	if (rv < 0) {
+		(void) fclose(journal->f);
+		free(journal);
+		return EIO;
+	}
+
+	*rjournal = journal;
+	return 0;
+}
+
+/** Sync and close change journal.
+ *
+ * @param journal Journal
+ * @return Zero on success or an error code
+ */
+int journal_destroy(journal_t *journal)
+{
+	int rc;
+
+	rc = journal_sync(journal);
+	if (fclose(journal->f) < 0 && rc == 0)
+		rc = EIO;
+
+	free(journal);
+	return rc;
+}
+
+/** Write out buffered journal records to stable storage.
+ *
+ * @param journal Journal
+ * @return Zero on success or an error code
+ */
+int journal_sync(journal_t *journal)
+{
+	if (journal->error != 0)
+		return journal->error;
+
+	if (fflush(journal->f) < 0 || fsync(fileno(journal->f)) < 0)
+		journal->error = EIO;
+
+	return journal->error;
+}
+
+/** Finish writing journal record.
+ *
+ * @param journal Journal
+ * @param rc Zero if the record body was written successfully or an error
+ *           code
+ */
+static void journal_rec_end(journal_t *journal, int rc)
+{
+	if (rc == 0 && fputs(".\n", journal->f) < 0)
+		rc = EIO;
+
+	if (rc != 0) {
+		if (journal->error == 0)
+			journal->error = rc;
+		return;
+	}
+
+	++journal->nrecs;
+}
+
+/** Record change of map tile.
+ *
+ * @param journal Journal
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ * @param ttype New tile type
+ */
+void journal_map_set(journal_t *journal, int x, int y, map_tile_t ttype)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "m %d %d %d\n", x, y, (int)ttype);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record change of a run of map tiles in one column.
+ *
+ * @param journal Journal
+ * @param x X tile coordinate
+ * @param y0 Y coordinate of first tile
+ * @param y1 Y coordinate of last tile
+ * @param ttype New tile type
+ */
+void journal_map_set_col(journal_t *journal, int x, int y0, int y1,
+    map_tile_t ttype)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "c %d %d %d %d\n", x, y0, y1, (int)ttype);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record addition of robot.
+ *
+ * @param journal Journal
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ */
+void journal_robot_add(journal_t *journal, int x, int y)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "a %d %d\n", x, y);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record removal of robot.
+ *
+ * @param journal Journal
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ */
+void journal_robot_remove(journal_t *journal, int x, int y)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "d %d %d\n", x, y);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record robot movement.
+ *
+ * @param journal Journal
+ * @param x Original X tile coordinate
+ * @param y Original Y tile coordinate
+ * @param dx X coordinate change
+ * @param dy Y coordinate change
+ */
+void journal_robot_move(journal_t *journal, int x, int y, int dx, int dy)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "r %d %d %d %d\n", x, y, dx, dy);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record robot turning left.
+ *
+ * @param journal Journal
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ */
+void journal_robot_turn_left(journal_t *journal, int x, int y)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "t %d %d\n", x, y);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Record appending procedure to module.
+ *
+ * @param journal Journal
+ * @param proc Procedure
+ */
+void journal_proc_append(journal_t *journal, prog_proc_t *proc)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "p\n");
+	if (rv < 0) {
+		journal_rec_end(journal, EIO);
+		return;
+	}
+
+	journal_rec_end(journal, prog_proc_save(proc, journal->f));
+}
+
+/** Record deleting procedure from module.
+ *
+ * @param journal Journal
+ * @param proc Procedure
+ */
+void journal_proc_delete(journal_t *journal, prog_proc_t *proc)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "x\n");
+	if (rv < 0) {
+		journal_rec_end(journal, EIO);
+		return;
+	}
+
+	journal_rec_end(journal, prog_proc_save_ident(proc->ident,
+	    journal->f));
+}
+
+/** Record changing procedure body.
+ *
+ * The whole procedure is recorded.
+ *
+ * @param journal Journal
+ * @param proc Procedure
+ */
+void journal_proc_body(journal_t *journal, prog_proc_t *proc)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "b\n");
+	if (rv < 0) {
+		journal_rec_end(journal, EIO);
+		return;
+	}
+
+	journal_rec_end(journal, prog_proc_save(proc, journal->f));
+}
+
+/** Record adding icon to icon dictionary.
+ *
+ * @param journal Journal
+ * @param ident Identifier
+ * @param w Icon width
+ * @param h Icon height
+ * @param pixels Packed icon pixels
+ */
+void journal_icon_add(journal_t *journal, const char *ident, int w, int h,
+    const uint8_t *pixels)
+{
+	int rv;
+	int rc;
+
+	rv = fprintf(journal->f, "i\n");
+	if (rv < 0) {
+		journal_rec_end(journal, EIO);
+		return;
+	}
+
+	rc = prog_proc_save_ident(ident, journal->f);
+	if (rc == 0)
+		rc = icon_save_rgb(w, h, pixels, journal->f);
+
+	journal_rec_end(journal, rc);
+}
+
+/** Record change of application mode.
+ *
+ * @param journal Journal
+ * @param mode New mode
+ */
+void journal_mode(journal_t *journal, int mode)
+{
+	int rv;
+
+	rv = fprintf(journal->f, "k %d\n", mode);
+	journal_rec_end(journal, rv < 0 ? EIO : 0);
+}
+
+/** Read end of journal record.
+ *
+ * @param f File
+ * @return @c true iff the record was terminated properly
+ */
+static bool journal_rec_complete(FILE *f)
+{
+	char buf[3];
+
+	if (fgets(buf, sizeof(buf), f) == NULL)
+		return false;
+
+	return strcmp(buf, ".\n") == 0;
+}
+
+/** Replay change journal.
+ *
+ * Applies records from the journal to the workspace. Robots affected
+ * by the journal are stopped, since their execution state is not
+ * journaled.
+ *
+ * @param fname File name
+ * @param gen Generation number of the snapshot that was loaded
+ * @param map Map
+ * @param robots Robots
+ * @param prog Program module
+ * @param icondict Icon dictionary
+ * @param mode Application mode, updated by the journal
+ * @return Zero on success, ENOENT if there is no journal for
+ *         generation @a gen, ENOMEM if out of memory
+ */
+int journal_replay(const char *fname, unsigned long gen, map_t *map,
+    robots_t *robots, prog_module_t *prog, icondict_t *icondict, int *mode)
+{
+	FILE *f;
+	unsigned long fgen;
+	char ident[prog_proc_id_len + 1];
+	prog_proc_t *proc;
+	prog_proc_t *oproc;
+	icon_t *icon;
+	robot_t *robot;
+	int x, y, dx, dy;
+	int val;
+	int nitem;
+	int rtype;
+	int rc = 0;
+
+	f = fopen(fname, "r");
+	if (f == NULL)
+		return ENOENT;
+
+	nitem = fscanf(f, "%lu\n", &fgen);
+	if (nitem != 1 || fgen != gen) {
+		(void) fclose(f);
+		return ENOENT;
+	}
+
+	while (true) {
+		rtype = fgetc(f);
+		if (rtype == EOF)
+			break;
+
+		switch (rtype) {
+		case 'm':
+			nitem = fscanf(f, " %d %d %d\n", &x, &y, &val);
+			if (nitem != 3 || !journal_rec_complete(f))
+				goto done;
+			if (x < 0 || y < 0 || x >= map->width ||
+			    y >= map->height || val < 0 || val > mapt_robot)
+				goto done;
+			map_set(map, x, y, (map_tile_t)val);
+			break;
+		case 'c':
+			nitem = fscanf(f, " %d %d %d %d\n", &x, &y, &dy, &val);
+			if (nitem != 4 || !journal_rec_complete(f))
+				goto done;
+			if (x < 0 || y < 0 || x >= map->width || y > dy ||
+			    dy >= map->height || val < 0 || val > mapt_robot)
+				goto done;
+			map_set_col(map, x, y, dy, (map_tile_t)val);
+			break;
+		case 'a':
+			nitem = fscanf(f, " %d %d\n", &x, &y);
+			if (nitem != 2 || !journal_rec_complete(f))
+				goto done;
+			rc = robots_add(robots, x, y);
+			if (rc == ENOMEM)
+				goto done;
+			rc = 0;
+			break;
+		case 'd':
+			nitem = fscanf(f, " %d %d\n", &x, &y);
+			if (nitem != 2 || !journal_rec_complete(f))
+				goto done;
+			robots_remove(robots, x, y);
+			break;
+		case 'r':
+			nitem = fscanf(f, " %d %d %d %d\n", &x, &y, &dx, &dy);
+			if (nitem != 4 || !journal_rec_complete(f))
+				goto done;
+			robot = robots_get(robots, x, y);
+			if (robot == NULL)
+				goto done;
+			robot_reset(robot);
+			robots_move_robot(robots, robot, dx, dy);
+			break;
+		case 't':
+			nitem = fscanf(f, " %d %d\n", &x, &y);
+			if (nitem != 2 || !journal_rec_complete(f))
+				goto done;
+			robot = robots_get(robots, x, y);
+			if (robot == NULL)
+				goto done;
+			robot_reset(robot);
+			robot_turn_left(robot);
+			break;
+		case 'p':
+			if (fgetc(f) != '\n')
+				goto done;
+			rc = prog_proc_load(prog, f, &proc);
+			if (rc != 0) {
+				rc = rc == ENOMEM ? rc : 0;
+				goto done;
+			}
+			if (!journal_rec_complete(f)) {
+				prog_proc_destroy(proc);
+				goto done;
+			}
+			rc = prog_module_append(prog, proc);
+			if (rc != 0) {
+				prog_proc_destroy(proc);
+				if (rc == ENOMEM)
+					goto done;
+				rc = 0;
+			}
+			break;
+		case 'b':
+			if (fgetc(f) != '\n')
+				goto done;
+			rc = prog_proc_load(prog, f, &proc);
+			if (rc != 0) {
+				rc = rc == ENOMEM ? rc : 0;
+				goto done;
+			}
+			if (!journal_rec_complete(f)) {
+				prog_proc_destroy(proc);
+				goto done;
+			}
+			oproc = prog_module_proc_by_ident(prog, proc->ident);
+			if (oproc != NULL &&
+			    prog_proc_set_body(oproc, proc->body) == 0)
+				proc->body = NULL;
+			prog_proc_destroy(proc);
+			break;
+		case 'x':
+			if (fgetc(f) != '\n')
+				goto done;
+			if (prog_proc_load_ident(f, ident) != 0 ||
+			    !journal_rec_complete(f))
+				goto done;
+			proc = prog_module_proc_by_ident(prog, ident);
+			if (proc != NULL)
+				(void) prog_module_delete_proc(proc);
+			break;
+		case 'i':
+			if (fgetc(f) != '\n')
+				goto done;
+			if (prog_proc_load_ident(f, ident) != 0)
+				goto done;
+			rc = icon_load(f, &icon);
+			if (rc != 0) {
+				rc = rc == ENOMEM ? rc : 0;
+				goto done;
+			}
+			if (!journal_rec_complete(f)) {
+				icon_destroy(icon);
+				goto done;
+			}
+			if (icondict_find(icondict, ident) != NULL) {
+				icon_destroy(icon);
+				break;
+			}
+			rc = icondict_add(icondict, ident, icon);
+			if (rc != 0) {
+				icon_destroy(icon);
+				goto done;
+			}
+			break;
+		case 'k':
+			nitem = fscanf(f, " %d\n", &val);
+			if (nitem != 1 || !journal_rec_complete(f))
+				goto done;
+			*mode = val;
+			break;
+		default:
+			/* Damaged record */
+			goto done;
+		}
+	}
+
+done:
+	(void) fclose(f);
+	return rc;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "icon.h"
+#include "icondict.h"
+#include "map.h"
+#include "prog.h"
+#include "robots.h"
+
+/** Change journal */
+typedef struct journal {
+	/** Journal file */
+	FILE *f;
+	/** Number of records written */
+	unsigned long nrecs;
+	/** First error that occurred while writing or zero */
+	int error;
+} journal_t;
+
+extern int journal_create(const char *, unsigned long, journal_t **);
+extern int journal_destroy(journal_t *);
+extern int journal_sync(journal_t *);
+extern int journal_replay(const char *, unsigned long, map_t *, robots_t *,
+    prog_module_t *, icondict_t *, int *);
+extern void journal_map_set(journal_t *, int, int, map_tile_t);
+extern void journal_map_set_col(journal_t *, int, int, int, map_tile_t);
+extern void journal_robot_add(journal_t *, int, int);
+extern void journal_robot_remove(journal_t *, int, int);
+extern void journal_robot_move(journal_t *, int, int, int, int);
+extern void journal_robot_turn_left(journal_t *, int, int);
+extern void journal_proc_append(journal_t *, prog_proc_t *);
+extern void journal_proc_delete(journal_t *, prog_proc_t *);
+extern void journal_proc_body(journal_t *, prog_proc_t *);
+extern void journal_icon_add(journal_t *, const char *, int, int,
+    const uint8_t *);
+extern void journal_mode(journal_t *, int);
+
+#endif
@@ -28,9 +28,15 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include <SDL.h>
+#include "bgsave.h"
 #include "gfx.h"
+#include "journal.h"
 #include "karlik.h"
+#include "levelpack.h"
 #include "mapedit.h"
 #include "prog.h"
 #include "toolbar.h"
@@ -65,6 +71,15 @@ enum {
 	robot_def_y = 4
 };
 
+enum {
+	/** Interval between writing out journal records (milliseconds) */
+	karlik_autosave_interval = 5000,
+	/** Number of journal records after which a snapshot is taken */
+	karlik_compact_recs = 10000,
+	/** Size of buffer for journal file name */
+	karlik_jnl_fname_size = 32
+};
+
 /** Robot image file names */
 static const char *robots_files[] = {
 	"img/robot/east.bmp",
@@ -113,41 +128,41 @@ static void karlik_display(karlik_t *karlik, gfx_t *gfx)
 	}
 }
 
-/** Set up map for use (common between load and new)
+/** Set up map for use (common between load, new and entering a level)
  *
- * @param karlik Karlik
+ * @param map Map
  */
-static int karlik_map_setup(karlik_t *karlik)
+static int karlik_map_setup(map_t *map)
 {
 	int rc;
 
-	rc = map_load_tile_img(karlik->map, map_tile_files);
+	rc = map_load_tile_img(map, map_tile_files);
 	if (rc != 0)
 		return rc;
 
-	map_set_tile_size(karlik->map, 16, 16);
-	map_set_tile_margins(karlik->map, 2, 2);
+	map_set_tile_size(map, 16, 16);
+	map_set_tile_margins(map, 2, 2);
 
 	return 0;
 }
 
-/** Set up robots for use (common between load and new)
+/** Set up robots for use (common between load, new and entering a level)
  *
- * @param karlik Karlik
+ * @param robots Robots
  */
-static int karlik_robots_setup(karlik_t *karlik)
+static int karlik_robots_setup(robots_t *robots)
 {
 	int rc;
 
-	rc = robots_load_img(karlik->robots, robots_key[0], robots_key[1],
+	rc = robots_load_img(robots, robots_key[0], robots_key[1],
 	    robots_key[2], robots_files);
 	if (rc != 0) {
 		printf("Error loading robot graphics.\n");
 		return rc;
 	}
 
-	robots_set_tile_size(karlik->robots, 18, 18);
-	robots_set_rel_pos(karlik->robots, -5, -16);
+	robots_set_tile_size(robots, 18, 18);
+	robots_set_rel_pos(robots, -5, -16);
 
 	return 0;
 }
@@ -165,7 +180,7 @@ static int karlik_new(karlik_t *karlik)
 	if (rc != 0)
 		return rc;
 
-	rc = karlik_map_setup(karlik);
+	rc = karlik_map_setup(karlik->map);
 	if (rc != 0)
 		return rc;
 
@@ -177,7 +192,7 @@ static int karlik_new(karlik_t *karlik)
 	if (rc != 0)
 		return rc;
 
-	rc = karlik_robots_setup(karlik);
+	rc = karlik_robots_setup(karlik->robots);
 	if (rc != 0)
 		return rc;
 
@@ -196,6 +211,144 @@ static int karlik_new(karlik_t *karlik)
 	return 0;
 }
 
+/** Get journal file name.
+ *
+ * @param gen Generation number of snapshot the journal applies to
+ * @param fname Buffer of size karlik_jnl_fname_size for the file name
+ */
+static void karlik_jnl_fname(unsigned long gen, char *fname)
+{
+	snprintf(fname, karlik_jnl_fname_size, "karlik.jnl.%lu", gen);
+}
+
+/** Get workspace map.
+ *
+ * While in a level this is the map put aside when entering the level.
+ *
+ * @param karlik Karlik
+ * @return Workspace map
+ */
+static map_t *karlik_ws_map(karlik_t *karlik)
+{
+	return karlik->level_idx >= 0 ? karlik->ws_map : karlik->map;
+}
+
+/** Get workspace robots.
+ *
+ * While in a level these are the robots put aside when entering the level.
+ *
+ * @param karlik Karlik
+ * @return Workspace robots
+ */
+static robots_t *karlik_ws_robots(karlik_t *karlik)
+{
+	return karlik->level_idx >= 0 ? karlik->ws_robots : karlik->robots;
+}
+
+/** Attach journal to all parts of the workspace.
+ *
+ * Level map and robots are not part of the workspace and are not
+ * journaled.
+ *
+ * @param karlik Karlik
+ * @param journal Journal or @c NULL to stop journaling
+ */
+static void karlik_set_journal(karlik_t *karlik, journal_t *journal)
+{
+	if (karlik_ws_map(karlik) != NULL)
+		map_set_journal(karlik_ws_map(karlik), journal);
+	if (karlik_ws_robots(karlik) != NULL)
+		robots_set_journal(karlik_ws_robots(karlik), journal);
+	if (karlik->prog != NULL)
+		prog_module_set_journal(karlik->prog, journal);
+	if (karlik->vocabed != NULL)
+		icondict_set_journal(karlik->vocabed->icondict, journal);
+}
+
+/** Stop journaling and close journal.
+ *
+ * @param karlik Karlik
+ */
+static void karlik_close_journal(karlik_t *karlik)
+{
+	if (karlik->journal == NULL)
+		return;
+
+	karlik_set_journal(karlik, NULL);
+	if (journal_destroy(karlik->journal) != 0)
+		printf("Error writing journal.\n");
+	karlik->journal = NULL;
+}
+
+/** Start new journal.
+ *
+ * If the journal cannot be created, changes are not journaled until
+ * the next snapshot.
+ *
+ * @param karlik Karlik
+ * @param gen Generation number of snapshot the journal applies to
+ */
+static void karlik_open_journal(karlik_t *karlik, unsigned long gen)
+{
+	char fname[karlik_jnl_fname_size];
+	int rc;
+
+	karlik_close_journal(karlik);
+
+	/*
+	 * A stale journal with the next number (e.g. left over after
+	 * karlik.dat was removed) must not be mistaken for a continuation.
+	 */
+	karlik_jnl_fname(gen + 1, fname);
+	(void) unlink(fname);
+
+	karlik_jnl_fname(gen, fname);
+	rc = journal_create(fname, gen, &karlik->journal);
+	if (rc != 0) {
+		printf("Error creating journal.\n");
+		karlik->journal = NULL;
+		return;
+	}
+
+	karlik_set_journal(karlik, karlik->journal);
+}
+
+/** Remove journals made obsolete by the last snapshot.
+ *
+ * Must only be called once the last snapshot is known to be written.
+ *
+ * @param karlik Karlik
+ */
+static void karlik_prune_journals(karlik_t *karlik)
+{
+	char fname[karlik_jnl_fname_size];
+
+	while (karlik->jnl_first < karlik->snap_gen) {
+		karlik_jnl_fname(karlik->jnl_first, fname);
+		(void) unlink(fname);
+		++karlik->jnl_first;
+	}
+}
+
+/** Autosave timer handler.
+ *
+ * Writes out journal records. If the journal has grown large (or cannot
+ * be written), takes a new snapshot instead.
+ *
+ * @param arg Karlik (karlik_t *)
+ */
+static void karlik_autosave(void *arg)
+{
+	karlik_t *karlik = (karlik_t *)arg;
+
+	if (karlik->journal != NULL &&
+	    karlik->journal->nrecs < karlik_compact_recs &&
+	    journal_sync(karlik->journal) == 0)
+		return;
+
+	(void) karlik_save(karlik);
+}
+
 /** Load Karlik state.
  *
  * @param mapedit Map editor
@@ -203,10 +356,19 @@ static int karlik_new(karlik_t *karlik)
 static int karlik_load(karlik_t *karlik)
 {
 	FILE *f;
+	char fname[karlik_jnl_fname_size];
+	unsigned long gen;
 	int rc;
 	int nitem;
 	int kmode;
 
+	/* Make sure we read the latest saved state */
+	if (karlik->bgsave != NULL)
+		(void) bgsave_wait(karlik->bgsave);
+
+	/* Current journal will be replayed */
+	karlik_close_journal(karlik);
+
 	f = fopen("karlik.dat", "r");
 	if (f == NULL)
 		return EIO;
@@ -215,7 +377,7 @@ static int karlik_load(karlik_t *karlik)
 	if (rc != 0)
 		goto error;
 
-	rc = karlik_map_setup(karlik);
+	rc = karlik_map_setup(karlik->map);
 	if (rc != 0)
 		return rc;
 
@@ -227,7 +389,7 @@ static int karlik_load(karlik_t *karlik)
 	if (rc != 0)
 		return rc;
 
-	rc = karlik_robots_setup(karlik);
+	rc = karlik_robots_setup(karlik->robots);
 	if (rc != 0)
 		return rc;
 
@@ -235,10 +397,6 @@ static int karlik_load(karlik_t *karlik)
 	if (nitem != 1)
 		goto error;
 
-	printf("kmode=%d\n", kmode);
-	if (kmode >= 0 && kmode <= km_vocab)
-		karlik->kmode = kmode;
-
 	rc = mapedit_load(karlik->map, karlik->robots, f, &karlik_mapedit_cb,
 	    (void *)karlik, &karlik->mapedit);
 	if (rc != 0) {
@@ -253,7 +411,35 @@ static int karlik_load(karlik_t *karlik)
 		goto error;
 	}
 
+	/* Snapshots written before journaling was introduced lack this */
+	nitem = fscanf(f, "%lu\n", &gen);
+	if (nitem != 1)
+		gen = 0;
+
 	(void) fclose(f);
+
+	/* Replay changes made after the snapshot was taken */
+	karlik->snap_gen = gen;
+	karlik->jnl_first = gen;
+	while (true) {
+		karlik_jnl_fname(gen, fname);
+		rc = journal_replay(fname, gen, karlik->map, karlik->robots,
+		    karlik->prog, karlik->vocabed->icondict, &kmode);
+		if (rc != 0)
+			break;
+		++gen;
+	}
+
+	if (rc == ENOMEM)
+		return rc;
+
+	karlik->next_gen = gen > karlik->snap_gen ? gen :
+	    karlik->snap_gen + 1;
+
+	printf("kmode=%d\n", kmode);
+	if (kmode >= 0 && kmode <= km_vocab)
+		karlik->kmode = kmode;
+
 	return 0;
 error:
 	printf("Error loading.\n");
@@ -261,66 +447,267 @@ error:
 	return rc;
 }
 
-/** Save Karlik workspace.
+/** Serialize Karlik workspace.
  *
  * @param karlik Karlik
+ * @param gen Snapshot generation number
+ * @param f File
+ * @return Zero on success or an error code
  */
-int karlik_save(karlik_t *karlik)
+static int karlik_save_to(karlik_t *karlik, unsigned long gen, FILE *f)
 {
-	FILE *f;
 	int rc;
 	int rv;
 
-	f = fopen("karlik.dat", "w");
-	if (f == NULL)
-		return EIO;
-
-	rc = map_save(karlik->map, f);
+	/* Level map and robots are never saved over the workspace */
+	rc = map_save(karlik_ws_map(karlik), f);
 	if (rc != 0)
-		goto error;
+		return rc;
 
 	rc = prog_module_save(karlik->prog, f);
 	if (rc != 0)
-		goto error;
+		return rc;
 
-	rc = robots_save(karlik->robots, f);
+	rc = robots_save(karlik_ws_robots(karlik), f);
 	if (rc != 0)
-		goto error;
+		return rc;
 
 	rv = fprintf(f, "%d\n", karlik->kmode);
-	if (rv < 0) {
-		rc = EIO;
-		goto error;
-	}
+	if (rv < 0)
+		return EIO;
 
 	rc = mapedit_save(karlik->mapedit, f);
 	if (rc != 0) {
 		printf("Error saving map editor.\n");
-		rc = EIO;
-		goto error;
+		return EIO;
 	}
 
 	rc = vocabed_save(karlik->vocabed, f);
 	if (rc != 0) {
 		printf("Error saving vocabulary editor.\n");
+		return EIO;
+	}
+
+	rv = fprintf(f, "%lu\n", gen);
+	if (rv < 0)
+		return EIO;
+
+	return 0;
+}
+
+/** Save Karlik workspace.
+ *
+ * The workspace is serialized into memory and written to karlik.dat
+ * in the background. The file is replaced atomically. A new journal
+ * is started for changes made after this snapshot.
+ *
+ * @param karlik Karlik
+ * @return Zero on success or an error code
+ */
+int karlik_save(karlik_t *karlik)
+{
+	struct timespec start;
+	struct timespec end;
+	FILE *f;
+	char *buf = NULL;
+	size_t size;
+	unsigned long gen;
+	int rc;
+
+	/* Previous snapshot must be on disk before its journals go away */
+	if (bgsave_wait(karlik->bgsave) == 0)
+		karlik_prune_journals(karlik);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	gen = karlik->next_gen;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL)
+		return ENOMEM;
+
+	rc = karlik_save_to(karlik, gen, f);
+	if (fclose(f) < 0 && rc == 0)
 		rc = EIO;
+	if (rc != 0) {
+		free(buf);
+		return rc;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Workspace serialized in %ld us.\n",
+	    (long)(end.tv_sec - start.tv_sec) * 1000000L +
+	    (end.tv_nsec - start.tv_nsec) / 1000);
+
+	karlik->next_gen = gen + 1;
+	karlik->snap_gen = gen;
+	karlik_open_journal(karlik, gen);
+
+	return bgsave_submit(karlik->bgsave, buf, size);
+}
+
+/** Wait for Karlik workspace to be saved.
+ *
+ * @param karlik Karlik
+ * @return Zero if the workspace was saved successfully or an error code
+ */
+int karlik_save_wait(karlik_t *karlik)
+{
+	bgsave_stats_t stats;
+	int rc;
+
+	rc = bgsave_wait(karlik->bgsave);
+	if (rc == 0)
+		karlik_prune_journals(karlik);
+
+	bgsave_get_stats(karlik->bgsave, &stats);
+	printf("Saves: %lu written, %lu failed, %lu superseded, "
+	    "latency last %lu us, max %lu us.\n", stats.nsaved,
+	    stats.nfailed, stats.ndropped, stats.last_usec, stats.max_usec);
+
+	return rc;
+}
+
+/** Switch map and robots shown in the editors.
+ *
+ * @param karlik Karlik
+ * @param map New map
+ * @param robots New robots
+ */
+static void karlik_set_world(karlik_t *karlik, map_t *map, robots_t *robots)
+{
+	mapedit_set_world(karlik->mapedit, map, robots);
+	vocabed_set_world(karlik->vocabed, map, robots);
+	karlik->map = map;
+	karlik->robots = robots;
+}
+
+/** Enter level from level pack.
+ *
+ * The map and robots are replaced with those of the level, the
+ * vocabulary is kept. The workspace map and robots are put aside
+ * and keep being saved in their place, so that playing a level
+ * never overwrites them.
+ *
+ * @param karlik Karlik
+ * @param idx Level index
+ * @return Zero on success or an error code
+ */
+static int karlik_level_enter(karlik_t *karlik, int idx)
+{
+	level_t *level;
+	robots_t *robots = NULL;
+	robot_t *robot;
+	robot_t *nrobot;
+	map_t *map;
+	map_t *omap;
+	robots_t *orobots;
+	int rc;
+
+	if (karlik->levelpack == NULL)
+		return ENOENT;
+	if (idx < 0)
+		return EINVAL;
+
+	rc = levelpack_load_level(karlik->levelpack, idx, &level);
+	if (rc != 0)
+		return rc;
+
+	rc = karlik_map_setup(level->map);
+	if (rc != 0)
 		goto error;
+
+	/* Level robots run procedures from the workspace vocabulary */
+	rc = robots_create(karlik->prog, level->map, &robots);
+	if (rc != 0)
+		goto error;
+
+	rc = karlik_robots_setup(robots);
+	if (rc != 0)
+		goto error;
+
+	robot = robots_first(level->robots);
+	while (robot != NULL) {
+		rc = robots_add(robots, robot->x, robot->y);
+		if (rc != 0)
+			goto error;
+
+		nrobot = robots_get(robots, robot->x, robot->y);
+		nrobot->dir = robot->dir;
+		robot = robots_next(robot);
 	}
 
-	if (fclose(f) < 0)
-		return EIO;
+	map = level->map;
+	level->map = NULL;
+	level_destroy(level);
+
+	if (karlik->level_idx < 0) {
+		/* Put workspace world aside */
+		karlik->ws_map = karlik->map;
+		karlik->ws_robots = karlik->robots;
+		karlik_set_world(karlik, map, robots);
+	} else {
+		/* Replace previous level */
+		omap = karlik->map;
+		orobots = karlik->robots;
+		karlik_set_world(karlik, map, robots);
+		robots_destroy(orobots);
+		map_destroy(omap);
+	}
+
+	karlik->level_idx = idx;
 
+	printf("Entered level %d/%u.\n", idx + 1,
+	    levelpack_count(karlik->levelpack));
 	return 0;
 error:
-	fclose(f);
+	if (robots != NULL)
+		robots_destroy(robots);
+	level_destroy(level);
 	return rc;
 }
 
+/** Leave level and return to the workspace map and robots.
+ *
+ * @param karlik Karlik
+ */
+static void karlik_level_leave(karlik_t *karlik)
+{
+	map_t *map;
+	robots_t *robots;
+
+	if (karlik->level_idx < 0)
+		return;
+
+	map = karlik->map;
+	robots = karlik->robots;
+	karlik_set_world(karlik, karlik->ws_map, karlik->ws_robots);
+	karlik->ws_map = NULL;
+	karlik->ws_robots = NULL;
+	karlik->level_idx = -1;
+
+	robots_destroy(robots);
+	map_destroy(map);
+	printf("Left level.\n");
+}
+
 static void karlik_key_press(karlik_t *karlik, SDL_Scancode scancode)
 {
 	switch (scancode) {
+	case SDL_SCANCODE_HOME:
+		karlik_level_leave(karlik);
+		break;
+	case SDL_SCANCODE_PAGEUP:
+		if (karlik->level_idx > 0)
+			(void) karlik_level_enter(karlik, karlik->level_idx - 1);
+		break;
+	case SDL_SCANCODE_PAGEDOWN:
+		(void) karlik_level_enter(karlik, karlik->level_idx + 1);
+		break;
 	case SDL_SCANCODE_L:
-		karlik_load(karlik);
+		karlik_level_leave(karlik);
+		if (karlik_load(karlik) == 0)
+			(void) karlik_save(karlik);
 		break;
 	case SDL_SCANCODE_S:
 		karlik_save(karlik);
@@ -389,6 +776,9 @@ static void karlik_main_toolbar_cb(void *arg, int idx)
 		break;
 	}
 
+	if (karlik->journal != NULL)
+		journal_mode(karlik->journal, karlik->kmode);
+
 	karlik_display(karlik, karlik->gfx);
 	gfx_update(karlik->gfx);
 }
@@ -429,6 +819,7 @@ int karlik_create(gfx_t *gfx, karlik_t **rkarlik)
 	karlik->gfx = gfx;
 	karlik->quit = false;
 	karlik->kmode = km_vocab;
+	karlik->level_idx = -1;
 
 	rc = toolbar_create(main_tb_files, &karlik->main_tb);
 	if (rc != 0) {
@@ -439,6 +830,12 @@ int karlik_create(gfx_t *gfx, karlik_t **rkarlik)
 	toolbar_set_origin(karlik->main_tb, 4, 4);
 	toolbar_set_cb(karlik->main_tb, karlik_main_toolbar_cb, karlik);
 
+	rc = bgsave_create("karlik.dat", &karlik->bgsave);
+	if (rc != 0) {
+		printf("Error creating background writer.\n");
+		goto error;
+	}
+
 	rc = karlik_load(karlik);
 	if (rc != 0) {
 		rc = karlik_new(karlik);
@@ -446,6 +843,22 @@ int karlik_create(gfx_t *gfx, karlik_t **rkarlik)
 			goto error;
 	}
 
+	rc = levelpack_open("karlik.lpk", &karlik->levelpack);
+	if (rc != 0 && rc != ENOENT)
+		printf("Error opening level pack.\n");
+
+	/* Start journaling changes */
+	rc = karlik_save(karlik);
+	if (rc != 0)
+		goto error;
+
+	rc = gfx_timer_create(karlik_autosave_interval, karlik_autosave,
+	    karlik, &karlik->autosave_timer);
+	if (rc != 0)
+		goto error;
+
+	gfx_timer_start(karlik->autosave_timer);
+
 	printf("kmode=%d\n", karlik->kmode);
 	toolbar_select(karlik->main_tb,
 	    karlik_mode_to_toolbar_idx(karlik->kmode));
@@ -468,6 +881,7 @@ void karlik_destroy(karlik_t *karlik)
 {
 	if (karlik->main_tb != NULL)
 		toolbar_destroy(karlik->main_tb);
+	karlik_level_leave(karlik);
 	if (karlik->map != NULL)
 		map_destroy(karlik->map);
 	if (karlik->prog != NULL)
@@ -476,5 +890,12 @@ void karlik_destroy(karlik_t *karlik)
 		mapedit_destroy(karlik->mapedit);
 	if (karlik->vocabed != NULL)
 		vocabed_destroy(karlik->vocabed);
+	if (karlik->autosave_timer != NULL)
+		gfx_timer_destroy(karlik->autosave_timer);
+	karlik_close_journal(karlik);
+	if (karlik->bgsave != NULL)
+		bgsave_destroy(karlik->bgsave);
+	if (karlik->levelpack != NULL)
+		levelpack_close(karlik->levelpack);
 	free(karlik);
 }
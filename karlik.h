@@ -25,7 +25,10 @@
 
 #include <SDL.h>
 #include <stdbool.h>
+#include "bgsave.h"
 #include "gfx.h"
+#include "journal.h"
+#include "levelpack.h"
 #include "mapedit.h"
 #include "prog.h"
 #include "robots.h"
@@ -60,11 +63,32 @@ typedef struct {
 	prog_module_t *prog;
 	/** Vocabulary editor */
 	vocabed_t *vocabed;
+	/** Background writer for saved workspace */
+	bgsave_t *bgsave;
+	/** Journal of changes since the last snapshot or @c NULL */
+	journal_t *journal;
+	/** Generation number of the last snapshot */
+	unsigned long snap_gen;
+	/** Next generation number to use */
+	unsigned long next_gen;
+	/** Lowest generation number of journal that may still exist */
+	unsigned long jnl_first;
+	/** Autosave timer */
+	gfx_timer_t *autosave_timer;
+	/** Level pack or @c NULL */
+	levelpack_t *levelpack;
+	/** Index of current level in level pack or -1 if not in a level */
+	int level_idx;
+	/** Workspace map put aside while in a level or @c NULL */
+	map_t *ws_map;
+	/** Workspace robots put aside while in a level or @c NULL */
+	robots_t *ws_robots;
 } karlik_t;
 
 extern int karlik_create(gfx_t *, karlik_t **);
 extern void karlik_destroy(karlik_t *);
 extern int karlik_save(karlik_t *);
+extern int karlik_save_wait(karlik_t *);
 extern void karlik_event(karlik_t *, SDL_Event *, gfx_t *);
 
 #endif
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Level pack
+ *
+ * A level pack starts with an index giving the offset and size of each
+ * level relative to the start of the data area, which immediately
+ * follows the index. A level is loaded by seeking to its offset, so
+ * the cost does not depend on the number or size of the other levels.
+ *
+ * Each level consists of a map, a program module with starter
+ * procedures, robots and optionally a goal map.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bgsave.h"
+#include "levelpack.h"
+#include "map.h"
+#include "prog.h"
+#include "robots.h"
+
+/** Destroy level.
+ *
+ * @param level Level
+ */
+void level_destroy(level_t *level)
+{
+	if (level->robots != NULL)
+		robots_destroy(level->robots);
+	if (level->prog != NULL)
+		prog_module_destroy(level->prog);
+	if (level->map != NULL)
+		map_destroy(level->map);
+	if (level->goal != NULL)
+		map_destroy(level->goal);
+	free(level);
+}
+
+/** Open level pack.
+ *
+ * Only the index is read.
+ *
+ * @param fname File name
+ * @param rpack Place to store pointer to level pack
+ * @return Zero on success, ENOENT if the file does not exist, EIO if
+ *         the file is malformed, ENOMEM if out of memory
+ */
+int levelpack_open(const char *fname, levelpack_t **rpack)
+{
+	levelpack_t *pack;
+	unsigned i;
+	int nitem;
+	int rc;
+
+	pack = calloc(1, sizeof(levelpack_t));
+	if (pack == NULL)
+		return ENOMEM;
+
+	pack->f = fopen(fname, "r");
+	if (pack->f == NULL) {
+		rc = ENOENT;
+		goto error;
+	}
+
+	nitem = fscanf(pack->f, "%u", &pack->nlevels);
+	if (nitem != 1 || fgetc(pack->f) != '\n') {
+		rc = EIO;
+		goto error;
+	}
+
+	if (pack->nlevels > 0) {
+		pack->index = calloc(pack->nlevels, sizeof(levelpack_entry_t));
+		if (pack->index == NULL) {
+			rc = ENOMEM;
+			goto error;
+		}
+	}
+
+	for (i = 0; i < pack->nlevels; i++) {
+		nitem = fscanf(pack->f, "%ld %ld", &pack->index[i].offset,
+		    &pack->index[i].size);
+		if (nitem != 2 || fgetc(pack->f) != '\n' ||
+		    pack->index[i].offset < 0 || pack->index[i].size < 0) {
+			rc = EIO;
+			goto error;
+		}
+	}
+
+	pack->base = ftell(pack->f);
+	if (pack->base < 0) {
+		rc = EIO;
+		goto error;
+	}
+
+	*rpack = pack;
+	return 0;
+error:
+	levelpack_close(pack);
+	return rc;
+}
+
+/** Close level pack.
+ *
+ * @param pack Level pack
+ */
+void levelpack_close(levelpack_t *pack)
+{
+	if (pack->f != NULL)
+		(void) fclose(pack->f);
+	free(pack->index);
+	free(pack);
+}
+
+/** Get number of levels in level pack.
+ *
+ * @param pack Level pack
+ * @return Number of levels
+ */
+unsigned levelpack_count(levelpack_t *pack)
+{
+	return pack->nlevels;
+}
+
+/** Load level from level pack.
+ *
+ * Levels can be loaded in any order. Loading levels in order of
+ * increasing index reads the file sequentially.
+ *
+ * @param pack Level pack
+ * @param idx Level index
+ * @param rlevel Place to store pointer to new level
+ * @return Zero on success, EINVAL if @a idx is out of range, EIO if
+ *         level data is malformed, ENOMEM if out of memory
+ */
+int levelpack_load_level(levelpack_t *pack, unsigned idx, level_t **rlevel)
+{
+	levelpack_entry_t *entry;
+	level_t *level;
+	long end;
+	int has_goal;
+	int nitem;
+	int rc;
+
+	if (idx >= pack->nlevels)
+		return EINVAL;
+
+	entry = &pack->index[idx];
+	if (fseek(pack->f, pack->base + entry->offset, SEEK_SET) < 0)
+		return EIO;
+
+	level = calloc(1, sizeof(level_t));
+	if (level == NULL)
+		return ENOMEM;
+
+	rc = map_load(pack->f, &level->map);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_module_load(pack->f, &level->prog);
+	if (rc != 0)
+		goto error;
+
+	rc = robots_load(pack->f, level->prog, level->map, &level->robots);
+	if (rc != 0)
+		goto error;
+
+	nitem = fscanf(pack->f, "%d", &has_goal);
+	if (nitem != 1 || fgetc(pack->f) != '\n') {
+		rc = EIO;
+		goto error;
+	}
+
+	if (has_goal) {
+		rc = map_load(pack->f, &level->goal);
+		if (rc != 0)
+			goto error;
+	}
+
+	/* Level must not extend past its index entry */
+	end = ftell(pack->f);
+	if (end < 0 || end > pack->base + entry->offset + entry->size) {
+		rc = EIO;
+		goto error;
+	}
+
+	*rlevel = level;
+	return 0;
+error:
+	level_destroy(level);
+	return rc;
+}
+
+/** Create level pack writer.
+ *
+ * Levels are accumulated in memory and the pack file is written
+ * by levelpack_wr_close().
+ *
+ * @param fname Destination file name
+ * @param rwr Place to store pointer to new level pack writer
+ * @return Zero on success or an error code
+ */
+int levelpack_wr_create(const char *fname, levelpack_wr_t **rwr)
+{
+	levelpack_wr_t *wr;
+
+	wr = calloc(1, sizeof(levelpack_wr_t));
+	if (wr == NULL)
+		return ENOMEM;
+
+	wr->fname = strdup(fname);
+	if (wr->fname == NULL)
+		goto error;
+
+	wr->data = open_memstream(&wr->dbuf, &wr->dsize);
+	if (wr->data == NULL)
+		goto error;
+
+	*rwr = wr;
+	return 0;
+error:
+	free(wr->fname);
+	free(wr);
+	return ENOMEM;
+}
+
+/** Add level to level pack.
+ *
+ * @param wr Level pack writer
+ * @param map Map
+ * @param prog Starter procedures
+ * @param robots Robots
+ * @param goal Goal map or @c NULL
+ * @return Zero on success or an error code
+ */
+int levelpack_wr_add(levelpack_wr_t *wr, map_t *map, prog_module_t *prog,
+    robots_t *robots, map_t *goal)
+{
+	levelpack_entry_t *nindex;
+	long start;
+	long end;
+	int rv;
+	int rc;
+
+	if (wr->error != 0)
+		return wr->error;
+
+	nindex = realloc(wr->index, (wr->nlevels + 1) *
+	    sizeof(levelpack_entry_t));
+	if (nindex == NULL)
+		return ENOMEM;
+	wr->index = nindex;
+
+	start = ftell(wr->data);
+	if (start < 0) {
+		rc = EIO;
+		goto error;
+	}
+
+	rc = map_save(map, wr->data);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_module_save(prog, wr->data);
+	if (rc != 0)
+		goto error;
+
+	rc = robots_save(robots, wr->data);
+	if (rc != 0)
+		goto error;
+
+	rv = fprintf(wr->data, "%d\n", goal != NULL ? 1 : 0);
+	if (rv < 0) {
+		rc = EIO;
+		goto error;
+	}
+
+	if (goal != NULL) {
+		rc = map_save(goal, wr->data);
+		if (rc != 0)
+			goto error;
+	}
+
+	end = ftell(wr->data);
+	if (end < 0) {
+		rc = EIO;
+		goto error;
+	}
+
+	wr->index[wr->nlevels].offset = start;
+	wr->index[wr->nlevels].size = end - start;
+	++wr->nlevels;
+	return 0;
+error:
+	/* Partially written level data cannot be taken back */
+	wr->error = rc;
+	return rc;
+}
+
+/** Write level pack and destroy level pack writer.
+ *
+ * The pack file is replaced atomically.
+ *
+ * @param wr Level pack writer
+ * @return Zero on success or an error code
+ */
+int levelpack_wr_close(levelpack_wr_t *wr)
+{
+	bgsave_t *bgsave = NULL;
+	FILE *f;
+	char *buf = NULL;
+	size_t size;
+	unsigned i;
+	int rc;
+
+	rc = wr->error;
+	if (fclose(wr->data) < 0 && rc == 0)
+		rc = EIO;
+	wr->data = NULL;
+	if (rc != 0)
+		goto out;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	if (fprintf(f, "%u\n", wr->nlevels) < 0)
+		rc = EIO;
+
+	for (i = 0; i < wr->nlevels && rc == 0; i++) {
+		if (fprintf(f, "%ld %ld\n", wr->index[i].offset,
+		    wr->index[i].size) < 0)
+			rc = EIO;
+	}
+
+	if (rc == 0 && fwrite(wr->dbuf, 1, wr->dsize, f) != wr->dsize)
+		rc = EIO;
+
+	if (fclose(f) < 0 && rc == 0)
+		rc = EIO;
+	if (rc != 0)
+		goto out;
+
+	rc = bgsave_create(wr->fname, &bgsave);
+	if (rc != 0)
+		goto out;
+
+	rc = bgsave_submit(bgsave, buf, size);
+	buf = NULL;
+	if (rc == 0)
+		rc = bgsave_wait(bgsave);
+	bgsave_destroy(bgsave);
+out:
+	free(buf);
+	levelpack_wr_abort(wr);
+	return rc;
+}
+
+/** Destroy level pack writer without writing the level pack.
+ *
+ * @param wr Level pack writer
+ */
+void levelpack_wr_abort(levelpack_wr_t *wr)
+{
+	if (wr->data != NULL)
+		(void) fclose(wr->data);
+	free(wr->dbuf);
+	free(wr->index);
+	free(wr->fname);
+	free(wr);
+}
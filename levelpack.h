@@ -0,0 +1,96 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LEVELPACK_H
+#define LEVELPACK_H
+
+#include <stdio.h>
+#include "map.h"
+#include "prog.h"
+#include "robots.h"
+
+/** Level */
+typedef struct {
+	/** Map */
+	map_t *map;
+	/** Starter procedures (possibly empty) */
+	prog_module_t *prog;
+	/** Robots */
+	robots_t *robots;
+	/** Goal map or @c NULL */
+	map_t *goal;
+} level_t;
+
+/** Level pack index entry */
+typedef struct {
+	/** Offset of level data from the start of the data area */
+	long offset;
+	/** Size of level data */
+	long size;
+} levelpack_entry_t;
+
+/** Level pack
+ *
+ * A file holding many levels, with an index allowing to load any level
+ * without parsing the others.
+ */
+typedef struct {
+	/** Level pack file */
+	FILE *f;
+	/** Number of levels */
+	unsigned nlevels;
+	/** Index (array of @c nlevels entries) */
+	levelpack_entry_t *index;
+	/** File offset of the data area */
+	long base;
+} levelpack_t;
+
+/** Level pack writer */
+typedef struct {
+	/** Destination file name */
+	char *fname;
+	/** Level data */
+	FILE *data;
+	/** Level data buffer */
+	char *dbuf;
+	/** Size of level data buffer */
+	size_t dsize;
+	/** Number of levels */
+	unsigned nlevels;
+	/** Index (array of @c nlevels entries) */
+	levelpack_entry_t *index;
+	/** Error that occurred while adding levels */
+	int error;
+} levelpack_wr_t;
+
+extern void level_destroy(level_t *);
+extern int levelpack_open(const char *, levelpack_t **);
+extern void levelpack_close(levelpack_t *);
+extern unsigned levelpack_count(levelpack_t *);
+extern int levelpack_load_level(levelpack_t *, unsigned, level_t **);
+extern int levelpack_wr_create(const char *, levelpack_wr_t **);
+extern int levelpack_wr_add(levelpack_wr_t *, map_t *, prog_module_t *,
+    robots_t *, map_t *);
+extern int levelpack_wr_close(levelpack_wr_t *);
+extern void levelpack_wr_abort(levelpack_wr_t *);
+
+#endif
@@ -27,12 +27,40 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <SDL.h>
+#include "batch.h"
 #include "gfx.h"
 #include "karlik.h"
 
 static void print_syntax(void)
 {
-	printf("Syntax: karlik [-f]\n");
+	printf("Syntax: karlik [-f | -b]\n");
+	printf("  -f  Full screen\n");
+	printf("  -b  Batch mode, read commands from standard input\n");
+}
+
+/** Run in batch mode.
+ *
+ * Commands are read from standard input and replies written to
+ * standard output. No window is created.
+ *
+ * @return Zero if all commands succeeded, one otherwise
+ */
+static int main_batch(void)
+{
+	batch_t *batch;
+	unsigned long nerrors;
+	int rc;
+
+	rc = batch_create(stdout, &batch);
+	if (rc != 0) {
+		printf("Out of memory.\n");
+		return 1;
+	}
+
+	rc = batch_run(batch, stdin, &nerrors);
+	batch_destroy(batch);
+
+	return (rc != 0 || nerrors > 0) ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
@@ -47,6 +75,8 @@ int main(int argc, char *argv[])
 	if (argc >= 2) {
 		if (strcmp(argv[1], "-f") == 0) {
 			fs = true;
+		} else if (strcmp(argv[1], "-b") == 0 && argc == 2) {
+			return main_batch();
 		} else {
 			print_syntax();
 			return 1;
@@ -77,6 +107,8 @@ int main(int argc, char *argv[])
 	}
 
 	rc = karlik_save(karlik);
+	if (rc == 0)
+		rc = karlik_save_wait(karlik);
 	if (rc != 0) {
 		printf("Error saving map!\n");
 		goto error;
@@ -28,7 +28,12 @@
 #include <errno.h>
 #include <SDL.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adt/hmap.h"
 #include "gfx.h"
+#include "journal.h"
 #include "map.h"
 
 /** Create map.
@@ -50,6 +55,7 @@ int map_create(int w, int h, map_t **rmap)
 
 	map->width = w;
 	map->height = h;
+	map->count[mapt_none] = w * h;
 
 	map->tile = calloc(w, sizeof(map_tile_t *));
 	if (map->tile == NULL)
@@ -92,9 +98,41 @@ void map_destroy(map_t *map)
 	}
 
 	free(map->image);
+	bitmap_destroy(map->watch);
 	free(map);
 }
 
+/** Create copy of map contents.
+ *
+ * Only the tiles are copied. The copy has no tile images, watched tiles
+ * or journal.
+ *
+ * @param map Map
+ * @param rmap Place to store pointer to new map
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int map_clone(map_t *map, map_t **rmap)
+{
+	map_t *copy;
+	int x;
+	int rc;
+
+	rc = map_create(map->width, map->height, &copy);
+	if (rc != 0)
+		return rc;
+
+	for (x = 0; x < map->width; x++) {
+		memcpy(copy->tile[x], map->tile[x],
+		    map->height * sizeof(map_tile_t));
+	}
+
+	memcpy(copy->count, map->count, sizeof(map->count));
+	copy->hash = map->hash;
+
+	*rmap = copy;
+	return 0;
+}
+
 /** Set map tile size.
  *
  * @param w Tile width
@@ -160,6 +198,39 @@ error:
 	return EIO;
 }
 
+/** Set change journal.
+ *
+ * @param map Map
+ * @param journal Journal to record changes to or @c NULL
+ */
+void map_set_journal(map_t *map, struct journal *journal)
+{
+	map->journal = journal;
+}
+
+/** Compute hash contribution of a map tile.
+ *
+ * The map hash is the sum of contributions of all tiles, so that it can
+ * be updated in constant time when a tile changes. Empty tiles do not
+ * contribute, the hash of an empty map is zero.
+ *
+ * @param map Map
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ * @param ttype Tile type
+ * @return Hash contribution
+ */
+static uint64_t map_tile_hash(map_t *map, int x, int y, map_tile_t ttype)
+{
+	uint64_t idx;
+
+	if (ttype == mapt_none)
+		return 0;
+
+	idx = (uint64_t)y * map->width + x;
+	return hmap_hash_int(idx * mapt_limit + ttype);
+}
+
 /** Set map tile.
  *
  * @param map Map
@@ -174,9 +245,66 @@ void map_set(map_t *map, int x, int y, map_tile_t ttype)
 	assert(x < map->width);
 	assert(y < map->height);
 
+	if (map->watch != NULL && map->tile[x][y] != ttype &&
+	    bitmap_get(map->watch, y * map->width + x))
+		map->watch_hit = true;
+
+	if (map->journal != NULL && map->tile[x][y] != ttype)
+		journal_map_set(map->journal, x, y, ttype);
+
+	--map->count[map->tile[x][y]];
+	++map->count[ttype];
+	map->hash += map_tile_hash(map, x, y, ttype) -
+	    map_tile_hash(map, x, y, map->tile[x][y]);
+
 	map->tile[x][y] = ttype;
 }
 
+/** Set a run of map tiles in one column.
+ *
+ * Same as calling map_set() on each tile, but the change is journaled
+ * as a single record.
+ *
+ * @param map Map
+ * @param x X tile coordinate
+ * @param y0 Y coordinate of first tile
+ * @param y1 Y coordinate of last tile (at least @a y0)
+ * @param ttype Tile type
+ */
+void map_set_col(map_t *map, int x, int y0, int y1, map_tile_t ttype)
+{
+	map_tile_t *col;
+	map_tile_t oldt;
+	int y;
+
+	assert(x >= 0);
+	assert(y0 >= 0);
+	assert(x < map->width);
+	assert(y1 < map->height);
+	assert(y0 <= y1);
+
+	if (map->journal != NULL)
+		journal_map_set_col(map->journal, x, y0, y1, ttype);
+
+	col = map->tile[x];
+	for (y = y0; y <= y1; y++) {
+		oldt = col[y];
+		if (oldt == ttype)
+			continue;
+
+		if (map->watch != NULL &&
+		    bitmap_get(map->watch, y * map->width + x))
+			map->watch_hit = true;
+
+		--map->count[oldt];
+		++map->count[ttype];
+		map->hash += map_tile_hash(map, x, y, ttype) -
+		    map_tile_hash(map, x, y, oldt);
+
+		col[y] = ttype;
+	}
+}
+
 /** Get map tile.
  *
  * Get map tile contents. If the coordinates lie outside of the map,
@@ -194,6 +322,60 @@ map_tile_t map_get(map_t *map, int x, int y)
 	return map->tile[x][y];
 }
 
+/** Set or clear watchpoint on map tile.
+ *
+ * When a watched tile changes, @c watch_hit is set.
+ *
+ * @param map Map
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param watch @c true to watch tile, @c false to stop watching it
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int map_watch_set(map_t *map, int x, int y, bool watch)
+{
+	int rc;
+
+	assert(x >= 0);
+	assert(y >= 0);
+	assert(x < map->width);
+	assert(y < map->height);
+
+	if (map->watch == NULL) {
+		if (!watch)
+			return 0;
+
+		rc = bitmap_create(map->width * map->height, &map->watch);
+		if (rc != 0)
+			return rc;
+	}
+
+	bitmap_set(map->watch, y * map->width + x, watch);
+
+	/* Without watchpoints, changing tiles costs nothing extra */
+	if (bitmap_count(map->watch) == 0) {
+		bitmap_destroy(map->watch);
+		map->watch = NULL;
+	}
+
+	return 0;
+}
+
+/** Determine if map tile is watched.
+ *
+ * @param map Map
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @return @c true iff tile is watched
+ */
+bool map_watch_get(map_t *map, int x, int y)
+{
+	if (map->watch == NULL)
+		return false;
+
+	return bitmap_get(map->watch, y * map->width + x);
+}
+
 /** Load map from file.
  *
  * @param f File
@@ -210,7 +392,8 @@ int map_load(FILE *f, map_t **rmap)
 	int rc;
 
 	nitem = fscanf(f, "%d %d\n\n", &w, &h);
-	if (nitem != 2)
+	if (nitem != 2 || w <= 0 || h <= 0 || w > map_max_dim ||
+	    h > map_max_dim)
 		return EIO;
 
 	rc = map_create(w, h, &map);
@@ -263,6 +446,135 @@ int map_save(map_t *map, FILE *f)
 	return 0;
 }
 
+/** Get number of tiles of a particular type.
+ *
+ * @param map Map
+ * @param ttype Tile type
+ * @return Number of tiles of type @a ttype
+ */
+unsigned map_count(map_t *map, map_tile_t ttype)
+{
+	return map->count[ttype];
+}
+
+/** Get hash of map contents.
+ *
+ * Maps with equal contents have equal hashes.
+ *
+ * @param map Map
+ * @return Hash
+ */
+uint64_t map_hash(map_t *map)
+{
+	return map->hash;
+}
+
+/** Determine if maps could be equal, looking only at summary data.
+ *
+ * @param a First map
+ * @param b Second map
+ * @return @c false if maps are known to differ
+ */
+static bool map_maybe_equal(map_t *a, map_t *b)
+{
+	return a->width == b->width && a->height == b->height &&
+	    a->hash == b->hash &&
+	    memcmp(a->count, b->count, sizeof(a->count)) == 0;
+}
+
+/** Determine if two maps have the same contents.
+ *
+ * Most differing maps are told apart in constant time by their tile
+ * counts and hashes. Otherwise the tiles are compared column by column.
+ *
+ * @param a First map
+ * @param b Second map
+ * @return @c true if the maps are equal
+ */
+bool map_equal(map_t *a, map_t *b)
+{
+	int x;
+
+	if (!map_maybe_equal(a, b))
+		return false;
+
+	for (x = 0; x < a->width; x++) {
+		if (memcmp(a->tile[x], b->tile[x],
+		    a->height * sizeof(map_tile_t)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+/** Compute difference between two maps of the same size.
+ *
+ * Columns that are equal are skipped using memcmp, only differing
+ * columns are examined tile by tile.
+ *
+ * @param a First map
+ * @param b Second map
+ * @param rdiff Place to store pointer to new map difference
+ * @return Zero on success, EINVAL if the maps differ in size, ENOMEM
+ *         if out of memory
+ */
+int map_diff(map_t *a, map_t *b, map_diff_t **rdiff)
+{
+	map_diff_t *diff;
+	map_diff_tile_t *ntiles;
+	size_t alloc = 0;
+	int x, y;
+
+	if (a->width != b->width || a->height != b->height)
+		return EINVAL;
+
+	diff = calloc(1, sizeof(map_diff_t));
+	if (diff == NULL)
+		return ENOMEM;
+
+	for (x = 0; x < a->width; x++) {
+		if (memcmp(a->tile[x], b->tile[x],
+		    a->height * sizeof(map_tile_t)) == 0)
+			continue;
+
+		for (y = 0; y < a->height; y++) {
+			if (a->tile[x][y] == b->tile[x][y])
+				continue;
+
+			if (diff->ntiles >= alloc) {
+				alloc = alloc > 0 ? 2 * alloc : 16;
+				ntiles = realloc(diff->tiles, alloc *
+				    sizeof(map_diff_tile_t));
+				if (ntiles == NULL) {
+					map_diff_destroy(diff);
+					return ENOMEM;
+				}
+
+				diff->tiles = ntiles;
+			}
+
+			diff->tiles[diff->ntiles].x = x;
+			diff->tiles[diff->ntiles].y = y;
+			diff->tiles[diff->ntiles].a = a->tile[x][y];
+			diff->tiles[diff->ntiles].b = b->tile[x][y];
+			++diff->ntiles;
+		}
+	}
+
+	*rdiff = diff;
+	return 0;
+}
+
+/** Destroy map difference.
+ *
+ * @param diff Map difference
+ */
+void map_diff_destroy(map_diff_t *diff)
+{
+	free(diff->tiles);
+	free(diff);
+}
+
 /** Return non-zero if robot can walk on a tile type.
  *
  * @param tile Tile type
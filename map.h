@@ -23,7 +23,10 @@
 #ifndef MAP_H
 #define MAP_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "adt/bitmap.h"
 #include "gfx.h"
 
 typedef enum {
@@ -41,6 +44,15 @@ typedef enum {
 	mapt_robot
 } map_tile_t;
 
+enum {
+	mapt_limit = mapt_robot + 1
+};
+
+enum {
+	/** Maximum map width or height accepted when loading */
+	map_max_dim = 1024
+};
+
 /** City map */
 typedef struct {
 	/** Width in tiles */
@@ -61,17 +73,57 @@ typedef struct {
 	gfx_bmp_t **image;
 	/** Number of images */
 	int nimages;
+	/** Watched tiles or @c NULL if no tile is watched */
+	bitmap_t *watch;
+	/** Has a watched tile changed? */
+	bool watch_hit;
+	/** Change journal or @c NULL */
+	struct journal *journal;
+	/** Number of tiles of each type */
+	unsigned count[mapt_limit];
+	/** Hash of tile contents, maintained by map_set() */
+	uint64_t hash;
 } map_t;
 
+/** Differing map tile */
+typedef struct {
+	/** X tile coordinate */
+	int x;
+	/** Y tile coordinate */
+	int y;
+	/** Tile in the first map */
+	map_tile_t a;
+	/** Tile in the second map */
+	map_tile_t b;
+} map_diff_tile_t;
+
+/** Map difference */
+typedef struct {
+	/** Number of differing tiles */
+	unsigned ntiles;
+	/** Differing tiles (array of @c ntiles entries) */
+	map_diff_tile_t *tiles;
+} map_diff_t;
+
 extern int map_create(int, int, map_t **);
 extern void map_destroy(map_t *);
+extern int map_clone(map_t *, map_t **);
 extern void map_set_tile_size(map_t *, int, int);
 extern void map_set_tile_margins(map_t *, int, int);
+extern void map_set_journal(map_t *, struct journal *);
 extern void map_set(map_t *, int, int, map_tile_t);
+extern void map_set_col(map_t *, int, int, int, map_tile_t);
 extern map_tile_t map_get(map_t *, int, int);
+extern int map_watch_set(map_t *, int, int, bool);
+extern bool map_watch_get(map_t *, int, int);
 extern int map_load_tile_img(map_t *, const char **);
 extern int map_load(FILE *, map_t **);
 extern int map_save(map_t *, FILE *);
+extern unsigned map_count(map_t *, map_tile_t);
+extern uint64_t map_hash(map_t *);
+extern bool map_equal(map_t *, map_t *);
+extern int map_diff(map_t *, map_t *, map_diff_t **);
+extern void map_diff_destroy(map_diff_t *);
 extern int map_tile_walkable(map_tile_t);
 extern int map_tile_tag(map_tile_t);
 
@@ -28,12 +28,16 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <SDL.h>
+#include "adt/bitmap.h"
+#include "adt/vector.h"
 #include "gfx.h"
 #include "map.h"
 #include "mapedit.h"
 #include "robots.h"
 #include "toolbar.h"
+#include "undolog.h"
 
 enum {
 	tile_xs = 16,
@@ -53,8 +57,25 @@ static const char *map_tb_files[] = {
 	NULL
 };
 
+static const char *tool_tb_files[] = {
+	"img/tool/pen.bmp",
+	"img/tool/rect.bmp",
+	"img/tool/fill.bmp",
+	NULL
+};
+
+/** Flood fill seed */
+typedef struct {
+	/** X coordinate */
+	int x;
+	/** Y coordinate */
+	int y;
+} mapedit_seed_t;
+
 static void mapedit_mapview_setup(mapedit_t *);
 static void mapedit_map_toolbar_cb(void *, int);
+static void mapedit_tool_toolbar_cb(void *, int);
+static void mapedit_fill_rect(mapedit_t *);
 static int mapedit_mapt_to_toolbar_idx(map_tile_t);
 
 /** Display Map editor.
@@ -64,8 +85,36 @@ static int mapedit_mapt_to_toolbar_idx(map_tile_t);
  */
 void mapedit_display(mapedit_t *mapedit, gfx_t *gfx)
 {
+	int x0, y0, x1, y1;
+	uint32_t color;
+	map_t *map;
+
 	mapview_draw(mapedit->mapview, gfx);
 	toolbar_draw(mapedit->map_tb, gfx);
+	toolbar_draw(mapedit->tool_tb, gfx);
+
+	if (mapedit->rect_active) {
+		/* Outline the rectangle being dragged out */
+		map = mapedit->mapview->map;
+		mapview_tile_pos(mapedit->mapview,
+		    mapedit->rect_x0 < mapedit->rect_x1 ? mapedit->rect_x0 :
+		    mapedit->rect_x1, mapedit->rect_y0 < mapedit->rect_y1 ?
+		    mapedit->rect_y0 : mapedit->rect_y1, &x0, &y0);
+		mapview_tile_pos(mapedit->mapview,
+		    mapedit->rect_x0 > mapedit->rect_x1 ? mapedit->rect_x0 :
+		    mapedit->rect_x1, mapedit->rect_y0 > mapedit->rect_y1 ?
+		    mapedit->rect_y0 : mapedit->rect_y1, &x1, &y1);
+		x0 -= 1;
+		y0 -= 1;
+		x1 += map->tile_w;
+		y1 += map->tile_h;
+
+		color = gfx_rgb(gfx, 255, 255, 0);
+		gfx_rect(gfx, x0, y0, x1 - x0 + 1, 1, color);
+		gfx_rect(gfx, x0, y1, x1 - x0 + 1, 1, color);
+		gfx_rect(gfx, x0, y0, 1, y1 - y0 + 1, color);
+		gfx_rect(gfx, x1, y0, 1, y1 - y0 + 1, color);
+	}
 }
 
 /** Request repaint.
@@ -104,6 +153,10 @@ static int mapedit_create(map_t *map, robots_t *robots, mapedit_cb_t *cb,
 
 	mapedit->robots = robots;
 
+	rc = undolog_create(map, robots, &mapedit->undolog);
+	if (rc != 0)
+		goto error;
+
 	rc = toolbar_create(map_tb_files, &mapedit->map_tb);
 	if (rc != 0) {
 		printf("Error creating toolbar.\n");
@@ -116,6 +169,16 @@ static int mapedit_create(map_t *map, robots_t *robots, mapedit_cb_t *cb,
 	toolbar_select(mapedit->map_tb,
 	    mapedit_mapt_to_toolbar_idx(mapedit->ttype));
 
+	rc = toolbar_create(tool_tb_files, &mapedit->tool_tb);
+	if (rc != 0) {
+		printf("Error creating toolbar.\n");
+		goto error;
+	}
+
+	toolbar_set_origin(mapedit->tool_tb, 136, 26);
+	toolbar_set_cb(mapedit->tool_tb, mapedit_tool_toolbar_cb, mapedit);
+	toolbar_select(mapedit->tool_tb, mapedit->tool);
+
 	mapedit->cb = cb;
 	mapedit->arg = arg;
 
@@ -230,9 +293,15 @@ int mapedit_save(mapedit_t *mapedit, FILE *f)
  */
 static void mapedit_key_press(mapedit_t *mapedit, SDL_Scancode scancode)
 {
-	(void) mapedit;
-
 	switch (scancode) {
+	case SDL_SCANCODE_Z:
+		if (undolog_undo(mapedit->undolog) == 0)
+			mapedit_repaint_req(mapedit);
+		break;
+	case SDL_SCANCODE_Y:
+		if (undolog_redo(mapedit->undolog) == 0)
+			mapedit_repaint_req(mapedit);
+		break;
 	default:
 		break;
 	}
@@ -253,6 +322,8 @@ void mapedit_event(mapedit_t *mapedit, SDL_Event *e, gfx_t *gfx)
 
 	if (toolbar_event(mapedit->map_tb, e))
 		return;
+	if (toolbar_event(mapedit->tool_tb, e))
+		return;
 
 	(void) mapview_event(mapedit->mapview, e);
 
@@ -265,6 +336,16 @@ void mapedit_event(mapedit_t *mapedit, SDL_Event *e, gfx_t *gfx)
 		me = (SDL_MouseButtonEvent *) e;
 		(void) me;
 		break;
+	case SDL_MOUSEBUTTONUP:
+		if (mapedit->rect_active) {
+			mapedit_fill_rect(mapedit);
+			mapedit->rect_active = false;
+			mapedit_repaint_req(mapedit);
+		}
+
+		/* End of stroke, do not coalesce with the next one */
+		undolog_seal(mapedit->undolog);
+		break;
 	}
 }
 
@@ -302,6 +383,30 @@ static void mapedit_map_toolbar_cb(void *arg, int idx)
 	mapedit_repaint_req(mapedit);
 }
 
+/** Tool toolbar callback.
+ *
+ * @param arg Map editor (mapedit_t *)
+ * @param idx Index of the selected entry
+ */
+static void mapedit_tool_toolbar_cb(void *arg, int idx)
+{
+	mapedit_t *mapedit = (mapedit_t *)arg;
+
+	switch (idx) {
+	case 0:
+		mapedit->tool = met_pen;
+		break;
+	case 1:
+		mapedit->tool = met_rect;
+		break;
+	case 2:
+		mapedit->tool = met_fill;
+		break;
+	}
+
+	mapedit_repaint_req(mapedit);
+}
+
 /** Get toolbar index corresponsing to map tile type.
  *
  * @param mapt Map tile type
@@ -328,33 +433,364 @@ static int mapedit_mapt_to_toolbar_idx(map_tile_t mapt)
 	return 0;
 }
 
-/** Map callback.
+/** Paint map tile with the selected tile type.
  *
- * @param arg Map editor (mapedit_t *)
+ * @param mapedit Map editor
  * @param x Tile X coordinate
  * @param y Tile Y coordinate
  */
-static void mapedit_mapview_cb(void *arg, int x, int y)
+static void mapedit_paint(mapedit_t *mapedit, int x, int y)
 {
-	mapedit_t *mapedit = (mapedit_t *)arg;
 	map_tile_t oldt;
 	robot_t *oldr;
 
-	printf("mapedit_map_cb(%d,%d)\n", x, y);
-
 	oldt = map_get(mapedit->mapview->map, x, y);
 	oldr = robots_get(mapedit->robots, x, y);
 
 	if (mapedit->ttype != mapt_robot) {
-		if (mapedit->ttype != mapt_wall || oldr == NULL)
-			map_set(mapedit->mapview->map, x, y, mapedit->ttype);
+		if (mapedit->ttype != mapt_wall || oldr == NULL) {
+			(void) undolog_map_set(mapedit->undolog, x, y,
+			    mapedit->ttype);
+		}
 	}
 
 	if (mapedit->ttype == mapt_none)
-		robots_remove(mapedit->robots, x, y);
+		(void) undolog_robot_remove(mapedit->undolog, x, y);
 
 	if (mapedit->ttype == mapt_robot && oldt != mapt_wall)
-		(void) robots_add(mapedit->robots, x, y);
+		(void) undolog_robot_add(mapedit->undolog, x, y);
+}
+
+/** Paint line of map tiles with the selected tile type.
+ *
+ * Paints every tile on the line between the two tiles, except
+ * the first one, which has already been painted.
+ *
+ * @param mapedit Map editor
+ * @param x0 X coordinate of first tile
+ * @param y0 Y coordinate of first tile
+ * @param x1 X coordinate of last tile
+ * @param y1 Y coordinate of last tile
+ */
+static void mapedit_paint_line(mapedit_t *mapedit, int x0, int y0, int x1,
+    int y1)
+{
+	int dx, dy;
+	int sx, sy;
+	int err, e2;
+
+	dx = abs(x1 - x0);
+	dy = -abs(y1 - y0);
+	sx = x0 < x1 ? 1 : -1;
+	sy = y0 < y1 ? 1 : -1;
+	err = dx + dy;
+
+	while (x0 != x1 || y0 != y1) {
+		e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			x0 += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			y0 += sy;
+		}
+
+		mapedit_paint(mapedit, x0, y0);
+	}
+}
+
+/** Get tiles occupied by robots.
+ *
+ * @param mapedit Map editor
+ * @param rocc Place to store pointer to new bitmap with bit
+ *             (x * height + y) set for each occupied tile
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int mapedit_occupied(mapedit_t *mapedit, bitmap_t **rocc)
+{
+	map_t *map = mapedit->mapview->map;
+	bitmap_t *occ;
+	robot_t *robot;
+	int rc;
+
+	rc = bitmap_create((size_t) map->width * map->height, &occ);
+	if (rc != 0)
+		return rc;
+
+	robot = robots_first(mapedit->robots);
+	while (robot != NULL) {
+		bitmap_set(occ, (size_t) robot->x * map->height + robot->y,
+		    true);
+		robot = robots_next(robot);
+	}
+
+	*rocc = occ;
+	return 0;
+}
+
+/** Fill a run of tiles in one column with the selected tile type.
+ *
+ * Follows the same rules as mapedit_paint(): walls are not placed under
+ * robots and deleting removes robots, too. Robots are not placed by
+ * area tools.
+ *
+ * @param mapedit Map editor
+ * @param occ Tiles occupied by robots (see mapedit_occupied())
+ * @param x X coordinate
+ * @param y0 Y coordinate of first tile
+ * @param y1 Y coordinate of last tile
+ */
+static void mapedit_fill_col(mapedit_t *mapedit, bitmap_t *occ, int x,
+    int y0, int y1)
+{
+	size_t base = (size_t) x * mapedit->mapview->map->height;
+	int y, ys;
+
+	switch (mapedit->ttype) {
+	case mapt_robot:
+		break;
+	case mapt_wall:
+		y = y0;
+		while (y <= y1) {
+			while (y <= y1 && bitmap_get(occ, base + y))
+				++y;
+			ys = y;
+			while (y <= y1 && !bitmap_get(occ, base + y))
+				++y;
+			if (y > ys) {
+				(void) undolog_map_set_col(mapedit->undolog,
+				    x, ys, y - 1, mapt_wall);
+			}
+		}
+		break;
+	default:
+		(void) undolog_map_set_col(mapedit->undolog, x, y0, y1,
+		    mapedit->ttype);
+		if (mapedit->ttype != mapt_none)
+			break;
+
+		for (y = y0; y <= y1; y++) {
+			if (bitmap_get(occ, base + y))
+				(void) undolog_robot_remove(mapedit->undolog,
+				    x, y);
+		}
+		break;
+	}
+}
+
+/** Fill the rectangle that has been dragged out.
+ *
+ * @param mapedit Map editor
+ */
+static void mapedit_fill_rect(mapedit_t *mapedit)
+{
+	bitmap_t *occ;
+	int x0, y0, x1, y1;
+	int x;
+
+	x0 = mapedit->rect_x0 < mapedit->rect_x1 ? mapedit->rect_x0 :
+	    mapedit->rect_x1;
+	x1 = mapedit->rect_x0 > mapedit->rect_x1 ? mapedit->rect_x0 :
+	    mapedit->rect_x1;
+	y0 = mapedit->rect_y0 < mapedit->rect_y1 ? mapedit->rect_y0 :
+	    mapedit->rect_y1;
+	y1 = mapedit->rect_y0 > mapedit->rect_y1 ? mapedit->rect_y0 :
+	    mapedit->rect_y1;
+
+	if (mapedit_occupied(mapedit, &occ) != 0)
+		return;
+
+	undolog_begin(mapedit->undolog, 0);
+	for (x = x0; x <= x1; x++)
+		mapedit_fill_col(mapedit, occ, x, y0, y1);
+
+	bitmap_destroy(occ);
+}
+
+/** Push seeds for flood fill of neighboring column.
+ *
+ * Pushes one seed for each run of unvisited tiles of type @a oldt
+ * in column @a x between @a y0 and @a y1.
+ *
+ * @param mapedit Map editor
+ * @param visited Visited tiles
+ * @param stack Seed stack
+ * @param oldt Tile type being replaced
+ * @param x X coordinate of column
+ * @param y0 Y coordinate of first tile
+ * @param y1 Y coordinate of last tile
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int mapedit_flood_seeds(mapedit_t *mapedit, bitmap_t *visited,
+    vector_t *stack, map_tile_t oldt, int x, int y0, int y1)
+{
+	map_t *map = mapedit->mapview->map;
+	size_t base = (size_t) x * map->height;
+	mapedit_seed_t seed;
+	bool in_run = false;
+	int y;
+	int rc;
+
+	if (x < 0 || x >= map->width)
+		return 0;
+
+	for (y = y0; y <= y1; y++) {
+		if (map->tile[x][y] == oldt && !bitmap_get(visited, base + y)) {
+			if (!in_run) {
+				seed.x = x;
+				seed.y = y;
+				rc = vector_append(stack, &seed);
+				if (rc != 0)
+					return rc;
+			}
+			in_run = true;
+		} else {
+			in_run = false;
+		}
+	}
+
+	return 0;
+}
+
+/** Flood fill area with the selected tile type.
+ *
+ * Fills the area of tiles with the same contents as the starting tile
+ * that can be reached from it by moving horizontally or vertically.
+ * The area is scanned by columns (which are contiguous in memory) and
+ * each run of tiles is filled in one go.
+ *
+ * @param mapedit Map editor
+ * @param x X coordinate of starting tile
+ * @param y Y coordinate of starting tile
+ */
+static void mapedit_flood_fill(mapedit_t *mapedit, int x, int y)
+{
+	map_t *map = mapedit->mapview->map;
+	map_tile_t oldt;
+	bitmap_t *occ = NULL;
+	bitmap_t *visited = NULL;
+	vector_t stack;
+	mapedit_seed_t seed;
+	size_t base;
+	int y0, y1;
+	int i;
+
+	oldt = map_get(map, x, y);
+	if (oldt == mapedit->ttype || mapedit->ttype == mapt_robot)
+		return;
+
+	vector_initialize(&stack, sizeof(mapedit_seed_t));
+
+	if (mapedit_occupied(mapedit, &occ) != 0)
+		goto out;
+	if (bitmap_create((size_t) map->width * map->height, &visited) != 0)
+		goto out;
+
+	seed.x = x;
+	seed.y = y;
+	if (vector_append(&stack, &seed) != 0)
+		goto out;
+
+	while (vector_count(&stack) > 0) {
+		seed = *(mapedit_seed_t *)vector_get(&stack,
+		    vector_count(&stack) - 1);
+		vector_remove(&stack, vector_count(&stack) - 1);
+
+		base = (size_t) seed.x * map->height;
+		if (bitmap_get(visited, base + seed.y))
+			continue;
+
+		/* Extend run up and down */
+		y0 = seed.y;
+		while (y0 > 0 && map->tile[seed.x][y0 - 1] == oldt &&
+		    !bitmap_get(visited, base + y0 - 1))
+			--y0;
+		y1 = seed.y;
+		while (y1 < map->height - 1 &&
+		    map->tile[seed.x][y1 + 1] == oldt &&
+		    !bitmap_get(visited, base + y1 + 1))
+			++y1;
+
+		for (i = y0; i <= y1; i++)
+			bitmap_set(visited, base + i, true);
+
+		if (mapedit_flood_seeds(mapedit, visited, &stack, oldt,
+		    seed.x - 1, y0, y1) != 0)
+			break;
+		if (mapedit_flood_seeds(mapedit, visited, &stack, oldt,
+		    seed.x + 1, y0, y1) != 0)
+			break;
+
+		mapedit_fill_col(mapedit, occ, seed.x, y0, y1);
+	}
+
+out:
+	vector_fini(&stack);
+	if (visited != NULL)
+		bitmap_destroy(visited);
+	if (occ != NULL)
+		bitmap_destroy(occ);
+}
+
+/** Map callback.
+ *
+ * @param arg Map editor (mapedit_t *)
+ * @param x Tile X coordinate
+ * @param y Tile Y coordinate
+ */
+static void mapedit_mapview_cb(void *arg, int x, int y)
+{
+	mapedit_t *mapedit = (mapedit_t *)arg;
+
+	switch (mapedit->tool) {
+	case met_pen:
+		/* One tile type is one undo step until mouse up */
+		undolog_begin(mapedit->undolog, 1 + mapedit->ttype);
+		mapedit_paint(mapedit, x, y);
+		break;
+	case met_rect:
+		mapedit->rect_active = true;
+		mapedit->rect_x0 = x;
+		mapedit->rect_y0 = y;
+		mapedit->rect_x1 = x;
+		mapedit->rect_y1 = y;
+		break;
+	case met_fill:
+		undolog_begin(mapedit->undolog, 0);
+		mapedit_flood_fill(mapedit, x, y);
+		break;
+	}
+
+	mapedit_repaint_req(mapedit);
+}
+
+/** Map drag callback.
+ *
+ * @param arg Map editor (mapedit_t *)
+ * @param x0 X coordinate of previous tile
+ * @param y0 Y coordinate of previous tile
+ * @param x1 X coordinate of tile under the mouse pointer
+ * @param y1 Y coordinate of tile under the mouse pointer
+ */
+static void mapedit_mapview_drag_cb(void *arg, int x0, int y0, int x1, int y1)
+{
+	mapedit_t *mapedit = (mapedit_t *)arg;
+
+	switch (mapedit->tool) {
+	case met_pen:
+		undolog_begin(mapedit->undolog, 1 + mapedit->ttype);
+		mapedit_paint_line(mapedit, x0, y0, x1, y1);
+		break;
+	case met_rect:
+		if (!mapedit->rect_active)
+			return;
+		mapedit->rect_x1 = x1;
+		mapedit->rect_y1 = y1;
+		break;
+	case met_fill:
+		return;
+	}
 
 	mapedit_repaint_req(mapedit);
 }
@@ -367,6 +803,7 @@ static void mapedit_mapview_setup(mapedit_t *mapedit)
 {
 	mapview_set_orig(mapedit->mapview, 0, 56);
 	mapview_set_cb(mapedit->mapview, mapedit_mapview_cb, mapedit);
+	mapview_set_drag_cb(mapedit->mapview, mapedit_mapview_drag_cb);
 }
 
 /** Destroy map editor.
@@ -377,7 +814,23 @@ void mapedit_destroy(mapedit_t *mapedit)
 {
 	if (mapedit->map_tb != NULL)
 		toolbar_destroy(mapedit->map_tb);
+	if (mapedit->tool_tb != NULL)
+		toolbar_destroy(mapedit->tool_tb);
 	if (mapedit->mapview != NULL)
 		mapview_destroy(mapedit->mapview);
+	undolog_destroy(mapedit->undolog);
 	free(mapedit);
 }
+
+/** Switch map editor to a different map and robots.
+ *
+ * @param mapedit Map editor
+ * @param map Map
+ * @param robots Robots
+ */
+void mapedit_set_world(mapedit_t *mapedit, map_t *map, robots_t *robots)
+{
+	mapedit->robots = robots;
+	undolog_set_world(mapedit->undolog, map, robots);
+	mapview_set_world(mapedit->mapview, map, robots);
+}
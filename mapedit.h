@@ -30,11 +30,22 @@
 #include "mapview.h"
 #include "robots.h"
 #include "toolbar.h"
+#include "undolog.h"
 
 typedef struct {
 	void (*repaint)(void *);
 } mapedit_cb_t;
 
+/** Map editing tool */
+typedef enum {
+	/** Paint tiles under the mouse pointer */
+	met_pen,
+	/** Fill rectangle */
+	met_rect,
+	/** Flood fill area of the same tiles */
+	met_fill
+} mapedit_tool_t;
+
 /** Map editor */
 typedef struct {
 	/** Map view */
@@ -45,6 +56,22 @@ typedef struct {
 	map_tile_t ttype;
 	/** Map editor toolbar */
 	toolbar_t *map_tb;
+	/** Tool toolbar */
+	toolbar_t *tool_tb;
+	/** Selected tool */
+	mapedit_tool_t tool;
+	/** A rectangle is being dragged out */
+	bool rect_active;
+	/** X coordinate of rectangle corner where dragging started */
+	int rect_x0;
+	/** Y coordinate of rectangle corner where dragging started */
+	int rect_y0;
+	/** X coordinate of opposite rectangle corner */
+	int rect_x1;
+	/** Y coordinate of opposite rectangle corner */
+	int rect_y1;
+	/** Undo log */
+	undolog_t *undolog;
 	/** @c true to quit */
 	bool quit;
 	/** Callbacks */
@@ -58,6 +85,7 @@ extern int mapedit_new(map_t *, robots_t *, mapedit_cb_t *, void *,
 extern int mapedit_load(map_t *, robots_t *, FILE *, mapedit_cb_t *, void *,
     mapedit_t **);
 extern void mapedit_destroy(mapedit_t *);
+extern void mapedit_set_world(mapedit_t *, map_t *, robots_t *);
 extern void mapedit_display(mapedit_t *, gfx_t *gfx);
 extern int mapedit_save(mapedit_t *, FILE *);
 extern void mapedit_event(mapedit_t *, SDL_Event *, gfx_t *);
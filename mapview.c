@@ -77,6 +77,18 @@ void mapview_set_orig(mapview_t *mapview, int x, int y)
 	mapview->orig_y = y;
 }
 
+/** Set displayed map and robots.
+ *
+ * @param mapview Map view
+ * @param map Map
+ * @param robots Robots
+ */
+void mapview_set_world(mapview_t *mapview, map_t *map, robots_t *robots)
+{
+	mapview->map = map;
+	mapview->robots = robots;
+}
+
 /** Set map view callback.
  *
  * @param mapview Map view
@@ -89,6 +101,77 @@ void mapview_set_cb(mapview_t *mapview, mapview_cb_t cb, void *arg)
 	mapview->cb_arg = arg;
 }
 
+/** Set map view drag callback.
+ *
+ * The drag callback is called with the callback argument set by
+ * mapview_set_cb().
+ *
+ * @param mapview Map view
+ * @param drag_cb Drag callback
+ */
+void mapview_set_drag_cb(mapview_t *mapview, mapview_drag_cb_t drag_cb)
+{
+	mapview->drag_cb = drag_cb;
+}
+
+/** Get screen position of map tile.
+ *
+ * @param mapview Map view
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ * @param rdx Place to store X screen coordinate of top-left corner
+ * @param rdy Place to store Y screen coordinate of top-left corner
+ */
+void mapview_tile_pos(mapview_t *mapview, int x, int y, int *rdx, int *rdy)
+{
+	*rdx = mapview->orig_x + (1 + x) * mapview->map->margin_x +
+	    x * mapview->map->tile_w;
+	*rdy = mapview->orig_y + (1 + y) * mapview->map->margin_y +
+	    y * mapview->map->tile_h;
+}
+
+/** Find map tile at screen position.
+ *
+ * @param mapview Map view
+ * @param px X screen coordinate
+ * @param py Y screen coordinate
+ * @param rx Place to store X tile coordinate
+ * @param ry Place to store Y tile coordinate
+ * @return @c true iff there is a tile at the position (not a margin
+ *         or outside the map)
+ */
+bool mapview_tile_at(mapview_t *mapview, int px, int py, int *rx, int *ry)
+{
+	map_t *map = mapview->map;
+	int pitch_x, pitch_y;
+	int rel_x, rel_y;
+	int tx, ty;
+
+	pitch_x = map->margin_x + map->tile_w;
+	pitch_y = map->margin_y + map->tile_h;
+	if (pitch_x <= 0 || pitch_y <= 0)
+		return false;
+
+	rel_x = px - mapview->orig_x - map->margin_x;
+	rel_y = py - mapview->orig_y - map->margin_y;
+	if (rel_x < 0 || rel_y < 0)
+		return false;
+
+	tx = rel_x / pitch_x;
+	ty = rel_y / pitch_y;
+	if (tx >= map->width || ty >= map->height)
+		return false;
+
+	/* In the margin between tiles? */
+	if (rel_x - tx * pitch_x >= map->tile_w ||
+	    rel_y - ty * pitch_y >= map->tile_h)
+		return false;
+
+	*rx = tx;
+	*ry = ty;
+	return true;
+}
+
 /** Draw error frame around map tile.
  *
  * Since this is implemented as a solid rectangle, it needs to be drawn
@@ -105,10 +188,7 @@ void mapview_draw_error(mapview_t *mapview, int x, int y, gfx_t *gfx)
 	int fx, fy, fw, fh;
 	uint32_t color;
 
-	dx = mapview->orig_x + (1 + x) * mapview->map->margin_x +
-	    x * mapview->map->tile_w;
-	dy = mapview->orig_y + (1 + y) * mapview->map->margin_y +
-	    y * mapview->map->tile_h;
+	mapview_tile_pos(mapview, x, y, &dx, &dy);
 
 	fx = dx - error_frame_width;
 	fy = dy - error_frame_width;
@@ -120,6 +200,8 @@ void mapview_draw_error(mapview_t *mapview, int x, int y, gfx_t *gfx)
 }
 
 /** Draw map view.
+ *
+ * Only tiles that are at least partially visible are drawn.
  *
  * @param mapview Map view
  * @param gfx Graphics object to draw to
@@ -128,19 +210,36 @@ void mapview_draw(mapview_t *mapview, gfx_t *gfx)
 {
 	int x, y;
 	int dx, dy;
+	int scr_w, scr_h;
+	int x1, y1;
 	map_t *map;
 	map_tile_t ttype;
 	robot_t *robot;
 
 	map = mapview->map;
 
-	for (x = 0; x < map->width; x++) {
-		dx = mapview->orig_x + (1 + x) * map->margin_x +
-		    x * map->tile_w;
+	gfx_get_size(gfx, &scr_w, &scr_h);
 
-		for (y = 0; y < map->height; y++) {
-			dy = mapview->orig_y + (1 + y) * map->margin_y +
-			    y * map->tile_h;
+	/* Last tile that starts on the screen */
+	x1 = map->width - 1;
+	if (map->margin_x + map->tile_w > 0) {
+		x = (scr_w - mapview->orig_x) / (map->margin_x +
+		    map->tile_w);
+		if (x < x1)
+			x1 = x;
+	}
+
+	y1 = map->height - 1;
+	if (map->margin_y + map->tile_h > 0) {
+		y = (scr_h - mapview->orig_y) / (map->margin_y +
+		    map->tile_h);
+		if (y < y1)
+			y1 = y;
+	}
+
+	for (x = 0; x <= x1; x++) {
+		for (y = 0; y <= y1; y++) {
+			mapview_tile_pos(mapview, x, y, &dx, &dy);
 
 			robot = robots_get(mapview->robots, x, y);
 			if (robot != NULL && robot_error(robot))
@@ -165,36 +264,44 @@ void mapview_draw(mapview_t *mapview, gfx_t *gfx)
 bool mapview_event(mapview_t *mapview, SDL_Event *event)
 {
 	SDL_MouseButtonEvent *mbe;
-	map_t *map;
+	SDL_MouseMotionEvent *mme;
 	int tx, ty;
-	int x, y;
-	int w, h;
 
-	map = mapview->map;
+	switch (event->type) {
+	case SDL_MOUSEBUTTONDOWN:
+		mbe = (SDL_MouseButtonEvent *)event;
+		if (!mapview_tile_at(mapview, mbe->x, mbe->y, &tx, &ty))
+			return false;
+
+		mapview->drag = true;
+		mapview->drag_x = tx;
+		mapview->drag_y = ty;
 
-	w = map->tile_w;
-	h = map->tile_h;
-
-	for (tx = 0; tx < map->width; tx++) {
-		x = mapview->orig_x + (tx + 1) * map->margin_x +
-		    tx * map->tile_w;
-
-		for (ty = 0; ty < map->height; ty++) {
-			y = mapview->orig_y + (ty + 1) * map->margin_y +
-			    ty * map->tile_h;
-
-			if (event->type == SDL_MOUSEBUTTONDOWN) {
-				mbe = (SDL_MouseButtonEvent *)event;
-				if (mbe->x >= x && mbe->y >= y &&
-				    mbe->x < x + w && mbe->y < y + h) {
-					if (mapview->cb != NULL) {
-						mapview->cb(mapview->cb_arg,
-						    tx, ty);
-					}
-					return true;
-				}
-			}
+		if (mapview->cb != NULL)
+			mapview->cb(mapview->cb_arg, tx, ty);
+		return true;
+	case SDL_MOUSEMOTION:
+		mme = (SDL_MouseMotionEvent *)event;
+		if (!mapview->drag || (mme->state & SDL_BUTTON_LMASK) == 0)
+			return false;
+
+		/* Pointer can skip tiles, report the whole segment */
+		if (!mapview_tile_at(mapview, mme->x, mme->y, &tx, &ty))
+			return true;
+		if (tx == mapview->drag_x && ty == mapview->drag_y)
+			return true;
+
+		if (mapview->drag_cb != NULL) {
+			mapview->drag_cb(mapview->cb_arg, mapview->drag_x,
+			    mapview->drag_y, tx, ty);
 		}
+
+		mapview->drag_x = tx;
+		mapview->drag_y = ty;
+		return true;
+	case SDL_MOUSEBUTTONUP:
+		mapview->drag = false;
+		break;
 	}
 
 	return false;
@@ -24,11 +24,13 @@
 #define MAPVIEW_H
 
 #include <SDL.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include "map.h"
 #include "robots.h"
 
 typedef void (*mapview_cb_t)(void *arg, int x, int y);
+typedef void (*mapview_drag_cb_t)(void *arg, int x0, int y0, int x1, int y1);
 
 /** Map view
  *
@@ -45,14 +47,26 @@ typedef struct {
 	int orig_y;
 	/** Called when user clicks on a map tile */
 	mapview_cb_t cb;
+	/** Called when user drags the mouse from one tile to another */
+	mapview_drag_cb_t drag_cb;
 	/** Callback argument */
 	void *cb_arg;
+	/** Mouse button is held after clicking on a map tile */
+	bool drag;
+	/** X coordinate of tile last reported while dragging */
+	int drag_x;
+	/** Y coordinate of tile last reported while dragging */
+	int drag_y;
 } mapview_t;
 
 extern int mapview_create(map_t *, robots_t *, mapview_t **);
 extern void mapview_destroy(mapview_t *);
 extern void mapview_set_orig(mapview_t *, int, int);
+extern void mapview_set_world(mapview_t *, map_t *, robots_t *);
 extern void mapview_set_cb(mapview_t *, mapview_cb_t, void *);
+extern void mapview_set_drag_cb(mapview_t *, mapview_drag_cb_t);
+extern bool mapview_tile_at(mapview_t *, int, int, int *, int *);
+extern void mapview_tile_pos(mapview_t *, int, int, int *, int *);
 extern void mapview_draw(mapview_t *, gfx_t *);
 extern bool mapview_event(mapview_t *, SDL_Event *);
 
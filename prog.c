@@ -28,7 +28,56 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include "adt/arena.h"
+#include "journal.h"
 #include "prog.h"
+#include "proghash.h"
+
+enum {
+	/** Size of module arena chunks */
+	prog_arena_chunk_size = 65536,
+	/** Initial size of block statement array */
+	prog_block_min_alloc = 8,
+	/** Maximum number of statements reserved up front when loading */
+	prog_block_max_load_alloc = 1024
+};
+
+/** Opcode for statement type (intrinsics are refined by intrinsic type) */
+static const prog_op_t prog_stype_op[] = {
+	[progst_intrinsic] = progop_turn_left,
+	[progst_call] = progop_call,
+	[progst_if] = progop_if,
+	[progst_repeat] = progop_repeat,
+	[progst_recurse] = progop_recurse
+};
+
+/** Allocate zero-filled program node.
+ *
+ * @param arena Arena or @c NULL to allocate from the heap
+ * @param size Node size
+ * @return New node or @c NULL if out of memory
+ */
+static void *prog_node_alloc(arena_t *arena, size_t size)
+{
+	if (arena != NULL)
+		return arena_alloc(arena, size);
+
+	return calloc(1, size);
+}
+
+/** Free program node.
+ *
+ * @param arena Arena the node was allocated from or @c NULL
+ * @param node Node
+ * @param size Node size
+ */
+static void prog_node_free(arena_t *arena, void *node, size_t size)
+{
+	if (arena != NULL)
+		arena_free(arena, node, size);
+	else
+		free(node);
+}
 
 /** Create module.
  *
@@ -38,11 +87,25 @@
 int prog_module_create(prog_module_t **rmod)
 {
 	prog_module_t *mod;
+	int rc;
 
 	mod = calloc(1, sizeof(prog_module_t));
 	if (mod == NULL)
 		return ENOMEM;
 
+	rc = arena_create(prog_arena_chunk_size, &mod->arena);
+	if (rc != 0) {
+		free(mod);
+		return rc;
+	}
+
+	rc = hmap_create(hmk_str, &mod->proc_idx);
+	if (rc != 0) {
+		arena_destroy(mod->arena);
+		free(mod);
+		return rc;
+	}
+
 	list_initialize(&mod->procs);
 
 	*rmod = mod;
@@ -50,6 +113,9 @@ int prog_module_create(prog_module_t **rmod)
 }
 
 /** Destroy module.
+ *
+ * Nodes that were allocated from the module arena are released in bulk
+ * together with the arena.
  *
  * @param mod Module or @c NULL
  */
@@ -68,17 +134,44 @@ void prog_module_destroy(prog_module_t *mod)
 		prog_proc_destroy(proc);
 		proc = prog_module_first(mod);
 	}
+
+	hmap_destroy(mod->proc_idx);
+	arena_destroy(mod->arena);
+	free(mod);
 }
 
 /** Append procedure to module.
  *
  * @param mod Module
  * @param proc Procedure
+ * @return Zero on success, EEXIST if module already contains a procedure
+ *         with the same identifier, ENOMEM if out of memory
  */
-void prog_module_append(prog_module_t *mod, prog_proc_t *proc)
+int prog_module_append(prog_module_t *mod, prog_proc_t *proc)
 {
+	int rc;
+
+	rc = hmap_insert_str(mod->proc_idx, proc->ident, proc);
+	if (rc != 0)
+		return rc;
+
 	list_append(&proc->lprocs, &mod->procs);
 	proc->mod = mod;
+	prog_proc_changed(proc);
+
+	if (mod->journal != NULL)
+		journal_proc_append(mod->journal, proc);
+	return 0;
+}
+
+/** Set change journal.
+ *
+ * @param mod Module
+ * @param journal Journal to record changes to or @c NULL
+ */
+void prog_module_set_journal(prog_module_t *mod, struct journal *journal)
+{
+	mod->journal = journal;
 }
 
 /** Load module from file.
@@ -110,9 +203,18 @@ int prog_module_load(FILE *f, prog_module_t **rmod)
 		if (rc != 0)
 			goto error;
 
-		prog_module_append(mod, proc);
+		rc = prog_module_append(mod, proc);
+		if (rc != 0) {
+			prog_proc_destroy(proc);
+			goto error;
+		}
 	}
 
+	/* Identical procedures share native code and analysis results */
+	rc = proghash_cons(mod, NULL);
+	if (rc != 0)
+		goto error;
+
 	*rmod = mod;
 	return 0;
 error:
@@ -165,6 +267,8 @@ int prog_module_gen_ident(prog_module_t *mod, char **rident)
 	if (ident == NULL)
 		return ENOMEM;
 
+	ident[prog_proc_id_len] = '\0';
+
 	do {
 		/* Generate a new identifier */
 		for (i = 0; i < prog_proc_id_len; i++) {
@@ -174,7 +278,6 @@ int prog_module_gen_ident(prog_module_t *mod, char **rident)
 		proc = prog_module_proc_by_ident(mod, ident);
 	} while (proc != NULL);
 
-	ident[i] = '\0';
 	*rident = ident;
 	return 0;
 }
@@ -251,35 +354,39 @@ prog_proc_t *prog_module_prev(prog_proc_t *cur)
  */
 prog_proc_t *prog_module_proc_by_ident(prog_module_t *mod, const char *ident)
 {
-	prog_proc_t *proc;
-
-	proc = prog_module_first(mod);
-	while (proc != NULL) {
-		if (strcmp(proc->ident, ident) == 0)
-			return proc;
+	hmap_entry_t *entry;
 
-		proc = prog_module_next(proc);
-	}
+	entry = hmap_find_str(mod->proc_idx, ident);
+	if (entry == NULL)
+		return NULL;
 
-	return NULL;
+	return (prog_proc_t *)entry->value;
 }
 
-/** Create procedure.
+/** Allocate procedure.
  *
+ * @param arena Arena or @c NULL to allocate from the heap
  * @param ident Identifier
  * @param rproc Place to store pointer to new procedure
  * @return Zero on success or an error code
  */
-int prog_proc_create(const char *ident, prog_proc_t **rproc)
+static int prog_proc_alloc(arena_t *arena, const char *ident,
+    prog_proc_t **rproc)
 {
 	prog_proc_t *proc;
 	int rc;
 
-	proc = calloc(1, sizeof(prog_proc_t));
+	proc = prog_node_alloc(arena, sizeof(prog_proc_t));
 	if (proc == NULL)
 		return ENOMEM;
 
-	proc->ident = strdup(ident);
+	proc->arena = arena;
+	proc->canon = proc;
+	list_initialize(&proc->callers);
+	if (arena != NULL)
+		proc->ident = arena_strdup(arena, ident);
+	else
+		proc->ident = strdup(ident);
 	if (proc->ident == NULL) {
 		rc = ENOMEM;
 		goto error;
@@ -292,20 +399,206 @@ error:
 	return rc;
 }
 
+/** Stop sharing code between procedure and identical procedures.
+ *
+ * Must be called before the procedure body changes or the procedure
+ * is deleted. Duplicates stop sharing until the module is analyzed
+ * again (see proghash_cons()).
+ *
+ * @param proc Procedure
+ */
+static void prog_proc_unshare(prog_proc_t *proc)
+{
+	prog_proc_t *dup;
+
+	proc->canon = proc;
+	if (proc->mod == NULL)
+		return;
+
+	dup = prog_module_first(proc->mod);
+	while (dup != NULL) {
+		if (dup->canon == proc)
+			dup->canon = dup;
+		dup = prog_module_next(dup);
+	}
+}
+
+/** Delete procedure from its module.
+ *
+ * The procedure can only be deleted if it is not called from any
+ * statement and no robot is executing it or is due to return to it.
+ *
+ * @param proc Procedure
+ * @return Zero on success, EBUSY if procedure is still referenced
+ */
+int prog_module_delete_proc(prog_proc_t *proc)
+{
+	hmap_entry_t *entry;
+
+	if (prog_proc_is_referenced(proc))
+		return EBUSY;
+
+	prog_proc_unshare(proc);
+
+	if (proc->mod->journal != NULL)
+		journal_proc_delete(proc->mod->journal, proc);
+
+	entry = hmap_find_str(proc->mod->proc_idx, proc->ident);
+	assert(entry != NULL);
+	hmap_remove(proc->mod->proc_idx, entry);
+	proc->mod->cg_valid = false;
+
+	list_remove(&proc->lprocs);
+	proc->mod = NULL;
+	prog_proc_destroy(proc);
+	return 0;
+}
+
+/** Remove statement from procedure body.
+ *
+ * The statement is destroyed. The procedure must not be executing
+ * (no robot may be executing it or be due to return to it). The change
+ * is recorded in the module journal.
+ *
+ * @param proc Procedure
+ * @param stmt Statement inside @a proc
+ * @return Zero on success, EBUSY if the procedure is executing
+ */
+int prog_proc_remove_stmt(prog_proc_t *proc, prog_stmt_t *stmt)
+{
+	if (proc->stack_refs > 0)
+		return EBUSY;
+
+	prog_proc_unshare(proc);
+	prog_block_remove(stmt);
+	prog_stmt_destroy(stmt);
+	prog_proc_changed(proc);
+
+	if (proc->mod != NULL && proc->mod->journal != NULL)
+		journal_proc_body(proc->mod->journal, proc);
+	return 0;
+}
+
+/** Replace procedure body.
+ *
+ * The procedure must not be executing. The change is not journaled
+ * (this is used to replay the journal).
+ *
+ * @param proc Procedure
+ * @param body New body (ownership is transferred on success)
+ * @return Zero on success, EBUSY if the procedure is executing
+ */
+int prog_proc_set_body(prog_proc_t *proc, prog_block_t *body)
+{
+	if (proc->stack_refs > 0)
+		return EBUSY;
+
+	prog_proc_unshare(proc);
+	prog_block_destroy(proc->body);
+	proc->body = body;
+	prog_proc_changed(proc);
+	return 0;
+}
+
+/** Note that procedure body was modified.
+ *
+ * Analysis results for the containing module (stack depth, movement
+ * effects) and the statement table of the procedure will be recomputed
+ * when they are next needed.
+ *
+ * @param proc Procedure
+ */
+void prog_proc_changed(prog_proc_t *proc)
+{
+	proc->stmt_tab_valid = false;
+	if (proc->mod != NULL)
+		proc->mod->cg_valid = false;
+}
+
+/** Set procedure movement effect.
+ *
+ * @param proc Procedure
+ * @param effect New effect (ownership is transferred) or @c NULL
+ */
+void prog_proc_set_effect(prog_proc_t *proc, prog_effect_t *effect)
+{
+	prog_effect_destroy(proc->effect);
+	proc->effect = effect;
+}
+
+/** Set or clear breakpoint on statement.
+ *
+ * The statement opcode is replaced with progop_break, so that execution
+ * is not slowed down by statements without breakpoints.
+ *
+ * @param proc Procedure containing the statement
+ * @param stmt Statement
+ * @param breakpoint @c true to set breakpoint, @c false to clear it
+ */
+void prog_proc_set_breakpoint(prog_proc_t *proc, prog_stmt_t *stmt,
+    bool breakpoint)
+{
+	stmt->breakpoint = breakpoint;
+	stmt->op = breakpoint ? progop_break : prog_stmt_base_op(stmt);
+
+	/* Movement effects must not skip over breakpoints */
+	prog_proc_changed(proc);
+}
+
+/** Destroy procedure movement effect.
+ *
+ * @param effect Effect or @c NULL
+ */
+void prog_effect_destroy(prog_effect_t *effect)
+{
+	if (effect == NULL)
+		return;
+
+	free(effect->path);
+	free(effect);
+}
+
+/** Create procedure.
+ *
+ * @param ident Identifier
+ * @param rproc Place to store pointer to new procedure
+ * @return Zero on success or an error code
+ */
+int prog_proc_create(const char *ident, prog_proc_t **rproc)
+{
+	return prog_proc_alloc(NULL, ident, rproc);
+}
+
 /** Destroy procedure.
  *
  * @param proc Procedure or @c NULL
  */
 void prog_proc_destroy(prog_proc_t *proc)
 {
+	link_t *link;
+
 	if (proc == NULL)
 		return;
 
+	/*
+	 * Detach any remaining callers. This only happens when the
+	 * whole module is being destroyed.
+	 */
+	link = list_first(&proc->callers);
+	while (link != NULL) {
+		list_remove(link);
+		link = list_first(&proc->callers);
+	}
+
+	prog_effect_destroy(proc->effect);
+	free(proc->stmt_tab);
 	if (proc->body != NULL)
 		prog_block_destroy(proc->body);
-	if (proc->ident != NULL)
-		free(proc->ident);
-	free(proc);
+	if (proc->ident != NULL) {
+		prog_node_free(proc->arena, proc->ident,
+		    strlen(proc->ident) + 1);
+	}
+	prog_node_free(proc->arena, proc, sizeof(prog_proc_t));
 }
 
 /** Load procedure identifier from file.
@@ -370,7 +663,7 @@ int prog_proc_load(prog_module_t *mod, FILE *f, prog_proc_t **rproc)
 	if (rc != 0)
 		return rc;
 
-	rc = prog_proc_create(ident, &proc);
+	rc = prog_proc_alloc(mod->arena, ident, &proc);
 	if (rc != 0)
 		return rc;
 
@@ -406,56 +699,149 @@ int prog_proc_save(prog_proc_t *proc, FILE *f)
 	return 0;
 }
 
-/** Create block.
+/** Allocate block.
  *
+ * @param arena Arena or @c NULL to allocate from the heap
  * @param rblock Place to store pointer to new block.
  * @return Zero on success or an error code
  */
-int prog_block_create(prog_block_t **rblock)
+static int prog_block_alloc(arena_t *arena, prog_block_t **rblock)
 {
 	prog_block_t *block;
 
-	block = calloc(1, sizeof(prog_block_t));
+	block = prog_node_alloc(arena, sizeof(prog_block_t));
 	if (block == NULL)
 		return ENOMEM;
 
-	list_initialize(&block->stmts);
+	block->arena = arena;
 	*rblock = block;
 	return 0;
 }
 
+/** Create block.
+ *
+ * @param rblock Place to store pointer to new block.
+ * @return Zero on success or an error code
+ */
+int prog_block_create(prog_block_t **rblock)
+{
+	return prog_block_alloc(NULL, rblock);
+}
+
 /** Destroy block.
  *
  * @param block Block or @c NULL
  */
 void prog_block_destroy(prog_block_t *block)
 {
-	prog_stmt_t *stmt;
+	unsigned i;
 
 	if (block == NULL)
 		return;
 
-	stmt = prog_block_first(block);
-	while (stmt != NULL) {
-		list_remove(&stmt->lstmts);
-		stmt->block = NULL;
-		prog_stmt_destroy(stmt);
+	for (i = 0; i < block->nstmts; i++) {
+		block->stmts[i]->block = NULL;
+		prog_stmt_destroy(block->stmts[i]);
+	}
+
+	free(block->stmts);
+	prog_node_free(block->arena, block, sizeof(prog_block_t));
+}
+
+/** Make sure block can hold a number of statements without reallocation.
+ *
+ * @param block Block
+ * @param cnt Total number of statements the block should be able to hold
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int prog_block_reserve(prog_block_t *block, unsigned cnt)
+{
+	prog_stmt_t **nstmts;
+
+	if (cnt <= block->alloc_stmts)
+		return 0;
+
+	nstmts = realloc(block->stmts, cnt * sizeof(prog_stmt_t *));
+	if (nstmts == NULL)
+		return ENOMEM;
+
+	block->stmts = nstmts;
+	block->alloc_stmts = cnt;
+	return 0;
+}
+
+/** Insert statement into block at the specified position.
+ *
+ * Statements at @a idx and above are shifted by one.
+ *
+ * @param block Block
+ * @param idx Index where the statement should be inserted
+ *            (at most the number of statements in the block)
+ * @param stmt Statement
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int prog_block_insert(prog_block_t *block, unsigned idx, prog_stmt_t *stmt)
+{
+	unsigned i;
+	int rc;
+
+	assert(idx <= block->nstmts);
 
-		stmt = prog_block_first(block);
+	if (block->nstmts >= block->alloc_stmts) {
+		rc = prog_block_reserve(block, block->alloc_stmts > 0 ?
+		    2 * block->alloc_stmts : prog_block_min_alloc);
+		if (rc != 0)
+			return rc;
 	}
 
-	free(block);
+	memmove(&block->stmts[idx + 1], &block->stmts[idx],
+	    (block->nstmts - idx) * sizeof(prog_stmt_t *));
+	++block->nstmts;
+
+	block->stmts[idx] = stmt;
+	stmt->block = block;
+
+	for (i = idx; i < block->nstmts; i++)
+		block->stmts[i]->idx = i;
+
+	return 0;
 }
 
 /** Append statement to block.
  *
  * @param block Block
  * @param stmt Statement
+ * @return Zero on success, ENOMEM if out of memory
  */
-void prog_block_append(prog_block_t *block, prog_stmt_t *stmt)
+int prog_block_append(prog_block_t *block, prog_stmt_t *stmt)
 {
-	list_append(&stmt->lstmts, &block->stmts);
-	stmt->block = block;
+	return prog_block_insert(block, block->nstmts, stmt);
+}
+
+/** Remove statement from its containing block.
+ *
+ * Statements following @a stmt are shifted down by one. The statement
+ * itself is not destroyed.
+ *
+ * @param stmt Statement
+ */
+void prog_block_remove(prog_stmt_t *stmt)
+{
+	prog_block_t *block = stmt->block;
+	unsigned i;
+
+	assert(block != NULL);
+	assert(block->stmts[stmt->idx] == stmt);
+
+	memmove(&block->stmts[stmt->idx], &block->stmts[stmt->idx + 1],
+	    (block->nstmts - stmt->idx - 1) * sizeof(prog_stmt_t *));
+	--block->nstmts;
+
+	for (i = stmt->idx; i < block->nstmts; i++)
+		block->stmts[i]->idx = i;
+
+	stmt->block = NULL;
+	stmt->idx = 0;
 }
 
 /** Load block from file.
@@ -474,7 +860,7 @@ int prog_block_load(prog_module_t *mod, FILE *f, prog_block_t **rblock)
 	prog_stmt_t *stmt;
 	int rc;
 
-	rc = prog_block_create(&block);
+	rc = prog_block_alloc(mod->arena, &block);
 	if (rc != 0)
 		goto error;
 
@@ -484,12 +870,26 @@ int prog_block_load(prog_module_t *mod, FILE *f, prog_block_t **rblock)
 		goto error;
 	}
 
+	/*
+	 * Do not trust the count for the up-front allocation, a corrupted
+	 * file could make us request gigabytes. The array still grows
+	 * as statements are actually read.
+	 */
+	rc = prog_block_reserve(block, cnt < prog_block_max_load_alloc ?
+	    cnt : prog_block_max_load_alloc);
+	if (rc != 0)
+		goto error;
+
 	for (i = 0; i < cnt; i++) {
 		rc = prog_stmt_load(mod, f, &stmt);
 		if (rc != 0)
 			goto error;
 
-		prog_block_append(block, stmt);
+		rc = prog_block_append(block, stmt);
+		if (rc != 0) {
+			prog_stmt_destroy(stmt);
+			goto error;
+		}
 	}
 
 	*rblock = block;
@@ -507,42 +907,55 @@ error:
  */
 int prog_block_save(prog_block_t *block, FILE *f)
 {
-	prog_stmt_t *stmt;
-	unsigned cnt;
+	unsigned i;
 	int rc;
 	int rv;
 
-	cnt = list_count(&block->stmts);
-	rv = fprintf(f, "%u\n", cnt);
+	rv = fprintf(f, "%u\n", block->nstmts);
 	if (rv < 0)
 		return EIO;
 
-	stmt = prog_block_first(block);
-	while (stmt != NULL) {
-		rc = prog_stmt_save(stmt, f);
+	for (i = 0; i < block->nstmts; i++) {
+		rc = prog_stmt_save(block->stmts[i], f);
 		if (rc != 0)
 			return rc;
-
-		stmt = prog_block_next(stmt);
 	}
 
 	return 0;
 }
 
-/** Get first statement in block.
+/** Get number of statements in block.
  *
  * @param block Block
- * @return First statement or @c NULL if block is empty
+ * @return Number of statements
  */
-prog_stmt_t *prog_block_first(prog_block_t *block)
+unsigned prog_block_count(prog_block_t *block)
 {
-	link_t *link;
+	return block->nstmts;
+}
 
-	link = list_first(&block->stmts);
-	if (link == NULL)
+/** Get statement by index.
+ *
+ * @param block Block
+ * @param idx Statement index
+ * @return Statement or @c NULL if @a idx is out of range
+ */
+prog_stmt_t *prog_block_stmt_by_index(prog_block_t *block, unsigned idx)
+{
+	if (idx >= block->nstmts)
 		return NULL;
 
-	return list_get_instance(link, prog_stmt_t, lstmts);
+	return block->stmts[idx];
+}
+
+/** Get first statement in block.
+ *
+ * @param block Block
+ * @return First statement or @c NULL if block is empty
+ */
+prog_stmt_t *prog_block_first(prog_block_t *block)
+{
+	return prog_block_stmt_by_index(block, 0);
 }
 
 /** Get next statement in block.
@@ -552,13 +965,7 @@ prog_stmt_t *prog_block_first(prog_block_t *block)
  */
 prog_stmt_t *prog_block_next(prog_stmt_t *cur)
 {
-	link_t *link;
-
-	link = list_next(&cur->lstmts, &cur->block->stmts);
-	if (link == NULL)
-		return NULL;
-
-	return list_get_instance(link, prog_stmt_t, lstmts);
+	return prog_block_stmt_by_index(cur->block, cur->idx + 1);
 }
 
 /** Get last statement in block.
@@ -568,13 +975,10 @@ prog_stmt_t *prog_block_next(prog_stmt_t *cur)
  */
 prog_stmt_t *prog_block_last(prog_block_t *block)
 {
-	link_t *link;
-
-	link = list_last(&block->stmts);
-	if (link == NULL)
+	if (block->nstmts == 0)
 		return NULL;
 
-	return list_get_instance(link, prog_stmt_t, lstmts);
+	return block->stmts[block->nstmts - 1];
 }
 
 /** Get previous statement in block.
@@ -584,59 +988,282 @@ prog_stmt_t *prog_block_last(prog_block_t *block)
  */
 prog_stmt_t *prog_block_prev(prog_stmt_t *cur)
 {
-	link_t *link;
-
-	link = list_prev(&cur->lstmts, &cur->block->stmts);
-	if (link == NULL)
+	if (cur->idx == 0)
 		return NULL;
 
-	return list_get_instance(link, prog_stmt_t, lstmts);
+	return cur->block->stmts[cur->idx - 1];
 }
 
-/** Get linear statement index within procedure.
+/** Count statements in block and nested blocks.
  *
- * @param proc Procedure
- * @param stmt Statement inside procedure (must be inside @a proc)
- * @return Linear index
+ * @param block Block or @c NULL
+ * @return Number of statements
+ */
+static unsigned prog_block_count_stmts(prog_block_t *block)
+{
+	prog_stmt_t *s;
+	unsigned cnt;
+	unsigned i;
+
+	if (block == NULL)
+		return 0;
+
+	cnt = block->nstmts;
+	for (i = 0; i < block->nstmts; i++) {
+		s = block->stmts[i];
+		switch (s->stype) {
+		case progst_if:
+			cnt += prog_block_count_stmts(s->s.sif.btrue);
+			cnt += prog_block_count_stmts(s->s.sif.bfalse);
+			break;
+		case progst_repeat:
+			cnt += prog_block_count_stmts(s->s.srepeat.body);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return cnt;
+}
+
+/** Fill statement table with statements of block and nested blocks.
+ *
+ * Statements are numbered in pre-order (a statement comes before
+ * the statements in its nested blocks).
+ *
+ * @param block Block or @c NULL
+ * @param tab Statement table
+ * @param rindex Index of the next table entry, incremented by the number
+ *               of statements
  */
-unsigned prog_proc_get_stmt_index(prog_proc_t *proc, prog_stmt_t *stmt)
+static void prog_block_fill_tab(prog_block_t *block, prog_stmt_t **tab,
+    unsigned *rindex)
 {
 	prog_stmt_t *s;
+	unsigned i;
+
+	if (block == NULL)
+		return;
+
+	for (i = 0; i < block->nstmts; i++) {
+		s = block->stmts[i];
+		s->pidx = *rindex;
+		tab[(*rindex)++] = s;
+
+		switch (s->stype) {
+		case progst_if:
+			prog_block_fill_tab(s->s.sif.btrue, tab, rindex);
+			prog_block_fill_tab(s->s.sif.bfalse, tab, rindex);
+			break;
+		case progst_repeat:
+			prog_block_fill_tab(s->s.srepeat.body, tab, rindex);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/** Make sure procedure statement table is up to date.
+ *
+ * The table is rebuilt after the procedure was changed (see
+ * prog_proc_changed()), so that converting between statements and
+ * their linear indices takes constant time.
+ *
+ * @param proc Procedure
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int prog_proc_update_stmt_tab(prog_proc_t *proc)
+{
+	prog_stmt_t **tab;
+	unsigned cnt;
 	unsigned index;
 
+	if (proc->stmt_tab_valid)
+		return 0;
+
+	cnt = prog_block_count_stmts(proc->body);
+	if (cnt > proc->nstmt_tab || proc->stmt_tab == NULL) {
+		tab = realloc(proc->stmt_tab, (cnt > 0 ? cnt : 1) *
+		    sizeof(prog_stmt_t *));
+		if (tab == NULL)
+			return ENOMEM;
+		proc->stmt_tab = tab;
+	}
+
 	index = 0;
-	s = prog_block_first(proc->body);
+	prog_block_fill_tab(proc->body, proc->stmt_tab, &index);
+	assert(index == cnt);
+
+	proc->nstmt_tab = cnt;
+	proc->stmt_tab_valid = true;
+	return 0;
+}
+
+/** Get linear statement index within procedure.
+ *
+ * Statements in nested blocks are numbered, too, in pre-order.
+ * For a procedure without nested blocks this is the index in the body.
+ *
+ * @param proc Procedure
+ * @param stmt Statement inside procedure (must be inside @a proc)
+ * @param rindex Place to store linear index
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int prog_proc_get_stmt_index(prog_proc_t *proc, prog_stmt_t *stmt,
+    unsigned *rindex)
+{
+	int rc;
 
-	while (s != stmt) {
-		++index;
-		s = prog_block_next(s);
+	rc = prog_proc_update_stmt_tab(proc);
+	if (rc != 0)
+		return rc;
+
+	/* Table was not invalidated after a change */
+	if (stmt->pidx >= proc->nstmt_tab ||
+	    proc->stmt_tab[stmt->pidx] != stmt) {
+		proc->stmt_tab_valid = false;
+		rc = prog_proc_update_stmt_tab(proc);
+		if (rc != 0)
+			return rc;
 	}
 
-	assert(s == stmt);
-	return index;
+	assert(stmt->pidx < proc->nstmt_tab);
+	assert(proc->stmt_tab[stmt->pidx] == stmt);
+	*rindex = stmt->pidx;
+	return 0;
 }
 
 /** Find statement in procedure by linear index.
  *
- * @pram proc Procedure
- * @param index Linear index (must be valid)
- * @return Statement
+ * @param proc Procedure
+ * @param index Linear index
+ * @return Statement or @c NULL if @a index is out of range
+ *         (or out of memory)
  */
 prog_stmt_t *prog_proc_stmt_by_index(prog_proc_t *proc, unsigned index)
+{
+	if (prog_proc_update_stmt_tab(proc) != 0)
+		return NULL;
+
+	if (index >= proc->nstmt_tab)
+		return NULL;
+
+	return proc->stmt_tab[index];
+}
+
+/** Get first statement calling procedure.
+ *
+ * @param proc Procedure
+ * @return First call statement or @c NULL if procedure is not called
+ */
+prog_stmt_t *prog_proc_first_caller(prog_proc_t *proc)
+{
+	link_t *link;
+
+	link = list_first(&proc->callers);
+	if (link == NULL)
+		return NULL;
+
+	return list_get_instance(link, prog_stmt_t, s.scall.lcallers);
+}
+
+/** Get next statement calling the same procedure.
+ *
+ * @param cur Current call statement
+ * @return Next call statement or @c NULL if @a cur is the last one
+ */
+prog_stmt_t *prog_proc_next_caller(prog_stmt_t *cur)
+{
+	link_t *link;
+
+	assert(cur->stype == progst_call);
+
+	link = list_next(&cur->s.scall.lcallers, &cur->s.scall.proc->callers);
+	if (link == NULL)
+		return NULL;
+
+	return list_get_instance(link, prog_stmt_t, s.scall.lcallers);
+}
+
+/** Note that a robot or robot stack frame references procedure.
+ *
+ * @param proc Procedure
+ */
+void prog_proc_stack_ref(prog_proc_t *proc)
+{
+	++proc->stack_refs;
+}
+
+/** Drop robot or robot stack frame reference to procedure.
+ *
+ * @param proc Procedure
+ */
+void prog_proc_stack_unref(prog_proc_t *proc)
+{
+	assert(proc->stack_refs > 0);
+	--proc->stack_refs;
+}
+
+/** Determine if procedure is referenced by a call or a robot.
+ *
+ * @param proc Procedure
+ * @return @c true iff procedure is called from any statement or
+ *         is referenced by a robot or robot stack
+ */
+bool prog_proc_is_referenced(prog_proc_t *proc)
+{
+	return !list_empty(&proc->callers) || proc->stack_refs > 0;
+}
+
+/** Allocate statement.
+ *
+ * @param arena Arena or @c NULL to allocate from the heap
+ * @param stype Statement type
+ * @param rstmt Place to store pointer to new statement
+ * @return Zero on succes or an error code
+ */
+static int prog_stmt_alloc(arena_t *arena, prog_stmt_type_t stype,
+    prog_stmt_t **rstmt)
 {
 	prog_stmt_t *stmt;
-	unsigned i;
 
-	i = 0;
-	stmt = prog_block_first(proc->body);
+	stmt = prog_node_alloc(arena, sizeof(prog_stmt_t));
+	if (stmt == NULL)
+		return ENOMEM;
 
-	while (i != index) {
-		++i;
-		stmt = prog_block_next(stmt);
-	}
+	stmt->arena = arena;
+	stmt->stype = stype;
+	stmt->op = prog_stype_op[stype];
+	*rstmt = stmt;
+	return 0;
+}
+
+/** Set call statement target.
+ *
+ * @param stmt Call statement
+ * @param proc Called procedure
+ */
+static void prog_stmt_call_set_proc(prog_stmt_t *stmt, prog_proc_t *proc)
+{
+	assert(stmt->stype == progst_call);
+
+	stmt->s.scall.proc = proc;
+	list_append(&stmt->s.scall.lcallers, &proc->callers);
+}
+
+/** Get statement opcode, ignoring any breakpoint.
+ *
+ * @param stmt Statement
+ * @return Opcode
+ */
+prog_op_t prog_stmt_base_op(prog_stmt_t *stmt)
+{
+	if (stmt->stype == progst_intrinsic)
+		return (prog_op_t)stmt->s.sintr.itype;
 
-	assert(i == index);
-	return stmt;
+	return prog_stype_op[stmt->stype];
 }
 
 /** Create intrinsic statement.
@@ -648,13 +1275,14 @@ prog_stmt_t *prog_proc_stmt_by_index(prog_proc_t *proc, unsigned index)
 int prog_stmt_intrinsic_create(prog_intr_type_t itype, prog_stmt_t **rstmt)
 {
 	prog_stmt_t *stmt;
+	int rc;
 
-	stmt = calloc(1, sizeof(prog_stmt_t));
-	if (stmt == NULL)
-		return ENOMEM;
+	rc = prog_stmt_alloc(NULL, progst_intrinsic, &stmt);
+	if (rc != 0)
+		return rc;
 
-	stmt->stype = progst_intrinsic;
 	stmt->s.sintr.itype = itype;
+	stmt->op = (prog_op_t)itype;
 	*rstmt = stmt;
 	return 0;
 }
@@ -668,13 +1296,13 @@ int prog_stmt_intrinsic_create(prog_intr_type_t itype, prog_stmt_t **rstmt)
 int prog_stmt_call_create(prog_proc_t *proc, prog_stmt_t **rstmt)
 {
 	prog_stmt_t *stmt;
+	int rc;
 
-	stmt = calloc(1, sizeof(prog_stmt_t));
-	if (stmt == NULL)
-		return ENOMEM;
+	rc = prog_stmt_alloc(NULL, progst_call, &stmt);
+	if (rc != 0)
+		return rc;
 
-	stmt->stype = progst_call;
-	stmt->s.scall.proc = proc;
+	prog_stmt_call_set_proc(stmt, proc);
 	*rstmt = stmt;
 	return 0;
 }
@@ -686,15 +1314,7 @@ int prog_stmt_call_create(prog_proc_t *proc, prog_stmt_t **rstmt)
  */
 int prog_stmt_if_create(prog_stmt_t **rstmt)
 {
-	prog_stmt_t *stmt;
-
-	stmt = calloc(1, sizeof(prog_stmt_t));
-	if (stmt == NULL)
-		return ENOMEM;
-
-	stmt->stype = progst_if;
-	*rstmt = stmt;
-	return 0;
+	return prog_stmt_alloc(NULL, progst_if, rstmt);
 }
 
 /** Create repeat statement.
@@ -704,15 +1324,7 @@ int prog_stmt_if_create(prog_stmt_t **rstmt)
  */
 int prog_stmt_repeat_create(prog_stmt_t **rstmt)
 {
-	prog_stmt_t *stmt;
-
-	stmt = calloc(1, sizeof(prog_stmt_t));
-	if (stmt == NULL)
-		return ENOMEM;
-
-	stmt->stype = progst_repeat;
-	*rstmt = stmt;
-	return 0;
+	return prog_stmt_alloc(NULL, progst_repeat, rstmt);
 }
 
 /** Create recurse statement.
@@ -722,15 +1334,7 @@ int prog_stmt_repeat_create(prog_stmt_t **rstmt)
  */
 int prog_stmt_recurse_create(prog_stmt_t **rstmt)
 {
-	prog_stmt_t *stmt;
-
-	stmt = calloc(1, sizeof(prog_stmt_t));
-	if (stmt == NULL)
-		return ENOMEM;
-
-	stmt->stype = progst_recurse;
-	*rstmt = stmt;
-	return 0;
+	return prog_stmt_alloc(NULL, progst_recurse, rstmt);
 }
 
 /** Destroy statement.
@@ -742,7 +1346,23 @@ void prog_stmt_destroy(prog_stmt_t *stmt)
 	if (stmt == NULL)
 		return;
 
-	free(stmt);
+	switch (stmt->stype) {
+	case progst_call:
+		if (link_used(&stmt->s.scall.lcallers))
+			list_remove(&stmt->s.scall.lcallers);
+		break;
+	case progst_if:
+		prog_block_destroy(stmt->s.sif.btrue);
+		prog_block_destroy(stmt->s.sif.bfalse);
+		break;
+	case progst_repeat:
+		prog_block_destroy(stmt->s.srepeat.body);
+		break;
+	default:
+		break;
+	}
+
+	prog_node_free(stmt->arena, stmt, sizeof(prog_stmt_t));
 }
 
 /** Load condition from file.
@@ -788,14 +1408,18 @@ static int prog_cond_save(prog_cond_t *cond, FILE *f)
 
 /** Load intrinsic statement from file.
  *
+ * @param mod Containing module
  * @param f File
  * @param rstmt Place to store pointer to new statement
  * @return Zero on success or an error code
  */
-static int prog_stmt_intrinsic_load(FILE *f, prog_stmt_t **rstmt)
+static int prog_stmt_intrinsic_load(prog_module_t *mod, FILE *f,
+    prog_stmt_t **rstmt)
 {
+	prog_stmt_t *stmt;
 	unsigned itype;
 	int nitem;
+	int rc;
 
 	nitem = fscanf(f, "%u\n", &itype);
 	if (nitem != 1)
@@ -804,7 +1428,14 @@ static int prog_stmt_intrinsic_load(FILE *f, prog_stmt_t **rstmt)
 	if (itype > progin_pick_up)
 		return EIO;
 
-	return prog_stmt_intrinsic_create((prog_intr_type_t)itype, rstmt);
+	rc = prog_stmt_alloc(mod->arena, progst_intrinsic, &stmt);
+	if (rc != 0)
+		return rc;
+
+	stmt->s.sintr.itype = (prog_intr_type_t)itype;
+	stmt->op = (prog_op_t)itype;
+	*rstmt = stmt;
+	return 0;
 }
 
 /** Save intrinsic statement to file.
@@ -837,6 +1468,7 @@ static int prog_stmt_call_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 {
 	char ident[prog_proc_id_len + 1];
 	prog_proc_t *proc;
+	prog_stmt_t *stmt;
 	int rc;
 
 	rc = prog_proc_load_ident(f, ident);
@@ -847,7 +1479,13 @@ static int prog_stmt_call_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 	if (proc == NULL)
 		return EIO;
 
-	return prog_stmt_call_create(proc, rstmt);
+	rc = prog_stmt_alloc(mod->arena, progst_call, &stmt);
+	if (rc != 0)
+		return rc;
+
+	prog_stmt_call_set_proc(stmt, proc);
+	*rstmt = stmt;
+	return 0;
 }
 
 /** Save call statement to file.
@@ -877,7 +1515,7 @@ static int prog_stmt_if_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 	int nitem;
 	int rc;
 
-	rc = prog_stmt_if_create(&stmt);
+	rc = prog_stmt_alloc(mod->arena, progst_if, &stmt);
 	if (rc != 0)
 		goto error;
 
@@ -890,8 +1528,10 @@ static int prog_stmt_if_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 		goto error;
 
 	nitem = fscanf(f, "%u\n", &have_false);
-	if (nitem != 1)
-		return EIO;
+	if (nitem != 1) {
+		rc = EIO;
+		goto error;
+	}
 
 	if (have_false != 0) {
 		rc = prog_block_load(mod, f, &stmt->s.sif.bfalse);
@@ -959,17 +1599,23 @@ static int prog_stmt_repeat_load(prog_module_t *mod, FILE *f,
 	int nitem;
 	int rc;
 
-	rc = prog_stmt_repeat_create(&stmt);
+	rc = prog_stmt_alloc(mod->arena, progst_repeat, &stmt);
 	if (rc != 0)
 		goto error;
 
 	nitem = fscanf(f, "%u\n", &repcnt);
-	if (nitem != 1)
-		return EIO;
+	if (nitem != 1) {
+		rc = EIO;
+		goto error;
+	}
+
+	stmt->s.srepeat.repcnt = repcnt;
 
 	nitem = fscanf(f, "%u\n", &have_scond);
-	if (nitem != 1)
-		return EIO;
+	if (nitem != 1) {
+		rc = EIO;
+		goto error;
+	}
 
 	if (have_scond != 0) {
 		rc = prog_cond_load(f, &stmt->s.srepeat.scond);
@@ -984,8 +1630,10 @@ static int prog_stmt_repeat_load(prog_module_t *mod, FILE *f,
 		goto error;
 
 	nitem = fscanf(f, "%u\n", &have_econd);
-	if (nitem != 1)
-		return EIO;
+	if (nitem != 1) {
+		rc = EIO;
+		goto error;
+	}
 
 	if (have_econd != 0) {
 		rc = prog_cond_load(f, &stmt->s.srepeat.econd);
@@ -1050,11 +1698,13 @@ static int prog_stmt_repeat_save(prog_stmt_t *stmt, FILE *f)
 
 /** Load recurse statement from file.
  *
+ * @param mod Containing module
  * @param f File
  * @param rstmt Place to store pointer to new statement
  * @return Zero on success or an error code
  */
-static int prog_stmt_recurse_load(FILE *f, prog_stmt_t **rstmt)
+static int prog_stmt_recurse_load(prog_module_t *mod, FILE *f,
+    prog_stmt_t **rstmt)
 {
 	char c;
 	int nitem;
@@ -1066,7 +1716,7 @@ static int prog_stmt_recurse_load(FILE *f, prog_stmt_t **rstmt)
 	if (c != 'R')
 		return EIO;
 
-	return prog_stmt_recurse_create(rstmt);
+	return prog_stmt_alloc(mod->arena, progst_recurse, rstmt);
 }
 
 /** Save recurse statement to file.
@@ -1110,7 +1760,7 @@ int prog_stmt_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 
 	switch (stype) {
 	case progst_intrinsic:
-		return prog_stmt_intrinsic_load(f, rstmt);
+		return prog_stmt_intrinsic_load(mod, f, rstmt);
 	case progst_call:
 		return prog_stmt_call_load(mod, f, rstmt);
 	case progst_if:
@@ -1118,7 +1768,7 @@ int prog_stmt_load(prog_module_t *mod, FILE *f, prog_stmt_t **rstmt)
 	case progst_repeat:
 		return prog_stmt_repeat_load(mod, f, rstmt);
 	case progst_recurse:
-		return prog_stmt_recurse_load(f, rstmt);
+		return prog_stmt_recurse_load(mod, f, rstmt);
 	}
 
 	return EINVAL;
@@ -25,6 +25,8 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include "adt/arena.h"
+#include "adt/hmap.h"
 #include "adt/list.h"
 
 enum {
@@ -67,6 +69,27 @@ typedef enum {
 	progst_recurse = 4
 } prog_stmt_type_t;
 
+/** Statement opcode
+ *
+ * Combines statement type and intrinsic type so that the interpreter
+ * can dispatch on a single value.
+ */
+typedef enum {
+	progop_turn_left = progin_turn_left,
+	progop_move = progin_move,
+	progop_put_white = progin_put_white,
+	progop_put_grey = progin_put_grey,
+	progop_put_black = progin_put_black,
+	progop_pick_up = progin_pick_up,
+	progop_call,
+	progop_if,
+	progop_repeat,
+	progop_recurse,
+	/** Breakpoint (the actual opcode is given by the statement) */
+	progop_break,
+	progop_limit
+} prog_op_t;
+
 /** Program condition type */
 typedef enum {
 	/** Wall */
@@ -99,25 +122,88 @@ typedef struct {
 
 /** Program block */
 typedef struct {
+	/** Arena the block was allocated from or @c NULL */
+	arena_t *arena;
 	/** Statements */
-	list_t stmts; /* of prog_stmt_t */
+	struct prog_stmt **stmts;
+	/** Number of statements */
+	unsigned nstmts;
+	/** Allocated size of @c stmts */
+	unsigned alloc_stmts;
 } prog_block_t;
 
 /** Program module */
 typedef struct {
 	list_t procs; /* of prog_proc_t */
+	/** Procedures by identifier */
+	hmap_t *proc_idx;
+	/** Arena for nodes created while loading the module */
+	arena_t *arena;
+	/** Are call graph analysis results up to date? */
+	bool cg_valid;
+	/** Change journal or @c NULL */
+	struct journal *journal;
 } prog_module_t;
 
-/** Program procedure */
+/** Movement effect of a procedure
+ *
+ * Summarizes a procedure that only moves and turns left (directly or
+ * through calls). Offsets are relative to the robot's starting position
+ * and direction, in units of one step forward and one step to the left.
+ */
 typedef struct {
+	/** Offsets of tiles entered, in order (forward, left pairs) */
+	int *path;
+	/** Number of tiles entered */
+	unsigned npath;
+	/** Final forward offset */
+	int df;
+	/** Final left offset */
+	int dl;
+	/** Number of left turns (modulo 4) */
+	unsigned rot;
+	/** Number of statements executed */
+	unsigned long nsteps;
+	/** Number of turn left statements executed */
+	unsigned long nturns;
+} prog_effect_t;
+
+/** Program procedure */
+typedef struct prog_proc {
 	/** Containing module */
 	prog_module_t *mod;
+	/** Arena the procedure was allocated from or @c NULL */
+	arena_t *arena;
 	/** Link to @c mod->procs */
 	link_t lprocs;
 	/** Body */
 	prog_block_t *body;
 	/** Icon identifier */
 	char *ident;
+	/** Call statements calling this procedure (prog_stmt_t) */
+	list_t callers;
+	/** Number of robot stack frames / robots executing this procedure */
+	unsigned stack_refs;
+	/** Maximum robot stack depth needed to run this procedure */
+	unsigned max_depth;
+	/** Can this procedure recurse without bound? */
+	bool unbounded;
+	/** Movement effect or @c NULL if procedure is not map-independent */
+	prog_effect_t *effect;
+	/** Identical procedure whose code and analysis are shared or self */
+	struct prog_proc *canon;
+	/** Statements in pre-order (valid if @c stmt_tab_valid) */
+	struct prog_stmt **stmt_tab;
+	/** Number of entries in @c stmt_tab */
+	unsigned nstmt_tab;
+	/** Is @c stmt_tab up to date with the body? */
+	bool stmt_tab_valid;
+	/** Recorded run in which procedure was first entered (see rerun.c) */
+	unsigned long rerun_seq;
+	/** Step count of the recorded run when procedure was first entered */
+	unsigned long rerun_step;
+	/** Recorded run in which all callees were marked as entered */
+	unsigned long rerun_eseq;
 } prog_proc_t;
 
 /** Program intrinsic */
@@ -130,6 +216,8 @@ typedef struct {
 typedef struct {
 	/** Procedure */
 	prog_proc_t *proc;
+	/** Link to @c proc->callers */
+	link_t lcallers;
 } prog_call_t;
 
 /** If statement */
@@ -159,13 +247,21 @@ typedef struct {
 } prog_repeat_t;
 
 /** Program statement */
-typedef struct {
+typedef struct prog_stmt {
 	/** Statement type */
 	prog_stmt_type_t stype;
+	/** Opcode (progop_break if statement has a breakpoint) */
+	prog_op_t op;
+	/** Does statement have a breakpoint? */
+	bool breakpoint;
+	/** Arena the statement was allocated from or @c NULL */
+	arena_t *arena;
 	/** Containing block */
 	prog_block_t *block;
-	/** Link to @c block->stmts */
-	link_t lstmts;
+	/** Index in @c block->stmts */
+	unsigned idx;
+	/** Linear index in procedure (see prog_proc_get_stmt_index()) */
+	unsigned pidx;
 	union {
 		/** Intrinsic statement */
 		prog_intr_t sintr;
@@ -180,7 +276,8 @@ typedef struct {
 
 extern int prog_module_create(prog_module_t **);
 extern void prog_module_destroy(prog_module_t *);
-extern void prog_module_append(prog_module_t *, prog_proc_t *);
+extern int prog_module_append(prog_module_t *, prog_proc_t *);
+extern void prog_module_set_journal(prog_module_t *, struct journal *);
 extern int prog_module_load(FILE *, prog_module_t **);
 extern int prog_module_save(prog_module_t *, FILE *);
 extern int prog_module_gen_ident(prog_module_t *, char **);
@@ -189,19 +286,37 @@ extern prog_proc_t *prog_module_next(prog_proc_t *);
 extern prog_proc_t *prog_module_last(prog_module_t *);
 extern prog_proc_t *prog_module_prev(prog_proc_t *);
 extern prog_proc_t *prog_module_proc_by_ident(prog_module_t *, const char *);
+extern int prog_module_delete_proc(prog_proc_t *);
 extern int prog_proc_create(const char *, prog_proc_t **);
 extern void prog_proc_destroy(prog_proc_t *);
 extern int prog_proc_load(prog_module_t *, FILE *, prog_proc_t **);
 extern int prog_proc_save(prog_proc_t *, FILE *);
 extern int prog_proc_load_ident(FILE *, char *);
 extern int prog_proc_save_ident(const char *, FILE *);
-extern unsigned prog_proc_get_stmt_index(prog_proc_t *, prog_stmt_t *);
+extern int prog_proc_get_stmt_index(prog_proc_t *, prog_stmt_t *,
+    unsigned *);
 extern prog_stmt_t *prog_proc_stmt_by_index(prog_proc_t *, unsigned);
+extern prog_stmt_t *prog_proc_first_caller(prog_proc_t *);
+extern prog_stmt_t *prog_proc_next_caller(prog_stmt_t *);
+extern void prog_proc_stack_ref(prog_proc_t *);
+extern void prog_proc_stack_unref(prog_proc_t *);
+extern bool prog_proc_is_referenced(prog_proc_t *);
+extern int prog_proc_remove_stmt(prog_proc_t *, prog_stmt_t *);
+extern int prog_proc_set_body(prog_proc_t *, prog_block_t *);
+extern void prog_proc_changed(prog_proc_t *);
+extern void prog_proc_set_effect(prog_proc_t *, prog_effect_t *);
+extern void prog_proc_set_breakpoint(prog_proc_t *, prog_stmt_t *, bool);
+extern void prog_effect_destroy(prog_effect_t *);
 extern int prog_block_create(prog_block_t **);
 extern void prog_block_destroy(prog_block_t *);
-extern void prog_block_append(prog_block_t *, prog_stmt_t *);
+extern int prog_block_reserve(prog_block_t *, unsigned);
+extern int prog_block_insert(prog_block_t *, unsigned, prog_stmt_t *);
+extern int prog_block_append(prog_block_t *, prog_stmt_t *);
+extern void prog_block_remove(prog_stmt_t *);
 extern int prog_block_load(prog_module_t *, FILE *, prog_block_t **);
 extern int prog_block_save(prog_block_t *, FILE *);
+extern unsigned prog_block_count(prog_block_t *);
+extern prog_stmt_t *prog_block_stmt_by_index(prog_block_t *, unsigned);
 extern prog_stmt_t *prog_block_first(prog_block_t *);
 extern prog_stmt_t *prog_block_next(prog_stmt_t *);
 extern prog_stmt_t *prog_block_last(prog_block_t *);
@@ -212,6 +327,7 @@ extern int prog_stmt_if_create(prog_stmt_t **);
 extern int prog_stmt_repeat_create(prog_stmt_t **);
 extern int prog_stmt_recurse_create(prog_stmt_t **);
 extern void prog_stmt_destroy(prog_stmt_t *);
+extern prog_op_t prog_stmt_base_op(prog_stmt_t *);
 extern int prog_stmt_load(prog_module_t *, FILE *, prog_stmt_t **);
 extern int prog_stmt_save(prog_stmt_t *, FILE *);
 
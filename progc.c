@@ -0,0 +1,657 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Native program code
+ *
+ * A program module is translated to C source with one function per
+ * procedure. Structurally identical procedures (see proghash_cons())
+ * share one function. The source is compiled into a shared object with
+ * the system C compiler and loaded with dlopen().
+ *
+ * Generated code only executes intrinsic statements. Calls (and any
+ * statements not supported natively) are handed back to the interpreter,
+ * which keeps the robot stack exactly as if the whole program had been
+ * interpreted. Generated code counts the statements it executes against
+ * a budget and stops when it is used up, so execution can be suspended
+ * and resumed after any number of statements, exactly like with
+ * robot_run().
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "adt/hmap.h"
+#include "prog.h"
+#include "progc.h"
+#include "proghash.h"
+#include "robot.h"
+
+static int progc_intr_turn_left(void *);
+static int progc_intr_move(void *);
+static int progc_intr_put_white(void *);
+static int progc_intr_put_grey(void *);
+static int progc_intr_put_black(void *);
+static int progc_intr_pick_up(void *);
+
+/** Intrinsic functions indexed by intrinsic type */
+static const progc_intr_fn_t progc_intr[progin_limit] = {
+	[progin_turn_left] = progc_intr_turn_left,
+	[progin_move] = progc_intr_move,
+	[progin_put_white] = progc_intr_put_white,
+	[progin_put_grey] = progc_intr_put_grey,
+	[progin_put_black] = progc_intr_put_black,
+	[progin_pick_up] = progc_intr_pick_up
+};
+
+/** Emit C string literal.
+ *
+ * @param str String
+ * @param f Output file
+ * @return Zero on success, EIO on I/O error
+ */
+static int progc_emit_str(const char *str, FILE *f)
+{
+	int rv;
+
+	if (fputc('"', f) == EOF)
+		return EIO;
+
+	while (*str != '\0') {
+		if (isalnum((unsigned char)*str))
+			rv = fputc(*str, f);
+		else
+			rv = fprintf(f, "\\%03o", (unsigned char)*str);
+		if (rv < 0)
+			return EIO;
+		++str;
+	}
+
+	if (fputc('"', f) == EOF)
+		return EIO;
+
+	return 0;
+}
+
+/** Emit C function for procedure.
+ *
+ * @param proc Procedure
+ * @param idx Procedure index
+ * @param f Output file
+ * @return Zero on success, EIO on I/O error
+ */
+static int progc_emit_proc(prog_proc_t *proc, unsigned idx, FILE *f)
+{
+	prog_stmt_t *stmt;
+	unsigned i;
+	int rv;
+
+	rv = fprintf(f, "\nstatic int p%u(const intr_fn_t *intr, void *robot, "
+	    "unsigned *pc,\n    unsigned long *steps)\n{\n"
+	    "\tswitch (*pc) {\n", idx);
+	if (rv < 0)
+		return EIO;
+
+	stmt = prog_block_first(proc->body);
+	i = 0;
+	while (stmt != NULL) {
+		if (stmt->stype == progst_intrinsic && !stmt->breakpoint) {
+			rv = fprintf(f, "\tcase %u:\n"
+			    "\t\tif (*steps == 0) {\n"
+			    "\t\t\t*pc = %u;\n"
+			    "\t\t\treturn 1;\n"
+			    "\t\t}\n"
+			    "\t\t--*steps;\n"
+			    "\t\tif (intr[%u](robot)) {\n"
+			    "\t\t\t*pc = %u;\n"
+			    "\t\t\treturn 2;\n"
+			    "\t\t}\n", i, i, (unsigned)stmt->s.sintr.itype, i);
+		} else {
+			/* Leave to interpreter */
+			rv = fprintf(f, "\tcase %u:\n"
+			    "\t\t*pc = %u;\n"
+			    "\t\treturn 1;\n", i, i);
+		}
+
+		if (rv < 0)
+			return EIO;
+
+		stmt = prog_block_next(stmt);
+		++i;
+	}
+
+	rv = fprintf(f, "\t}\n\n\treturn 0;\n}\n");
+	if (rv < 0)
+		return EIO;
+
+	return 0;
+}
+
+/** Emit C source for program module.
+ *
+ * The generated source defines:
+ *   - karlik_progc_abi: interface version (progc_abi_version)
+ *   - karlik_idents: NULL-terminated array of procedure identifiers
+ *   - karlik_fn_idx: function index for each procedure identifier
+ *   - karlik_procs: NULL-terminated array of procedure functions
+ *     (progc_fn_t)
+ *
+ * @param mod Program module
+ * @param f Output file
+ * @return Zero on success, EIO on I/O error, ENOMEM if out of memory
+ */
+int progc_emit(prog_module_t *mod, FILE *f)
+{
+	prog_proc_t *proc;
+	hmap_t *fn_no = NULL;
+	hmap_entry_t *entry;
+	unsigned idx;
+	unsigned i;
+	int rc;
+	int rv;
+
+	rc = proghash_cons(mod, NULL);
+	if (rc != 0)
+		return rc;
+
+	rc = hmap_create(hmk_int, &fn_no);
+	if (rc != 0)
+		return rc;
+
+	rv = fprintf(f, "/* Generated by Karlik. Do not edit. */\n\n"
+	    "typedef int (*intr_fn_t)(void *);\n\n"
+	    "const int karlik_progc_abi = %d;\n", progc_abi_version);
+	if (rv < 0)
+		goto ioerror;
+
+	/* One function per canonical procedure */
+	idx = 0;
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		if (proc->canon == proc) {
+			rc = hmap_insert_int(fn_no, (uintptr_t)proc,
+			    (void *)(uintptr_t)idx);
+			if (rc != 0)
+				goto error;
+
+			rc = progc_emit_proc(proc, idx, f);
+			if (rc != 0)
+				goto error;
+
+			++idx;
+		}
+
+		proc = prog_module_next(proc);
+	}
+
+	rv = fprintf(f, "\nconst char *const karlik_idents[] = {\n");
+	if (rv < 0)
+		goto ioerror;
+
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		if (fputc('\t', f) == EOF)
+			goto ioerror;
+
+		rc = progc_emit_str(proc->ident, f);
+		if (rc != 0)
+			goto error;
+
+		if (fputs(",\n", f) == EOF)
+			goto ioerror;
+
+		proc = prog_module_next(proc);
+	}
+
+	rv = fprintf(f, "\t0\n};\n\nconst unsigned karlik_fn_idx[] = {\n");
+	if (rv < 0)
+		goto ioerror;
+
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		entry = hmap_find_int(fn_no, (uintptr_t)proc->canon);
+		assert(entry != NULL);
+		rv = fprintf(f, "\t%u,\n", (unsigned)(uintptr_t)entry->value);
+		if (rv < 0)
+			goto ioerror;
+
+		proc = prog_module_next(proc);
+	}
+
+	rv = fprintf(f, "\t0\n};\n\n"
+	    "int (*const karlik_procs[])(const intr_fn_t *, void *, "
+	    "unsigned *,\n    unsigned long *) = {\n");
+	if (rv < 0)
+		goto ioerror;
+
+	for (i = 0; i < idx; i++) {
+		rv = fprintf(f, "\tp%u,\n", i);
+		if (rv < 0)
+			goto ioerror;
+	}
+
+	rv = fprintf(f, "\t0\n};\n");
+	if (rv < 0)
+		goto ioerror;
+
+	hmap_destroy(fn_no);
+	return 0;
+ioerror:
+	rc = EIO;
+error:
+	hmap_destroy(fn_no);
+	return rc;
+}
+
+/** Compile C source into shared object.
+ *
+ * Uses the compiler specified by the CC environment variable or @c cc.
+ *
+ * @param src Source file name
+ * @param obj Output file name
+ * @return Zero on success, EIO if compilation failed, ENOMEM if out
+ *         of memory
+ */
+static int progc_cc(const char *src, const char *obj)
+{
+	const char *fmt = "%s -O2 -shared -fPIC -w -o '%s' '%s'";
+	const char *cc;
+	char *cmd;
+	size_t size;
+	int rv;
+
+	cc = getenv("CC");
+	if (cc == NULL)
+		cc = "cc";
+
+	size = strlen(fmt) + strlen(cc) + strlen(obj) + strlen(src) + 1;
+	cmd = malloc(size);
+	if (cmd == NULL)
+		return ENOMEM;
+
+	snprintf(cmd, size, fmt, cc, obj, src);
+	rv = system(cmd);
+	free(cmd);
+	if (rv != 0)
+		return EIO;
+
+	return 0;
+}
+
+/** Bind loaded procedure functions to module procedures.
+ *
+ * @param progc Native code with shared object loaded
+ * @return Zero on success, EIO if the shared object does not match
+ *         the module, ENOMEM if out of memory
+ */
+static int progc_bind(progc_t *progc)
+{
+	const int *abi;
+	const char *const *idents;
+	const unsigned *fn_idx;
+	prog_proc_t *proc;
+	uintptr_t nfns;
+	uintptr_t i;
+	int rc;
+
+	abi = dlsym(progc->handle, "karlik_progc_abi");
+	idents = dlsym(progc->handle, "karlik_idents");
+	fn_idx = dlsym(progc->handle, "karlik_fn_idx");
+	progc->fns = dlsym(progc->handle, "karlik_procs");
+	if (abi == NULL || idents == NULL || fn_idx == NULL ||
+	    progc->fns == NULL)
+		return EIO;
+
+	if (*abi != progc_abi_version)
+		return EIO;
+
+	nfns = 0;
+	while (progc->fns[nfns] != NULL)
+		++nfns;
+
+	for (i = 0; idents[i] != NULL; i++) {
+		proc = prog_module_proc_by_ident(progc->mod, idents[i]);
+		if (proc == NULL || fn_idx[i] >= nfns)
+			return EIO;
+
+		rc = hmap_insert_int(progc->fn_idx, (uintptr_t)proc,
+		    (void *)(uintptr_t)fn_idx[i]);
+		if (rc != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/** Compile program module to native code.
+ *
+ * The module must not be modified while the native code is in use.
+ *
+ * @param mod Program module
+ * @param rprogc Place to store pointer to new native code
+ * @return Zero on success, EIO if generating, compiling or loading
+ *         the code failed, ENOMEM if out of memory
+ */
+int progc_compile(prog_module_t *mod, progc_t **rprogc)
+{
+	progc_t *progc = NULL;
+	char dname[] = "/tmp/karlikXXXXXX";
+	char src[sizeof(dname) + 8];
+	char obj[sizeof(dname) + 8];
+	bool have_dir = false;
+	FILE *f = NULL;
+	int rc;
+
+	progc = calloc(1, sizeof(progc_t));
+	if (progc == NULL)
+		return ENOMEM;
+
+	progc->mod = mod;
+
+	rc = hmap_create(hmk_int, &progc->fn_idx);
+	if (rc != 0)
+		goto error;
+
+	if (mkdtemp(dname) == NULL) {
+		rc = EIO;
+		goto error;
+	}
+
+	have_dir = true;
+	snprintf(src, sizeof(src), "%s/prog.c", dname);
+	snprintf(obj, sizeof(obj), "%s/prog.so", dname);
+
+	f = fopen(src, "wt");
+	if (f == NULL) {
+		rc = EIO;
+		goto error;
+	}
+
+	rc = progc_emit(mod, f);
+	if (rc != 0)
+		goto error;
+
+	if (fclose(f) < 0) {
+		f = NULL;
+		rc = EIO;
+		goto error;
+	}
+
+	f = NULL;
+
+	rc = progc_cc(src, obj);
+	if (rc != 0)
+		goto error;
+
+	progc->handle = dlopen(obj, RTLD_NOW | RTLD_LOCAL);
+	if (progc->handle == NULL) {
+		rc = EIO;
+		goto error;
+	}
+
+	rc = progc_bind(progc);
+	if (rc != 0)
+		goto error;
+
+	(void) remove(obj);
+	(void) remove(src);
+	(void) rmdir(dname);
+	*rprogc = progc;
+	return 0;
+error:
+	if (f != NULL)
+		fclose(f);
+	if (have_dir) {
+		(void) remove(obj);
+		(void) remove(src);
+		(void) rmdir(dname);
+	}
+	progc_destroy(progc);
+	return rc;
+}
+
+/** Destroy native code.
+ *
+ * @param progc Native code or @c NULL
+ */
+void progc_destroy(progc_t *progc)
+{
+	if (progc == NULL)
+		return;
+
+	if (progc->handle != NULL)
+		dlclose(progc->handle);
+	hmap_destroy(progc->fn_idx);
+	free(progc);
+}
+
+/** Get native function for procedure.
+ *
+ * @param progc Native code
+ * @param proc Procedure
+ * @return Function or @c NULL if procedure was not compiled
+ */
+static progc_fn_t progc_proc_fn(progc_t *progc, prog_proc_t *proc)
+{
+	hmap_entry_t *entry;
+
+	entry = hmap_find_int(progc->fn_idx, (uintptr_t)proc);
+	if (entry == NULL)
+		return NULL;
+
+	return progc->fns[(uintptr_t)entry->value];
+}
+
+/** Execute robot up to the next statement not executed natively.
+ *
+ * Runs native code of the current procedure until it reaches a statement
+ * that is not executed natively, the end of the procedure or the end of
+ * the budget. A statement that is not executed natively is then executed
+ * by the interpreter. Procedures that have no native code are interpreted
+ * one statement at a time.
+ *
+ * Statements are counted the same way as by robot_run().
+ *
+ * @param progc Native code
+ * @param robot Robot
+ * @param max_steps Maximum number of statements to execute
+ * @param rsteps Place to store number of statements executed
+ * @return Zero on success, EINTR if robot stopped at a breakpoint
+ *         or watchpoint or an error code (as robot_run())
+ */
+int progc_step(progc_t *progc, robot_t *robot, unsigned long max_steps,
+    unsigned long *rsteps)
+{
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+	progc_fn_t fn;
+	unsigned long left;
+	unsigned long isteps;
+	unsigned pc;
+	int rv;
+	int rc;
+
+	*rsteps = 0;
+
+	proc = robot_cur_proc(robot);
+	stmt = robot_cur_stmt(robot);
+	if (stmt == NULL || robot_error(robot) != errt_none)
+		return EINVAL;
+
+	if (max_steps == 0)
+		return 0;
+
+	fn = progc_proc_fn(progc, proc);
+	if (fn == NULL || stmt->block != proc->body)
+		return robot_run(robot, 1, rsteps);
+
+	pc = stmt->idx;
+	left = max_steps;
+	robot->halt = false;
+	rv = fn(progc_intr, robot, &pc, &left);
+	*rsteps = max_steps - left;
+
+	if (rv == 0) {
+		/* End of procedure */
+		robot_advance(robot, NULL);
+		return 0;
+	}
+
+	stmt = prog_block_stmt_by_index(proc->body, pc);
+	if (rv == 1) {
+		/* Stopped before statement */
+		robot_advance(robot, stmt);
+		if (left == 0)
+			return 0;
+
+		/* Let the interpreter execute the statement */
+		rc = robot_run(robot, 1, &isteps);
+		*rsteps += isteps;
+		return rc;
+	}
+
+	if (robot_error(robot) != errt_none) {
+		/* Failed statement remains current */
+		robot_advance(robot, stmt);
+		return 0;
+	}
+
+	/* Watchpoint hit */
+	robot_advance(robot, prog_block_next(stmt));
+	return EINTR;
+}
+
+/** Run robot for a number of steps using native code.
+ *
+ * Equivalent to robot_run(), the robot stops at exactly the same state.
+ *
+ * @param progc Native code
+ * @param robot Robot
+ * @param max_steps Maximum number of statements to execute
+ * @param rsteps Place to store number of statements executed or @c NULL
+ * @return Zero on success, EINTR if robot stopped at a breakpoint
+ *         or watchpoint or an error code (as robot_run())
+ */
+int progc_run(progc_t *progc, robot_t *robot, unsigned long max_steps,
+    unsigned long *rsteps)
+{
+	unsigned long steps = 0;
+	unsigned long n;
+	int rc = 0;
+
+	while (steps < max_steps && robot_is_busy(robot) &&
+	    robot_error(robot) == errt_none) {
+		rc = progc_step(progc, robot, max_steps - steps, &n);
+		steps += n;
+		if (rc != 0)
+			break;
+	}
+
+	if (rsteps != NULL)
+		*rsteps = steps;
+	return rc;
+}
+
+/** Turn robot left (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_turn_left(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_turn_left(robot);
+	return robot->halt;
+}
+
+/** Move robot (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_move(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_move(robot);
+	return robot->halt;
+}
+
+/** Put white tag (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_put_white(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_put_white(robot);
+	return robot->halt;
+}
+
+/** Put grey tag (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_put_grey(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_put_grey(robot);
+	return robot->halt;
+}
+
+/** Put black tag (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_put_black(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_put_black(robot);
+	return robot->halt;
+}
+
+/** Pick up tag (intrinsic).
+ *
+ * @param arg Robot (robot_t *)
+ * @return Non-zero if robot must stop (error or watchpoint hit)
+ */
+static int progc_intr_pick_up(void *arg)
+{
+	robot_t *robot = (robot_t *)arg;
+
+	robot_pick_up(robot);
+	return robot->halt;
+}
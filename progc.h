@@ -0,0 +1,77 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Native program code
+ */
+
+#ifndef PROGC_H
+#define PROGC_H
+
+#include <stdio.h>
+#include "adt/hmap.h"
+#include "prog.h"
+#include "robot.h"
+
+enum {
+	/** Version of interface between runtime and generated code */
+	progc_abi_version = 3
+};
+
+/** Intrinsic function called by generated code.
+ *
+ * Returns non-zero if the robot must stop (error or watchpoint hit).
+ */
+typedef int (*progc_intr_fn_t)(void *);
+
+/** Generated procedure function.
+ *
+ * Executes procedure body starting at statement index @c *pc, decrementing
+ * @c *steps for each statement executed. Returns zero when the end of
+ * the body is reached. Returns one with @c *pc set to the index of
+ * the statement it stopped before, which is either a statement that is
+ * not executed natively (such as a call or a statement with a breakpoint)
+ * or the next statement when @c *steps reached zero. Returns two with
+ * @c *pc set to the index of an intrinsic after which the robot must stop.
+ */
+typedef int (*progc_fn_t)(const progc_intr_fn_t *, void *, unsigned *,
+    unsigned long *);
+
+/** Native code for a program module */
+typedef struct {
+	/** Program module */
+	prog_module_t *mod;
+	/** Shared object handle */
+	void *handle;
+	/** Procedure functions */
+	const progc_fn_t *fns;
+	/** Procedure to function index map */
+	hmap_t *fn_idx;
+} progc_t;
+
+extern int progc_emit(prog_module_t *, FILE *);
+extern int progc_compile(prog_module_t *, progc_t **);
+extern void progc_destroy(progc_t *);
+extern int progc_step(progc_t *, robot_t *, unsigned long, unsigned long *);
+extern int progc_run(progc_t *, robot_t *, unsigned long, unsigned long *);
+
+#endif
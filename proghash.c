@@ -0,0 +1,471 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Structural program hash
+ *
+ * The hash of a procedure covers its body and the bodies of all
+ * procedures it (transitively) calls. Procedure identifiers are not
+ * hashed. Instead, called procedures are numbered in the order in which
+ * they are first encountered when scanning bodies and a call statement
+ * hashes the number of its callee. Procedures that differ only in their
+ * identifiers therefore hash equal.
+ *
+ * proghash_body() hashes a single body, with callees hashed by their
+ * identifiers, so that a change can be attributed to the procedure whose
+ * body was edited.
+ *
+ * Hash-consing uses the same traversal to find procedures that are
+ * structurally identical (including breakpoints). Each such procedure
+ * points to the first of them in the module (@c canon), whose native
+ * code and analysis results it shares.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adt/hmap.h"
+#include "adt/vector.h"
+#include "prog.h"
+#include "proghash.h"
+
+/** Structural hash computation state */
+typedef struct {
+	/** Current hash value */
+	uint64_t hash;
+	/** Procedures in order of numbering (prog_proc_t *) */
+	vector_t procs;
+	/** Procedure number by procedure address */
+	hmap_t *proc_no;
+	/** Include breakpoints? */
+	bool bps;
+	/** Hash callees by identifier instead of numbering them? */
+	bool local;
+	/** Vector to record hashed values to (uint64_t) or @c NULL */
+	vector_t *tokens;
+	/** Error that occurred while recording values */
+	int error;
+} proghash_t;
+
+/** Canonical procedure (used during hash-consing) */
+typedef struct {
+	/** Procedure */
+	prog_proc_t *proc;
+	/** Hashed values (uint64_t) */
+	vector_t tokens;
+} proghash_canon_t;
+
+static int proghash_block(proghash_t *, prog_block_t *);
+
+/** Mix value into hash.
+ *
+ * @param ph Hash computation state
+ * @param v Value
+ */
+static void proghash_mix(proghash_t *ph, uint64_t v)
+{
+	ph->hash = hmap_hash_int(ph->hash ^ (v + 0x9e3779b97f4a7c15ULL +
+	    (ph->hash << 6) + (ph->hash >> 2)));
+
+	if (ph->tokens != NULL && ph->error == 0)
+		ph->error = vector_append(ph->tokens, &v);
+}
+
+/** Get procedure number, numbering the procedure if it is new.
+ *
+ * @param ph Hash computation state
+ * @param proc Procedure
+ * @param rno Place to store procedure number
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int proghash_proc_no(proghash_t *ph, prog_proc_t *proc,
+    uint64_t *rno)
+{
+	hmap_entry_t *entry;
+	uint64_t no;
+	int rc;
+
+	entry = hmap_find_int(ph->proc_no, (uint64_t)(uintptr_t)proc);
+	if (entry != NULL) {
+		*rno = (uint64_t)(uintptr_t)entry->value;
+		return 0;
+	}
+
+	no = vector_count(&ph->procs);
+	rc = vector_append(&ph->procs, &proc);
+	if (rc != 0)
+		return rc;
+
+	rc = hmap_insert_int(ph->proc_no, (uint64_t)(uintptr_t)proc,
+	    (void *)(uintptr_t)no);
+	if (rc != 0)
+		return rc;
+
+	*rno = no;
+	return 0;
+}
+
+/** Hash condition.
+ *
+ * @param ph Hash computation state
+ * @param cond Condition
+ */
+static void proghash_cond(proghash_t *ph, prog_cond_t *cond)
+{
+	proghash_mix(ph, cond->not);
+	proghash_mix(ph, cond->ctype);
+}
+
+/** Hash statement.
+ *
+ * @param ph Hash computation state
+ * @param stmt Statement
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int proghash_stmt(proghash_t *ph, prog_stmt_t *stmt)
+{
+	prog_repeat_t *rep;
+	uint64_t no;
+	int rc;
+
+	proghash_mix(ph, stmt->stype);
+	if (ph->bps)
+		proghash_mix(ph, stmt->breakpoint);
+
+	switch (stmt->stype) {
+	case progst_intrinsic:
+		proghash_mix(ph, stmt->s.sintr.itype);
+		break;
+	case progst_call:
+		if (ph->local) {
+			proghash_mix(ph,
+			    hmap_hash_str(stmt->s.scall.proc->ident));
+			break;
+		}
+
+		rc = proghash_proc_no(ph, stmt->s.scall.proc, &no);
+		if (rc != 0)
+			return rc;
+		proghash_mix(ph, no);
+		break;
+	case progst_if:
+		proghash_cond(ph, &stmt->s.sif.cond);
+		rc = proghash_block(ph, stmt->s.sif.btrue);
+		if (rc != 0)
+			return rc;
+		rc = proghash_block(ph, stmt->s.sif.bfalse);
+		if (rc != 0)
+			return rc;
+		break;
+	case progst_repeat:
+		rep = &stmt->s.srepeat;
+		proghash_mix(ph, rep->repcnt);
+		proghash_mix(ph, rep->have_scond);
+		if (rep->have_scond)
+			proghash_cond(ph, &rep->scond);
+		rc = proghash_block(ph, rep->body);
+		if (rc != 0)
+			return rc;
+		proghash_mix(ph, rep->have_econd);
+		if (rep->have_econd)
+			proghash_cond(ph, &rep->econd);
+		break;
+	case progst_recurse:
+		break;
+	}
+
+	return 0;
+}
+
+/** Hash block.
+ *
+ * @param ph Hash computation state
+ * @param block Block or @c NULL
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int proghash_block(proghash_t *ph, prog_block_t *block)
+{
+	prog_stmt_t *stmt;
+	int rc;
+
+	if (block == NULL) {
+		proghash_mix(ph, UINT64_MAX);
+		return 0;
+	}
+
+	proghash_mix(ph, prog_block_count(block));
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		rc = proghash_stmt(ph, stmt);
+		if (rc != 0)
+			return rc;
+
+		stmt = prog_block_next(stmt);
+	}
+
+	return 0;
+}
+
+/** Hash procedure and the procedures it calls.
+ *
+ * @param proc Procedure
+ * @param bps @c true to include breakpoints
+ * @param tokens Vector to record hashed values to or @c NULL
+ * @param rhash Place to store hash
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int proghash_proc_graph(prog_proc_t *proc, bool bps, vector_t *tokens,
+    uint64_t *rhash)
+{
+	proghash_t ph;
+	prog_proc_t **pp;
+	uint64_t no;
+	size_t i;
+	int rc;
+
+	ph.hash = 0;
+	ph.bps = bps;
+	ph.local = false;
+	ph.tokens = tokens;
+	ph.error = 0;
+	vector_initialize(&ph.procs, sizeof(prog_proc_t *));
+	rc = hmap_create(hmk_int, &ph.proc_no);
+	if (rc != 0)
+		return rc;
+
+	rc = proghash_proc_no(&ph, proc, &no);
+	if (rc != 0)
+		goto out;
+
+	/* Bodies are hashed in procedure number order */
+	for (i = 0; i < vector_count(&ph.procs); i++) {
+		pp = vector_get(&ph.procs, i);
+		rc = proghash_block(&ph, (*pp)->body);
+		if (rc != 0)
+			goto out;
+	}
+
+	rc = ph.error;
+	if (rc != 0)
+		goto out;
+
+	*rhash = ph.hash;
+out:
+	hmap_destroy(ph.proc_no);
+	vector_fini(&ph.procs);
+	return rc;
+}
+
+/** Compute structural hash of procedure.
+ *
+ * Procedures with the same structure (including the structure of
+ * the procedures they call) hash equal, regardless of their identifiers.
+ * Breakpoints are not taken into account.
+ *
+ * @param proc Procedure
+ * @param rhash Place to store hash
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int proghash_proc(prog_proc_t *proc, uint64_t *rhash)
+{
+	return proghash_proc_graph(proc, false, NULL, rhash);
+}
+
+/** Compute structural hash of procedure body.
+ *
+ * Unlike proghash_proc(), called procedures are not followed. A call
+ * statement hashes the identifier of the callee, so the hash only
+ * changes when the body of this procedure changes. Breakpoints are not
+ * taken into account.
+ *
+ * @param proc Procedure
+ * @return Hash
+ */
+uint64_t proghash_body(prog_proc_t *proc)
+{
+	proghash_t ph;
+	int rc;
+
+	ph.hash = 0;
+	ph.bps = false;
+	ph.local = true;
+	ph.tokens = NULL;
+	ph.error = 0;
+
+	/* Cannot fail since no procedures are numbered */
+	rc = proghash_block(&ph, proc->body);
+	assert(rc == 0);
+	(void) rc;
+
+	return ph.hash;
+}
+
+/** Compare hashes for qsort.
+ *
+ * @param a First hash
+ * @param b Second hash
+ * @return Comparison result
+ */
+static int proghash_cmp(const void *a, const void *b)
+{
+	uint64_t ha = *(const uint64_t *)a;
+	uint64_t hb = *(const uint64_t *)b;
+
+	return ha < hb ? -1 : ha > hb ? 1 : 0;
+}
+
+/** Compute structural hash of program module.
+ *
+ * The hash does not depend on procedure identifiers or the order
+ * of procedures in the module.
+ *
+ * @param mod Program module
+ * @param rhash Place to store hash
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int proghash_module(prog_module_t *mod, uint64_t *rhash)
+{
+	proghash_t ph;
+	prog_proc_t *proc;
+	uint64_t *hashes;
+	unsigned nprocs;
+	unsigned i;
+	int rc;
+
+	nprocs = list_count(&mod->procs);
+	hashes = calloc(nprocs + 1, sizeof(uint64_t));
+	if (hashes == NULL)
+		return ENOMEM;
+
+	i = 0;
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		rc = proghash_proc(proc, &hashes[i++]);
+		if (rc != 0) {
+			free(hashes);
+			return rc;
+		}
+
+		proc = prog_module_next(proc);
+	}
+
+	qsort(hashes, nprocs, sizeof(uint64_t), proghash_cmp);
+
+	ph.hash = 0;
+	ph.tokens = NULL;
+	ph.error = 0;
+	proghash_mix(&ph, nprocs);
+	for (i = 0; i < nprocs; i++)
+		proghash_mix(&ph, hashes[i]);
+
+	free(hashes);
+	*rhash = ph.hash;
+	return 0;
+}
+
+/** Find structurally identical procedures in module.
+ *
+ * Sets @c canon of every procedure in the module to the first procedure
+ * in the module that is structurally identical to it (including
+ * breakpoints), or to the procedure itself.
+ *
+ * @param mod Program module
+ * @param rndups Place to store number of duplicate procedures or @c NULL
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int proghash_cons(prog_module_t *mod, unsigned *rndups)
+{
+	vector_t canons;
+	proghash_canon_t canon;
+	proghash_canon_t *c;
+	hmap_t *canon_idx;
+	hmap_entry_t *entry;
+	prog_proc_t *proc;
+	unsigned ndups = 0;
+	uint64_t hash;
+	size_t i;
+	int rc;
+
+	vector_initialize(&canons, sizeof(proghash_canon_t));
+	rc = hmap_create(hmk_int, &canon_idx);
+	if (rc != 0)
+		return rc;
+
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		proc->canon = proc;
+		proc = prog_module_next(proc);
+	}
+
+	proc = prog_module_first(mod);
+	while (proc != NULL) {
+		canon.proc = proc;
+		vector_initialize(&canon.tokens, sizeof(uint64_t));
+		rc = proghash_proc_graph(proc, true, &canon.tokens, &hash);
+		if (rc != 0) {
+			vector_fini(&canon.tokens);
+			goto out;
+		}
+
+		entry = hmap_find_int(canon_idx, hash);
+		if (entry != NULL) {
+			c = vector_get(&canons, (size_t)(uintptr_t)entry->value);
+			if (vector_count(&c->tokens) ==
+			    vector_count(&canon.tokens) &&
+			    memcmp(c->tokens.data, canon.tokens.data,
+			    vector_count(&c->tokens) * sizeof(uint64_t)) == 0) {
+				proc->canon = c->proc;
+				++ndups;
+			}
+
+			/* On hash collision the procedure stays unshared */
+			vector_fini(&canon.tokens);
+		} else {
+			rc = hmap_insert_int(canon_idx, hash,
+			    (void *)(uintptr_t)vector_count(&canons));
+			if (rc == 0)
+				rc = vector_append(&canons, &canon);
+			if (rc != 0) {
+				vector_fini(&canon.tokens);
+				goto out;
+			}
+		}
+
+		proc = prog_module_next(proc);
+	}
+
+	if (rndups != NULL)
+		*rndups = ndups;
+out:
+	for (i = 0; i < vector_count(&canons); i++) {
+		c = vector_get(&canons, i);
+		vector_fini(&c->tokens);
+	}
+
+	vector_fini(&canons);
+	hmap_destroy(canon_idx);
+	return rc;
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Loop extraction
+ *
+ * Rewrites repeated runs of statements in a procedure (a statement
+ * repeated several times in a row, or a periodic sequence of statements)
+ * into counted repeat statements. This is meant to be applied to learned
+ * procedures, which are always a flat sequence of statements.
+ *
+ * The rewritten procedure behaves exactly the same as the original one.
+ * A counted repeat statement does not count as a step (see
+ * robot_run_cost()) and its loop stack entry does not count against
+ * the robot stack limit (except while a call at the end of the loop body
+ * is executing, when it stands for the call's continuation), so errors,
+ * including stack overflow, occur at the same step as before. Statements
+ * with breakpoints are never extracted.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "prog.h"
+#include "progloop.h"
+
+enum {
+	/** Maximum number of statements in loop body */
+	progloop_max_period = 64
+};
+
+static bool progloop_block_equal(prog_block_t *, prog_block_t *);
+static int progloop_block(prog_block_t *, unsigned *);
+
+/** Compare conditions.
+ *
+ * @param a First condition
+ * @param b Second condition
+ * @return @c true if conditions are equal
+ */
+static bool progloop_cond_equal(prog_cond_t *a, prog_cond_t *b)
+{
+	return a->not == b->not && a->ctype == b->ctype;
+}
+
+/** Compare statements structurally.
+ *
+ * @param a First statement
+ * @param b Second statement
+ * @return @c true if statements are equal (statements with breakpoints
+ *         are never equal)
+ */
+static bool progloop_stmt_equal(prog_stmt_t *a, prog_stmt_t *b)
+{
+	prog_repeat_t *ra, *rb;
+
+	if (a->breakpoint || b->breakpoint || a->stype != b->stype)
+		return false;
+
+	switch (a->stype) {
+	case progst_intrinsic:
+		return a->s.sintr.itype == b->s.sintr.itype;
+	case progst_call:
+		return a->s.scall.proc == b->s.scall.proc;
+	case progst_if:
+		return progloop_cond_equal(&a->s.sif.cond, &b->s.sif.cond) &&
+		    progloop_block_equal(a->s.sif.btrue, b->s.sif.btrue) &&
+		    progloop_block_equal(a->s.sif.bfalse, b->s.sif.bfalse);
+	case progst_repeat:
+		ra = &a->s.srepeat;
+		rb = &b->s.srepeat;
+		if (ra->repcnt != rb->repcnt ||
+		    ra->have_scond != rb->have_scond ||
+		    ra->have_econd != rb->have_econd)
+			return false;
+		if (ra->have_scond && !progloop_cond_equal(&ra->scond,
+		    &rb->scond))
+			return false;
+		if (ra->have_econd && !progloop_cond_equal(&ra->econd,
+		    &rb->econd))
+			return false;
+		return progloop_block_equal(ra->body, rb->body);
+	case progst_recurse:
+		return true;
+	}
+
+	return false;
+}
+
+/** Compare blocks structurally.
+ *
+ * @param a First block or @c NULL
+ * @param b Second block or @c NULL
+ * @return @c true if blocks are equal
+ */
+static bool progloop_block_equal(prog_block_t *a, prog_block_t *b)
+{
+	unsigned i;
+
+	if (a == NULL || b == NULL)
+		return a == b;
+
+	if (a->nstmts != b->nstmts)
+		return false;
+
+	for (i = 0; i < a->nstmts; i++) {
+		if (!progloop_stmt_equal(a->stmts[i], b->stmts[i]))
+			return false;
+	}
+
+	return true;
+}
+
+/** Count repetitions of a sequence of statements.
+ *
+ * @param block Block
+ * @param i Index of first statement of the sequence
+ * @param p Length of the sequence
+ * @return Number of times the sequence occurs in a row starting at @a i
+ */
+static unsigned progloop_count(prog_block_t *block, unsigned i, unsigned p)
+{
+	unsigned k;
+	unsigned j;
+
+	k = 1;
+	while (i + (k + 1) * p <= block->nstmts) {
+		for (j = 0; j < p; j++) {
+			if (!progloop_stmt_equal(block->stmts[i + j],
+			    block->stmts[i + k * p + j]))
+				return k;
+		}
+
+		++k;
+	}
+
+	return k;
+}
+
+/** Replace repeated sequence of statements with repeat statement.
+ *
+ * @param block Block
+ * @param i Index of first statement of the sequence
+ * @param p Length of the sequence
+ * @param k Number of repetitions
+ * @return Zero on success, ENOMEM if out of memory (@a block is not
+ *         modified)
+ */
+static int progloop_replace(prog_block_t *block, unsigned i, unsigned p,
+    unsigned k)
+{
+	prog_stmt_t *rstmt;
+	prog_stmt_t *stmt;
+	unsigned j;
+	int rc;
+
+	rc = prog_stmt_repeat_create(&rstmt);
+	if (rc != 0)
+		return rc;
+
+	rc = prog_block_create(&rstmt->s.srepeat.body);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_block_reserve(rstmt->s.srepeat.body, p);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_block_insert(block, i, rstmt);
+	if (rc != 0)
+		goto error;
+
+	rstmt->s.srepeat.repcnt = k;
+
+	/* Move first occurrence into loop body */
+	for (j = 0; j < p; j++) {
+		stmt = block->stmts[i + 1];
+		prog_block_remove(stmt);
+		rc = prog_block_append(rstmt->s.srepeat.body, stmt);
+		(void) rc;
+	}
+
+	/* Destroy the other occurrences */
+	for (j = 0; j < (k - 1) * p; j++) {
+		stmt = block->stmts[i + 1];
+		prog_block_remove(stmt);
+		prog_stmt_destroy(stmt);
+	}
+
+	return 0;
+error:
+	prog_stmt_destroy(rstmt);
+	return rc;
+}
+
+/** Extract loops in nested blocks of statement.
+ *
+ * @param stmt Statement
+ * @param rnloops Incremented by the number of loops extracted
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int progloop_stmt(prog_stmt_t *stmt, unsigned *rnloops)
+{
+	int rc;
+
+	switch (stmt->stype) {
+	case progst_if:
+		rc = progloop_block(stmt->s.sif.btrue, rnloops);
+		if (rc != 0)
+			return rc;
+		return progloop_block(stmt->s.sif.bfalse, rnloops);
+	case progst_repeat:
+		return progloop_block(stmt->s.srepeat.body, rnloops);
+	default:
+		return 0;
+	}
+}
+
+/** Extract loops from block.
+ *
+ * Scans the block left to right. At each position the sequence length
+ * that removes the most statements is chosen (the shortest one if more
+ * lengths remove the same number). The block is scanned again until
+ * no more loops can be extracted.
+ *
+ * @param block Block or @c NULL
+ * @param rnloops Incremented by the number of loops extracted
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int progloop_block(prog_block_t *block, unsigned *rnloops)
+{
+	unsigned i, p, k;
+	unsigned best_p, best_k;
+	unsigned long saved, best_saved;
+	bool changed;
+	int rc;
+
+	if (block == NULL)
+		return 0;
+
+	for (i = 0; i < block->nstmts; i++) {
+		rc = progloop_stmt(block->stmts[i], rnloops);
+		if (rc != 0)
+			return rc;
+	}
+
+	do {
+		changed = false;
+		i = 0;
+		while (i < block->nstmts) {
+			best_p = 0;
+			best_k = 0;
+			best_saved = 0;
+			for (p = 1; p <= progloop_max_period &&
+			    i + 2 * p <= block->nstmts; p++) {
+				k = progloop_count(block, i, p);
+				if (k < 2)
+					continue;
+
+				/* The repeat statement itself is added */
+				saved = (unsigned long)(k - 1) * p - 1;
+				if (saved > best_saved) {
+					best_p = p;
+					best_k = k;
+					best_saved = saved;
+				}
+			}
+
+			if (best_saved > 0) {
+				rc = progloop_replace(block, i, best_p, best_k);
+				if (rc != 0)
+					return rc;
+
+				rc = progloop_block(
+				    block->stmts[i]->s.srepeat.body, rnloops);
+				if (rc != 0)
+					return rc;
+
+				++*rnloops;
+				changed = true;
+			}
+
+			++i;
+		}
+	} while (changed);
+
+	return 0;
+}
+
+/** Extract loops from procedure.
+ *
+ * The procedure must not be executing (no robot may be executing it
+ * or be due to return to it).
+ *
+ * @param proc Procedure
+ * @param rnloops Place to store number of loops extracted or @c NULL
+ * @return Zero on success, EBUSY if the procedure is executing, ENOMEM
+ *         if out of memory (the procedure may have been partially
+ *         rewritten, but still behaves the same)
+ */
+int progloop_extract(prog_proc_t *proc, unsigned *rnloops)
+{
+	unsigned nloops = 0;
+	int rc;
+
+	if (proc->stack_refs > 0)
+		return EBUSY;
+
+	rc = progloop_block(proc->body, &nloops);
+	if (nloops > 0)
+		prog_proc_changed(proc);
+	if (rnloops != NULL)
+		*rnloops = nloops;
+	return rc;
+}
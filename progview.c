@@ -145,6 +145,154 @@ prog_proc_t *progview_get_proc(progview_t *progview)
 	return progview->proc;
 }
 
+/** Program view layout visitor.
+ *
+ * @param progview Program view
+ * @param stmt Statement
+ * @param dx X coordinate of statement cell
+ * @param dy Y coordinate of statement cell
+ * @param level Number of enclosing loops
+ * @param arg Argument
+ * @return @c true to stop walking
+ */
+typedef bool (*progview_visit_t)(progview_t *, prog_stmt_t *, int, int,
+    unsigned, void *);
+
+/** Walk statements of block in display order.
+ *
+ * Every statement occupies one cell. The body of a repeat statement
+ * is laid out inline, right after the repeat statement.
+ *
+ * @param progview Program view
+ * @param block Block
+ * @param level Number of enclosing loops
+ * @param x Column of next cell (updated)
+ * @param y Row of next cell (updated)
+ * @param visit Visitor function
+ * @param arg Visitor argument
+ * @return @c true if the visitor stopped the walk
+ */
+static bool progview_walk(progview_t *progview, prog_block_t *block,
+    unsigned level, int *x, int *y, progview_visit_t visit, void *arg)
+{
+	prog_stmt_t *stmt;
+	int dx, dy;
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		dx = progview->orig_x + (1 + *x) * progview->margin_x +
+		    *x * progview->icon_w;
+		dy = progview->orig_y + (1 + *y) * progview->margin_y +
+		    *y * progview->icon_h;
+
+		if (visit(progview, stmt, dx, dy, level, arg))
+			return true;
+
+		++*x;
+		if (*x >= progview_columns) {
+			*x = 0;
+			++*y;
+		}
+
+		if (stmt->stype == progst_repeat &&
+		    stmt->s.srepeat.body != NULL) {
+			if (progview_walk(progview, stmt->s.srepeat.body,
+			    level + 1, x, y, visit, arg))
+				return true;
+		}
+
+		stmt = prog_block_next(stmt);
+	}
+
+	return false;
+}
+
+/** Draw repeat statement cell.
+ *
+ * The repeat count is shown as a grid of dots (as many as fit).
+ *
+ * @param progview Program view
+ * @param gfx Graphics object to draw to
+ * @param stmt Repeat statement
+ * @param dx X coordinate of cell
+ * @param dy Y coordinate of cell
+ */
+static void progview_draw_repeat(progview_t *progview, gfx_t *gfx,
+    prog_stmt_t *stmt, int dx, int dy)
+{
+	unsigned cols, rows;
+	unsigned i;
+	uint32_t color;
+
+	color = gfx_rgb(gfx, 0, 160, 0);
+	gfx_rect(gfx, dx, dy, progview->icon_w, progview->icon_h, color);
+
+	cols = progview->icon_w / 4;
+	rows = progview->icon_h / 4;
+	color = gfx_rgb(gfx, 255, 255, 255);
+	for (i = 0; i < stmt->s.srepeat.repcnt && i < cols * rows; i++) {
+		gfx_rect(gfx, dx + 1 + (i % cols) * 4, dy + 1 + (i / cols) * 4,
+		    2, 2, color);
+	}
+}
+
+/** Draw statement (program view layout visitor).
+ *
+ * @param progview Program view
+ * @param stmt Statement
+ * @param dx X coordinate of statement cell
+ * @param dy Y coordinate of statement cell
+ * @param level Number of enclosing loops
+ * @param arg Graphics object to draw to (gfx_t *)
+ * @return @c false
+ */
+static bool progview_draw_stmt(progview_t *progview, prog_stmt_t *stmt,
+    int dx, int dy, unsigned level, void *arg)
+{
+	gfx_t *gfx = (gfx_t *)arg;
+	gfx_bmp_t *bmp = NULL;
+	icondict_entry_t *entry;
+	uint32_t color;
+	unsigned i;
+
+	if (stmt->stype == progst_intrinsic) {
+		bmp = progview->intr_img[stmt->s.sintr.itype];
+	} else if (stmt->stype == progst_call) {
+		printf("ident='%s'\n", stmt->s.scall.proc->ident);
+		entry = icondict_find(progview->icondict,
+		    stmt->s.scall.proc->ident);
+		assert(entry != NULL);
+		bmp = icondict_entry_bmp(entry);
+	} else if (stmt->stype != progst_repeat) {
+		return false;
+	}
+
+	if (stmt->breakpoint) {
+		color = gfx_rgb(gfx, 255, 0, 0);
+		gfx_rect(gfx, dx - 2, dy - 2, progview->icon_w + 4,
+		    progview->icon_h + 4, color);
+	}
+	if (stmt == progview->hgl_stmt) {
+		color = gfx_rgb(gfx, 0, 255, 255);
+		gfx_rect(gfx, dx - 1, dy - 1, progview->icon_w + 2,
+		    progview->icon_h + 2, color);
+	}
+
+	if (stmt->stype == progst_repeat)
+		progview_draw_repeat(progview, gfx, stmt, dx, dy);
+	else if (bmp != NULL)
+		gfx_bmp_render(gfx, bmp, dx, dy);
+
+	/* Mark loop body with one bar for each enclosing loop */
+	color = gfx_rgb(gfx, 0, 160, 0);
+	for (i = 0; i < level; i++) {
+		gfx_rect(gfx, dx, dy + progview->icon_h + 1 + 2 * i,
+		    progview->icon_w, 1, color);
+	}
+
+	return false;
+}
+
 /** Draw program view.
  *
  * @param progview Program view
@@ -153,12 +301,9 @@ prog_proc_t *progview_get_proc(progview_t *progview)
 void progview_draw(progview_t *progview, gfx_t *gfx)
 {
 	int x, y;
-	int dx, dy;
 	prog_proc_t *proc;
-	prog_stmt_t *stmt;
 	gfx_bmp_t *bmp;
 	icondict_entry_t *entry;
-	uint32_t color;
 
 	proc = progview->proc;
 	if (proc == NULL)
@@ -167,48 +312,44 @@ void progview_draw(progview_t *progview, gfx_t *gfx)
 	/* Current procedure icon */
 	entry = icondict_find(progview->icondict, proc->ident);
 	printf("ident='%s' entry=%p\n", proc->ident, entry);
-	if (entry != NULL) {
-		bmp = entry->icon->bmp;
+	bmp = entry != NULL ? icondict_entry_bmp(entry) : NULL;
+	if (bmp != NULL)
 		gfx_bmp_render(gfx, bmp, progview->orig_x, progview->orig_y);
-	}
 
 	x = 0;
 	y = 1;
+	(void) progview_walk(progview, proc->body, 0, &x, &y,
+	    progview_draw_stmt, gfx);
+}
 
-	stmt = prog_block_first(proc->body);
-	while (stmt != NULL) {
-		dx = progview->orig_x + (1 + x) * progview->margin_x +
-		    x * progview->icon_w;
-		dy = progview->orig_y + (1 + y) * progview->margin_y +
-		    y * progview->icon_h;
-
-		if (stmt->stype == progst_intrinsic || stmt->stype == progst_call) {
-			if (stmt->stype == progst_intrinsic) {
-				bmp = progview->intr_img[stmt->s.sintr.itype];
-			} else {
-				printf("ident='%s'\n",
-				    stmt->s.scall.proc->ident);
-				entry = icondict_find(progview->icondict,
-				    stmt->s.scall.proc->ident);
-				assert(entry != NULL);
-				bmp = entry->icon->bmp;
-			}
-			if (stmt == progview->hgl_stmt) {
-				color = gfx_rgb(gfx, 0, 255, 255);
-				gfx_rect(gfx, dx - 1, dy - 1,
-				    progview->icon_w + 2, progview->icon_h + 2,
-				    color);
-			}
-			gfx_bmp_render(gfx, bmp, dx, dy);
-		}
+/** Find clicked statement (program view layout visitor).
+ *
+ * @param progview Program view
+ * @param stmt Statement
+ * @param dx X coordinate of statement cell
+ * @param dy Y coordinate of statement cell
+ * @param level Number of enclosing loops
+ * @param arg Mouse button event (SDL_MouseButtonEvent *)
+ * @return @c true if statement was clicked
+ */
+static bool progview_hit_stmt(progview_t *progview, prog_stmt_t *stmt,
+    int dx, int dy, unsigned level, void *arg)
+{
+	SDL_MouseButtonEvent *mbe = (SDL_MouseButtonEvent *)arg;
+
+	(void) level;
 
-		++x;
-		if (x >= progview_columns) {
-			x = 0;
-			++y;
+	if (mbe->x >= dx && mbe->y >= dy &&
+	    mbe->x < dx + progview->icon_w &&
+	    mbe->y < dy + progview->icon_h) {
+		if (progview->cb != NULL &&
+		    progview->cb->stmt_clicked != NULL) {
+			progview->cb->stmt_clicked(progview->cb_arg, stmt);
 		}
-		stmt = prog_block_next(stmt);
+		return true;
 	}
+
+	return false;
 }
 
 /** Process input event in program view.
@@ -219,7 +360,13 @@ void progview_draw(progview_t *progview, gfx_t *gfx)
  */
 bool progview_event(progview_t *progview, SDL_Event *event)
 {
-	(void)progview;
-	(void)event;
-	return false;
+	int x, y;
+
+	if (event->type != SDL_MOUSEBUTTONDOWN || progview->proc == NULL)
+		return false;
+
+	x = 0;
+	y = 1;
+	return progview_walk(progview, progview->proc->body, 0, &x, &y,
+	    progview_hit_stmt, event);
 }
@@ -31,13 +31,15 @@
 
 /** Program view callbacks */
 typedef struct {
-	void (*dummy)(void *arg);
+	/** Statement was clicked */
+	void (*stmt_clicked)(void *arg, prog_stmt_t *stmt);
 } progview_cb_t;
 
 /** Program view
  *
- * Displays a procedure, highlights the current statement. Future:
- * editing.
+ * Displays a procedure, highlights the current statement and statements
+ * with breakpoints. Loop bodies are shown inline after the loop, marked
+ * with a bar. Future: editing.
  */
 typedef struct {
 	/** Program procedure */
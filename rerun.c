@@ -0,0 +1,751 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Incremental re-execution
+ *
+ * While a run is recorded, a checkpoint of the world and of the execution
+ * state of all robots is taken every so many statements. For every
+ * procedure we remember the step count at which it was first entered and
+ * the hash of its body at the start of the run. A procedure whose
+ * movement effect is applied in one go counts as entering all the
+ * procedures it calls.
+ *
+ * After procedures are edited, the run can be repeated starting from
+ * the last checkpoint taken before any changed procedure was first
+ * entered. Everything executed up to that checkpoint ran unchanged code
+ * on the same world, so it would be repeated exactly. If a checkpoint
+ * cannot be restored, we fall back to repeating the whole run.
+ *
+ * Execution positions are saved as procedure identifiers and statement
+ * indices, so checkpoints stay valid if unrelated procedures are edited
+ * or deleted.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "adt/hmap.h"
+#include "adt/vector.h"
+#include "map.h"
+#include "prog.h"
+#include "proghash.h"
+#include "rerun.h"
+#include "robot.h"
+#include "robots.h"
+#include "rstack.h"
+
+/** Last run sequence number assigned (shared by all recorders) */
+static unsigned long rerun_last_seq;
+
+static void rerun_mark_block(rerun_t *, prog_block_t *);
+
+/** Create run recorder.
+ *
+ * The recorder needs to be attached to @a robots using robots_set_rerun()
+ * in order to record anything.
+ *
+ * @param robots Robots
+ * @param rrerun Place to store pointer to new run recorder
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int rerun_create(robots_t *robots, rerun_t **rrerun)
+{
+	rerun_t *rerun;
+	int rc;
+
+	rerun = calloc(1, sizeof(rerun_t));
+	if (rerun == NULL)
+		return ENOMEM;
+
+	rc = hmap_create(hmk_str, &rerun->hash_idx);
+	if (rc != 0) {
+		free(rerun);
+		return rc;
+	}
+
+	vector_initialize(&rerun->hashes, sizeof(uint64_t));
+	rerun->robots = robots;
+	rerun->interval = rerun_def_interval;
+	*rrerun = rerun;
+	return 0;
+}
+
+/** Destroy run recorder.
+ *
+ * @param rerun Run recorder or @c NULL
+ */
+void rerun_destroy(rerun_t *rerun)
+{
+	if (rerun == NULL)
+		return;
+
+	rerun_stop(rerun);
+	hmap_destroy(rerun->hash_idx);
+	vector_fini(&rerun->hashes);
+	free(rerun);
+}
+
+/** Destroy checkpoint.
+ *
+ * @param ckpt Checkpoint
+ */
+static void rerun_ckpt_destroy(rerun_ckpt_t *ckpt)
+{
+	unsigned i;
+
+	if (ckpt->robots != NULL) {
+		for (i = 0; i < ckpt->nrobots; i++)
+			free(ckpt->robots[i].stack);
+	}
+
+	free(ckpt->robots);
+	if (ckpt->map != NULL)
+		map_destroy(ckpt->map);
+	free(ckpt);
+}
+
+/** Save program position.
+ *
+ * @param pos Position to fill in
+ * @param proc Procedure
+ * @param stmt Statement in procedure
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rerun_pos_set(rerun_pos_t *pos, prog_proc_t *proc,
+    prog_stmt_t *stmt)
+{
+	snprintf(pos->ident, sizeof(pos->ident), "%s", proc->ident);
+	pos->loop = 0;
+	pos->cont = false;
+	return prog_proc_get_stmt_index(proc, stmt, &pos->idx);
+}
+
+/** Find saved program position in the current program.
+ *
+ * @param rerun Run recorder
+ * @param pos Saved position
+ * @param rproc Place to store procedure
+ * @param rstmt Place to store statement
+ * @return Zero on success, ENOENT if the procedure or statement
+ *         no longer exists
+ */
+static int rerun_pos_get(rerun_t *rerun, rerun_pos_t *pos,
+    prog_proc_t **rproc, prog_stmt_t **rstmt)
+{
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+
+	proc = prog_module_proc_by_ident(rerun->robots->prog, pos->ident);
+	if (proc == NULL)
+		return ENOENT;
+
+	stmt = prog_proc_stmt_by_index(proc, pos->idx);
+	if (stmt == NULL)
+		return ENOENT;
+
+	*rproc = proc;
+	*rstmt = stmt;
+	return 0;
+}
+
+/** Save robot state.
+ *
+ * @param robot Robot
+ * @param rr Robot state to fill in
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rerun_robot_save(robot_t *robot, rerun_robot_t *rr)
+{
+	rstack_entry_t *entry;
+	unsigned i;
+	int rc;
+
+	rr->x = robot->x;
+	rr->y = robot->y;
+	rr->dir = robot->dir;
+	rr->error = robot->error;
+	rr->busy = robot_is_busy(robot);
+	if (!rr->busy)
+		return 0;
+
+	rr->at_bp = robot->bp_stmt != NULL &&
+	    robot->bp_stmt == robot->cur_stmt;
+	rc = rerun_pos_set(&rr->cur, robot->cur_proc, robot->cur_stmt);
+	if (rc != 0)
+		return rc;
+
+	rr->nstack = robot->rstack->nentries;
+	if (rr->nstack == 0)
+		return 0;
+
+	rr->stack = calloc(rr->nstack, sizeof(rerun_pos_t));
+	if (rr->stack == NULL)
+		return ENOMEM;
+
+	i = 0;
+	entry = rstack_first(robot->rstack);
+	while (entry != NULL) {
+		rc = rerun_pos_set(&rr->stack[i], entry->caller_proc,
+		    entry->caller_stmt);
+		if (rc != 0)
+			return rc;
+		rr->stack[i].loop = entry->loop;
+		rr->stack[i++].cont = entry->cont;
+		entry = rstack_next(entry);
+	}
+
+	return 0;
+}
+
+/** Take checkpoint.
+ *
+ * @param rerun Run recorder
+ * @param rckpt Place to store pointer to new checkpoint
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rerun_ckpt_create(rerun_t *rerun, rerun_ckpt_t **rckpt)
+{
+	robots_t *robots = rerun->robots;
+	rerun_ckpt_t *ckpt;
+	robot_t *robot;
+	unsigned i;
+	int rc;
+
+	ckpt = calloc(1, sizeof(rerun_ckpt_t));
+	if (ckpt == NULL)
+		return ENOMEM;
+
+	ckpt->steps = rerun->steps;
+	ckpt->tick_next = -1;
+
+	rc = map_clone(robots->map, &ckpt->map);
+	if (rc != 0)
+		goto error;
+
+	ckpt->nrobots = list_count(&robots->robots);
+	if (ckpt->nrobots > 0) {
+		ckpt->robots = calloc(ckpt->nrobots, sizeof(rerun_robot_t));
+		if (ckpt->robots == NULL) {
+			rc = ENOMEM;
+			goto error;
+		}
+	}
+
+	i = 0;
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		if (robot == robots->tick_next)
+			ckpt->tick_next = i;
+
+		rc = rerun_robot_save(robot, &ckpt->robots[i]);
+		if (rc != 0)
+			goto error;
+
+		++i;
+		robot = robots_next(robot);
+	}
+
+	*rckpt = ckpt;
+	return 0;
+error:
+	rerun_ckpt_destroy(ckpt);
+	return rc;
+}
+
+/** Check that checkpoint can be restored.
+ *
+ * Also makes sure robot stacks can hold the saved entries, so that
+ * restoring the checkpoint cannot fail.
+ *
+ * @param rerun Run recorder
+ * @param ckpt Checkpoint
+ * @return Zero on success, EINVAL if robots were added or removed,
+ *         ENOENT if a saved position no longer exists, ENOSPC if
+ *         a robot stack limit is exceeded, ENOMEM if out of memory
+ */
+static int rerun_ckpt_check(rerun_t *rerun, rerun_ckpt_t *ckpt)
+{
+	robots_t *robots = rerun->robots;
+	rerun_robot_t *rr;
+	robot_t *robot;
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+	unsigned i, j;
+	unsigned nconts;
+	int rc;
+
+	if (ckpt->nrobots != list_count(&robots->robots))
+		return EINVAL;
+
+	i = 0;
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		rr = &ckpt->robots[i++];
+		if (rr->busy) {
+			rc = rerun_pos_get(rerun, &rr->cur, &proc, &stmt);
+			if (rc != 0)
+				return rc;
+
+			nconts = 0;
+			for (j = 0; j < rr->nstack; j++) {
+				rc = rerun_pos_get(rerun, &rr->stack[j], &proc,
+				    &stmt);
+				if (rc != 0)
+					return rc;
+
+				if (rr->stack[j].loop > 0 &&
+				    stmt->stype != progst_repeat)
+					return ENOENT;
+				if (rr->stack[j].loop == 0 || rr->stack[j].cont)
+					++nconts;
+			}
+
+			/* Plain loop entries do not count against the limit */
+			if (nconts > robot->rstack->limit)
+				return ENOSPC;
+
+			rc = rstack_reserve(robot->rstack, rr->nstack);
+			if (rc != 0)
+				return rc;
+
+			/* Reservation is capped at the limit */
+			if (robot->rstack->alloc < rr->nstack)
+				return ENOSPC;
+		}
+
+		robot = robots_next(robot);
+	}
+
+	return 0;
+}
+
+/** Restore robot state.
+ *
+ * @param rerun Run recorder
+ * @param robot Robot
+ * @param rr Saved robot state (must have been checked)
+ */
+static void rerun_robot_restore(rerun_t *rerun, robot_t *robot,
+    rerun_robot_t *rr)
+{
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+	unsigned j;
+	int rc;
+
+	robot_reset(robot);
+
+	if (robot->x != rr->x || robot->y != rr->y) {
+		robots_move_robot(rerun->robots, robot, rr->x - robot->x,
+		    rr->y - robot->y);
+	}
+
+	while (robot->dir != rr->dir)
+		robot_turn_left(robot);
+
+	if (rr->busy) {
+		for (j = 0; j < rr->nstack; j++) {
+			(void) rerun_pos_get(rerun, &rr->stack[j], &proc,
+			    &stmt);
+			if (rr->stack[j].loop > 0) {
+				rc = rstack_push_loop(robot->rstack, proc,
+				    stmt, rr->stack[j].loop);
+				if (rc == 0 && rr->stack[j].cont)
+					rc = rstack_loop_cont(robot->rstack);
+			} else {
+				rc = rstack_push_cont(robot->rstack, proc,
+				    stmt);
+			}
+			assert(rc == 0);
+			(void) rc;
+		}
+
+		(void) rerun_pos_get(rerun, &rr->cur, &proc, &stmt);
+		robot_continue_at(robot, proc, stmt);
+		if (rr->at_bp)
+			robot->bp_stmt = stmt;
+	}
+
+	robot->halt = false;
+	robot->error = rr->error;
+}
+
+/** Restore checkpoint.
+ *
+ * @param rerun Run recorder
+ * @param ckpt Checkpoint
+ * @return Zero on success or an error code (see rerun_ckpt_check()),
+ *         in which case nothing is changed
+ */
+static int rerun_ckpt_restore(rerun_t *rerun, rerun_ckpt_t *ckpt)
+{
+	robots_t *robots = rerun->robots;
+	map_diff_t *diff;
+	robot_t *robot;
+	unsigned i;
+	int rc;
+
+	rc = rerun_ckpt_check(rerun, ckpt);
+	if (rc != 0)
+		return rc;
+
+	rc = map_diff(robots->map, ckpt->map, &diff);
+	if (rc != 0)
+		return rc;
+
+	for (i = 0; i < diff->ntiles; i++) {
+		map_set(robots->map, diff->tiles[i].x, diff->tiles[i].y,
+		    diff->tiles[i].b);
+	}
+
+	map_diff_destroy(diff);
+
+	robots->tick_next = NULL;
+	i = 0;
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		if ((int)i == ckpt->tick_next)
+			robots->tick_next = robot;
+
+		rerun_robot_restore(rerun, robot, &ckpt->robots[i++]);
+		robot = robots_next(robot);
+	}
+
+	return 0;
+}
+
+/** Record body hashes of all procedures.
+ *
+ * @param rerun Run recorder
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rerun_record_hashes(rerun_t *rerun)
+{
+	prog_proc_t *proc;
+	uint64_t hash;
+	size_t idx;
+	int rc;
+
+	hmap_clear(rerun->hash_idx);
+	vector_clear(&rerun->hashes);
+
+	proc = prog_module_first(rerun->robots->prog);
+	while (proc != NULL) {
+		idx = vector_count(&rerun->hashes);
+		hash = proghash_body(proc);
+		rc = vector_append(&rerun->hashes, &hash);
+		if (rc != 0)
+			return rc;
+
+		rc = hmap_insert_str(rerun->hash_idx, proc->ident,
+		    (void *)(uintptr_t)idx);
+		if (rc != 0)
+			return rc;
+
+		proc = prog_module_next(proc);
+	}
+
+	return 0;
+}
+
+/** Determine if procedure body changed since the start of the run.
+ *
+ * @param rerun Run recorder
+ * @param proc Procedure
+ * @return @c true if procedure changed or did not exist
+ */
+static bool rerun_proc_changed(rerun_t *rerun, prog_proc_t *proc)
+{
+	hmap_entry_t *entry;
+	uint64_t *hash;
+
+	entry = hmap_find_str(rerun->hash_idx, proc->ident);
+	if (entry == NULL)
+		return true;
+
+	hash = vector_get(&rerun->hashes, (uintptr_t)entry->value);
+	return *hash != proghash_body(proc);
+}
+
+/** Mark procedures being executed by robots as entered.
+ *
+ * @param rerun Run recorder
+ */
+static void rerun_mark_cur(rerun_t *rerun)
+{
+	robot_t *robot;
+
+	robot = robots_first(rerun->robots);
+	while (robot != NULL) {
+		if (robot_is_busy(robot))
+			rerun_proc_entered(rerun, robot->cur_proc, false);
+		robot = robots_next(robot);
+	}
+}
+
+/** Mark procedures called from block as entered.
+ *
+ * @param rerun Run recorder
+ * @param block Block or @c NULL
+ */
+static void rerun_mark_block(rerun_t *rerun, prog_block_t *block)
+{
+	prog_stmt_t *stmt;
+
+	if (block == NULL)
+		return;
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		switch (stmt->stype) {
+		case progst_call:
+			rerun_proc_entered(rerun, stmt->s.scall.proc, true);
+			break;
+		case progst_if:
+			rerun_mark_block(rerun, stmt->s.sif.btrue);
+			rerun_mark_block(rerun, stmt->s.sif.bfalse);
+			break;
+		case progst_repeat:
+			rerun_mark_block(rerun, stmt->s.srepeat.body);
+			break;
+		default:
+			break;
+		}
+
+		stmt = prog_block_next(stmt);
+	}
+}
+
+/** Start recording a run.
+ *
+ * Should be called after the robots were given the procedure to run.
+ * Any previously recorded run is discarded.
+ *
+ * @param rerun Run recorder
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int rerun_start(rerun_t *rerun)
+{
+	int rc;
+
+	rerun_stop(rerun);
+
+	rc = rerun_record_hashes(rerun);
+	if (rc != 0)
+		return rc;
+
+	rerun->seq = ++rerun_last_seq;
+	rerun->steps = 0;
+	rerun->interval = rerun_def_interval;
+	rerun->next_ckpt = rerun->interval;
+
+	rc = rerun_ckpt_create(rerun, &rerun->ckpt[0]);
+	if (rc != 0) {
+		rerun->seq = 0;
+		return rc;
+	}
+
+	rerun->nckpts = 1;
+	rerun_mark_cur(rerun);
+	return 0;
+}
+
+/** Stop recording and discard the recorded run.
+ *
+ * @param rerun Run recorder
+ */
+void rerun_stop(rerun_t *rerun)
+{
+	unsigned i;
+
+	for (i = 0; i < rerun->nckpts; i++)
+		rerun_ckpt_destroy(rerun->ckpt[i]);
+
+	rerun->nckpts = 0;
+	rerun->seq = 0;
+}
+
+/** Determine if a run was recorded.
+ *
+ * @param rerun Run recorder
+ * @return @c true if a run can be repeated
+ */
+bool rerun_recorded(rerun_t *rerun)
+{
+	return rerun->seq != 0;
+}
+
+/** Drop every other checkpoint and double the checkpoint interval.
+ *
+ * The first checkpoint (start of the run) is always kept.
+ *
+ * @param rerun Run recorder
+ */
+static void rerun_thin(rerun_t *rerun)
+{
+	unsigned i, j;
+
+	j = 0;
+	for (i = 0; i < rerun->nckpts; i++) {
+		if (i % 2 == 0)
+			rerun->ckpt[j++] = rerun->ckpt[i];
+		else
+			rerun_ckpt_destroy(rerun->ckpt[i]);
+	}
+
+	rerun->nckpts = j;
+	rerun->interval *= 2;
+}
+
+/** Take checkpoint if one is due.
+ *
+ * Called by robots_tick() before robots run, when all robots are
+ * between statements. Failing to take a checkpoint is not an error,
+ * rerun_resume() then starts from an earlier one.
+ *
+ * @param rerun Run recorder
+ */
+void rerun_tick(rerun_t *rerun)
+{
+	rerun_ckpt_t *ckpt;
+	int rc;
+
+	if (rerun->seq == 0 || rerun->steps < rerun->next_ckpt)
+		return;
+
+	if (rerun->nckpts >= rerun_max_ckpts)
+		rerun_thin(rerun);
+
+	rc = rerun_ckpt_create(rerun, &ckpt);
+	if (rc == 0)
+		rerun->ckpt[rerun->nckpts++] = ckpt;
+
+	rerun->next_ckpt = rerun->steps + rerun->interval;
+}
+
+/** Note that procedure was entered.
+ *
+ * @param rerun Run recorder
+ * @param proc Procedure
+ * @param effect @c true if the movement effect of the procedure was
+ *               applied (so all procedures it calls are entered, too)
+ */
+void rerun_proc_entered(rerun_t *rerun, prog_proc_t *proc, bool effect)
+{
+	if (rerun->seq == 0)
+		return;
+
+	if (proc->rerun_seq != rerun->seq) {
+		proc->rerun_seq = rerun->seq;
+		proc->rerun_step = rerun->steps;
+	}
+
+	if (effect && proc->rerun_eseq != rerun->seq) {
+		proc->rerun_eseq = rerun->seq;
+		rerun_mark_block(rerun, proc->body);
+	}
+}
+
+/** Repeat recorded run, skipping over unchanged work.
+ *
+ * Restores the world and robots to the last checkpoint taken before
+ * the first procedure whose body changed since the start of the run
+ * was first entered. If no procedure changed, the last checkpoint is
+ * used. The robots are then ready to continue running.
+ *
+ * Recording continues, so the run can be repeated again after further
+ * changes.
+ *
+ * @param rerun Run recorder
+ * @param rsteps Place to store number of statements skipped or @c NULL
+ * @return Zero on success, ENOENT if no run was recorded or it cannot
+ *         be repeated, EINVAL if robots were added or removed,
+ *         ENOMEM if out of memory
+ */
+int rerun_resume(rerun_t *rerun, unsigned long *rsteps)
+{
+	prog_proc_t *proc;
+	unsigned long first = ULONG_MAX;
+	unsigned k, i;
+	int rc;
+
+	if (rerun->seq == 0)
+		return ENOENT;
+
+	/* Find first step at which changed code could have run */
+	proc = prog_module_first(rerun->robots->prog);
+	while (proc != NULL) {
+		if (proc->rerun_seq == rerun->seq && proc->rerun_step < first &&
+		    rerun_proc_changed(rerun, proc))
+			first = proc->rerun_step;
+		proc = prog_module_next(proc);
+	}
+
+	k = rerun->nckpts - 1;
+	while (k > 0 && rerun->ckpt[k]->steps > first)
+		--k;
+
+	rc = rerun_record_hashes(rerun);
+	if (rc != 0)
+		goto error;
+
+	rc = rerun_ckpt_restore(rerun, rerun->ckpt[k]);
+	if (rc != 0 && k > 0) {
+		/* Fall back to repeating the whole run */
+		k = 0;
+		rc = rerun_ckpt_restore(rerun, rerun->ckpt[0]);
+	}
+
+	if (rc != 0)
+		goto error;
+
+	for (i = k + 1; i < rerun->nckpts; i++)
+		rerun_ckpt_destroy(rerun->ckpt[i]);
+	rerun->nckpts = k + 1;
+
+	rerun->steps = rerun->ckpt[k]->steps;
+	rerun->next_ckpt = rerun->steps + rerun->interval;
+
+	/* Forget procedures entered after the checkpoint */
+	proc = prog_module_first(rerun->robots->prog);
+	while (proc != NULL) {
+		if (proc->rerun_seq == rerun->seq &&
+		    proc->rerun_step >= rerun->steps)
+			proc->rerun_seq = 0;
+		proc->rerun_eseq = 0;
+		proc = prog_module_next(proc);
+	}
+
+	rerun_mark_cur(rerun);
+
+	if (rsteps != NULL)
+		*rsteps = rerun->steps;
+	return 0;
+error:
+	rerun_stop(rerun);
+	return rc;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RERUN_H
+#define RERUN_H
+
+#include <stdbool.h>
+#include "adt/hmap.h"
+#include "adt/vector.h"
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+#include "robot.h"
+#include "robots.h"
+
+enum {
+	/** Default number of statements executed between checkpoints */
+	rerun_def_interval = 256,
+	/** Maximum number of checkpoints kept */
+	rerun_max_ckpts = 64
+};
+
+/** Program position saved in a checkpoint */
+typedef struct {
+	/** Procedure identifier */
+	char ident[prog_proc_id_len + 1];
+	/** Statement index in procedure */
+	unsigned idx;
+	/** Loop iterations left (loop stack entry) or zero */
+	unsigned loop;
+	/** Loop stack entry stands for continuation of a call */
+	bool cont;
+} rerun_pos_t;
+
+/** Robot state saved in a checkpoint */
+typedef struct {
+	/** X tile coordinate */
+	int x;
+	/** Y tile coordinate */
+	int y;
+	/** Direction robot is facing */
+	dir_t dir;
+	/** Robot error */
+	robot_error_t error;
+	/** Is robot executing code? */
+	bool busy;
+	/** Is robot stopped at a breakpoint at the current statement? */
+	bool at_bp;
+	/** Current position (valid if @c busy) */
+	rerun_pos_t cur;
+	/** Robot stack entries, bottom first */
+	rerun_pos_t *stack;
+	/** Number of robot stack entries */
+	unsigned nstack;
+} rerun_robot_t;
+
+/** Checkpoint */
+typedef struct {
+	/** Number of statements executed in the run before the checkpoint */
+	unsigned long steps;
+	/** Map contents */
+	map_t *map;
+	/** Robot states, in robots list order */
+	rerun_robot_t *robots;
+	/** Number of robots */
+	unsigned nrobots;
+	/** Index of robot to run first in the next tick or -1 */
+	int tick_next;
+} rerun_ckpt_t;
+
+/** Run recorder */
+typedef struct rerun {
+	/** Robots being recorded */
+	robots_t *robots;
+	/** Sequence number of the recorded run or zero if none */
+	unsigned long seq;
+	/** Number of statements executed in the recorded run */
+	unsigned long steps;
+	/** Number of statements between checkpoints */
+	unsigned long interval;
+	/** Step count at which the next checkpoint is due */
+	unsigned long next_ckpt;
+	/** Checkpoints, oldest first */
+	rerun_ckpt_t *ckpt[rerun_max_ckpts];
+	/** Number of checkpoints */
+	unsigned nckpts;
+	/** Index into @c hashes by procedure identifier */
+	hmap_t *hash_idx;
+	/** Procedure body hashes at the start of the run (uint64_t) */
+	vector_t hashes;
+} rerun_t;
+
+extern int rerun_create(robots_t *, rerun_t **);
+extern void rerun_destroy(rerun_t *);
+extern int rerun_start(rerun_t *);
+extern void rerun_stop(rerun_t *);
+extern bool rerun_recorded(rerun_t *);
+extern void rerun_tick(rerun_t *);
+extern void rerun_proc_entered(rerun_t *, prog_proc_t *, bool);
+extern int rerun_resume(rerun_t *, unsigned long *);
+
+#endif
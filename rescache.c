@@ -0,0 +1,395 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Result cache
+ *
+ * Running the same program on the same initial world with the same step
+ * limit always has the same outcome. The cache remembers outcomes so that
+ * repeated evaluations are reduced to a hash lookup.
+ *
+ * The cache file has one line per entry. Entries are only ever appended,
+ * a later entry with the same key replaces an earlier one. Malformed
+ * lines (such as a line cut short by a crash) are ignored.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adt/hmap.h"
+#include "map.h"
+#include "proghash.h"
+#include "rescache.h"
+#include "robot.h"
+#include "robots.h"
+
+enum {
+	/** Maximum length of cache file line */
+	rescache_line_len = 256
+};
+
+/** Mix value into hash.
+ *
+ * @param hash Hash
+ * @param v Value
+ * @return New hash
+ */
+static uint64_t rescache_mix(uint64_t hash, uint64_t v)
+{
+	return hmap_hash_int(hash ^ (v + 0x9e3779b97f4a7c15ULL +
+	    (hash << 6) + (hash >> 2)));
+}
+
+/** Compute hash of result cache key.
+ *
+ * @param key Key
+ * @return Hash
+ */
+static uint64_t rescache_key_hash(rescache_key_t *key)
+{
+	uint64_t hash;
+
+	hash = rescache_mix(0, key->prog_hash);
+	hash = rescache_mix(hash, key->world_hash);
+	hash = rescache_mix(hash, key->x);
+	hash = rescache_mix(hash, key->y);
+	hash = rescache_mix(hash, key->dir);
+	return rescache_mix(hash, key->max_steps);
+}
+
+/** Compute hash of world.
+ *
+ * Covers the map and the positions and directions of the robots.
+ *
+ * @param map Map
+ * @param robots Robots
+ * @return Hash
+ */
+uint64_t rescache_world_hash(map_t *map, robots_t *robots)
+{
+	robot_t *robot;
+	uint64_t hash;
+
+	hash = rescache_mix(0, map->width);
+	hash = rescache_mix(hash, map->height);
+	hash = rescache_mix(hash, map_hash(map));
+
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		hash = rescache_mix(hash, robot->x);
+		hash = rescache_mix(hash, robot->y);
+		hash = rescache_mix(hash, robot->dir);
+		robot = robots_next(robot);
+	}
+
+	return hash;
+}
+
+/** Initialize result cache key.
+ *
+ * The program is identified by the structural hash of its entry
+ * procedure, which covers all code that can be executed. The world hash
+ * does not tell which of the robots runs the program, so the position
+ * and direction of that robot are part of the key.
+ *
+ * @param key Key to initialize
+ * @param proc Entry procedure
+ * @param map Initial map
+ * @param robots Initial robots
+ * @param robot Robot running the procedure (one of @a robots)
+ * @param max_steps Step limit
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int rescache_key_init(rescache_key_t *key, prog_proc_t *proc, map_t *map,
+    robots_t *robots, robot_t *robot, unsigned long max_steps)
+{
+	int rc;
+
+	rc = proghash_proc(proc, &key->prog_hash);
+	if (rc != 0)
+		return rc;
+
+	key->world_hash = rescache_world_hash(map, robots);
+	key->x = robot->x;
+	key->y = robot->y;
+	key->dir = robot->dir;
+	key->max_steps = max_steps;
+	return 0;
+}
+
+/** Find result cache entry.
+ *
+ * @param cache Result cache
+ * @param key Key
+ * @param rhentry Place to store hash map entry of the chain or @c NULL
+ * @return Entry or @c NULL if not found
+ */
+static rescache_entry_t *rescache_find(rescache_t *cache,
+    rescache_key_t *key, hmap_entry_t **rhentry)
+{
+	hmap_entry_t *hentry;
+	rescache_entry_t *entry;
+
+	hentry = hmap_find_int(cache->entries, rescache_key_hash(key));
+	*rhentry = hentry;
+	if (hentry == NULL)
+		return NULL;
+
+	entry = hentry->value;
+	while (entry != NULL) {
+		if (entry->key.prog_hash == key->prog_hash &&
+		    entry->key.world_hash == key->world_hash &&
+		    entry->key.x == key->x && entry->key.y == key->y &&
+		    entry->key.dir == key->dir &&
+		    entry->key.max_steps == key->max_steps)
+			return entry;
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+/** Set result cache entry in memory.
+ *
+ * @param cache Result cache
+ * @param key Key
+ * @param outcome Outcome
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rescache_set(rescache_t *cache, rescache_key_t *key,
+    rescache_outcome_t *outcome)
+{
+	hmap_entry_t *hentry;
+	rescache_entry_t *entry;
+	int rc;
+
+	entry = rescache_find(cache, key, &hentry);
+	if (entry != NULL) {
+		entry->outcome = *outcome;
+		return 0;
+	}
+
+	entry = calloc(1, sizeof(rescache_entry_t));
+	if (entry == NULL)
+		return ENOMEM;
+
+	entry->key = *key;
+	entry->outcome = *outcome;
+
+	if (hentry != NULL) {
+		/* Prepend to hash chain */
+		entry->next = hentry->value;
+		hentry->value = entry;
+	} else {
+		rc = hmap_insert_int(cache->entries, rescache_key_hash(key),
+		    entry);
+		if (rc != 0) {
+			free(entry);
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+/** Parse result cache file line.
+ *
+ * @param line Line
+ * @param key Place to store key
+ * @param outcome Place to store outcome
+ * @return @c true on success, @c false if line is malformed
+ */
+static bool rescache_parse(const char *line, rescache_key_t *key,
+    rescache_outcome_t *outcome)
+{
+	int dir;
+	int finished;
+	int error;
+	int nitem;
+
+	nitem = sscanf(line, "%" SCNx64 " %" SCNx64 " %d %d %d %lu %d %d %lu %"
+	    SCNx64 " %" SCNx64 "\n", &key->prog_hash, &key->world_hash,
+	    &key->x, &key->y, &dir, &key->max_steps, &finished, &error,
+	    &outcome->nsteps, &outcome->world_hash, &outcome->map_hash);
+	if (nitem != 11 || line[strlen(line) - 1] != '\n')
+		return false;
+
+	if (dir < 0 || dir > dir_south)
+		return false;
+
+	if (finished < 0 || finished > 1 || error < 0 || error >= errt_limit)
+		return false;
+
+	key->dir = (dir_t)dir;
+	outcome->finished = finished != 0;
+	outcome->error = (robot_error_t)error;
+	return true;
+}
+
+/** Open result cache.
+ *
+ * The cache file is created if it does not exist.
+ *
+ * @param fname Cache file name
+ * @param rcache Place to store pointer to result cache
+ * @return Zero on success or an error code
+ */
+int rescache_open(const char *fname, rescache_t **rcache)
+{
+	rescache_t *cache;
+	rescache_key_t key;
+	rescache_outcome_t outcome;
+	char line[rescache_line_len];
+	bool torn = false;
+	FILE *f;
+	int rc;
+
+	cache = calloc(1, sizeof(rescache_t));
+	if (cache == NULL)
+		return ENOMEM;
+
+	rc = hmap_create(hmk_int, &cache->entries);
+	if (rc != 0)
+		goto error;
+
+	f = fopen(fname, "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL) {
+			torn = line[strlen(line) - 1] != '\n';
+			if (!rescache_parse(line, &key, &outcome))
+				continue;
+
+			rc = rescache_set(cache, &key, &outcome);
+			if (rc != 0) {
+				(void) fclose(f);
+				goto error;
+			}
+		}
+
+		(void) fclose(f);
+	}
+
+	cache->f = fopen(fname, "a");
+	if (cache->f == NULL) {
+		rc = EIO;
+		goto error;
+	}
+
+	/* Do not append to an incomplete line */
+	if (torn && fputc('\n', cache->f) == EOF) {
+		rc = EIO;
+		goto error;
+	}
+
+	*rcache = cache;
+	return 0;
+error:
+	rescache_close(cache);
+	return rc;
+}
+
+/** Close result cache.
+ *
+ * @param cache Result cache
+ */
+void rescache_close(rescache_t *cache)
+{
+	hmap_entry_t *hentry;
+	rescache_entry_t *entry;
+	rescache_entry_t *next;
+
+	if (cache->entries != NULL) {
+		hentry = hmap_first(cache->entries);
+		while (hentry != NULL) {
+			entry = hentry->value;
+			while (entry != NULL) {
+				next = entry->next;
+				free(entry);
+				entry = next;
+			}
+
+			hentry = hmap_next(cache->entries, hentry);
+		}
+
+		hmap_destroy(cache->entries);
+	}
+
+	if (cache->f != NULL)
+		(void) fclose(cache->f);
+	free(cache);
+}
+
+/** Look up outcome in result cache.
+ *
+ * @param cache Result cache
+ * @param key Key
+ * @param outcome Place to store outcome
+ * @return Zero on success, ENOENT if the cache has no outcome for @a key
+ */
+int rescache_lookup(rescache_t *cache, rescache_key_t *key,
+    rescache_outcome_t *outcome)
+{
+	hmap_entry_t *hentry;
+	rescache_entry_t *entry;
+
+	++cache->nlookups;
+
+	entry = rescache_find(cache, key, &hentry);
+	if (entry == NULL)
+		return ENOENT;
+
+	++cache->nhits;
+	*outcome = entry->outcome;
+	return 0;
+}
+
+/** Insert outcome into result cache.
+ *
+ * @param cache Result cache
+ * @param key Key
+ * @param outcome Outcome
+ * @return Zero on success or an error code
+ */
+int rescache_insert(rescache_t *cache, rescache_key_t *key,
+    rescache_outcome_t *outcome)
+{
+	int rv;
+	int rc;
+
+	rc = rescache_set(cache, key, outcome);
+	if (rc != 0)
+		return rc;
+
+	rv = fprintf(cache->f, "%016" PRIx64 " %016" PRIx64 " %d %d %d %lu "
+	    "%d %d %lu %016" PRIx64 " %016" PRIx64 "\n", key->prog_hash,
+	    key->world_hash, key->x, key->y, (int)key->dir, key->max_steps,
+	    outcome->finished ? 1 : 0, (int)outcome->error, outcome->nsteps,
+	    outcome->world_hash, outcome->map_hash);
+	if (rv < 0 || fflush(cache->f) != 0)
+		return EIO;
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RESCACHE_H
+#define RESCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "adt/hmap.h"
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+#include "robot.h"
+#include "robots.h"
+
+/** Result cache key */
+typedef struct {
+	/** Structural hash of the program */
+	uint64_t prog_hash;
+	/** Hash of the initial world */
+	uint64_t world_hash;
+	/** Initial position of the robot running the program */
+	int x, y;
+	/** Initial direction of the robot running the program */
+	dir_t dir;
+	/** Step limit */
+	unsigned long max_steps;
+} rescache_key_t;
+
+/** Outcome of running a program */
+typedef struct {
+	/** Did the program finish within the step limit? */
+	bool finished;
+	/** Robot error */
+	robot_error_t error;
+	/** Number of steps executed */
+	unsigned long nsteps;
+	/** Hash of the final world */
+	uint64_t world_hash;
+	/** Hash of the final map (see map_hash()) */
+	uint64_t map_hash;
+} rescache_outcome_t;
+
+/** Result cache entry */
+typedef struct rescache_entry {
+	/** Key */
+	rescache_key_t key;
+	/** Outcome */
+	rescache_outcome_t outcome;
+	/** Next entry with the same key hash */
+	struct rescache_entry *next;
+} rescache_entry_t;
+
+/** Result cache
+ *
+ * Maps program, initial world, the robot running the program and
+ * step limit to the outcome of running the program. The cache is kept
+ * in memory and new entries are appended to a file.
+ */
+typedef struct {
+	/** Cache file opened for appending or @c NULL */
+	FILE *f;
+	/** Entries by key hash (first entry in hash chain) */
+	hmap_t *entries;
+	/** Number of lookups */
+	unsigned long nlookups;
+	/** Number of lookups that found an entry */
+	unsigned long nhits;
+} rescache_t;
+
+extern int rescache_open(const char *, rescache_t **);
+extern void rescache_close(rescache_t *);
+extern int rescache_key_init(rescache_key_t *, prog_proc_t *, map_t *,
+    robots_t *, robot_t *, unsigned long);
+extern uint64_t rescache_world_hash(map_t *, robots_t *);
+extern int rescache_lookup(rescache_t *, rescache_key_t *,
+    rescache_outcome_t *);
+extern int rescache_insert(rescache_t *, rescache_key_t *,
+    rescache_outcome_t *);
+
+#endif
@@ -26,15 +26,40 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "callgraph.h"
 #include "dir.h"
+#include "journal.h"
 #include "map.h"
 #include "prog.h"
+#include "rerun.h"
 #include "robot.h"
 #include "robots.h"
 #include "rstack.h"
 
+static void robot_set_cur(robot_t *, prog_proc_t *, prog_stmt_t *);
+static void robot_set_error(robot_t *, robot_error_t);
+static void robot_set_tile(robot_t *, map_tile_t);
+
+/** Cost model charging one unit per statement */
+static const robot_cost_t robot_unit_cost = {
+	.op = {
+		[progop_turn_left] = 1,
+		[progop_move] = 1,
+		[progop_put_white] = 1,
+		[progop_put_grey] = 1,
+		[progop_put_black] = 1,
+		[progop_pick_up] = 1,
+		[progop_call] = 1,
+		[progop_if] = 1,
+		[progop_repeat] = 1,
+		[progop_recurse] = 1,
+		[progop_break] = 1
+	}
+};
+
 /** Create new robot.
  *
  * @param x X tile coordinate
@@ -65,6 +90,7 @@ int robot_create(int x, int y, dir_t dir, rstack_t *rstack, robot_t **rrobot)
  */
 void robot_destroy(robot_t *robot)
 {
+	robot_set_cur(robot, NULL, NULL);
 	rstack_destroy(robot->rstack);
 	free(robot);
 }
@@ -104,7 +130,7 @@ int robot_load(prog_module_t *prog, FILE *f, robot_t **rrobot)
 	}
 
 	if (error != 0)
-		robot->error = error;
+		robot_set_error(robot, error);
 
 	*rrobot = robot;
 	return 0;
@@ -121,19 +147,53 @@ int robot_save(robot_t *robot, FILE *f)
 	int rv;
 
 	rv = fprintf(f, "%d %d %d %u\n", robot->x, robot->y, robot->dir,
-	    robot->error ? 1 : 0);
+	    (unsigned)robot->error);
 	if (rv < 0)
 		return EIO;
 
 	return rstack_save(robot->rstack, f);
 }
 
+/** Stop robot due to error.
+ *
+ * @param robot Robot
+ * @param error Error
+ */
+static void robot_set_error(robot_t *robot, robot_error_t error)
+{
+	robot->error = error;
+	robot->halt = true;
+}
+
+/** Set map tile under robot.
+ *
+ * Stops the robot if the tile is being watched.
+ *
+ * @param robot Robot
+ * @param tile New tile contents
+ */
+static void robot_set_tile(robot_t *robot, map_tile_t tile)
+{
+	map_t *map = robot->robots->map;
+
+	map_set(map, robot->x, robot->y, tile);
+	if (map->watch_hit) {
+		map->watch_hit = false;
+		robot->halt = true;
+	}
+}
+
 /** Turn robot left.
  *
  * @param robot Robot
  */
 void robot_turn_left(robot_t *robot)
 {
+	if (robot->robots != NULL && robot->robots->journal != NULL) {
+		journal_robot_turn_left(robot->robots->journal, robot->x,
+		    robot->y);
+	}
+
 	robot->dir = dir_next_ccw(robot->dir);
 }
 
@@ -151,7 +211,7 @@ void robot_move(robot_t *robot)
 	tile = map_get(robot->robots->map, robot->x + xoff, robot->y + yoff);
 
 	if (!map_tile_walkable(tile)) {
-		robot->error = errt_hit_wall;
+		robot_set_error(robot, errt_hit_wall);
 		return;
 	}
 
@@ -170,11 +230,11 @@ void robot_put_white(robot_t *robot)
 	tile = map_get(robot->robots->map, robot->x, robot->y);
 
 	if (tile != mapt_none) {
-		robot->error = errt_already_tag;
+		robot_set_error(robot, errt_already_tag);
 		return;
 	}
 
-	map_set(robot->robots->map, robot->x, robot->y, mapt_wtag);
+	robot_set_tile(robot, mapt_wtag);
 }
 
 /** Put down grey tag.
@@ -189,11 +249,11 @@ void robot_put_grey(robot_t *robot)
 	tile = map_get(robot->robots->map, robot->x, robot->y);
 
 	if (tile != mapt_none) {
-		robot->error = errt_already_tag;
+		robot_set_error(robot, errt_already_tag);
 		return;
 	}
 
-	map_set(robot->robots->map, robot->x, robot->y, mapt_gtag);
+	robot_set_tile(robot, mapt_gtag);
 }
 
 /** Put down black tag.
@@ -208,11 +268,11 @@ void robot_put_black(robot_t *robot)
 	tile = map_get(robot->robots->map, robot->x, robot->y);
 
 	if (tile != mapt_none) {
-		robot->error = errt_already_tag;
+		robot_set_error(robot, errt_already_tag);
 		return;
 	}
 
-	map_set(robot->robots->map, robot->x, robot->y, mapt_btag);
+	robot_set_tile(robot, mapt_btag);
 }
 
 /** Pick up tag.
@@ -227,29 +287,66 @@ void robot_pick_up(robot_t *robot)
 	tile = map_get(robot->robots->map, robot->x, robot->y);
 
 	if (!map_tile_tag(tile)) {
-		robot->error = errt_no_tag;
+		robot_set_error(robot, errt_no_tag);
 		return;
 	}
 
-	map_set(robot->robots->map, robot->x, robot->y, mapt_none);
+	robot_set_tile(robot, mapt_none);
+}
+
+/** Set current procedure and statement.
+ *
+ * Keeps the procedure stack reference counts up to date.
+ *
+ * @param robot Robot
+ * @param proc Procedure or @c NULL
+ * @param stmt Statement or @c NULL
+ */
+static void robot_set_cur(robot_t *robot, prog_proc_t *proc,
+    prog_stmt_t *stmt)
+{
+	if (proc != NULL)
+		prog_proc_stack_ref(proc);
+	if (robot->cur_proc != NULL)
+		prog_proc_stack_unref(robot->cur_proc);
+
+	robot->cur_proc = proc;
+	robot->cur_stmt = stmt;
 }
 
 /** Start executing procedure.
  *
- * Start executing program (run a procedure).
+ * Start executing program (run a procedure). If the procedure cannot
+ * recurse without bound, the robot stack is allocated up front to
+ * the maximum depth the procedure can need.
  *
  * @param robot Robot
  * @param proc Procedure
  * @return Zero on success. EBUSY if robot is already busy executing code
- *         or stopped due to error.
+ *         or stopped due to error, ENOMEM if out of memory.
  */
 int robot_run_proc(robot_t *robot, prog_proc_t *proc)
 {
+	bool unbounded;
+	unsigned depth;
+	int rc;
+
 	if (robot->cur_stmt != NULL || robot->error)
 		return EBUSY;
 
-	robot->cur_proc = proc;
-	robot->cur_stmt = prog_block_first(proc->body);
+	robot->bp_stmt = NULL;
+
+	rc = callgraph_proc_depth(proc, &unbounded, &depth);
+	if (rc != 0)
+		return rc;
+
+	if (!unbounded) {
+		rc = rstack_reserve(robot->rstack, depth);
+		if (rc != 0)
+			return rc;
+	}
+
+	robot_set_cur(robot, proc, prog_block_first(proc->body));
 	return 0;
 }
 
@@ -280,68 +377,162 @@ robot_error_t robot_error(robot_t *robot)
 void robot_reset(robot_t *robot)
 {
 	robot->error = errt_none;
-	robot->cur_stmt = NULL;
+	robot->halt = false;
+	robot->bp_stmt = NULL;
+	robot_set_cur(robot, NULL, NULL);
+	rstack_clear(robot->rstack);
 }
 
 /** Leave statement block.
+ *
+ * If the block is the body of a loop with iterations left, the body
+ * is entered again. Otherwise execution continues after the loop.
  *
  * @param robot Robot
  */
 static void robot_leave(robot_t *robot)
 {
+	rstack_entry_t *entry;
 	prog_proc_t *next_proc;
 	prog_stmt_t *next_stmt;
-
-	if (rstack_is_empty(robot->rstack)) {
-		robot->cur_proc = NULL;
-		robot->cur_stmt = NULL;
+	prog_block_t *body;
+	bool loop;
+
+	while (true) {
+		entry = rstack_last(robot->rstack);
+		if (entry == NULL) {
+			robot_set_cur(robot, NULL, NULL);
+			return;
+		}
+
+		if (entry->cont) {
+			/* Call at the end of the loop body returned */
+			rstack_loop_uncont(robot->rstack);
+		}
+
+		if (entry->loop > 1) {
+			/* Next iteration */
+			--entry->loop;
+			body = entry->caller_stmt->s.srepeat.body;
+			robot_set_cur(robot, entry->caller_proc,
+			    prog_block_first(body));
+			return;
+		}
+
+		loop = entry->loop > 0;
+		rstack_pop_cont(robot->rstack, &next_proc, &next_stmt);
+		if (loop) {
+			/* Loop finished, continue after repeat statement */
+			next_stmt = prog_block_next(next_stmt);
+			if (next_stmt == NULL)
+				continue;
+		}
+
+		robot_set_cur(robot, next_proc, next_stmt);
 		return;
 	}
+}
 
-	rstack_pop_cont(robot->rstack, &next_proc, &next_stmt);
+/** Determine if robot can execute repeat statement.
+ *
+ * Only loops with a repeat count and no conditions are supported.
+ *
+ * @param stmt Repeat statement
+ * @return @c true if statement can be executed
+ */
+static bool robot_repeat_supported(prog_stmt_t *stmt)
+{
+	prog_repeat_t *rep = &stmt->s.srepeat;
 
-	robot->cur_proc = next_proc;
-	robot->cur_stmt = next_stmt;
+	return rep->repcnt > 0 && !rep->have_scond && !rep->have_econd;
 }
 
-/** Execute intrinsic statement.
+/** Continue execution at another statement of the current block.
+ *
+ * This allows statements to be executed outside of the interpreter.
  *
- * Executes the next statement, which must be an intrinsic statement.
  * @param robot Robot
+ * @param stmt Statement in the current block or @c NULL to leave the block
  */
-static void robot_stmt_intrinsic(robot_t *robot)
+void robot_advance(robot_t *robot, prog_stmt_t *stmt)
 {
-	assert(robot->cur_stmt->stype == progst_intrinsic);
+	assert(robot->cur_stmt != NULL);
 
-	switch (robot->cur_stmt->s.sintr.itype) {
-	case progin_turn_left:
-		robot_turn_left(robot);
-		break;
-	case progin_move:
-		robot_move(robot);
-		break;
-	case progin_put_white:
-		robot_put_white(robot);
-		break;
-	case progin_put_grey:
-		robot_put_grey(robot);
-		break;
-	case progin_put_black:
-		robot_put_black(robot);
-		break;
-	case progin_pick_up:
-		robot_pick_up(robot);
-		break;
+	if (stmt == NULL) {
+		robot_leave(robot);
+		return;
 	}
 
-	if (robot->error)
+	assert(stmt->block == robot->cur_stmt->block);
+	robot->cur_stmt = stmt;
+}
+
+/** Continue execution at a statement.
+ *
+ * This is used to restore saved execution state. The robot stack must
+ * already hold the continuation entries.
+ *
+ * @param robot Robot
+ * @param proc Procedure
+ * @param stmt Statement in procedure body
+ */
+void robot_continue_at(robot_t *robot, prog_proc_t *proc, prog_stmt_t *stmt)
+{
+	robot_set_cur(robot, proc, stmt);
+}
+
+/** Note that robot entered procedure, if the run is being recorded.
+ *
+ * @param robot Robot
+ * @param proc Procedure
+ * @param effect @c true if the movement effect of the procedure is applied
+ */
+static void robot_proc_entered(robot_t *robot, prog_proc_t *proc,
+    bool effect)
+{
+	rerun_t *rerun;
+
+	if (robot->robots == NULL || robot->robots->rerun == NULL)
 		return;
 
-	robot->cur_stmt = prog_block_next(robot->cur_stmt);
-	if (robot->cur_stmt == NULL) {
-		/* End of block */
-		robot_leave(robot);
+	rerun = robot->robots->rerun;
+	if (proc->rerun_seq != rerun->seq ||
+	    (effect && proc->rerun_eseq != rerun->seq))
+		rerun_proc_entered(rerun, proc, effect);
+}
+
+/** Determine if call statement is a tail call.
+ *
+ * A call is a tail call if it is the last statement executed in its
+ * procedure. This includes a call at the end of a loop body in the last
+ * iteration, if nothing follows the loop (or the enclosing loops).
+ *
+ * @param robot Robot
+ * @param scall Call statement
+ * @return @c true iff @a scall is a tail call
+ */
+static bool robot_call_is_tail(robot_t *robot, prog_stmt_t *scall)
+{
+	rstack_entry_t *entry;
+	prog_stmt_t *stmt;
+
+	if (prog_block_next(scall) != NULL)
+		return false;
+
+	/* Loop entries of the current procedure are on top of the stack */
+	stmt = scall;
+	entry = rstack_last(robot->rstack);
+	while (entry != NULL && entry->loop > 0 &&
+	    stmt->block == entry->caller_stmt->s.srepeat.body) {
+		if (entry->loop > 1 ||
+		    prog_block_next(entry->caller_stmt) != NULL)
+			return false;
+
+		stmt = entry->caller_stmt;
+		entry = rstack_prev(entry);
 	}
+
+	return true;
 }
 
 /** Execeute call statement.
@@ -360,23 +551,353 @@ static int robot_stmt_call(robot_t *robot)
 	assert(scall->stype == progst_call);
 
 	snext = prog_block_next(scall);
-	if (snext == NULL) {
+	if (robot_call_is_tail(robot, scall)) {
 		/* Tail call - do nothing */
+	} else if (snext == NULL) {
+		/* Call ends loop body, loop entry stands for continuation */
+		rc = rstack_loop_cont(robot->rstack);
+		if (rc == ENOSPC) {
+			robot_set_error(robot, errt_stack_overflow);
+			return 0;
+		}
 	} else {
 		/* Push next statement position */
 		rc = rstack_push_cont(robot->rstack, robot->cur_proc,
 		    snext);
+		if (rc == ENOSPC) {
+			robot_set_error(robot, errt_stack_overflow);
+			return 0;
+		}
+
 		if (rc != 0)
 			return rc;
 	}
 
+	robot_proc_entered(robot, scall->s.scall.proc, false);
+
 	/* Set current program position */
-	robot->cur_proc = scall->s.scall.proc;
-	robot->cur_stmt = prog_block_first(robot->cur_proc->body);
+	robot_set_cur(robot, scall->s.scall.proc,
+	    prog_block_first(scall->s.scall.proc->body));
+
+	/* Empty procedure returns immediately */
+	if (robot->cur_stmt == NULL)
+		robot_leave(robot);
 
 	return 0;
 }
 
+/** Execute call statement using movement effect of the called procedure.
+ *
+ * The effect is only applied if it leads to exactly the same result as
+ * interpreting the call would, i.e. if no wall is hit on the path and
+ * the robot stack limit is not exceeded. The statement following the call
+ * is not entered.
+ *
+ * @param robot Robot
+ * @param scall Call statement
+ * @param cost Cost model
+ * @param max_steps Maximum number of statements that can be executed
+ * @param max_cost Maximum cost that can be charged
+ * @param rcost Place to store cost of the statements executed
+ * @return Number of statements executed or zero if the effect was
+ *         not applied
+ */
+static unsigned long robot_call_effect(robot_t *robot, prog_stmt_t *scall,
+    const robot_cost_t *cost, unsigned long max_steps,
+    unsigned long max_cost, unsigned long *rcost)
+{
+	prog_proc_t *proc = scall->s.scall.proc;
+	prog_effect_t *effect = proc->effect;
+	unsigned long ecost;
+	unsigned depth;
+	int fx, fy, lx, ly;
+	int x, y;
+	unsigned i;
+
+	if (effect == NULL || proc->mod == NULL || !proc->mod->cg_valid)
+		return 0;
+
+	/* Intermediate positions might be watched */
+	if (robot->robots->pos_watch != NULL)
+		return 0;
+
+	/* The call statement counts as one step */
+	if (effect->nsteps + 1 > max_steps)
+		return 0;
+
+	/* Statements that are neither moves nor turns are calls */
+	ecost = effect->npath * cost->op[progop_move] +
+	    effect->nturns * cost->op[progop_turn_left] +
+	    (effect->nsteps + 1 - effect->npath - effect->nturns) *
+	    cost->op[progop_call];
+	if (ecost > max_cost)
+		return 0;
+
+	depth = robot->rstack->nentries - robot->rstack->nloops +
+	    proc->max_depth;
+	if (!robot_call_is_tail(robot, scall))
+		++depth;
+	if (depth > robot->rstack->limit)
+		return 0;
+
+	dir_get_off(robot->dir, &fx, &fy);
+	dir_get_off(dir_next_ccw(robot->dir), &lx, &ly);
+
+	for (i = 0; i < effect->npath; i++) {
+		x = robot->x + effect->path[2 * i] * fx +
+		    effect->path[2 * i + 1] * lx;
+		y = robot->y + effect->path[2 * i] * fy +
+		    effect->path[2 * i + 1] * ly;
+		if (!map_tile_walkable(map_get(robot->robots->map, x, y)))
+			return 0;
+	}
+
+	if (effect->df != 0 || effect->dl != 0) {
+		robots_move_robot(robot->robots, robot,
+		    effect->df * fx + effect->dl * lx,
+		    effect->df * fy + effect->dl * ly);
+	}
+
+	for (i = 0; i < effect->rot; i++)
+		robot_turn_left(robot);
+
+	robot_proc_entered(robot, proc, true);
+
+	*rcost = ecost;
+	return effect->nsteps + 1;
+}
+
+/*
+ * With GCC the run loop uses threaded dispatch (labels as values),
+ * jumping directly from one statement handler to the next. Otherwise
+ * it falls back to a switch statement.
+ */
+#if defined(__GNUC__) && !defined(ROBOT_NO_THREADED)
+#define ROBOT_THREADED
+#endif
+
+#ifdef ROBOT_THREADED
+#define ROBOT_OP(label, op) label:
+#define ROBOT_DISPATCH() goto *op_labels[op]
+#else
+#define ROBOT_OP(label, op) case op:
+#define ROBOT_DISPATCH() goto dispatch
+#endif
+
+/** Fetch next statement and dispatch it or stop the run loop */
+#define ROBOT_NEXT() \
+	if (steps >= max_steps || used >= max_cost || \
+	    robot->cur_stmt == NULL || robot->halt) \
+		goto done; \
+	stmt = robot->cur_stmt; \
+	op = stmt->op; \
+	ROBOT_DISPATCH()
+
+/** Initialize cost model where every statement costs one unit.
+ *
+ * @param cost Cost model
+ */
+void robot_cost_init_unit(robot_cost_t *cost)
+{
+	*cost = robot_unit_cost;
+}
+
+/** Initialize cost model where only visible actions are charged.
+ *
+ * Intrinsic statements cost one unit, other statements are free.
+ *
+ * @param cost Cost model
+ */
+void robot_cost_init_actions(robot_cost_t *cost)
+{
+	unsigned i;
+
+	for (i = 0; i < progop_limit; i++)
+		cost->op[i] = i < progin_limit ? 1 : 0;
+}
+
+/** Run robot for a number of steps.
+ *
+ * Executes statements until @a max_steps statements have been executed,
+ * the robot finishes, stops due to error, reaches a breakpoint or hits
+ * a watchpoint. Calls to procedures with a known movement effect are
+ * executed in one go when possible.
+ *
+ * A robot stopped at a breakpoint executes the statement when it is run
+ * again.
+ *
+ * @param robot Robot
+ * @param max_steps Maximum number of statements to execute
+ * @param rsteps Place to store number of statements executed or @c NULL
+ * @return Zero on success, EINTR if robot stopped at a breakpoint
+ *         or watchpoint, ENOTSUP if robot reached a statement that
+ *         cannot be executed, ENOMEM if out of memory
+ */
+int robot_run(robot_t *robot, unsigned long max_steps, unsigned long *rsteps)
+{
+	return robot_run_cost(robot, NULL, ULONG_MAX, max_steps, NULL,
+	    rsteps);
+}
+
+/** Run robot within a cost budget.
+ *
+ * Like robot_run(), but each statement is charged according to the cost
+ * model @a cost and execution also stops when @a max_cost is used up.
+ * Statements with zero cost are still limited by @a max_steps.
+ *
+ * @param robot Robot
+ * @param cost Cost model or @c NULL to charge one unit per statement
+ * @param max_cost Maximum cost to charge
+ * @param max_steps Maximum number of statements to execute
+ * @param rcost Place to store cost charged or @c NULL
+ * @param rsteps Place to store number of statements executed or @c NULL
+ * @return Zero on success, EINTR if robot stopped at a breakpoint
+ *         or watchpoint, ENOTSUP if robot reached a statement that
+ *         cannot be executed, ENOMEM if out of memory
+ */
+int robot_run_cost(robot_t *robot, const robot_cost_t *cost,
+    unsigned long max_cost, unsigned long max_steps, unsigned long *rcost,
+    unsigned long *rsteps)
+{
+#ifdef ROBOT_THREADED
+	static const void *const op_labels[progop_limit] = {
+		[progop_turn_left] = &&op_turn_left,
+		[progop_move] = &&op_move,
+		[progop_put_white] = &&op_put_white,
+		[progop_put_grey] = &&op_put_grey,
+		[progop_put_black] = &&op_put_black,
+		[progop_pick_up] = &&op_pick_up,
+		[progop_call] = &&op_call,
+		[progop_if] = &&op_other,
+		[progop_repeat] = &&op_repeat,
+		[progop_recurse] = &&op_other,
+		[progop_break] = &&op_break
+	};
+#endif
+	prog_stmt_t *stmt;
+	prog_stmt_t *first;
+	prog_op_t op;
+	unsigned long steps = 0;
+	unsigned long used = 0;
+	unsigned long esteps;
+	unsigned long ecost;
+	int rc = 0;
+
+	if (cost == NULL)
+		cost = &robot_unit_cost;
+
+	/* Resume after watchpoint hit */
+	robot->halt = robot->error != errt_none;
+
+	ROBOT_NEXT();
+
+#ifndef ROBOT_THREADED
+dispatch:
+	switch (op) {
+#endif
+	ROBOT_OP(op_turn_left, progop_turn_left)
+		robot_turn_left(robot);
+		goto intr_done;
+	ROBOT_OP(op_move, progop_move)
+		robot_move(robot);
+		goto intr_done;
+	ROBOT_OP(op_put_white, progop_put_white)
+		robot_put_white(robot);
+		goto intr_done;
+	ROBOT_OP(op_put_grey, progop_put_grey)
+		robot_put_grey(robot);
+		goto intr_done;
+	ROBOT_OP(op_put_black, progop_put_black)
+		robot_put_black(robot);
+		goto intr_done;
+	ROBOT_OP(op_pick_up, progop_pick_up)
+		robot_pick_up(robot);
+		goto intr_done;
+	ROBOT_OP(op_call, progop_call)
+		esteps = robot_call_effect(robot, stmt, cost, max_steps - steps,
+		    max_cost - used, &ecost);
+		if (esteps > 0) {
+			steps += esteps;
+			used += ecost;
+			goto advance;
+		}
+
+		rc = robot_stmt_call(robot);
+		if (rc != 0)
+			goto done;
+		++steps;
+		used += cost->op[progop_call];
+		ROBOT_NEXT();
+	ROBOT_OP(op_repeat, progop_repeat)
+		if (!robot_repeat_supported(stmt)) {
+			rc = ENOTSUP;
+			goto done;
+		}
+
+		/*
+		 * A loop only stands for its unrolled body, so entering it
+		 * is neither counted as a step nor charged.
+		 */
+		first = prog_block_first(stmt->s.srepeat.body);
+		if (first == NULL)
+			goto advance;
+
+		rc = rstack_push_loop(robot->rstack, robot->cur_proc, stmt,
+		    stmt->s.srepeat.repcnt);
+		if (rc != 0)
+			goto done;
+
+		robot->cur_stmt = first;
+		ROBOT_NEXT();
+	ROBOT_OP(op_break, progop_break)
+		if (robot->bp_stmt != stmt) {
+			/* Stop before executing the statement */
+			robot->bp_stmt = stmt;
+			rc = EINTR;
+			goto done;
+		}
+
+		/* Resume from breakpoint */
+		robot->bp_stmt = NULL;
+		op = prog_stmt_base_op(stmt);
+		ROBOT_DISPATCH();
+#ifndef ROBOT_THREADED
+	default:
+		break;
+	}
+#else
+op_other:
+#endif
+	/* Statement cannot be executed */
+	rc = ENOTSUP;
+	goto done;
+
+intr_done:
+	++steps;
+	used += cost->op[op];
+	if (robot->error != errt_none)
+		goto done;
+advance:
+	robot->cur_stmt = prog_block_next(stmt);
+	if (robot->cur_stmt == NULL) {
+		/* End of block */
+		robot_leave(robot);
+	}
+
+	ROBOT_NEXT();
+done:
+	if (rc == 0 && robot->halt && robot->error == errt_none) {
+		/* Watchpoint hit */
+		rc = EINTR;
+	}
+
+	if (rcost != NULL)
+		*rcost = used;
+	if (rsteps != NULL)
+		*rsteps = steps;
+	return rc;
+}
+
 /** Advance one step in robot execution.
  *
  * @parm robot Robot
@@ -384,25 +905,12 @@ static int robot_stmt_call(robot_t *robot)
  */
 int robot_step(robot_t *robot)
 {
-	int rc = 0;
-
 	if (robot->cur_stmt == NULL)
 		return EINVAL;
 	if (robot->error)
 		return EINVAL;
 
-	switch (robot->cur_stmt->stype) {
-	case progst_intrinsic:
-		robot_stmt_intrinsic(robot);
-		break;
-	case progst_call:
-		rc = robot_stmt_call(robot);
-		break;
-	default:
-		return ENOTSUP;
-	}
-
-	return rc;
+	return robot_run(robot, 1, NULL);
 }
 
 /** Return current procedure.
@@ -39,7 +39,9 @@ typedef enum {
 	/** Robot tried to put a tag on a square already occupied by a tag */
 	errt_already_tag,
 	/** Robot tried to pick up a tag, but there was no tag */
-	errt_no_tag
+	errt_no_tag,
+	/** Robot exceeded maximum stack depth */
+	errt_stack_overflow
 } robot_error_t;
 
 /** Robot */
@@ -64,12 +66,22 @@ typedef struct {
 	rstack_t *rstack;
 	/** Was robot stopped due to error? */
 	robot_error_t error;
+	/** Stop executing (error or watchpoint hit) */
+	bool halt;
+	/** Breakpoint statement the robot is stopped at or @c NULL */
+	prog_stmt_t *bp_stmt;
 } robot_t;
 
 enum {
-	errt_limit = errt_no_tag + 1
+	errt_limit = errt_stack_overflow + 1
 };
 
+/** Statement cost model */
+typedef struct {
+	/** Cost of executing statement with each opcode */
+	unsigned long op[progop_limit];
+} robot_cost_t;
+
 extern int robot_create(int, int, dir_t, rstack_t *, robot_t **);
 extern void robot_destroy(robot_t *);
 extern int robot_load(prog_module_t *, FILE *, robot_t **);
@@ -85,6 +97,13 @@ extern int robot_is_busy(robot_t *);
 extern robot_error_t robot_error(robot_t *);
 extern void robot_reset(robot_t *);
 extern int robot_step(robot_t *);
+extern int robot_run(robot_t *, unsigned long, unsigned long *);
+extern int robot_run_cost(robot_t *, const robot_cost_t *, unsigned long,
+    unsigned long, unsigned long *, unsigned long *);
+extern void robot_cost_init_unit(robot_cost_t *);
+extern void robot_cost_init_actions(robot_cost_t *);
+extern void robot_advance(robot_t *, prog_stmt_t *);
+extern void robot_continue_at(robot_t *, prog_proc_t *, prog_stmt_t *);
 extern prog_proc_t *robot_cur_proc(robot_t *);
 extern prog_stmt_t *robot_cur_stmt(robot_t *);
 
@@ -26,8 +26,11 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
 #include "dir.h"
+#include "journal.h"
 #include "prog.h"
+#include "rerun.h"
 #include "robot.h"
 #include "robots.h"
 
@@ -53,6 +56,10 @@ int robots_create(prog_module_t *prog, map_t *map, robots_t **rrobots)
 	list_initialize(&robots->dorder);
 	robots->prog = prog;
 	robots->map = map;
+	robots->stack_limit = rstack_def_limit;
+	robot_cost_init_actions(&robots->cost);
+	robots->tick_budget = robots_def_tick_budget;
+	robots->tick_usec = robots_def_tick_usec;
 	*rrobots = robots;
 	return 0;
 }
@@ -64,6 +71,7 @@ int robots_create(prog_module_t *prog, map_t *map, robots_t **rrobots)
 void robots_destroy(robots_t *robots)
 {
 	robot_t *robot;
+	int i;
 
 	robot = robots_first(robots);
 	while (robot != NULL) {
@@ -73,6 +81,13 @@ void robots_destroy(robots_t *robots)
 		robot = robots_first(robots);
 	}
 
+	for (i = 0; i < robots->nimages; i++) {
+		if (robots->image[i] != NULL)
+			gfx_bmp_destroy(robots->image[i]);
+	}
+
+	free(robots->image);
+	bitmap_destroy(robots->pos_watch);
 	free(robots);
 }
 
@@ -158,6 +173,7 @@ static void robots_add_robot(robots_t *robots, robot_t *robot)
 
 	robot->robots = robots;
 	list_append(&robot->lrobots, &robots->robots);
+	rstack_set_limit(robot->rstack, robots->stack_limit);
 
 	if (oldr != NULL)
 		list_insert_before(&robot->ldorder, &oldr->ldorder);
@@ -197,6 +213,9 @@ int robots_add(robots_t *robots, int x, int y)
 	}
 
 	robots_add_robot(robots, robot);
+
+	if (robots->journal != NULL)
+		journal_robot_add(robots->journal, x, y);
 	return 0;
 }
 
@@ -215,6 +234,12 @@ void robots_remove(robots_t *robots, int x, int y)
 	if (oldr == NULL)
 		return;
 
+	if (robots->tick_next == oldr)
+		robots->tick_next = NULL;
+
+	if (robots->journal != NULL)
+		journal_robot_remove(robots->journal, x, y);
+
 	list_remove(&oldr->lrobots);
 	list_remove(&oldr->ldorder);
 	robot_destroy(oldr);
@@ -231,8 +256,6 @@ void robots_move_robot(robots_t *robots, robot_t *robot, int dx, int dy)
 {
 	robot_t *next;
 
-	printf("robots_move_robot(robot=%p dx=%d dy=%d\n",
-	    robot, dx, dy);
 	if (dy < 0) {
 		next = robots_dorder_prev(robot);
 		while (next != NULL && robot->y + dy < next->y)
@@ -255,8 +278,15 @@ void robots_move_robot(robots_t *robots, robot_t *robot, int dx, int dy)
 			list_append(&robot->ldorder, &robots->dorder);
 	}
 
+	if (robots->journal != NULL)
+		journal_robot_move(robots->journal, robot->x, robot->y, dx, dy);
+
 	robot->x += dx;
 	robot->y += dy;
+
+	if (robots->pos_watch != NULL &&
+	    robots_watch_pos_get(robots, robot->x, robot->y))
+		robot->halt = true;
 }
 
 /** Get first robot.
@@ -506,3 +536,241 @@ void robots_set_rel_pos(robots_t *robots, int x, int y)
 	robots->rel_x = x;
 	robots->rel_y = y;
 }
+
+/** Set maximum robot stack depth.
+ *
+ * A robot that exceeds the limit stops with errt_stack_overflow.
+ *
+ * @param robots Robots
+ * @param limit Maximum number of robot stack entries
+ */
+void robots_set_stack_limit(robots_t *robots, unsigned limit)
+{
+	robot_t *robot;
+
+	robots->stack_limit = limit;
+
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		rstack_set_limit(robot->rstack, limit);
+		robot = robots_next(robot);
+	}
+}
+
+/** Set change journal.
+ *
+ * @param robots Robots
+ * @param journal Journal to record changes to or @c NULL
+ */
+void robots_set_journal(robots_t *robots, struct journal *journal)
+{
+	robots->journal = journal;
+}
+
+/** Set run recorder.
+ *
+ * @param robots Robots
+ * @param rerun Run recorder to record runs to or @c NULL
+ */
+void robots_set_rerun(robots_t *robots, struct rerun *rerun)
+{
+	robots->rerun = rerun;
+}
+
+/** Set or clear watchpoint on robot position.
+ *
+ * A robot that enters a watched tile stops executing.
+ *
+ * @param robots Robots
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ * @param watch @c true to watch position, @c false to stop watching it
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int robots_watch_pos_set(robots_t *robots, int x, int y, bool watch)
+{
+	map_t *map = robots->map;
+	int rc;
+
+	assert(x >= 0 && x < map->width);
+	assert(y >= 0 && y < map->height);
+
+	if (robots->pos_watch == NULL) {
+		if (!watch)
+			return 0;
+
+		rc = bitmap_create(map->width * map->height,
+		    &robots->pos_watch);
+		if (rc != 0)
+			return rc;
+	}
+
+	bitmap_set(robots->pos_watch, y * map->width + x, watch);
+
+	/* Without watchpoints, moving robots costs nothing extra */
+	if (bitmap_count(robots->pos_watch) == 0) {
+		bitmap_destroy(robots->pos_watch);
+		robots->pos_watch = NULL;
+	}
+
+	return 0;
+}
+
+/** Determine if robot position is watched.
+ *
+ * @param robots Robots
+ * @param x X tile coordinate
+ * @param y Y tile coordinate
+ * @return @c true iff position is watched
+ */
+bool robots_watch_pos_get(robots_t *robots, int x, int y)
+{
+	map_t *map = robots->map;
+
+	if (robots->pos_watch == NULL)
+		return false;
+
+	if (x < 0 || y < 0 || x >= map->width || y >= map->height)
+		return false;
+
+	return bitmap_get(robots->pos_watch, y * map->width + x);
+}
+
+/** Set statement cost model used by robots_tick().
+ *
+ * @param robots Robots
+ * @param cost Cost model
+ */
+void robots_set_cost(robots_t *robots, const robot_cost_t *cost)
+{
+	robots->cost = *cost;
+}
+
+/** Set cost budget granted to each robot per tick.
+ *
+ * @param robots Robots
+ * @param budget Cost budget
+ */
+void robots_set_tick_budget(robots_t *robots, unsigned long budget)
+{
+	robots->tick_budget = budget;
+}
+
+/** Set maximum time spent in one tick.
+ *
+ * @param robots Robots
+ * @param usec Maximum time in microseconds
+ */
+void robots_set_tick_time(robots_t *robots, unsigned long usec)
+{
+	robots->tick_usec = usec;
+}
+
+/** Return microseconds elapsed since a point in time.
+ *
+ * @param start Start time (monotonic clock)
+ * @return Microseconds elapsed
+ */
+static unsigned long robots_usec_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	    (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/** Determine if robot can run.
+ *
+ * @param robot Robot
+ * @return @c true iff robot is busy and has not stopped due to error
+ */
+static bool robots_runnable(robot_t *robot)
+{
+	return robot_is_busy(robot) && robot_error(robot) == errt_none;
+}
+
+/** Run robots for one tick.
+ *
+ * Each runnable robot, in turn, executes statements until it uses up
+ * the tick budget (as charged by the cost model) or stops. If the
+ * tick time limit is exceeded, the tick ends early and the next tick
+ * starts with the robot following the one that was interrupted.
+ *
+ * The tick also ends when a robot stops at a breakpoint or watchpoint.
+ *
+ * If a run recorder is set, a checkpoint is taken before the robots run
+ * when one is due.
+ *
+ * @param robots Robots
+ * @param ractive Place to store @c true iff some robot can continue
+ *                running
+ * @param rerror Place to store first error a robot stopped with during
+ *               this tick or errt_none
+ * @return Zero on success, EINTR if a robot stopped at a breakpoint
+ *         or watchpoint, other error code if a robot could not
+ *         continue executing
+ */
+int robots_tick(robots_t *robots, bool *ractive, robot_error_t *rerror)
+{
+	struct timespec start;
+	robot_t *robot;
+	robot_t *first;
+	unsigned long left;
+	unsigned long used;
+	unsigned long steps;
+	bool active = false;
+	robot_error_t error = errt_none;
+	int rc = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (robots->rerun != NULL)
+		rerun_tick(robots->rerun);
+
+	first = robots->tick_next != NULL ? robots->tick_next :
+	    robots_first(robots);
+	robots->tick_next = NULL;
+
+	robot = first;
+	while (robot != NULL) {
+		left = robots->tick_budget;
+		while (left > 0 && robots_runnable(robot)) {
+			rc = robot_run_cost(robot, &robots->cost, left,
+			    robots_tick_chunk, &used, &steps);
+			left -= used;
+			if (robots->rerun != NULL)
+				robots->rerun->steps += steps;
+
+			if (robot_error(robot) != errt_none &&
+			    error == errt_none)
+				error = robot_error(robot);
+			if (rc != 0)
+				goto out;
+
+			if (robots_usec_since(&start) >= robots->tick_usec) {
+				/* Let the other robots go first next time */
+				robots->tick_next = robots_next(robot);
+				goto out;
+			}
+		}
+
+		robot = robots_next(robot);
+		if (robot == NULL)
+			robot = robots_first(robots);
+		if (robot == first)
+			break;
+	}
+
+out:
+	robot = robots_first(robots);
+	while (robot != NULL) {
+		if (robots_runnable(robot))
+			active = true;
+		robot = robots_next(robot);
+	}
+
+	*ractive = active;
+	*rerror = error;
+	return rc;
+}
@@ -24,12 +24,22 @@
 #define ROBOTS_H
 
 #include <stdio.h>
+#include "adt/bitmap.h"
 #include "adt/list.h"
 #include "gfx.h"
 #include "map.h"
 #include "prog.h"
 #include "robot.h"
 
+enum {
+	/** Default cost budget granted to each robot per tick */
+	robots_def_tick_budget = 1,
+	/** Default maximum time spent in one tick (microseconds) */
+	robots_def_tick_usec = 10000,
+	/** Number of statements executed between checks of elapsed time */
+	robots_tick_chunk = 256
+};
+
 /** Robots */
 typedef struct robots {
 	/** Program module used by robots */
@@ -52,6 +62,22 @@ typedef struct robots {
 	int rel_x;
 	/** Relative position to map tile */
 	int rel_y;
+	/** Maximum robot stack depth */
+	unsigned stack_limit;
+	/** Watched robot positions or @c NULL if none are watched */
+	bitmap_t *pos_watch;
+	/** Statement cost model used by robots_tick() */
+	robot_cost_t cost;
+	/** Cost budget granted to each robot per tick */
+	unsigned long tick_budget;
+	/** Maximum time spent in one tick (microseconds) */
+	unsigned long tick_usec;
+	/** Robot to run first in the next tick or @c NULL */
+	robot_t *tick_next;
+	/** Change journal or @c NULL */
+	struct journal *journal;
+	/** Run recorder or @c NULL */
+	struct rerun *rerun;
 } robots_t;
 
 extern int robots_create(prog_module_t *, map_t *, robots_t **);
@@ -74,5 +100,14 @@ extern void robots_draw(robots_t *, int, int, gfx_t *);
 extern int robots_load_img(robots_t *, int, int, int, const char **);
 extern void robots_set_tile_size(robots_t *, int, int);
 extern void robots_set_rel_pos(robots_t *, int, int);
+extern void robots_set_stack_limit(robots_t *, unsigned);
+extern void robots_set_journal(robots_t *, struct journal *);
+extern void robots_set_rerun(robots_t *, struct rerun *);
+extern int robots_watch_pos_set(robots_t *, int, int, bool);
+extern bool robots_watch_pos_get(robots_t *, int, int);
+extern void robots_set_cost(robots_t *, const robot_cost_t *);
+extern void robots_set_tick_budget(robots_t *, unsigned long);
+extern void robots_set_tick_time(robots_t *, unsigned long);
+extern int robots_tick(robots_t *, bool *, robot_error_t *);
 
 #endif
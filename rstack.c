@@ -32,6 +32,7 @@
 static void rstack_entry_destroy(rstack_entry_t *);
 static int rstack_entry_load(FILE *, rstack_t *);
 static int rstack_entry_save(rstack_entry_t *, FILE *);
+static int rstack_push(rstack_t *, prog_proc_t *, prog_stmt_t *, unsigned);
 
 /** Create new robot stack.
  *
@@ -46,8 +47,8 @@ int rstack_create(prog_module_t *prog, rstack_t **rrstack)
 	if (rstack == NULL)
 		return ENOMEM;
 
-	list_initialize(&rstack->entries);
 	rstack->prog = prog;
+	rstack->limit = rstack_def_limit;
 	*rrstack = rstack;
 	return 0;
 }
@@ -57,16 +58,64 @@ int rstack_create(prog_module_t *prog, rstack_t **rrstack)
  * @param robot Robot stack
  */
 void rstack_destroy(rstack_t *rstack)
+{
+	rstack_clear(rstack);
+	free(rstack->entries);
+	free(rstack);
+}
+
+/** Remove all entries from robot stack.
+ *
+ * @param rstack Robot stack
+ */
+void rstack_clear(rstack_t *rstack)
 {
 	rstack_entry_t *entry;
 
-	entry = rstack_first(rstack);
+	entry = rstack_last(rstack);
 	while (entry != NULL) {
 		rstack_entry_destroy(entry);
-		entry = rstack_first(rstack);
+		entry = rstack_last(rstack);
 	}
+}
 
-	free(rstack);
+/** Set maximum number of robot stack entries.
+ *
+ * Pushing more continuation entries fails with ENOSPC. Entries already
+ * on the stack (including those loaded from a file) are not affected.
+ * Loop entries do not count against the limit, so that a loop never fails
+ * where the statements it stands for would not.
+ *
+ * @param rstack Robot stack
+ * @param limit Maximum number of entries
+ */
+void rstack_set_limit(rstack_t *rstack, unsigned limit)
+{
+	rstack->limit = limit;
+}
+
+/** Make sure robot stack can hold a number of entries without reallocation.
+ *
+ * @param rstack Robot stack
+ * @param cnt Number of entries (is capped at the stack limit)
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int rstack_reserve(rstack_t *rstack, unsigned cnt)
+{
+	rstack_entry_t *nentries;
+
+	if (cnt > rstack->limit)
+		cnt = rstack->limit;
+	if (cnt <= rstack->alloc)
+		return 0;
+
+	nentries = realloc(rstack->entries, cnt * sizeof(rstack_entry_t));
+	if (nentries == NULL)
+		return ENOMEM;
+
+	rstack->entries = nentries;
+	rstack->alloc = cnt;
+	return 0;
 }
 
 /** Load robot stack.
@@ -94,6 +143,12 @@ int rstack_load(prog_module_t *prog, FILE *f, rstack_t **rrstack)
 		return ENOMEM;
 	}
 
+	rc = rstack_reserve(rstack, nentries);
+	if (rc != 0) {
+		rstack_destroy(rstack);
+		return rc;
+	}
+
 	for (i = 0; i < nentries; i++) {
 		rc = rstack_entry_load(f, rstack);
 		if (rc != 0) {
@@ -118,7 +173,7 @@ int rstack_save(rstack_t *rstack, FILE *f)
 	int rc;
 	int rv;
 
-	rv = fprintf(f, "%u\n", (unsigned)list_count(&rstack->entries));
+	rv = fprintf(f, "%u\n", rstack->nentries);
 	if (rv < 0)
 		return EIO;
 
@@ -135,19 +190,18 @@ int rstack_save(rstack_t *rstack, FILE *f)
 }
 
 /** Get first robot stack entry.
+ *
+ * Entry pointers are only valid until the next push.
  *
  * @param rstack Robot stack
  * @return First entry or @c NULL if stack is empty
  */
 rstack_entry_t *rstack_first(rstack_t *rstack)
 {
-	link_t *link;
-
-	link = list_first(&rstack->entries);
-	if (link == NULL)
+	if (rstack->nentries == 0)
 		return NULL;
 
-	return list_get_instance(link, rstack_entry_t, lentries);
+	return &rstack->entries[0];
 }
 
 /** Get next robot stack entry.
@@ -157,13 +211,12 @@ rstack_entry_t *rstack_first(rstack_t *rstack)
  */
 rstack_entry_t *rstack_next(rstack_entry_t *cur)
 {
-	link_t *link;
+	rstack_t *rstack = cur->rstack;
 
-	link = list_next(&cur->lentries, &cur->rstack->entries);
-	if (link == NULL)
+	if (cur == &rstack->entries[rstack->nentries - 1])
 		return NULL;
 
-	return list_get_instance(link, rstack_entry_t, lentries);
+	return cur + 1;
 }
 
 /** Get last robot stack entry.
@@ -173,29 +226,23 @@ rstack_entry_t *rstack_next(rstack_entry_t *cur)
  */
 rstack_entry_t *rstack_last(rstack_t *rstack)
 {
-	link_t *link;
-
-	link = list_last(&rstack->entries);
-	if (link == NULL)
+	if (rstack->nentries == 0)
 		return NULL;
 
-	return list_get_instance(link, rstack_entry_t, lentries);
+	return &rstack->entries[rstack->nentries - 1];
 }
 
 /** Get previous robot stack entry.
  *
  * @param cur Current entry
- * @return Previous entry or @c NULL if @a cur is the last entry
+ * @return Previous entry or @c NULL if @a cur is the first entry
  */
 rstack_entry_t *rstack_prev(rstack_entry_t *cur)
 {
-	link_t *link;
-
-	link = list_prev(&cur->lentries, &cur->rstack->entries);
-	if (link == NULL)
+	if (cur == &cur->rstack->entries[0])
 		return NULL;
 
-	return list_get_instance(link, rstack_entry_t, lentries);
+	return cur - 1;
 }
 
 /** Load robot stack entry.
@@ -208,18 +255,36 @@ static int rstack_entry_load(FILE *f, rstack_t *rstack)
 	char ident[prog_proc_id_len + 1];
 	int nitem;
 	int rc;
+	int c;
 	unsigned stmt_index;
+	unsigned loop;
+	unsigned cont;
 	prog_proc_t *proc;
 	prog_stmt_t *stmt;
+	rstack_entry_t *entry;
 
 	rc = prog_proc_load_ident(f, ident);
 	if (rc != 0)
 		return rc;
 
-	nitem = fscanf(f, "%u\n", &stmt_index);
+	nitem = fscanf(f, "%u", &stmt_index);
 	if (nitem != 1)
 		return EIO;
 
+	/* Loop entries have the iteration count and continuation flag */
+	loop = 0;
+	cont = 0;
+	c = fgetc(f);
+	if (c == ' ') {
+		nitem = fscanf(f, "%u %u", &loop, &cont);
+		if (nitem != 2 || loop == 0 || cont > 1)
+			return EIO;
+		c = fgetc(f);
+	}
+
+	if (c != '\n')
+		return EIO;
+
 	proc = prog_module_proc_by_ident(rstack->prog, ident);
 	if (proc == NULL)
 		return EIO;
@@ -228,7 +293,24 @@ static int rstack_entry_load(FILE *f, rstack_t *rstack)
 	if (stmt == NULL)
 		return EIO;
 
-	return rstack_push_cont(rstack, proc, stmt);
+	if (loop > 0 && stmt->stype != progst_repeat)
+		return EIO;
+
+	/*
+	 * The stack limit is not checked here. A stack saved with a higher
+	 * limit must still load, it only cannot grow any further.
+	 */
+	rc = rstack_push(rstack, proc, stmt, loop);
+	if (rc != 0)
+		return rc;
+
+	if (cont != 0) {
+		entry = rstack_last(rstack);
+		entry->cont = true;
+		--rstack->nloops;
+	}
+
+	return 0;
 }
 
 /** Save robot stack entry.
@@ -243,14 +325,20 @@ static int rstack_entry_save(rstack_entry_t *entry, FILE *f)
 	int rv;
 	unsigned stmt_index;
 
-	stmt_index = prog_proc_get_stmt_index(entry->caller_proc,
-	    entry->caller_stmt);
+	rc = prog_proc_get_stmt_index(entry->caller_proc, entry->caller_stmt,
+	    &stmt_index);
+	if (rc != 0)
+		return rc;
 
 	rc = prog_proc_save_ident(entry->caller_proc->ident, f);
 	if (rc != 0)
 		return rc;
 
-	rv = fprintf(f, "%u\n", stmt_index);
+	if (entry->loop > 0)
+		rv = fprintf(f, "%u %u %u\n", stmt_index, entry->loop,
+		    entry->cont ? 1 : 0);
+	else
+		rv = fprintf(f, "%u\n", stmt_index);
 	if (rv < 0)
 		return EIO;
 
@@ -259,12 +347,56 @@ static int rstack_entry_save(rstack_entry_t *entry, FILE *f)
 
 /** Destroy robot stack entry.
  *
- * @param entry Robot stack entry
+ * @param entry Robot stack entry (must be the top entry)
  */
 static void rstack_entry_destroy(rstack_entry_t *entry)
 {
-	list_remove(&entry->lentries);
-	free(entry);
+	rstack_t *rstack = entry->rstack;
+
+	assert(entry == rstack_last(rstack));
+	prog_proc_stack_unref(entry->caller_proc);
+	if (entry->loop > 0 && !entry->cont)
+		--rstack->nloops;
+	--rstack->nentries;
+}
+
+/** Push entry to robot stack.
+ *
+ * @param rstack Robot stack
+ * @param proc Procedure
+ * @param stmt Statement
+ * @param loop Loop iterations left or zero
+ *
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int rstack_push(rstack_t *rstack, prog_proc_t *proc, prog_stmt_t *stmt,
+    unsigned loop)
+{
+	rstack_entry_t *entry;
+	unsigned nalloc;
+	rstack_entry_t *nentries;
+
+	if (rstack->nentries >= rstack->alloc) {
+		nalloc = rstack->alloc > 0 ? 2 * rstack->alloc : 8;
+		nentries = realloc(rstack->entries,
+		    nalloc * sizeof(rstack_entry_t));
+		if (nentries == NULL)
+			return ENOMEM;
+
+		rstack->entries = nentries;
+		rstack->alloc = nalloc;
+	}
+
+	entry = &rstack->entries[rstack->nentries++];
+	entry->rstack = rstack;
+	entry->caller_proc = proc;
+	entry->caller_stmt = stmt;
+	entry->loop = loop;
+	entry->cont = false;
+	if (loop > 0)
+		++rstack->nloops;
+	prog_proc_stack_ref(proc);
+	return 0;
 }
 
 /** Push continuation entry to robot stack.
@@ -273,23 +405,73 @@ static void rstack_entry_destroy(rstack_entry_t *entry)
  * @param proc Calling procedure
  * @param stmt Calling statement
  *
- * @return Zero on success, ENOMEM if out of memory
+ * @return Zero on success, ENOSPC if stack limit was reached,
+ *         ENOMEM if out of memory
  */
 int rstack_push_cont(rstack_t *rstack, prog_proc_t *proc, prog_stmt_t *stmt)
+{
+	if (rstack->nentries - rstack->nloops >= rstack->limit)
+		return ENOSPC;
+
+	return rstack_push(rstack, proc, stmt, 0);
+}
+
+/** Push loop entry to robot stack.
+ *
+ * @param rstack Robot stack
+ * @param proc Procedure containing the repeat statement
+ * @param stmt Repeat statement
+ * @param loop Number of iterations left including the current one
+ *
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int rstack_push_loop(rstack_t *rstack, prog_proc_t *proc, prog_stmt_t *stmt,
+    unsigned loop)
+{
+	assert(loop > 0);
+	return rstack_push(rstack, proc, stmt, loop);
+}
+
+/** Make topmost loop entry stand for continuation of a call.
+ *
+ * Used for a call at the end of a loop body that is not the last
+ * statement executed in the procedure. The loop entry then counts
+ * against the stack limit, just like the continuation entry would
+ * if the loop body was written out.
+ *
+ * @param rstack Robot stack
+ * @return Zero on success, ENOSPC if stack limit was reached
+ */
+int rstack_loop_cont(rstack_t *rstack)
 {
 	rstack_entry_t *entry;
 
-	entry = calloc(1, sizeof(rstack_entry_t));
-	if (entry == NULL)
-		return ENOMEM;
+	entry = rstack_last(rstack);
+	assert(entry != NULL && entry->loop > 0 && !entry->cont);
 
-	entry->rstack = rstack;
-	list_append(&entry->lentries, &rstack->entries);
-	entry->caller_proc = proc;
-	entry->caller_stmt = stmt;
+	if (rstack->nentries - rstack->nloops >= rstack->limit)
+		return ENOSPC;
+
+	entry->cont = true;
+	--rstack->nloops;
 	return 0;
 }
 
+/** Return topmost loop entry to plain loop entry after call returned.
+ *
+ * @param rstack Robot stack
+ */
+void rstack_loop_uncont(rstack_t *rstack)
+{
+	rstack_entry_t *entry;
+
+	entry = rstack_last(rstack);
+	assert(entry != NULL && entry->loop > 0 && entry->cont);
+
+	entry->cont = false;
+	++rstack->nloops;
+}
+
 /** Pop continuation entry from robot stack.
  *
  * @param rstack Robot stack
@@ -317,5 +499,5 @@ void rstack_pop_cont(rstack_t *rstack, prog_proc_t **rproc,
  */
 int rstack_is_empty(rstack_t *rstack)
 {
-	return list_empty(&rstack->entries);
+	return rstack->nentries == 0;
 }
@@ -23,16 +23,29 @@
 #ifndef RSTACK_H
 #define RSTACK_H
 
+#include <stdbool.h>
 #include <stdio.h>
-#include "adt/list.h"
 #include "prog.h"
 
+enum {
+	/** Default maximum number of robot stack entries */
+	rstack_def_limit = 1024
+};
+
 /** Robot stack */
-typedef struct {
+typedef struct rstack {
 	/** Program module */
 	prog_module_t *prog;
-	/** Stack entries (robot_stack_entry_t) */
-	list_t entries;
+	/** Stack entries, bottom first */
+	struct rstack_entry *entries;
+	/** Number of entries */
+	unsigned nentries;
+	/** Number of allocated entries */
+	unsigned alloc;
+	/** Maximum number of continuation entries (loop entries not counted) */
+	unsigned limit;
+	/** Number of loop entries not counted against the limit */
+	unsigned nloops;
 } rstack_t;
 
 /** Robot stack continuation entry
@@ -40,20 +53,30 @@ typedef struct {
  * This entry records at which procedure/statement to continue after
  * we finish a program block (such as a procedure body, a loop body,
  * an if/else clause).
+ *
+ * A loop entry records a repeat statement whose body is being executed
+ * and how many more times the body is to be executed. While a call
+ * at the end of the loop body is executing, the loop entry also stands
+ * for the continuation of the call.
  */
-typedef struct {
+typedef struct rstack_entry {
 	/** Containing robot stack */
 	rstack_t *rstack;
-	/** Link to @c stack->entries */
-	link_t lentries;
 	/** Continuation procedure */
 	prog_proc_t *caller_proc;
-	/** Continuation statement */
+	/** Continuation statement (repeat statement for loop entry) */
 	prog_stmt_t *caller_stmt;
+	/** Iterations left including the current one or zero if not a loop */
+	unsigned loop;
+	/** Loop entry stands for continuation of a call */
+	bool cont;
 } rstack_entry_t;
 
 extern int rstack_create(prog_module_t *, rstack_t **);
 extern void rstack_destroy(rstack_t *);
+extern void rstack_clear(rstack_t *);
+extern void rstack_set_limit(rstack_t *, unsigned);
+extern int rstack_reserve(rstack_t *, unsigned);
 extern int rstack_load(prog_module_t *, FILE *, rstack_t **);
 extern int rstack_save(rstack_t *, FILE *);
 extern rstack_entry_t *rstack_first(rstack_t *);
@@ -61,6 +84,10 @@ extern rstack_entry_t *rstack_next(rstack_entry_t *);
 extern rstack_entry_t *rstack_last(rstack_t *);
 extern rstack_entry_t *rstack_prev(rstack_entry_t *);
 extern int rstack_push_cont(rstack_t *, prog_proc_t *, prog_stmt_t *);
+extern int rstack_push_loop(rstack_t *, prog_proc_t *, prog_stmt_t *,
+    unsigned);
+extern int rstack_loop_cont(rstack_t *);
+extern void rstack_loop_uncont(rstack_t *);
 extern void rstack_pop_cont(rstack_t *, prog_proc_t **, prog_stmt_t **);
 extern int rstack_is_empty(rstack_t *);
 
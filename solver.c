@@ -0,0 +1,724 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Level solver
+ *
+ * Searches the states of the world (robot pose and tags) breadth-first
+ * for the shortest sequence of intrinsic statements that turns the start
+ * map into the goal map. Each level of the search is expanded in parallel
+ * by a pool of worker threads that share a visited set split into shards,
+ * each with its own lock.
+ *
+ * Only tag actions that bring a tile closer to its goal contents are
+ * considered (putting down a tag the goal does not want, or picking up
+ * a tag the goal has, can never be part of a shortest solution). Each
+ * tile that differs between the start and the goal map therefore goes
+ * through at most three stages (start contents, empty, goal contents),
+ * so the whole world state is packed into a single 64-bit key together
+ * with the robot pose. Every tag action brings the world one action
+ * closer to the goal, which gives a lower bound on the remaining
+ * solution length, used to prune states that cannot reach the goal
+ * within the maximum number of steps.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "adt/hmap.h"
+#include "adt/pool.h"
+#include "adt/vector.h"
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+#include "solver.h"
+
+/** Tile stage (progress towards goal contents) */
+typedef enum {
+	/** Start contents */
+	sts_start = 0,
+	/** Wrong tag has been picked up */
+	sts_empty = 1,
+	/** Goal contents */
+	sts_goal = 2
+} solver_stage_t;
+
+/** Create level solver.
+ *
+ * @param map Start map
+ * @param goal Goal map (same size as @a map)
+ * @param rsolver Place to store pointer to new solver
+ * @return Zero on success, EINVAL if the maps differ in size,
+ *         ENOMEM if out of memory
+ */
+int solver_create(map_t *map, map_t *goal, solver_t **rsolver)
+{
+	solver_t *solver;
+	long ncpus;
+
+	if (map->width != goal->width || map->height != goal->height)
+		return EINVAL;
+
+	solver = calloc(1, sizeof(solver_t));
+	if (solver == NULL)
+		return ENOMEM;
+
+	solver->map = map;
+	solver->goal = goal;
+	solver->max_steps = solver_def_max_steps;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	solver->nthreads = ncpus > 0 ? (unsigned)ncpus : 1;
+
+	*rsolver = solver;
+	return 0;
+}
+
+/** Destroy level solver.
+ *
+ * @param solver Level solver
+ */
+void solver_destroy(solver_t *solver)
+{
+	free(solver);
+}
+
+/** Set number of worker threads.
+ *
+ * @param solver Level solver
+ * @param nthreads Number of worker threads (at least one)
+ */
+void solver_set_threads(solver_t *solver, unsigned nthreads)
+{
+	solver->nthreads = nthreads > 0 ? nthreads : 1;
+}
+
+/** Set maximum solution length.
+ *
+ * @param solver Level solver
+ * @param max_steps Maximum number of statements of the solution
+ */
+void solver_set_max_steps(solver_t *solver, unsigned max_steps)
+{
+	solver->max_steps = max_steps;
+}
+
+/** Get tile contents for stage of differing tile.
+ *
+ * @param solver Level solver
+ * @param idx Differing tile index
+ * @param stage Stage
+ * @return Tile contents
+ */
+static map_tile_t solver_tile(solver_t *solver, unsigned idx,
+    solver_stage_t stage)
+{
+	int x = solver->tile_xy[2 * idx];
+	int y = solver->tile_xy[2 * idx + 1];
+
+	switch (stage) {
+	case sts_start:
+		return map_get(solver->map, x, y);
+	case sts_empty:
+		return mapt_none;
+	default:
+		return map_get(solver->goal, x, y);
+	}
+}
+
+/** Find tiles that differ between start and goal map.
+ *
+ * @param solver Level solver
+ * @param rleft Place to store number of tag actions needed
+ * @return Zero on success, ENOENT if the goal cannot be reached
+ *         by putting down and picking up tags, E2BIG if too many
+ *         tiles differ, ENOMEM if out of memory
+ */
+static int solver_find_tiles(solver_t *solver, unsigned *rleft)
+{
+	map_diff_t *diff;
+	map_diff_tile_t *t;
+	unsigned left = 0;
+	unsigned npos;
+	unsigned i;
+	int rc;
+
+	rc = map_diff(solver->map, solver->goal, &diff);
+	if (rc != 0)
+		return rc;
+
+	npos = (unsigned)solver->map->width * solver->map->height * 4;
+	solver->pose_bits = 0;
+	while ((1u << solver->pose_bits) < npos)
+		++solver->pose_bits;
+
+	if (solver->pose_bits + 2 * diff->ntiles > 64) {
+		rc = E2BIG;
+		goto error;
+	}
+
+	solver->ntiles = diff->ntiles;
+	solver->tile_xy = calloc(2 * diff->ntiles + 1, sizeof(int));
+	solver->tile_idx = malloc(solver->map->width * solver->map->height *
+	    sizeof(int));
+	if (solver->tile_xy == NULL || solver->tile_idx == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	for (i = 0; i < (unsigned)(solver->map->width * solver->map->height);
+	    i++)
+		solver->tile_idx[i] = -1;
+
+	for (i = 0; i < diff->ntiles; i++) {
+		t = &diff->tiles[i];
+		if ((t->a != mapt_none && !map_tile_tag(t->a)) ||
+		    (t->b != mapt_none && !map_tile_tag(t->b))) {
+			/* Only tags can be changed */
+			rc = ENOENT;
+			goto error;
+		}
+
+		solver->tile_xy[2 * i] = t->x;
+		solver->tile_xy[2 * i + 1] = t->y;
+		solver->tile_idx[t->y * solver->map->width + t->x] = i;
+
+		/* A wrong tag must be picked up before the right one is put */
+		left += t->a != mapt_none && t->b != mapt_none ? 2 : 1;
+	}
+
+	map_diff_destroy(diff);
+	*rleft = left;
+	return 0;
+error:
+	map_diff_destroy(diff);
+	return rc;
+}
+
+/** Pack robot pose into state key.
+ *
+ * @param solver Level solver
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param dir Direction
+ * @return Key with all tiles in start stage
+ */
+static uint64_t solver_pose_key(solver_t *solver, int x, int y, dir_t dir)
+{
+	return ((uint64_t)y * solver->map->width + x) * 4 + dir;
+}
+
+/** Get stage of differing tile from state key.
+ *
+ * @param solver Level solver
+ * @param key State key
+ * @param idx Differing tile index
+ * @return Stage
+ */
+static solver_stage_t solver_key_stage(solver_t *solver, uint64_t key,
+    unsigned idx)
+{
+	return (solver_stage_t)((key >> (solver->pose_bits + 2 * idx)) & 3);
+}
+
+/** Set stage of differing tile in state key.
+ *
+ * @param solver Level solver
+ * @param key State key
+ * @param idx Differing tile index
+ * @param stage New stage
+ * @return New state key
+ */
+static uint64_t solver_key_set_stage(solver_t *solver, uint64_t key,
+    unsigned idx, solver_stage_t stage)
+{
+	unsigned shift = solver->pose_bits + 2 * idx;
+
+	return (key & ~((uint64_t)3 << shift)) | ((uint64_t)stage << shift);
+}
+
+/** Add state to visited set unless already visited.
+ *
+ * @param worker Worker adding the state
+ * @param parent Predecessor state or @c NULL
+ * @param key State key
+ * @param action Intrinsic leading from @a parent
+ * @param left Number of tag actions still needed
+ * @param rstate Place to store pointer to new state or @c NULL if
+ *               the state was already visited
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int solver_visit(solver_worker_t *worker, solver_state_t *parent,
+    uint64_t key, prog_intr_type_t action, unsigned left,
+    solver_state_t **rstate)
+{
+	solver_t *solver = worker->solver;
+	solver_shard_t *shard;
+	solver_state_t *state = NULL;
+	int rc = 0;
+
+	shard = &solver->shard[hmap_hash_int(key) % solver_nshards];
+	pthread_mutex_lock(&shard->lock);
+
+	if (hmap_find_int(shard->visited, key) != NULL)
+		goto out;
+
+	state = pool_alloc(worker->states);
+	if (state == NULL) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	state->parent = parent;
+	state->key = key;
+	state->depth = parent != NULL ? parent->depth + 1 : 0;
+	state->left = left;
+	state->action = action;
+
+	rc = hmap_insert_int(shard->visited, key, state);
+	if (rc != 0) {
+		pool_free(worker->states, state);
+		state = NULL;
+	}
+out:
+	pthread_mutex_unlock(&shard->lock);
+	*rstate = state;
+	return rc;
+}
+
+/** Expand state.
+ *
+ * Successors not visited before are added to the worker's next level.
+ *
+ * @param worker Worker
+ * @param state State to expand
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int solver_expand(solver_worker_t *worker, solver_state_t *state)
+{
+	solver_t *solver = worker->solver;
+	solver_state_t *nstate;
+	prog_intr_type_t action;
+	uint64_t pose;
+	uint64_t key;
+	solver_stage_t stage;
+	map_tile_t tile, gtile, put;
+	unsigned left;
+	unsigned i;
+	int x, y, dx, dy;
+	int idx;
+	dir_t dir;
+	int rc;
+
+	pose = state->key & (((uint64_t)1 << solver->pose_bits) - 1);
+	dir = (dir_t)(pose % 4);
+	x = (int)(pose / 4 % solver->map->width);
+	y = (int)(pose / 4 / solver->map->width);
+	idx = solver->tile_idx[y * solver->map->width + x];
+
+	for (i = 0; i < progin_limit; i++) {
+		action = (prog_intr_type_t)i;
+		key = state->key;
+		left = state->left;
+
+		switch (action) {
+		case progin_turn_left:
+			key = key - pose + solver_pose_key(solver, x, y,
+			    dir_next_ccw(dir));
+			break;
+		case progin_move:
+			dir_get_off(dir, &dx, &dy);
+			if (!map_tile_walkable(map_get(solver->map, x + dx,
+			    y + dy)))
+				continue;
+			key = key - pose + solver_pose_key(solver, x + dx,
+			    y + dy, dir);
+			break;
+		default:
+			/* Only tag actions towards the goal are useful */
+			if (idx < 0)
+				continue;
+
+			stage = solver_key_stage(solver, key, idx);
+			tile = solver_tile(solver, idx, stage);
+			gtile = solver_tile(solver, idx, sts_goal);
+			if (tile == gtile)
+				continue;
+
+			if (action == progin_pick_up) {
+				if (!map_tile_tag(tile))
+					continue;
+				stage = gtile == mapt_none ? sts_goal :
+				    sts_empty;
+			} else {
+				put = action == progin_put_white ? mapt_wtag :
+				    action == progin_put_grey ? mapt_gtag :
+				    mapt_btag;
+				if (tile != mapt_none || put != gtile)
+					continue;
+				stage = sts_goal;
+			}
+
+			key = solver_key_set_stage(solver, key, idx, stage);
+			--left;
+			break;
+		}
+
+		/* Every remaining tag action takes at least one step */
+		if (state->depth + 1 + left > solver->max_steps)
+			continue;
+
+		rc = solver_visit(worker, state, key, action, left, &nstate);
+		if (rc != 0)
+			return rc;
+
+		if (nstate == NULL)
+			continue;
+
+		if (left == 0) {
+			if (worker->found == NULL || nstate->key <
+			    worker->found->key)
+				worker->found = nstate;
+			continue;
+		}
+
+		rc = vector_append(&worker->next, &nstate);
+		if (rc != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/** Worker thread.
+ *
+ * Expands states of each level as they are handed out, a chunk at a time.
+ *
+ * @param arg Worker (solver_worker_t *)
+ * @return @c NULL
+ */
+static void *solver_worker(void *arg)
+{
+	solver_worker_t *worker = (solver_worker_t *)arg;
+	solver_t *solver = worker->solver;
+	solver_state_t *state;
+	unsigned level = 0;
+	size_t start, end;
+	size_t i;
+	int rc;
+
+	pthread_mutex_lock(&solver->lock);
+	while (true) {
+		while (!solver->quit && solver->level == level)
+			pthread_cond_wait(&solver->work_cv, &solver->lock);
+		if (solver->quit)
+			break;
+
+		level = solver->level;
+		while (solver->next < vector_count(&solver->frontier)) {
+			start = solver->next;
+			end = start + solver_chunk;
+			if (end > vector_count(&solver->frontier))
+				end = vector_count(&solver->frontier);
+			solver->next = end;
+			pthread_mutex_unlock(&solver->lock);
+
+			rc = 0;
+			for (i = start; i < end && rc == 0; i++) {
+				state = *(solver_state_t **)vector_get(
+				    &solver->frontier, i);
+				rc = solver_expand(worker, state);
+			}
+
+			pthread_mutex_lock(&solver->lock);
+			if (rc != 0)
+				worker->rc = rc;
+
+			/* Stop handing out states once the goal is reached */
+			if (rc != 0 || worker->found != NULL)
+				solver->next = vector_count(&solver->frontier);
+		}
+
+		if (--solver->nbusy == 0)
+			pthread_cond_signal(&solver->done_cv);
+	}
+
+	pthread_mutex_unlock(&solver->lock);
+	return NULL;
+}
+
+/** Expand one level of the search using the worker threads.
+ *
+ * @param solver Level solver
+ */
+static void solver_run_level(solver_t *solver)
+{
+	pthread_mutex_lock(&solver->lock);
+	solver->next = 0;
+	solver->nbusy = solver->nthreads;
+	++solver->level;
+	pthread_cond_broadcast(&solver->work_cv);
+
+	while (solver->nbusy > 0)
+		pthread_cond_wait(&solver->done_cv, &solver->lock);
+	pthread_mutex_unlock(&solver->lock);
+}
+
+/** Create procedure from path to goal state.
+ *
+ * @param state Goal state
+ * @param ident Procedure identifier
+ * @param rproc Place to store pointer to new procedure
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int solver_make_proc(solver_state_t *state, const char *ident,
+    prog_proc_t **rproc)
+{
+	prog_proc_t *proc;
+	prog_stmt_t **stmts = NULL;
+	unsigned nstmts = state->depth;
+	unsigned i;
+	int rc;
+
+	rc = prog_proc_create(ident, &proc);
+	if (rc != 0)
+		return rc;
+
+	rc = prog_block_create(&proc->body);
+	if (rc != 0)
+		goto error;
+
+	stmts = calloc(nstmts + 1, sizeof(prog_stmt_t *));
+	if (stmts == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	/* Walk back from the goal state */
+	i = nstmts;
+	while (state->parent != NULL) {
+		rc = prog_stmt_intrinsic_create(state->action, &stmts[--i]);
+		if (rc != 0)
+			goto error;
+		state = state->parent;
+	}
+
+	rc = prog_block_reserve(proc->body, nstmts);
+	if (rc != 0)
+		goto error;
+
+	for (i = 0; i < nstmts; i++) {
+		rc = prog_block_append(proc->body, stmts[i]);
+		if (rc != 0)
+			goto error;
+		stmts[i] = NULL;
+	}
+
+	free(stmts);
+	*rproc = proc;
+	return 0;
+error:
+	if (stmts != NULL) {
+		for (i = 0; i < nstmts; i++)
+			prog_stmt_destroy(stmts[i]);
+		free(stmts);
+	}
+	prog_proc_destroy(proc);
+	return rc;
+}
+
+/** Free search data.
+ *
+ * @param solver Level solver
+ * @param nworkers Number of workers that were started
+ */
+static void solver_cleanup(solver_t *solver, unsigned nworkers)
+{
+	solver_worker_t *worker;
+	unsigned i;
+
+	pthread_mutex_lock(&solver->lock);
+	solver->quit = true;
+	pthread_cond_broadcast(&solver->work_cv);
+	pthread_mutex_unlock(&solver->lock);
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(solver->workers[i].thread, NULL);
+
+	solver->nstates = 0;
+	for (i = 0; i < solver_nshards; i++) {
+		if (solver->shard[i].visited != NULL) {
+			solver->nstates += hmap_count(solver->shard[i].visited);
+			hmap_destroy(solver->shard[i].visited);
+			solver->shard[i].visited = NULL;
+		}
+		pthread_mutex_destroy(&solver->shard[i].lock);
+	}
+
+	if (solver->workers != NULL) {
+		for (i = 0; i < solver->nthreads; i++) {
+			worker = &solver->workers[i];
+			if (worker->states != NULL)
+				pool_destroy(worker->states);
+			vector_fini(&worker->next);
+		}
+	}
+
+	free(solver->workers);
+	solver->workers = NULL;
+	vector_fini(&solver->frontier);
+	pthread_cond_destroy(&solver->done_cv);
+	pthread_cond_destroy(&solver->work_cv);
+	pthread_mutex_destroy(&solver->lock);
+	free(solver->tile_xy);
+	solver->tile_xy = NULL;
+	free(solver->tile_idx);
+	solver->tile_idx = NULL;
+}
+
+/** Find shortest intrinsic-only solution.
+ *
+ * @param solver Level solver
+ * @param x Robot starting X coordinate
+ * @param y Robot starting Y coordinate
+ * @param dir Robot starting direction
+ * @param ident Identifier for the solution procedure
+ * @param rproc Place to store pointer to new procedure with the solution
+ * @return Zero on success, ENOENT if there is no solution with at most
+ *         the maximum number of steps, E2BIG if too many tiles differ
+ *         between start and goal map, EINVAL if the robot is outside
+ *         the map, ENOMEM if out of memory
+ */
+int solver_solve(solver_t *solver, int x, int y, dir_t dir,
+    const char *ident, prog_proc_t **rproc)
+{
+	solver_worker_t *worker;
+	solver_state_t *root;
+	solver_state_t *found = NULL;
+	unsigned nworkers = 0;
+	unsigned left;
+	unsigned i;
+	size_t j;
+	int rc;
+
+	if (x < 0 || y < 0 || x >= solver->map->width ||
+	    y >= solver->map->height)
+		return EINVAL;
+
+	pthread_mutex_init(&solver->lock, NULL);
+	pthread_cond_init(&solver->work_cv, NULL);
+	pthread_cond_init(&solver->done_cv, NULL);
+	solver->level = 0;
+	solver->quit = false;
+	vector_initialize(&solver->frontier, sizeof(solver_state_t *));
+	for (i = 0; i < solver_nshards; i++)
+		pthread_mutex_init(&solver->shard[i].lock, NULL);
+
+	rc = solver_find_tiles(solver, &left);
+	if (rc != 0)
+		goto out;
+
+	for (i = 0; i < solver_nshards; i++) {
+		rc = hmap_create(hmk_int, &solver->shard[i].visited);
+		if (rc != 0)
+			goto out;
+	}
+
+	solver->workers = calloc(solver->nthreads, sizeof(solver_worker_t));
+	if (solver->workers == NULL) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < solver->nthreads; i++) {
+		worker = &solver->workers[i];
+		worker->solver = solver;
+		vector_initialize(&worker->next, sizeof(solver_state_t *));
+		rc = pool_create(sizeof(solver_state_t), &worker->states);
+		if (rc != 0)
+			goto out;
+	}
+
+	rc = solver_visit(&solver->workers[0], NULL, solver_pose_key(solver,
+	    x, y, dir), progin_turn_left, left, &root);
+	if (rc != 0)
+		goto out;
+
+	if (left == 0)
+		found = root;
+
+	if (left > solver->max_steps) {
+		rc = ENOENT;
+		goto out;
+	}
+
+	rc = vector_append(&solver->frontier, &root);
+	if (rc != 0)
+		goto out;
+
+	for (i = 0; i < solver->nthreads; i++) {
+		rc = pthread_create(&solver->workers[i].thread, NULL,
+		    solver_worker, &solver->workers[i]);
+		if (rc != 0)
+			goto out;
+		++nworkers;
+	}
+
+	while (found == NULL && vector_count(&solver->frontier) > 0) {
+		solver_run_level(solver);
+
+		vector_clear(&solver->frontier);
+		for (i = 0; i < nworkers; i++) {
+			worker = &solver->workers[i];
+			if (worker->rc != 0) {
+				rc = worker->rc;
+				goto out;
+			}
+
+			if (worker->found != NULL && (found == NULL ||
+			    worker->found->key < found->key))
+				found = worker->found;
+
+			for (j = 0; j < vector_count(&worker->next); j++) {
+				rc = vector_append(&solver->frontier,
+				    vector_get(&worker->next, j));
+				if (rc != 0)
+					goto out;
+			}
+
+			vector_clear(&worker->next);
+		}
+	}
+
+	if (found == NULL) {
+		rc = ENOENT;
+		goto out;
+	}
+
+	rc = solver_make_proc(found, ident, rproc);
+out:
+	solver_cleanup(solver, nworkers);
+	return rc;
+}
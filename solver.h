@@ -0,0 +1,138 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "adt/hmap.h"
+#include "adt/pool.h"
+#include "adt/vector.h"
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+
+enum {
+	/** Default maximum solution length */
+	solver_def_max_steps = 1000,
+	/** Number of visited set shards */
+	solver_nshards = 64,
+	/** Number of frontier states a worker takes at once */
+	solver_chunk = 64
+};
+
+/** Solver search state */
+typedef struct solver_state {
+	/** Predecessor state or @c NULL */
+	struct solver_state *parent;
+	/** Packed robot pose and tag progress */
+	uint64_t key;
+	/** Number of steps from the initial state */
+	unsigned depth;
+	/** Number of tag actions still needed */
+	unsigned left;
+	/** Intrinsic leading from predecessor */
+	prog_intr_type_t action;
+} solver_state_t;
+
+/** Visited set shard */
+typedef struct {
+	/** Protects @c visited */
+	pthread_mutex_t lock;
+	/** Visited states by key */
+	hmap_t *visited;
+} solver_shard_t;
+
+struct solver;
+
+/** Solver worker thread */
+typedef struct {
+	/** Containing solver */
+	struct solver *solver;
+	/** Thread */
+	pthread_t thread;
+	/** States allocated by this worker */
+	pool_t *states;
+	/** New states found in the current level (solver_state_t *) */
+	vector_t next;
+	/** Goal state found in the current level or @c NULL */
+	solver_state_t *found;
+	/** Error that occurred in the current level */
+	int rc;
+} solver_worker_t;
+
+/** Level solver
+ *
+ * Finds the shortest sequence of intrinsic statements that takes a robot
+ * from its starting position and the start map to the goal map.
+ */
+typedef struct solver {
+	/** Start map */
+	map_t *map;
+	/** Goal map */
+	map_t *goal;
+	/** Number of worker threads */
+	unsigned nthreads;
+	/** Maximum solution length */
+	unsigned max_steps;
+	/** Number of tiles that differ between start and goal map */
+	unsigned ntiles;
+	/** Coordinates of differing tiles (pairs of int) */
+	int *tile_xy;
+	/** Differing tile index by map position or -1 */
+	int *tile_idx;
+	/** Number of bits of the key holding the robot pose */
+	unsigned pose_bits;
+	/** Visited set */
+	solver_shard_t shard[solver_nshards];
+	/** Worker threads */
+	solver_worker_t *workers;
+	/** Protects the fields below */
+	pthread_mutex_t lock;
+	/** Signalled when a level is started or workers should quit */
+	pthread_cond_t work_cv;
+	/** Signalled when a worker finished a level */
+	pthread_cond_t done_cv;
+	/** Current level number */
+	unsigned level;
+	/** Number of workers still expanding the current level */
+	unsigned nbusy;
+	/** Should workers quit? */
+	bool quit;
+	/** States to expand in the current level (solver_state_t *) */
+	vector_t frontier;
+	/** Index of next state in @c frontier to hand out */
+	size_t next;
+	/** Number of states visited by the last search */
+	unsigned long nstates;
+} solver_t;
+
+extern int solver_create(map_t *, map_t *, solver_t **);
+extern void solver_destroy(solver_t *);
+extern void solver_set_threads(solver_t *, unsigned);
+extern void solver_set_max_steps(solver_t *, unsigned);
+extern int solver_solve(solver_t *, int, int, dir_t, const char *,
+    prog_proc_t **);
+
+#endif
@@ -0,0 +1,549 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Container unit tests and microbenchmarks
+ *
+ * Run without arguments to run the unit tests. Run with -b to also
+ * measure the speed of the containers.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../adt/hmap.h"
+#include "../adt/list.h"
+#include "../adt/pool.h"
+#include "../adt/vector.h"
+
+/** Fail current test if condition does not hold. */
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, \
+			    __LINE__, #cond); \
+			return EIO; \
+		} \
+	} while (0)
+
+enum {
+	/** Number of operations in each benchmark */
+	bench_nops = 1000000
+};
+
+/** Test vector growth, insertion and removal.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_vector(void)
+{
+	vector_t vec;
+	size_t alloc;
+	int i;
+	int x;
+
+	vector_initialize(&vec, sizeof(int));
+	CHECK(vector_count(&vec) == 0);
+
+	/* Growth keeps contents and is amortized */
+	alloc = 0;
+	for (i = 0; i < 10000; i++) {
+		CHECK(vector_append(&vec, &i) == 0);
+		if (vec.alloc != alloc) {
+			CHECK(vec.alloc >= 2 * alloc);
+			alloc = vec.alloc;
+		}
+	}
+
+	CHECK(vector_count(&vec) == 10000);
+	for (i = 0; i < 10000; i++)
+		CHECK(*(int *)vector_get(&vec, i) == i);
+
+	/* Insert at the beginning and in the middle */
+	x = -1;
+	CHECK(vector_insert(&vec, 0, &x) == 0);
+	x = -2;
+	CHECK(vector_insert(&vec, 5000, &x) == 0);
+	CHECK(vector_count(&vec) == 10002);
+	CHECK(*(int *)vector_get(&vec, 0) == -1);
+	CHECK(*(int *)vector_get(&vec, 4999) == 4998);
+	CHECK(*(int *)vector_get(&vec, 5000) == -2);
+	CHECK(*(int *)vector_get(&vec, 5001) == 4999);
+	CHECK(*(int *)vector_get(&vec, 10001) == 9999);
+
+	/* Insert at the end */
+	x = -3;
+	CHECK(vector_insert(&vec, 10002, &x) == 0);
+	CHECK(*(int *)vector_get(&vec, 10002) == -3);
+
+	/* Remove first, middle and last */
+	vector_remove(&vec, 10002);
+	vector_remove(&vec, 5000);
+	vector_remove(&vec, 0);
+	CHECK(vector_count(&vec) == 10000);
+	for (i = 0; i < 10000; i++)
+		CHECK(*(int *)vector_get(&vec, i) == i);
+
+	/* Reserve does not shrink, clear keeps storage */
+	alloc = vec.alloc;
+	CHECK(vector_reserve(&vec, 10) == 0);
+	CHECK(vec.alloc == alloc);
+	CHECK(vector_reserve(&vec, alloc + 100) == 0);
+	CHECK(vec.alloc == alloc + 100);
+	vector_clear(&vec);
+	CHECK(vector_count(&vec) == 0);
+	CHECK(vec.alloc == alloc + 100);
+
+	vector_fini(&vec);
+	return 0;
+}
+
+/** Find integer keys that start probing at the same slot.
+ *
+ * @param size Number of slots in the hash map
+ * @param keys Array to fill with keys
+ * @param nkeys Number of keys to find
+ */
+static void test_hmap_colliding_keys(size_t size, uint64_t *keys,
+    size_t nkeys)
+{
+	uint64_t key;
+	size_t slot;
+	size_t i;
+
+	slot = hmap_hash_int(0) & (size - 1);
+	i = 0;
+	key = 0;
+	while (i < nkeys) {
+		if ((hmap_hash_int(key) & (size - 1)) == slot)
+			keys[i++] = key;
+		++key;
+	}
+}
+
+/** Test hash map with integer keys.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_hmap_int(void)
+{
+	hmap_t *hmap;
+	hmap_entry_t *entry;
+	uintptr_t i;
+	size_t n;
+
+	CHECK(hmap_create(hmk_int, &hmap) == 0);
+	CHECK(hmap_find_int(hmap, 1) == NULL);
+
+	/* Insertion with resizing */
+	for (i = 0; i < 100000; i++)
+		CHECK(hmap_insert_int(hmap, i * 7, (void *)(i + 1)) == 0);
+	CHECK(hmap_count(hmap) == 100000);
+	CHECK((hmap->size & (hmap->size - 1)) == 0);
+	CHECK(hmap->used * 4 <= hmap->size * 3);
+
+	/* Duplicate key */
+	CHECK(hmap_insert_int(hmap, 7, NULL) == EEXIST);
+	CHECK(hmap_count(hmap) == 100000);
+
+	/* Removal */
+	for (i = 0; i < 100000; i += 2) {
+		entry = hmap_find_int(hmap, i * 7);
+		CHECK(entry != NULL);
+		CHECK(entry->value == (void *)(i + 1));
+		hmap_remove(hmap, entry);
+	}
+
+	CHECK(hmap_count(hmap) == 50000);
+	for (i = 0; i < 100000; i++) {
+		entry = hmap_find_int(hmap, i * 7);
+		CHECK((entry != NULL) == (i % 2 == 1));
+	}
+
+	/* Iteration visits every entry once */
+	n = 0;
+	entry = hmap_first(hmap);
+	while (entry != NULL) {
+		CHECK(entry->ikey % 14 == 7);
+		++n;
+		entry = hmap_next(hmap, entry);
+	}
+
+	CHECK(n == 50000);
+
+	hmap_clear(hmap);
+	CHECK(hmap_count(hmap) == 0);
+	CHECK(hmap_first(hmap) == NULL);
+	CHECK(hmap_find_int(hmap, 7) == NULL);
+
+	hmap_destroy(hmap);
+	return 0;
+}
+
+/** Test hash map collisions and tombstones.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_hmap_tombstones(void)
+{
+	hmap_t *hmap;
+	hmap_entry_t *entry;
+	uint64_t keys[4];
+	size_t size;
+	uintptr_t i;
+
+	CHECK(hmap_create(hmk_int, &hmap) == 0);
+	size = hmap->size;
+
+	/* Four keys in one probe chain */
+	test_hmap_colliding_keys(size, keys, 4);
+	for (i = 0; i < 4; i++)
+		CHECK(hmap_insert_int(hmap, keys[i], (void *)(i + 1)) == 0);
+	CHECK(hmap->size == size);
+
+	/* Removing from the middle of the chain leaves it intact */
+	hmap_remove(hmap, hmap_find_int(hmap, keys[1]));
+	CHECK(hmap_find_int(hmap, keys[1]) == NULL);
+	entry = hmap_find_int(hmap, keys[3]);
+	CHECK(entry != NULL && entry->value == (void *)4);
+	CHECK(hmap->used == 4);
+
+	/* Duplicate behind a tombstone is detected */
+	CHECK(hmap_insert_int(hmap, keys[2], NULL) == EEXIST);
+
+	/* Reinsertion reuses the tombstone */
+	CHECK(hmap_insert_int(hmap, keys[1], (void *)5) == 0);
+	CHECK(hmap->used == 4);
+	entry = hmap_find_int(hmap, keys[1]);
+	CHECK(entry != NULL && entry->value == (void *)5);
+
+	/* Insert/remove churn does not grow the table */
+	for (i = 0; i < 100000; i++) {
+		CHECK(hmap_insert_int(hmap, 1000000 + i, NULL) == 0);
+		entry = hmap_find_int(hmap, 1000000 + i);
+		CHECK(entry != NULL);
+		hmap_remove(hmap, entry);
+	}
+
+	CHECK(hmap_count(hmap) == 4);
+	CHECK(hmap->size <= 4 * size);
+	for (i = 0; i < 4; i++)
+		CHECK(hmap_find_int(hmap, keys[i]) != NULL);
+
+	hmap_destroy(hmap);
+	return 0;
+}
+
+/** Test hash map with string keys.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_hmap_str(void)
+{
+	hmap_t *hmap;
+	hmap_entry_t *entry;
+	char key[32];
+	uintptr_t i;
+
+	CHECK(hmap_create(hmk_str, &hmap) == 0);
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "P%07u", (unsigned)i);
+		CHECK(hmap_insert_str(hmap, key, (void *)i) == 0);
+	}
+
+	/* Keys are copied */
+	snprintf(key, sizeof(key), "P%07u", 5);
+	entry = hmap_find_str(hmap, key);
+	CHECK(entry != NULL && entry->skey != key);
+	CHECK(hmap_insert_str(hmap, key, NULL) == EEXIST);
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "P%07u", (unsigned)i);
+		entry = hmap_find_str(hmap, key);
+		CHECK(entry != NULL && entry->value == (void *)i);
+		CHECK(strcmp(entry->skey, key) == 0);
+		if (i % 3 == 0)
+			hmap_remove(hmap, entry);
+	}
+
+	CHECK(hmap_count(hmap) == 666);
+	CHECK(hmap_find_str(hmap, "P0000003") == NULL);
+	CHECK(hmap_find_str(hmap, "P0000004") != NULL);
+	CHECK(hmap_find_str(hmap, "") == NULL);
+
+	hmap_destroy(hmap);
+	return 0;
+}
+
+/** Test object pool.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_pool(void)
+{
+	pool_t *pool;
+	char *obj[1000];
+	char *o;
+	size_t nchunks;
+	int i, j;
+
+	CHECK(pool_create(40, &pool) == 0);
+
+	for (i = 0; i < 1000; i++) {
+		obj[i] = pool_alloc(pool);
+		CHECK(obj[i] != NULL);
+		CHECK(((uintptr_t)obj[i] & 15) == 0);
+		memset(obj[i], i & 0xff, 40);
+	}
+
+	CHECK(pool_count(pool) == 1000);
+
+	/* Objects do not overlap */
+	for (i = 0; i < 1000; i++) {
+		for (j = 0; j < 40; j++)
+			CHECK((unsigned char)obj[i][j] == (i & 0xff));
+	}
+
+	/* Freed objects are reused, zeroed, without growing the pool */
+	nchunks = list_count(&pool->chunks);
+	for (i = 0; i < 1000; i += 2)
+		pool_free(pool, obj[i]);
+	CHECK(pool_count(pool) == 500);
+
+	for (i = 0; i < 1000; i += 2) {
+		o = pool_alloc(pool);
+		CHECK(o != NULL);
+		for (j = 0; j < 40; j++)
+			CHECK(o[j] == 0);
+		obj[i] = o;
+	}
+
+	CHECK(pool_count(pool) == 1000);
+	CHECK(list_count(&pool->chunks) == nchunks);
+
+	/* Freeing NULL is a no-op */
+	pool_free(pool, NULL);
+	CHECK(pool_count(pool) == 1000);
+
+	pool_destroy(pool);
+	return 0;
+}
+
+/** Test list element count.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_list(void)
+{
+	list_t list;
+	link_t links[3];
+	int i;
+
+	list_initialize(&list);
+	CHECK(list_count(&list) == 0);
+
+	for (i = 0; i < 3; i++) {
+		link_initialize(&links[i]);
+		list_append(&links[i], &list);
+	}
+
+	CHECK(list_count(&list) == 3);
+	list_remove(&links[1]);
+	CHECK(list_count(&list) == 2);
+	CHECK(list_first(&list) == &links[0]);
+	CHECK(list_last(&list) == &links[2]);
+	list_remove(&links[0]);
+	list_remove(&links[2]);
+	CHECK(list_empty(&list));
+	CHECK(list_count(&list) == 0);
+	return 0;
+}
+
+/** Get current time in nanoseconds.
+ *
+ * @return Monotonic time in nanoseconds
+ */
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Print benchmark result.
+ *
+ * @param name Benchmark name
+ * @param start Start time
+ */
+static void bench_report(const char *name, uint64_t start)
+{
+	uint64_t ns;
+
+	ns = bench_now() - start;
+	printf("%-24s %8.2f ns/op\n", name, (double)ns / bench_nops);
+}
+
+/** Run microbenchmarks.
+ *
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int bench(void)
+{
+	vector_t vec;
+	hmap_t *hmap;
+	hmap_entry_t *entry;
+	pool_t *pool;
+	void **objs;
+	uint64_t start;
+	uint64_t sum;
+	uintptr_t i;
+	int rc;
+
+	objs = calloc(bench_nops, sizeof(void *));
+	if (objs == NULL)
+		return ENOMEM;
+
+	vector_initialize(&vec, sizeof(uintptr_t));
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++) {
+		rc = vector_append(&vec, &i);
+		if (rc != 0)
+			goto error;
+	}
+	bench_report("vector_append", start);
+
+	sum = 0;
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++)
+		sum += *(uintptr_t *)vector_get(&vec, i);
+	bench_report("vector_get", start);
+	vector_fini(&vec);
+
+	rc = hmap_create(hmk_int, &hmap);
+	if (rc != 0)
+		goto error;
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++) {
+		rc = hmap_insert_int(hmap, i, (void *)i);
+		if (rc != 0) {
+			hmap_destroy(hmap);
+			goto error;
+		}
+	}
+	bench_report("hmap_insert_int", start);
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++)
+		sum += (uintptr_t)hmap_find_int(hmap, i)->value;
+	bench_report("hmap_find_int (hit)", start);
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++)
+		sum += hmap_find_int(hmap, bench_nops + i) != NULL;
+	bench_report("hmap_find_int (miss)", start);
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++) {
+		entry = hmap_find_int(hmap, i);
+		hmap_remove(hmap, entry);
+	}
+	bench_report("hmap_remove", start);
+	hmap_destroy(hmap);
+
+	rc = pool_create(48, &pool);
+	if (rc != 0)
+		goto error;
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++)
+		objs[i] = pool_alloc(pool);
+	for (i = 0; i < bench_nops; i++)
+		pool_free(pool, objs[i]);
+	bench_report("pool_alloc + pool_free", start);
+	pool_destroy(pool);
+
+	start = bench_now();
+	for (i = 0; i < bench_nops; i++)
+		objs[i] = calloc(1, 48);
+	for (i = 0; i < bench_nops; i++)
+		free(objs[i]);
+	bench_report("calloc + free", start);
+
+	/* Keep the compiler from optimizing the lookups away */
+	if (sum == 0)
+		printf("\n");
+
+	free(objs);
+	return 0;
+error:
+	vector_fini(&vec);
+	free(objs);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc;
+	int nfail = 0;
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "-b") != 0)) {
+		printf("Syntax: adttest [-b]\n");
+		return 1;
+	}
+
+	if (test_vector() != 0)
+		++nfail;
+	if (test_hmap_int() != 0)
+		++nfail;
+	if (test_hmap_tombstones() != 0)
+		++nfail;
+	if (test_hmap_str() != 0)
+		++nfail;
+	if (test_pool() != 0)
+		++nfail;
+	if (test_list() != 0)
+		++nfail;
+
+	if (nfail != 0) {
+		printf("adttest: %d test(s) failed.\n", nfail);
+		return 1;
+	}
+
+	printf("adttest: All tests passed.\n");
+
+	if (argc == 2) {
+		rc = bench();
+		if (rc != 0) {
+			printf("Benchmark failed.\n");
+			return 1;
+		}
+	}
+
+	return 0;
+}
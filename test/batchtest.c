@@ -0,0 +1,517 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Batch command interpreter tests
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../batch.h"
+#include "../levelpack.h"
+#include "../map.h"
+#include "../prog.h"
+#include "../robots.h"
+
+/** Fail current test if condition does not hold. */
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, \
+			    __LINE__, #cond); \
+			return EIO; \
+		} \
+	} while (0)
+
+enum {
+	/** Size of command and reply buffers */
+	test_line_size = 256
+};
+
+/** Batch command interpreter with captured output */
+typedef struct {
+	/** Batch command interpreter */
+	batch_t *batch;
+	/** Output stream */
+	FILE *out;
+	/** Output buffer */
+	char *buf;
+	/** Size of output */
+	size_t size;
+	/** Start of reply to the last command */
+	size_t pos;
+	/** Reply to the last command */
+	char reply[test_line_size];
+} test_batch_t;
+
+/** Temporary file names */
+static char test_world_fname[] = "/tmp/batchtest-w-XXXXXX";
+static char test_pack_fname[] = "/tmp/batchtest-p-XXXXXX";
+static char test_cache_fname[] = "/tmp/batchtest-c-XXXXXX";
+
+/** Create batch command interpreter with captured output.
+ *
+ * @param tb Test batch command interpreter to initialize
+ * @return Zero on success or an error code
+ */
+static int test_batch_create(test_batch_t *tb)
+{
+	int rc;
+
+	memset(tb, 0, sizeof(test_batch_t));
+
+	tb->out = open_memstream(&tb->buf, &tb->size);
+	if (tb->out == NULL)
+		return ENOMEM;
+
+	rc = batch_create(tb->out, &tb->batch);
+	if (rc != 0) {
+		fclose(tb->out);
+		free(tb->buf);
+		return rc;
+	}
+
+	return 0;
+}
+
+/** Destroy batch command interpreter with captured output.
+ *
+ * @param tb Test batch command interpreter
+ */
+static void test_batch_destroy(test_batch_t *tb)
+{
+	batch_destroy(tb->batch);
+	fclose(tb->out);
+	free(tb->buf);
+}
+
+/** Execute batch command and check its reply.
+ *
+ * @param tb Test batch command interpreter
+ * @param cmd Command
+ * @param reply Expected reply (whole output of the command) or @c NULL
+ *              not to check it. The reply is stored in @a tb in any case.
+ * @return Zero on success, EIO if the reply differs
+ */
+static int test_batch_cmd(test_batch_t *tb, const char *cmd,
+    const char *reply)
+{
+	char line[test_line_size];
+
+	snprintf(line, sizeof(line), "%s", cmd);
+	(void) batch_exec(tb->batch, line);
+	if (fflush(tb->out) != 0)
+		return EIO;
+
+	snprintf(tb->reply, sizeof(tb->reply), "%s", tb->buf + tb->pos);
+	tb->pos = tb->size;
+
+	if (reply != NULL && strcmp(tb->reply, reply) != 0) {
+		printf("'%s': expected '%s', got '%s'\n", cmd, reply,
+		    tb->reply);
+		return EIO;
+	}
+
+	return 0;
+}
+
+/** Create temporary file.
+ *
+ * @param fname File name template, replaced with the file name
+ * @return Zero on success, EIO on failure
+ */
+static int test_tmpfile(char *fname)
+{
+	int fd;
+
+	fd = mkstemp(fname);
+	if (fd < 0)
+		return EIO;
+
+	close(fd);
+	return 0;
+}
+
+/** Write world file used by the tests.
+ *
+ * The map is 6x4 with a robot at (1, 1). Procedure P0000001 moves
+ * forward, turns left and calls P0000002, which moves forward twice.
+ * Procedure P0000003 puts down a white tag.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_world_write(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *p1;
+	prog_proc_t *p2;
+	prog_proc_t *p3;
+	prog_stmt_t *stmt;
+	map_t *map;
+	robots_t *robots;
+	FILE *f;
+
+	/* Callee must be defined first */
+	CHECK(prog_module_create(&mod) == 0);
+	CHECK(prog_proc_create("P0000002", &p2) == 0);
+	CHECK(prog_block_create(&p2->body) == 0);
+	CHECK(prog_module_append(mod, p2) == 0);
+	CHECK(prog_proc_create("P0000001", &p1) == 0);
+	CHECK(prog_block_create(&p1->body) == 0);
+	CHECK(prog_module_append(mod, p1) == 0);
+
+	CHECK(prog_stmt_intrinsic_create(progin_move, &stmt) == 0);
+	CHECK(prog_block_append(p1->body, stmt) == 0);
+	CHECK(prog_stmt_intrinsic_create(progin_turn_left, &stmt) == 0);
+	CHECK(prog_block_append(p1->body, stmt) == 0);
+	CHECK(prog_stmt_call_create(p2, &stmt) == 0);
+	CHECK(prog_block_append(p1->body, stmt) == 0);
+	CHECK(prog_stmt_intrinsic_create(progin_move, &stmt) == 0);
+	CHECK(prog_block_append(p2->body, stmt) == 0);
+	CHECK(prog_stmt_intrinsic_create(progin_move, &stmt) == 0);
+	CHECK(prog_block_append(p2->body, stmt) == 0);
+
+	CHECK(prog_proc_create("P0000003", &p3) == 0);
+	CHECK(prog_block_create(&p3->body) == 0);
+	CHECK(prog_module_append(mod, p3) == 0);
+	CHECK(prog_stmt_intrinsic_create(progin_put_white, &stmt) == 0);
+	CHECK(prog_block_append(p3->body, stmt) == 0);
+
+	CHECK(map_create(6, 4, &map) == 0);
+	CHECK(robots_create(mod, map, &robots) == 0);
+	CHECK(robots_add(robots, 1, 1) == 0);
+
+	f = fopen(test_world_fname, "w");
+	CHECK(f != NULL);
+	CHECK(map_save(map, f) == 0);
+	CHECK(prog_module_save(mod, f) == 0);
+	CHECK(robots_save(robots, f) == 0);
+	CHECK(fclose(f) == 0);
+
+	robots_destroy(robots);
+	map_destroy(map);
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Write level pack used by the tests.
+ *
+ * Level 0 has no goal, level 1 has the goal of a wall at (0, 0),
+ * level 2 has the goal of a white tag under the robot.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_pack_write(void)
+{
+	levelpack_wr_t *wr;
+	prog_module_t *mod;
+	map_t *map;
+	map_t *goal;
+	robots_t *robots;
+	int i;
+
+	CHECK(levelpack_wr_create(test_pack_fname, &wr) == 0);
+
+	for (i = 0; i < 3; i++) {
+		CHECK(prog_module_create(&mod) == 0);
+		CHECK(map_create(4 + i, 3, &map) == 0);
+		CHECK(robots_create(mod, map, &robots) == 0);
+		CHECK(robots_add(robots, 1, 1) == 0);
+		CHECK(map_clone(map, &goal) == 0);
+		if (i < 2)
+			map_set(goal, 0, 0, mapt_wall);
+		else
+			map_set(goal, 1, 1, mapt_wtag);
+
+		CHECK(levelpack_wr_add(wr, map, mod, robots,
+		    i > 0 ? goal : NULL) == 0);
+
+		map_destroy(goal);
+		robots_destroy(robots);
+		map_destroy(map);
+		prog_module_destroy(mod);
+	}
+
+	CHECK(levelpack_wr_close(wr) == 0);
+	return 0;
+}
+
+/** Test that both engines produce the same outcome.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_engines(void)
+{
+	test_batch_t tb;
+	char cmd[test_line_size];
+	char reply[test_line_size];
+
+	CHECK(test_batch_create(&tb) == 0);
+	snprintf(cmd, sizeof(cmd), "load %s", test_world_fname);
+
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", NULL) == 0);
+	CHECK(strncmp(tb.reply, "ok 1 0 5 ", 9) == 0);
+	snprintf(reply, sizeof(reply), "%s", tb.reply);
+
+	CHECK(test_batch_cmd(&tb, "engine native", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", reply) == 0);
+
+	/* Step limit */
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 3", NULL) == 0);
+	CHECK(strncmp(tb.reply, "ok 0 0 3 ", 9) == 0);
+
+	/* Stepping a running robot */
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "step 2", "ok 2 1\n") == 0);
+	CHECK(test_batch_cmd(&tb, "step 100", "ok 3 0\n") == 0);
+
+	CHECK(test_batch_cmd(&tb, "engine fast", NULL) == 0);
+	CHECK(strncmp(tb.reply, "error ", 6) == 0);
+
+	test_batch_destroy(&tb);
+	return 0;
+}
+
+/** Test level pack commands.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_levels(void)
+{
+	test_batch_t tb;
+	char cmd[test_line_size];
+
+	CHECK(test_batch_create(&tb) == 0);
+
+	CHECK(test_batch_cmd(&tb, "level 0", "error 2 No level pack.\n") ==
+	    0);
+
+	snprintf(cmd, sizeof(cmd), "pack %s", test_pack_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok 3\n") == 0);
+	CHECK(test_batch_cmd(&tb, "level 3", "error 22 Invalid level.\n") ==
+	    0);
+
+	CHECK(test_batch_cmd(&tb, "level 0", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "error 2 Level has no goal.\n") ==
+	    0);
+
+	CHECK(test_batch_cmd(&tb, "level 1", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "tile 4 2 0", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "tile 5 0 0", "error 22 "
+	    "Invalid coordinates.\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 0\n") == 0);
+	snprintf(cmd, sizeof(cmd), "tile 0 0 %d", (int) mapt_wall);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 1\n") == 0);
+
+	test_batch_destroy(&tb);
+	return 0;
+}
+
+/** Test solving a level.
+ *
+ * The robot is moved away from the tile it has to tag. The solution
+ * found with one and with several threads is run, with the interpreter
+ * and with native code compiled before the solution was added.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_solve(void)
+{
+	test_batch_t tb;
+	char cmd[test_line_size];
+	char ident[9];
+	char reply[test_line_size];
+	unsigned nstmts[2];
+	int i;
+
+	CHECK(test_batch_create(&tb) == 0);
+
+	snprintf(cmd, sizeof(cmd), "load %s", test_world_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	snprintf(cmd, sizeof(cmd), "pack %s", test_pack_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok 3\n") == 0);
+
+	CHECK(test_batch_cmd(&tb, "level 0", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "solve 1 1", "error 2 Level has no goal.\n")
+	    == 0);
+
+	/* The robot cannot build walls */
+	CHECK(test_batch_cmd(&tb, "level 1", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "solve 1 1", "error 2 No solution.\n") ==
+	    0);
+
+	/* Compile the program before the solution is added */
+	CHECK(test_batch_cmd(&tb, "engine native", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000003 10", NULL) == 0);
+
+	for (i = 0; i < 2; i++) {
+		CHECK(test_batch_cmd(&tb, "level 2", "ok\n") == 0);
+		CHECK(test_batch_cmd(&tb, "remove 1 1", "ok\n") == 0);
+		CHECK(test_batch_cmd(&tb, "robot 4 1", "ok\n") == 0);
+		CHECK(test_batch_cmd(&tb, "solve 1 1",
+		    "error 2 No robot there.\n") == 0);
+		CHECK(test_batch_cmd(&tb, "solve 4 1 0",
+		    "error 22 Invalid count.\n") == 0);
+
+		CHECK(test_batch_cmd(&tb, i == 0 ? "solve 4 1 1" :
+		    "solve 4 1 4", NULL) == 0);
+		CHECK(sscanf(tb.reply, "ok %8s %u", ident, &nstmts[i]) == 2);
+		CHECK(strlen(ident) == 8);
+		CHECK(test_batch_cmd(&tb, "goal", "ok 0\n") == 0);
+
+		snprintf(cmd, sizeof(cmd), "run 4 1 %s 100", ident);
+		CHECK(test_batch_cmd(&tb, cmd, NULL) == 0);
+		snprintf(reply, sizeof(reply), "ok 1 0 %u ", nstmts[i]);
+		CHECK(strncmp(tb.reply, reply, strlen(reply)) == 0);
+		CHECK(test_batch_cmd(&tb, "goal", "ok 1\n") == 0);
+
+		CHECK(test_batch_cmd(&tb, "engine interp", "ok\n") == 0);
+	}
+
+	/* Shortest solution regardless of the number of threads */
+	CHECK(nstmts[0] == nstmts[1]);
+
+	test_batch_destroy(&tb);
+	return 0;
+}
+
+/** Test result cache.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_cache(void)
+{
+	test_batch_t tb;
+	char cmd[test_line_size];
+	char reply[test_line_size];
+	size_t len;
+
+	CHECK(test_batch_create(&tb) == 0);
+
+	snprintf(cmd, sizeof(cmd), "cache %s", test_cache_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+
+	snprintf(cmd, sizeof(cmd), "load %s", test_world_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", NULL) == 0);
+	len = strlen(tb.reply);
+	CHECK(len > 3 && strcmp(tb.reply + len - 3, " 0\n") == 0);
+	snprintf(reply, sizeof(reply), "%s", tb.reply);
+
+	/* Same outcome from the cache */
+	reply[len - 2] = '1';
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", reply) == 0);
+
+	/* Different step limit is a different key */
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 99", NULL) == 0);
+	len = strlen(tb.reply);
+	CHECK(strcmp(tb.reply + len - 3, " 0\n") == 0);
+
+	/* The robot running the program is part of the key */
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "robot 4 1", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", NULL) == 0);
+	CHECK(strncmp(tb.reply, "ok 1 0 5 ", 9) == 0);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "robot 4 1", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 4 1 P0000001 100", NULL) == 0);
+	CHECK(strncmp(tb.reply, "ok 1 1 5 ", 9) == 0);
+	len = strlen(tb.reply);
+	CHECK(strcmp(tb.reply + len - 3, " 0\n") == 0);
+
+	/* Goal after a cached run refers to the final map */
+	snprintf(cmd, sizeof(cmd), "pack %s", test_pack_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok 3\n") == 0);
+	CHECK(test_batch_cmd(&tb, "level 2", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 0\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000003 10", NULL) == 0);
+	len = strlen(tb.reply);
+	CHECK(strcmp(tb.reply + len - 3, " 0\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 1\n") == 0);
+
+	CHECK(test_batch_cmd(&tb, "level 2", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000003 10", NULL) == 0);
+	len = strlen(tb.reply);
+	CHECK(strcmp(tb.reply + len - 3, " 1\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 1\n") == 0);
+
+	/* Changing the world ends that */
+	CHECK(test_batch_cmd(&tb, "tile 3 0 0", "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "goal", "ok 0\n") == 0);
+
+	test_batch_destroy(&tb);
+
+	/* Cache is persistent */
+	CHECK(test_batch_create(&tb) == 0);
+	snprintf(cmd, sizeof(cmd), "cache %s", test_cache_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	snprintf(cmd, sizeof(cmd), "load %s", test_world_fname);
+	CHECK(test_batch_cmd(&tb, cmd, "ok\n") == 0);
+	CHECK(test_batch_cmd(&tb, "run 1 1 P0000001 100", reply) == 0);
+
+	test_batch_destroy(&tb);
+	return 0;
+}
+
+int main(void)
+{
+	int nfail = 0;
+
+	if (test_tmpfile(test_world_fname) != 0 ||
+	    test_tmpfile(test_pack_fname) != 0 ||
+	    test_tmpfile(test_cache_fname) != 0 ||
+	    test_world_write() != 0 || test_pack_write() != 0) {
+		printf("batchtest: Error creating test files.\n");
+		return 1;
+	}
+
+	if (test_engines() != 0)
+		++nfail;
+	if (test_levels() != 0)
+		++nfail;
+	if (test_solve() != 0)
+		++nfail;
+	if (test_cache() != 0)
+		++nfail;
+
+	(void) unlink(test_world_fname);
+	(void) unlink(test_pack_fname);
+	(void) unlink(test_cache_fname);
+
+	if (nfail != 0) {
+		printf("batchtest: %d test(s) failed.\n", nfail);
+		return 1;
+	}
+
+	printf("batchtest: All tests passed.\n");
+	return 0;
+}
@@ -0,0 +1,1596 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Differential fuzz tests
+ *
+ * Random programs, maps and robot placements are run by a reference
+ * interpreter, which walks the program tree recursively and shares no
+ * code with the engines, and by the engines (robot_run() with call effects
+ * and native code) in chunks of steps. After every chunk the robot and
+ * the map are compared with the reference state after the same number
+ * of steps.
+ * Mutated save files are fed to the module, map and icon loaders. Anything
+ * a loader accepts must save and load back unchanged.
+ *
+ * Failing cases are minimized and printed. A case can be repeated with
+ * -s <seed> -c 1 using the seed printed with it.
+ *
+ * Syntax: fuzztest [-s <seed>] [-c <count>] [-n]
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dir.h"
+#include "../icon.h"
+#include "../map.h"
+#include "../prog.h"
+#include "../progc.h"
+#include "../robot.h"
+#include "../robots.h"
+#include "../rstack.h"
+
+enum {
+	/** Maximum number of procedures in a random program */
+	fuzz_max_procs = 5,
+	/** Maximum number of statements in a random block */
+	fuzz_max_block = 5,
+	/** Maximum nesting depth of loops and if statements */
+	fuzz_max_depth = 3,
+	/** Maximum width and height of a random map */
+	fuzz_max_map_dim = 10,
+	/** Maximum number of idle robots */
+	fuzz_max_idle = 3,
+	/** Maximum size of a random icon */
+	fuzz_max_icon_dim = 8,
+	/** Number of steps after which a lockstep run is stopped */
+	fuzz_step_limit = 3000,
+	/** Number of mutated inputs tried for each loader per case */
+	fuzz_mutations = 20,
+	/** Maximum number of mutations applied to one input */
+	fuzz_max_mutations = 4
+};
+
+/** Engine */
+typedef enum {
+	/** Interpreter with call effects */
+	fuzz_eng_interp,
+	/** Native code */
+	fuzz_eng_native,
+	fuzz_eng_limit
+} fuzz_eng_t;
+
+/** Loader input format */
+typedef enum {
+	fuzz_fmt_module,
+	fuzz_fmt_map,
+	fuzz_fmt_icon,
+	fuzz_fmt_limit
+} fuzz_fmt_t;
+
+/** Saved file */
+typedef struct {
+	/** Data */
+	char *data;
+	/** Size of data in bytes */
+	size_t size;
+} fuzz_buf_t;
+
+/** Lockstep test case */
+typedef struct {
+	/** Saved program module (the last procedure is run) */
+	fuzz_buf_t prog;
+	/** Map */
+	map_t *map;
+	/** Robot position */
+	int x, y;
+	/** Robot direction */
+	dir_t dir;
+	/** Number of idle robots */
+	unsigned nidle;
+	/** Idle robot positions */
+	int idle_x[fuzz_max_idle], idle_y[fuzz_max_idle];
+	/** Robot stack limit */
+	unsigned stack_limit;
+	/** Number of steps engines run between comparisons */
+	unsigned long chunk;
+} fuzz_case_t;
+
+/** Why the reference run stopped */
+typedef enum {
+	/** Program finished */
+	fuzz_stop_none,
+	/** Robot error */
+	fuzz_stop_error,
+	/** Statement the engines cannot execute */
+	fuzz_stop_notsup,
+	/** Step limit reached */
+	fuzz_stop_limit
+} fuzz_stop_t;
+
+/** Robot state in reference run */
+typedef struct {
+	/** Robot position */
+	int x, y;
+	/** Robot direction */
+	dir_t dir;
+	/** Robot error */
+	robot_error_t error;
+	/** Map hash */
+	uint64_t map_hash;
+} fuzz_state_t;
+
+/** Reference run */
+typedef struct {
+	/** Map */
+	map_t *map;
+	/** Current robot state (map hash is only valid in @c states) */
+	fuzz_state_t cur;
+	/** Number of calls that will return to their caller */
+	unsigned depth;
+	/** Robot stack limit */
+	unsigned limit;
+	/** Robot states after 0, 1, 2, ... @c nsteps steps */
+	fuzz_state_t *states;
+	/** Number of steps executed */
+	unsigned long nsteps;
+	/** Maximum number of steps */
+	unsigned long max_steps;
+	/** Why the run stopped */
+	fuzz_stop_t stop;
+	/** Statement the robot stopped at (error or not supported) */
+	prog_stmt_t *stop_stmt;
+} fuzz_ref_t;
+
+/** Map, robots and the robot running the program for one engine */
+typedef struct {
+	map_t *map;
+	robots_t *robots;
+	robot_t *robot;
+} fuzz_world_t;
+
+static const char *fuzz_eng_name[fuzz_eng_limit] = {
+	"Interpreter",
+	"Native code"
+};
+
+static const char *fuzz_fmt_name[fuzz_fmt_limit] = {
+	"Module",
+	"Map",
+	"Icon"
+};
+
+/** Random number generator state */
+static uint64_t fuzz_rstate;
+
+/** Seed random number generator.
+ *
+ * @param seed Seed
+ */
+static void fuzz_srand(unsigned long seed)
+{
+	fuzz_rstate = (seed + 1) * 0x9e3779b97f4a7c15ULL;
+	if (fuzz_rstate == 0)
+		fuzz_rstate = 1;
+}
+
+/** Return random number.
+ *
+ * @param n Upper bound
+ * @return Random number from 0 to @a n - 1
+ */
+static unsigned fuzz_rand(unsigned n)
+{
+	fuzz_rstate ^= fuzz_rstate << 13;
+	fuzz_rstate ^= fuzz_rstate >> 7;
+	fuzz_rstate ^= fuzz_rstate << 17;
+	return (unsigned)((fuzz_rstate >> 32) % n);
+}
+
+/** Open buffer for saving.
+ *
+ * @param buf Buffer, filled in when the file is closed
+ * @return File or @c NULL if out of memory
+ */
+static FILE *fuzz_buf_create(fuzz_buf_t *buf)
+{
+	buf->data = NULL;
+	buf->size = 0;
+	return open_memstream(&buf->data, &buf->size);
+}
+
+/** Finish saving to buffer.
+ *
+ * @param f File returned by fuzz_buf_create()
+ * @param rc Return code of the save function
+ * @param buf Buffer
+ * @return @a rc or an error code if closing the file failed
+ */
+static int fuzz_buf_close(FILE *f, int rc, fuzz_buf_t *buf)
+{
+	if (fclose(f) != 0 && rc == 0)
+		rc = ENOMEM;
+	if (rc != 0) {
+		free(buf->data);
+		buf->data = NULL;
+	}
+
+	return rc;
+}
+
+/** Open buffer for loading.
+ *
+ * @param buf Buffer
+ * @return File or @c NULL if out of memory
+ */
+static FILE *fuzz_buf_open(fuzz_buf_t *buf)
+{
+	FILE *f;
+
+	f = tmpfile();
+	if (f == NULL)
+		return NULL;
+
+	if (fwrite(buf->data, 1, buf->size, f) != buf->size) {
+		fclose(f);
+		return NULL;
+	}
+
+	rewind(f);
+	return f;
+}
+
+/** Set random condition.
+ *
+ * @param cond Condition
+ */
+static void fuzz_cond(prog_cond_t *cond)
+{
+	cond->not = fuzz_rand(2) != 0;
+	cond->ctype = fuzz_rand(progct_south + 1);
+}
+
+static int fuzz_block_create(prog_proc_t **, unsigned, unsigned,
+    prog_block_t **);
+
+/** Create random statement.
+ *
+ * @param procs Procedures that can be called
+ * @param nprocs Number of procedures in @a procs
+ * @param depth Nesting depth
+ * @param rstmt Place to store pointer to new statement
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_stmt_create(prog_proc_t **procs, unsigned nprocs,
+    unsigned depth, prog_stmt_t **rstmt)
+{
+	prog_stmt_t *stmt;
+	prog_repeat_t *srepeat;
+	prog_intr_type_t itype;
+	unsigned k;
+	int rc;
+
+	/*
+	 * Statements the engines cannot execute are rare, so that most
+	 * runs get far enough to nest calls up to the stack limit.
+	 */
+	k = fuzz_rand(depth < fuzz_max_depth ? 32 : 21);
+	if (k < 16 || (k < 20 && nprocs == 0)) {
+		/* Mostly moves and turns, so that calls have an effect */
+		itype = fuzz_rand(4) != 0 ? progin_turn_left + fuzz_rand(2) :
+		    fuzz_rand(progin_limit);
+		return prog_stmt_intrinsic_create(itype, rstmt);
+	}
+	if (k < 20)
+		return prog_stmt_call_create(procs[fuzz_rand(nprocs)], rstmt);
+	if (k < 21)
+		return prog_stmt_recurse_create(rstmt);
+
+	if (k < 30) {
+		rc = prog_stmt_repeat_create(&stmt);
+		if (rc != 0)
+			return rc;
+
+		/* Mostly counted loops, which the engines can execute */
+		srepeat = &stmt->s.srepeat;
+		if (k < 29) {
+			srepeat->repcnt = 1 + fuzz_rand(4);
+		} else {
+			srepeat->have_scond = fuzz_rand(2) != 0;
+			if (srepeat->have_scond)
+				fuzz_cond(&srepeat->scond);
+			srepeat->have_econd = fuzz_rand(2) != 0;
+			if (srepeat->have_econd)
+				fuzz_cond(&srepeat->econd);
+		}
+
+		rc = fuzz_block_create(procs, nprocs, depth + 1,
+		    &srepeat->body);
+		if (rc != 0)
+			goto error;
+	} else {
+		rc = prog_stmt_if_create(&stmt);
+		if (rc != 0)
+			return rc;
+
+		fuzz_cond(&stmt->s.sif.cond);
+		rc = fuzz_block_create(procs, nprocs, depth + 1,
+		    &stmt->s.sif.btrue);
+		if (rc != 0)
+			goto error;
+
+		if (fuzz_rand(2) != 0) {
+			rc = fuzz_block_create(procs, nprocs, depth + 1,
+			    &stmt->s.sif.bfalse);
+			if (rc != 0)
+				goto error;
+		}
+	}
+
+	*rstmt = stmt;
+	return 0;
+error:
+	prog_stmt_destroy(stmt);
+	return rc;
+}
+
+/** Create random block.
+ *
+ * The block can be empty.
+ *
+ * @param procs Procedures that can be called
+ * @param nprocs Number of procedures in @a procs
+ * @param depth Nesting depth
+ * @param rblock Place to store pointer to new block
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_block_create(prog_proc_t **procs, unsigned nprocs,
+    unsigned depth, prog_block_t **rblock)
+{
+	prog_block_t *block;
+	prog_stmt_t *stmt;
+	unsigned n;
+	unsigned i;
+	int rc;
+
+	rc = prog_block_create(&block);
+	if (rc != 0)
+		return rc;
+
+	n = fuzz_rand(fuzz_max_block + 1);
+	for (i = 0; i < n; i++) {
+		rc = fuzz_stmt_create(procs, nprocs, depth, &stmt);
+		if (rc != 0)
+			goto error;
+
+		rc = prog_block_append(block, stmt);
+		if (rc != 0) {
+			prog_stmt_destroy(stmt);
+			goto error;
+		}
+	}
+
+	*rblock = block;
+	return 0;
+error:
+	prog_block_destroy(block);
+	return rc;
+}
+
+/** Create random program.
+ *
+ * Like programs taught in the game, a procedure only calls procedures
+ * defined before it and recurses using the recurse statement. Procedure
+ * bodies can be empty.
+ *
+ * @param buf Buffer to store the saved program module
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_prog_create(fuzz_buf_t *buf)
+{
+	prog_module_t *mod;
+	prog_proc_t *procs[fuzz_max_procs];
+	prog_block_t *body;
+	char ident[9];
+	unsigned nprocs;
+	unsigned i;
+	FILE *f;
+	int rc;
+
+	rc = prog_module_create(&mod);
+	if (rc != 0)
+		return rc;
+
+	nprocs = 1 + fuzz_rand(fuzz_max_procs);
+	for (i = 0; i < nprocs; i++) {
+		rc = fuzz_block_create(procs, i, 0, &body);
+		if (rc != 0)
+			goto error;
+
+		snprintf(ident, sizeof(ident), "P%07u", i + 1);
+		rc = prog_proc_create(ident, &procs[i]);
+		if (rc != 0) {
+			prog_block_destroy(body);
+			goto error;
+		}
+
+		procs[i]->body = body;
+		rc = prog_module_append(mod, procs[i]);
+		if (rc != 0) {
+			prog_proc_destroy(procs[i]);
+			goto error;
+		}
+	}
+
+	f = fuzz_buf_create(buf);
+	if (f == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	rc = fuzz_buf_close(f, prog_module_save(mod, f), buf);
+error:
+	prog_module_destroy(mod);
+	return rc;
+}
+
+/** Create random map.
+ *
+ * The top left tile is always a wall.
+ *
+ * @param rmap Place to store pointer to new map
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_map_create(map_t **rmap)
+{
+	map_t *map;
+	unsigned k;
+	int x, y;
+	int rc;
+
+	rc = map_create(2 + fuzz_rand(fuzz_max_map_dim - 1),
+	    1 + fuzz_rand(fuzz_max_map_dim), &map);
+	if (rc != 0)
+		return rc;
+
+	for (y = 0; y < map->height; y++) {
+		for (x = 0; x < map->width; x++) {
+			k = fuzz_rand(10);
+			if (k < 6)
+				map_set(map, x, y, mapt_none);
+			else if (k < 8)
+				map_set(map, x, y, mapt_wall);
+			else
+				map_set(map, x, y, mapt_wtag + fuzz_rand(3));
+		}
+	}
+
+	map_set(map, 0, 0, mapt_wall);
+	*rmap = map;
+	return 0;
+}
+
+/** Choose random tile other than the top left one.
+ *
+ * @param map Map
+ * @param rx Place to store X coordinate
+ * @param ry Place to store Y coordinate
+ */
+static void fuzz_map_tile(map_t *map, int *rx, int *ry)
+{
+	unsigned i;
+
+	i = 1 + fuzz_rand(map->width * map->height - 1);
+	*rx = i % map->width;
+	*ry = i / map->width;
+}
+
+/** Create random lockstep test case.
+ *
+ * @param fcase Test case to fill in
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_case_create(fuzz_case_t *fcase)
+{
+	static const unsigned long chunks[] = { 1, 2, 3, 7, 20, 100, 1000 };
+	unsigned i;
+	int rc;
+
+	memset(fcase, 0, sizeof(fuzz_case_t));
+
+	rc = fuzz_prog_create(&fcase->prog);
+	if (rc != 0)
+		return rc;
+
+	rc = fuzz_map_create(&fcase->map);
+	if (rc != 0) {
+		free(fcase->prog.data);
+		return rc;
+	}
+
+	fuzz_map_tile(fcase->map, &fcase->x, &fcase->y);
+	if (map_get(fcase->map, fcase->x, fcase->y) == mapt_wall)
+		map_set(fcase->map, fcase->x, fcase->y, mapt_none);
+	fcase->dir = fuzz_rand(4);
+
+	fcase->nidle = fuzz_rand(fuzz_max_idle + 1);
+	for (i = 0; i < fcase->nidle; i++)
+		fuzz_map_tile(fcase->map, &fcase->idle_x[i], &fcase->idle_y[i]);
+
+	/* Mostly small limits, which programs without recursion reach */
+	fcase->stack_limit = fuzz_rand(2) != 0 ? fuzz_rand(3) :
+	    1 + fuzz_rand(8);
+	fcase->chunk = chunks[fuzz_rand(sizeof(chunks) / sizeof(chunks[0]))];
+	return 0;
+}
+
+/** Destroy lockstep test case.
+ *
+ * @param fcase Test case
+ */
+static void fuzz_case_destroy(fuzz_case_t *fcase)
+{
+	free(fcase->prog.data);
+	map_destroy(fcase->map);
+}
+
+/** Print lockstep test case.
+ *
+ * @param fcase Test case
+ */
+static void fuzz_case_print(fuzz_case_t *fcase)
+{
+	unsigned i;
+
+	printf("Program:\n");
+	fwrite(fcase->prog.data, 1, fcase->prog.size, stdout);
+	printf("Map:\n");
+	(void)map_save(fcase->map, stdout);
+	printf("Robot at %d,%d direction %d stack limit %u, "
+	    "%lu steps between comparisons.\n", fcase->x, fcase->y,
+	    (int)fcase->dir, fcase->stack_limit, fcase->chunk);
+	for (i = 0; i < fcase->nidle; i++) {
+		printf("Idle robot at %d,%d.\n", fcase->idle_x[i],
+		    fcase->idle_y[i]);
+	}
+}
+
+/** Record robot state after a step of the reference run.
+ *
+ * @param ref Reference run
+ */
+static void fuzz_ref_record(fuzz_ref_t *ref)
+{
+	ref->cur.map_hash = map_hash(ref->map);
+	ref->states[++ref->nsteps] = ref->cur;
+}
+
+/** Put down tag in reference run.
+ *
+ * @param ref Reference run
+ * @param tag Tag tile
+ */
+static void fuzz_ref_put(fuzz_ref_t *ref, map_tile_t tag)
+{
+	if (map_get(ref->map, ref->cur.x, ref->cur.y) != mapt_none)
+		ref->cur.error = errt_already_tag;
+	else
+		map_set(ref->map, ref->cur.x, ref->cur.y, tag);
+}
+
+/** Execute intrinsic statement in reference run.
+ *
+ * @param ref Reference run
+ * @param itype Intrinsic type
+ */
+static void fuzz_ref_intr(fuzz_ref_t *ref, prog_intr_type_t itype)
+{
+	int dx, dy;
+
+	switch (itype) {
+	case progin_turn_left:
+		ref->cur.dir = dir_next_ccw(ref->cur.dir);
+		break;
+	case progin_move:
+		dir_get_off(ref->cur.dir, &dx, &dy);
+		if (map_get(ref->map, ref->cur.x + dx, ref->cur.y + dy) ==
+		    mapt_wall) {
+			ref->cur.error = errt_hit_wall;
+			break;
+		}
+
+		ref->cur.x += dx;
+		ref->cur.y += dy;
+		break;
+	case progin_put_white:
+		fuzz_ref_put(ref, mapt_wtag);
+		break;
+	case progin_put_grey:
+		fuzz_ref_put(ref, mapt_gtag);
+		break;
+	case progin_put_black:
+		fuzz_ref_put(ref, mapt_btag);
+		break;
+	default:
+		if (!map_tile_tag(map_get(ref->map, ref->cur.x, ref->cur.y)))
+			ref->cur.error = errt_no_tag;
+		else
+			map_set(ref->map, ref->cur.x, ref->cur.y, mapt_none);
+		break;
+	}
+}
+
+static fuzz_stop_t fuzz_ref_block(fuzz_ref_t *, prog_block_t *, bool);
+
+/** Execute statement in reference run.
+ *
+ * A call that is the last statement executed in its procedure replaces
+ * the calling procedure. Any other call returns to its caller and
+ * fails with stack overflow if the robot already has as many pending
+ * returns as its stack limit allows.
+ *
+ * @param ref Reference run
+ * @param stmt Statement
+ * @param tail @c true if no other statement of the procedure is executed
+ *        after @a stmt
+ * @return Why the run stopped or fuzz_stop_none to continue
+ */
+static fuzz_stop_t fuzz_ref_stmt(fuzz_ref_t *ref, prog_stmt_t *stmt,
+    bool tail)
+{
+	prog_repeat_t *srepeat;
+	fuzz_stop_t stop;
+	unsigned i;
+
+	if (ref->nsteps >= ref->max_steps)
+		return fuzz_stop_limit;
+
+	switch (stmt->stype) {
+	case progst_intrinsic:
+		fuzz_ref_intr(ref, stmt->s.sintr.itype);
+		fuzz_ref_record(ref);
+		if (ref->cur.error != errt_none)
+			break;
+		return fuzz_stop_none;
+	case progst_call:
+		if (!tail && ref->depth >= ref->limit) {
+			ref->cur.error = errt_stack_overflow;
+			fuzz_ref_record(ref);
+			break;
+		}
+
+		fuzz_ref_record(ref);
+		if (!tail)
+			++ref->depth;
+		stop = fuzz_ref_block(ref, stmt->s.scall.proc->body, true);
+		if (!tail)
+			--ref->depth;
+		return stop;
+	case progst_repeat:
+		srepeat = &stmt->s.srepeat;
+		if (srepeat->repcnt == 0 || srepeat->have_scond ||
+		    srepeat->have_econd) {
+			ref->stop_stmt = stmt;
+			return fuzz_stop_notsup;
+		}
+
+		for (i = 0; i < srepeat->repcnt; i++) {
+			stop = fuzz_ref_block(ref, srepeat->body,
+			    tail && i + 1 == srepeat->repcnt);
+			if (stop != fuzz_stop_none)
+				return stop;
+		}
+
+		return fuzz_stop_none;
+	default:
+		ref->stop_stmt = stmt;
+		return fuzz_stop_notsup;
+	}
+
+	ref->stop_stmt = stmt;
+	return fuzz_stop_error;
+}
+
+/** Execute block in reference run.
+ *
+ * @param ref Reference run
+ * @param block Block
+ * @param tail @c true if no other statement of the procedure is executed
+ *        after @a block
+ * @return Why the run stopped or fuzz_stop_none to continue
+ */
+static fuzz_stop_t fuzz_ref_block(fuzz_ref_t *ref, prog_block_t *block,
+    bool tail)
+{
+	prog_stmt_t *stmt;
+	prog_stmt_t *next;
+	fuzz_stop_t stop;
+
+	stmt = prog_block_first(block);
+	while (stmt != NULL) {
+		next = prog_block_next(stmt);
+		stop = fuzz_ref_stmt(ref, stmt, tail && next == NULL);
+		if (stop != fuzz_stop_none)
+			return stop;
+		stmt = next;
+	}
+
+	return fuzz_stop_none;
+}
+
+/** Run test case with the reference interpreter.
+ *
+ * The run is stopped after the engines could have reached the step limit
+ * of the lockstep run.
+ *
+ * @param fcase Test case
+ * @param mod Program module loaded from the test case
+ * @param ref Reference run to fill in
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_ref_run(fuzz_case_t *fcase, prog_module_t *mod,
+    fuzz_ref_t *ref)
+{
+	int rc;
+
+	memset(ref, 0, sizeof(fuzz_ref_t));
+	ref->max_steps = fuzz_step_limit + fcase->chunk;
+	ref->states = calloc(ref->max_steps + 1, sizeof(fuzz_state_t));
+	if (ref->states == NULL)
+		return ENOMEM;
+
+	rc = map_clone(fcase->map, &ref->map);
+	if (rc != 0) {
+		free(ref->states);
+		return rc;
+	}
+
+	ref->cur.x = fcase->x;
+	ref->cur.y = fcase->y;
+	ref->cur.dir = fcase->dir;
+	ref->cur.error = errt_none;
+	ref->cur.map_hash = map_hash(ref->map);
+	ref->states[0] = ref->cur;
+	ref->limit = fcase->stack_limit;
+
+	ref->stop = fuzz_ref_block(ref, prog_module_last(mod)->body, true);
+	return 0;
+}
+
+/** Destroy reference run.
+ *
+ * @param ref Reference run
+ */
+static void fuzz_ref_destroy(fuzz_ref_t *ref)
+{
+	free(ref->states);
+	map_destroy(ref->map);
+}
+
+/** Set up world for running test case.
+ *
+ * @param fcase Test case
+ * @param mod Program module loaded from the test case
+ * @param world World to fill in
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_world_create(fuzz_case_t *fcase, prog_module_t *mod,
+    fuzz_world_t *world)
+{
+	unsigned i;
+	int rc;
+
+	world->robots = NULL;
+	rc = map_clone(fcase->map, &world->map);
+	if (rc != 0)
+		return rc;
+
+	rc = robots_create(mod, world->map, &world->robots);
+	if (rc != 0)
+		goto error;
+
+	robots_set_stack_limit(world->robots, fcase->stack_limit);
+	rc = robots_add(world->robots, fcase->x, fcase->y);
+	if (rc != 0)
+		goto error;
+
+	world->robot = robots_get(world->robots, fcase->x, fcase->y);
+	world->robot->dir = fcase->dir;
+
+	for (i = 0; i < fcase->nidle; i++) {
+		rc = robots_add(world->robots, fcase->idle_x[i],
+		    fcase->idle_y[i]);
+		if (rc != 0 && rc != EEXIST)
+			goto error;
+	}
+
+	rc = robot_run_proc(world->robot, prog_module_last(mod));
+	if (rc != 0)
+		goto error;
+
+	return 0;
+error:
+	robots_destroy(world->robots);
+	map_destroy(world->map);
+	return rc;
+}
+
+/** Destroy world.
+ *
+ * @param world World
+ */
+static void fuzz_world_destroy(fuzz_world_t *world)
+{
+	robots_destroy(world->robots);
+	map_destroy(world->map);
+}
+
+/** Run robot for a number of steps.
+ *
+ * @param world World
+ * @param eng Engine
+ * @param progc Native code (if @a eng is fuzz_eng_native)
+ * @param max_steps Maximum number of steps
+ * @param rsteps Place to store number of steps executed
+ * @return As robot_run()
+ */
+static int fuzz_world_run(fuzz_world_t *world, fuzz_eng_t eng,
+    progc_t *progc, unsigned long max_steps, unsigned long *rsteps)
+{
+	if (eng == fuzz_eng_interp)
+		return robot_run(world->robot, max_steps, rsteps);
+	else
+		return progc_run(progc, world->robot, max_steps, rsteps);
+}
+
+/** Compare world with reference run after a chunk of steps.
+ *
+ * @param ref Reference run
+ * @param world World
+ * @param total Number of steps executed before the chunk
+ * @param chunk Maximum number of steps in the chunk
+ * @param rc Return code of the engine
+ * @param steps Number of steps the engine executed
+ * @return Description of the first difference or @c NULL if none
+ */
+static const char *fuzz_ref_diff(fuzz_ref_t *ref, fuzz_world_t *world,
+    unsigned long total, unsigned long chunk, int rc, unsigned long steps)
+{
+	robot_t *robot = world->robot;
+	fuzz_state_t *state;
+	unsigned long nexp;
+	bool end;
+	bool stopped;
+	int rexp;
+
+	nexp = ref->nsteps - total;
+	if (nexp > chunk)
+		nexp = chunk;
+	state = &ref->states[total + nexp];
+
+	/* Robot must stop if it has fewer steps left than the chunk */
+	end = total + nexp == ref->nsteps;
+	stopped = end && (nexp < chunk || ref->stop == fuzz_stop_error);
+	rexp = stopped && ref->stop == fuzz_stop_notsup ? ENOTSUP : 0;
+
+	if (rc != rexp)
+		return "return code";
+	if (steps != nexp)
+		return "step count";
+	if (robot->x != state->x || robot->y != state->y)
+		return "position";
+	if (robot->dir != state->dir)
+		return "direction";
+	if (robot_error(robot) != state->error)
+		return "error";
+	if (map_hash(world->map) != state->map_hash)
+		return "map";
+	if (stopped) {
+		if (robot_is_busy(robot) != (ref->stop != fuzz_stop_none))
+			return "busy";
+		if (ref->stop != fuzz_stop_none &&
+		    robot_cur_stmt(robot) != ref->stop_stmt)
+			return "current statement";
+	}
+
+	return NULL;
+}
+
+/** Run test case with all engines in lockstep.
+ *
+ * @param fcase Test case
+ * @param native @c true to also run native code
+ * @param verbose @c true to print where the engines diverge
+ * @return Zero if engines agree, EIO if they diverge, ENOMEM if out
+ *         of memory
+ */
+static int fuzz_lockstep(fuzz_case_t *fcase, bool native, bool verbose)
+{
+	prog_module_t *mod = NULL;
+	progc_t *progc = NULL;
+	fuzz_ref_t ref;
+	fuzz_world_t worlds[fuzz_eng_limit];
+	unsigned long steps;
+	unsigned neng = native ? fuzz_eng_limit : fuzz_eng_native;
+	unsigned long total = 0;
+	unsigned long nexp;
+	const char *diff;
+	unsigned nworlds = 0;
+	unsigned e;
+	FILE *f;
+	int rc;
+
+	f = fuzz_buf_open(&fcase->prog);
+	if (f == NULL)
+		return ENOMEM;
+
+	rc = prog_module_load(f, &mod);
+	fclose(f);
+	if (rc != 0)
+		return rc;
+
+	rc = fuzz_ref_run(fcase, mod, &ref);
+	if (rc != 0) {
+		prog_module_destroy(mod);
+		return rc;
+	}
+
+	if (native) {
+		rc = progc_compile(mod, &progc);
+		if (rc != 0)
+			goto error;
+	}
+
+	for (nworlds = 0; nworlds < neng; nworlds++) {
+		rc = fuzz_world_create(fcase, mod, &worlds[nworlds]);
+		if (rc != 0)
+			goto error;
+	}
+
+	while (total < fuzz_step_limit) {
+		for (e = 0; e < neng; e++) {
+			rc = fuzz_world_run(&worlds[e], e, progc, fcase->chunk,
+			    &steps);
+			diff = fuzz_ref_diff(&ref, &worlds[e], total,
+			    fcase->chunk, rc, steps);
+			if (diff != NULL) {
+				if (verbose) {
+					printf("%s differs from reference "
+					    "(%s) after %lu steps.\n",
+					    fuzz_eng_name[e], diff, total);
+				}
+				rc = EIO;
+				goto error;
+			}
+		}
+
+		nexp = ref.nsteps - total;
+		if (nexp >= fcase->chunk) {
+			total += fcase->chunk;
+		} else {
+			/* The engines have stopped */
+			break;
+		}
+
+		if (total == ref.nsteps && ref.stop == fuzz_stop_error)
+			break;
+	}
+
+	rc = 0;
+error:
+	for (e = 0; e < nworlds; e++)
+		fuzz_world_destroy(&worlds[e]);
+	if (progc != NULL)
+		progc_destroy(progc);
+	fuzz_ref_destroy(&ref);
+	prog_module_destroy(mod);
+	return rc;
+}
+
+/** Remove statement from saved program.
+ *
+ * @param prog Saved program module
+ * @param pidx Index of procedure in module
+ * @param sidx Index of statement in procedure (in pre-order)
+ * @param rprog Place to store saved program without the statement
+ * @return Zero on success, ENOENT if there is no such procedure,
+ *         ERANGE if the procedure has no such statement, ENOMEM if out
+ *         of memory
+ */
+static int fuzz_prog_remove_stmt(fuzz_buf_t *prog, unsigned pidx,
+    unsigned sidx, fuzz_buf_t *rprog)
+{
+	prog_module_t *mod;
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+	FILE *f;
+	int rc;
+
+	f = fuzz_buf_open(prog);
+	if (f == NULL)
+		return ENOMEM;
+
+	rc = prog_module_load(f, &mod);
+	fclose(f);
+	if (rc != 0)
+		return rc;
+
+	proc = prog_module_first(mod);
+	while (proc != NULL && pidx-- > 0)
+		proc = prog_module_next(proc);
+	if (proc == NULL) {
+		rc = ENOENT;
+		goto error;
+	}
+
+	stmt = prog_proc_stmt_by_index(proc, sidx);
+	if (stmt == NULL) {
+		rc = ERANGE;
+		goto error;
+	}
+
+	rc = prog_proc_remove_stmt(proc, stmt);
+	if (rc != 0)
+		goto error;
+
+	f = fuzz_buf_create(rprog);
+	if (f == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	rc = fuzz_buf_close(f, prog_module_save(mod, f), rprog);
+error:
+	prog_module_destroy(mod);
+	return rc;
+}
+
+/** Minimize failing lockstep test case.
+ *
+ * Idle robots and statements are removed one at a time as long as
+ * the engines still diverge.
+ *
+ * @param fcase Failing test case
+ * @param native @c true to also run native code
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_lockstep_minimize(fuzz_case_t *fcase, bool native)
+{
+	fuzz_buf_t prog;
+	fuzz_buf_t old;
+	unsigned pidx;
+	unsigned sidx;
+	bool progress;
+	int rc;
+
+	while (fcase->nidle > 0) {
+		--fcase->nidle;
+		rc = fuzz_lockstep(fcase, native, false);
+		if (rc == 0) {
+			++fcase->nidle;
+			break;
+		}
+
+		if (rc != EIO)
+			return rc;
+	}
+
+	do {
+		progress = false;
+		pidx = 0;
+		sidx = 0;
+		while (true) {
+			rc = fuzz_prog_remove_stmt(&fcase->prog, pidx, sidx,
+			    &prog);
+			if (rc == ENOENT)
+				break;
+			if (rc == ERANGE) {
+				++pidx;
+				sidx = 0;
+				continue;
+			}
+			if (rc != 0)
+				return rc;
+
+			old = fcase->prog;
+			fcase->prog = prog;
+			rc = fuzz_lockstep(fcase, native, false);
+			if (rc == EIO) {
+				/* Still fails without the statement */
+				free(old.data);
+				progress = true;
+				continue;
+			}
+
+			fcase->prog = old;
+			free(prog.data);
+			if (rc != 0)
+				return rc;
+			++sidx;
+		}
+	} while (progress);
+
+	return 0;
+}
+
+/** Run lockstep tests.
+ *
+ * @param seed Seed of the first test case
+ * @param count Number of test cases
+ * @param native @c true to also run native code
+ * @param nfail Number of failed cases to update
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_lockstep_test(unsigned long seed, unsigned long count,
+    bool native, unsigned *nfail)
+{
+	fuzz_case_t fcase;
+	unsigned long i;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		fuzz_srand(seed + i);
+		rc = fuzz_case_create(&fcase);
+		if (rc != 0)
+			return rc;
+
+		rc = fuzz_lockstep(&fcase, native, false);
+		if (rc == EIO) {
+			printf("Engines diverge (seed %lu).\n", seed + i);
+			rc = fuzz_lockstep_minimize(&fcase, native);
+			if (rc == 0)
+				(void)fuzz_lockstep(&fcase, native, true);
+			fuzz_case_print(&fcase);
+			++*nfail;
+		}
+
+		fuzz_case_destroy(&fcase);
+		if (rc != 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/** Create random loader input.
+ *
+ * @param fmt Format
+ * @param buf Buffer to store the saved file
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_load_input(fuzz_fmt_t fmt, fuzz_buf_t *buf)
+{
+	map_t *map;
+	icon_t *icon;
+	uint8_t *pixels;
+	int w, h;
+	int i;
+	FILE *f;
+	int rc;
+
+	switch (fmt) {
+	case fuzz_fmt_module:
+		return fuzz_prog_create(buf);
+	case fuzz_fmt_map:
+		rc = fuzz_map_create(&map);
+		if (rc != 0)
+			return rc;
+
+		f = fuzz_buf_create(buf);
+		if (f == NULL) {
+			map_destroy(map);
+			return ENOMEM;
+		}
+
+		rc = fuzz_buf_close(f, map_save(map, f), buf);
+		map_destroy(map);
+		return rc;
+	default:
+		w = 1 + fuzz_rand(fuzz_max_icon_dim);
+		h = 1 + fuzz_rand(fuzz_max_icon_dim);
+		pixels = malloc(3 * w * h);
+		if (pixels == NULL)
+			return ENOMEM;
+
+		for (i = 0; i < 3 * w * h; i++)
+			pixels[i] = fuzz_rand(256);
+
+		rc = icon_from_rgb(w, h, pixels, &icon);
+		free(pixels);
+		if (rc != 0)
+			return rc;
+
+		f = fuzz_buf_create(buf);
+		if (f == NULL) {
+			icon_destroy(icon);
+			return ENOMEM;
+		}
+
+		rc = fuzz_buf_close(f, icon_save(icon, f), buf);
+		icon_destroy(icon);
+		return rc;
+	}
+}
+
+/** Create mutated copy of loader input.
+ *
+ * Bytes are replaced, inserted or deleted, the input is truncated
+ * or suspicious numbers are inserted.
+ *
+ * @param src Input
+ * @param dst Buffer to store the mutated input
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_mutate(fuzz_buf_t *src, fuzz_buf_t *dst)
+{
+	static const char chars[] = "0123456789 ,\n-P";
+	static const char *numbers[] = {
+		"-1", "0", "1024", "1025", "2147483647", "4294967296",
+		"99999999999999999999"
+	};
+	const char *num;
+	char c;
+	unsigned nmut;
+	unsigned i;
+	size_t len;
+	size_t pos;
+
+	nmut = 1 + fuzz_rand(fuzz_max_mutations);
+	dst->data = malloc(src->size + nmut * 20 + 1);
+	if (dst->data == NULL)
+		return ENOMEM;
+
+	memcpy(dst->data, src->data, src->size);
+	dst->size = src->size;
+
+	for (i = 0; i < nmut; i++) {
+		pos = fuzz_rand(dst->size + 1);
+		c = chars[fuzz_rand(sizeof(chars) - 1)];
+		switch (fuzz_rand(5)) {
+		case 0:
+			if (pos < dst->size)
+				dst->data[pos] = c;
+			break;
+		case 1:
+			memmove(dst->data + pos + 1, dst->data + pos,
+			    dst->size - pos);
+			dst->data[pos] = c;
+			++dst->size;
+			break;
+		case 2:
+			if (pos < dst->size) {
+				memmove(dst->data + pos, dst->data + pos + 1,
+				    dst->size - pos - 1);
+				--dst->size;
+			}
+			break;
+		case 3:
+			dst->size = pos;
+			break;
+		default:
+			num = numbers[fuzz_rand(sizeof(numbers) /
+			    sizeof(numbers[0]))];
+			len = strlen(num);
+			memmove(dst->data + pos + len, dst->data + pos,
+			    dst->size - pos);
+			memcpy(dst->data + pos, num, len);
+			dst->size += len;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/** Load file and save it again.
+ *
+ * @param fmt Format
+ * @param in Input
+ * @param out Buffer to store the saved file
+ * @param rloaded Place to store @c true if the input was loaded
+ * @return Zero on success (even if the input was rejected), ENOMEM
+ *         if out of memory, EIO if saving failed
+ */
+static int fuzz_load_save(fuzz_fmt_t fmt, fuzz_buf_t *in, fuzz_buf_t *out,
+    bool *rloaded)
+{
+	prog_module_t *mod = NULL;
+	map_t *map = NULL;
+	icon_t *icon = NULL;
+	FILE *f;
+	int rc;
+
+	f = fuzz_buf_open(in);
+	if (f == NULL)
+		return ENOMEM;
+
+	switch (fmt) {
+	case fuzz_fmt_module:
+		rc = prog_module_load(f, &mod);
+		break;
+	case fuzz_fmt_map:
+		rc = map_load(f, &map);
+		break;
+	default:
+		rc = icon_load(f, &icon);
+		break;
+	}
+
+	fclose(f);
+	*rloaded = rc == 0;
+	if (rc != 0)
+		return 0;
+
+	f = fuzz_buf_create(out);
+	if (f == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	switch (fmt) {
+	case fuzz_fmt_module:
+		rc = prog_module_save(mod, f);
+		break;
+	case fuzz_fmt_map:
+		rc = map_save(map, f);
+		break;
+	default:
+		rc = icon_save(icon, f);
+		break;
+	}
+
+	rc = fuzz_buf_close(f, rc, out);
+error:
+	prog_module_destroy(mod);
+	if (map != NULL)
+		map_destroy(map);
+	if (icon != NULL)
+		icon_destroy(icon);
+	return rc;
+}
+
+/** Check that loader rejects input or loads it faithfully.
+ *
+ * If the input is loaded, saving it and loading it back must give
+ * the same file again.
+ *
+ * @param fmt Format
+ * @param in Input
+ * @return Zero if the check passed, EIO if it failed, ENOMEM if out
+ *         of memory
+ */
+static int fuzz_load_check(fuzz_fmt_t fmt, fuzz_buf_t *in)
+{
+	fuzz_buf_t first;
+	fuzz_buf_t second;
+	bool loaded;
+	int rc;
+
+	rc = fuzz_load_save(fmt, in, &first, &loaded);
+	if (rc != 0 || !loaded)
+		return rc;
+
+	rc = fuzz_load_save(fmt, &first, &second, &loaded);
+	if (rc != 0 || !loaded) {
+		free(first.data);
+		return rc != 0 ? rc : EIO;
+	}
+
+	if (first.size != second.size ||
+	    memcmp(first.data, second.data, first.size) != 0)
+		rc = EIO;
+
+	free(first.data);
+	free(second.data);
+	return rc;
+}
+
+/** Minimize failing loader input.
+ *
+ * Chunks of decreasing size are deleted as long as the check still fails.
+ *
+ * @param fmt Format
+ * @param in Failing input
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_load_minimize(fuzz_fmt_t fmt, fuzz_buf_t *in)
+{
+	fuzz_buf_t cand;
+	size_t csize;
+	size_t pos;
+	size_t n;
+	int rc;
+
+	for (csize = in->size / 2; csize > 0; csize /= 2) {
+		pos = 0;
+		while (pos < in->size) {
+			n = in->size - pos < csize ? in->size - pos : csize;
+			cand.size = in->size - n;
+			cand.data = malloc(cand.size + 1);
+			if (cand.data == NULL)
+				return ENOMEM;
+
+			memcpy(cand.data, in->data, pos);
+			memcpy(cand.data + pos, in->data + pos + n,
+			    in->size - pos - n);
+
+			rc = fuzz_load_check(fmt, &cand);
+			if (rc == EIO) {
+				/* Still fails without the chunk */
+				free(in->data);
+				*in = cand;
+				continue;
+			}
+
+			free(cand.data);
+			if (rc != 0)
+				return rc;
+			pos += csize;
+		}
+	}
+
+	return 0;
+}
+
+/** Run loader tests.
+ *
+ * @param seed Seed of the first test case
+ * @param count Number of test cases
+ * @param nfail Number of failed cases to update
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int fuzz_load_test(unsigned long seed, unsigned long count,
+    unsigned *nfail)
+{
+	fuzz_buf_t orig;
+	fuzz_buf_t in;
+	fuzz_fmt_t fmt;
+	bool failed;
+	unsigned long i;
+	unsigned j;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		fuzz_srand(seed + i);
+		for (fmt = 0; fmt < fuzz_fmt_limit; fmt++) {
+			rc = fuzz_load_input(fmt, &orig);
+			if (rc != 0)
+				return rc;
+
+			/* The unmodified input is checked first */
+			failed = false;
+			for (j = 0; j <= fuzz_mutations; j++) {
+				if (j == 0) {
+					in.data = malloc(orig.size + 1);
+					in.size = orig.size;
+					rc = in.data != NULL ? 0 : ENOMEM;
+					if (rc == 0)
+						memcpy(in.data, orig.data,
+						    orig.size);
+				} else {
+					rc = fuzz_mutate(&orig, &in);
+				}
+
+				if (rc != 0)
+					break;
+
+				rc = fuzz_load_check(fmt, &in);
+				if (rc == EIO) {
+					printf("%s loader fails (seed %lu).\n",
+					    fuzz_fmt_name[fmt], seed + i);
+					rc = fuzz_load_minimize(fmt, &in);
+					printf("Input:\n");
+					fwrite(in.data, 1, in.size, stdout);
+					printf("\n");
+					++*nfail;
+					failed = true;
+				}
+
+				free(in.data);
+				if (rc != 0 || failed)
+					break;
+			}
+
+			free(orig.data);
+			if (rc != 0)
+				return rc;
+		}
+	}
+
+	return 0;
+}
+
+/** Parse numeric argument.
+ *
+ * @param arg Argument
+ * @param rval Place to store value
+ * @return Zero on success, EINVAL if argument is not a number
+ */
+static int fuzz_parse_num(const char *arg, unsigned long *rval)
+{
+	char *endptr;
+
+	if (arg == NULL || *arg < '0' || *arg > '9')
+		return EINVAL;
+
+	*rval = strtoul(arg, &endptr, 10);
+	if (*endptr != '\0')
+		return EINVAL;
+
+	return 0;
+}
+
+static void print_syntax(void)
+{
+	printf("Syntax: fuzztest [-s <seed>] [-c <count>] [-n]\n");
+	printf("\t-s <seed>  Seed of the first case (default 1)\n");
+	printf("\t-c <count> Number of cases (default 100)\n");
+	printf("\t-n         Do not run native code\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long seed = 1;
+	unsigned long count = 100;
+	bool native = true;
+	unsigned nfail = 0;
+	int i;
+	int rc;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0) {
+			rc = fuzz_parse_num(argv[++i], &seed);
+		} else if (strcmp(argv[i], "-c") == 0) {
+			rc = fuzz_parse_num(argv[++i], &count);
+		} else if (strcmp(argv[i], "-n") == 0) {
+			native = false;
+			rc = 0;
+		} else {
+			rc = EINVAL;
+		}
+
+		if (rc != 0) {
+			print_syntax();
+			return 1;
+		}
+	}
+
+	rc = fuzz_lockstep_test(seed, count, native, &nfail);
+	if (rc == 0)
+		rc = fuzz_load_test(seed, count, &nfail);
+	if (rc != 0) {
+		printf("fuzztest: Error running tests (%d).\n", rc);
+		return 1;
+	}
+
+	if (nfail != 0) {
+		printf("fuzztest: %u case(s) failed.\n", nfail);
+		return 1;
+	}
+
+	printf("fuzztest: All cases passed.\n");
+	return 0;
+}
@@ -0,0 +1,953 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Program execution and persistence tests
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../dir.h"
+#include "../map.h"
+#include "../prog.h"
+#include "../progloop.h"
+#include "../rerun.h"
+#include "../robot.h"
+#include "../robots.h"
+#include "../rstack.h"
+#include "../solver.h"
+#include "../undolog.h"
+
+/** Fail current test if condition does not hold. */
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, \
+			    __LINE__, #cond); \
+			return EIO; \
+		} \
+	} while (0)
+
+/** Create empty procedure and append it to module.
+ *
+ * @param mod Program module
+ * @param ident Procedure identifier
+ * @return New procedure or @c NULL if out of memory
+ */
+static prog_proc_t *test_proc(prog_module_t *mod, const char *ident)
+{
+	prog_proc_t *proc;
+
+	if (prog_proc_create(ident, &proc) != 0)
+		return NULL;
+
+	if (prog_block_create(&proc->body) != 0) {
+		prog_proc_destroy(proc);
+		return NULL;
+	}
+
+	if (prog_module_append(mod, proc) != 0) {
+		prog_proc_destroy(proc);
+		return NULL;
+	}
+
+	return proc;
+}
+
+/** Append intrinsic statement to procedure.
+ *
+ * @param proc Procedure
+ * @param itype Intrinsic type
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int test_intr(prog_proc_t *proc, prog_intr_type_t itype)
+{
+	prog_stmt_t *stmt;
+	int rc;
+
+	rc = prog_stmt_intrinsic_create(itype, &stmt);
+	if (rc != 0)
+		return rc;
+
+	rc = prog_block_append(proc->body, stmt);
+	if (rc != 0)
+		prog_stmt_destroy(stmt);
+	return rc;
+}
+
+/** Append call statement to procedure.
+ *
+ * @param proc Procedure
+ * @param callee Called procedure
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int test_call(prog_proc_t *proc, prog_proc_t *callee)
+{
+	prog_stmt_t *stmt;
+	int rc;
+
+	rc = prog_stmt_call_create(callee, &stmt);
+	if (rc != 0)
+		return rc;
+
+	rc = prog_block_append(proc->body, stmt);
+	if (rc != 0)
+		prog_stmt_destroy(stmt);
+	return rc;
+}
+
+/** Test loading a robot stack deeper than the current stack limit.
+ *
+ * Also tests that the stack overflow error survives saving and loading.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_stack_load(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *proc;
+	map_t *map;
+	robots_t *robots;
+	robots_t *lrobots;
+	robot_t *robot;
+	FILE *f;
+
+	CHECK(prog_module_create(&mod) == 0);
+	CHECK(map_create(4, 4, &map) == 0);
+
+	/* P calls itself before turning, so the stack keeps growing */
+	proc = test_proc(mod, "P0000001");
+	CHECK(proc != NULL);
+	CHECK(test_call(proc, proc) == 0);
+	CHECK(test_intr(proc, progin_turn_left) == 0);
+
+	CHECK(robots_create(mod, map, &robots) == 0);
+	robots_set_stack_limit(robots, 2 * rstack_def_limit);
+	CHECK(robots_add(robots, 1, 1) == 0);
+	robot = robots_first(robots);
+	CHECK(robot_run_proc(robot, proc) == 0);
+	while (robot->rstack->nentries < rstack_def_limit + 100)
+		CHECK(robot_step(robot) == 0);
+
+	f = tmpfile();
+	CHECK(f != NULL);
+	CHECK(robots_save(robots, f) == 0);
+	rewind(f);
+
+	/* Loads with the default limit */
+	CHECK(robots_load(f, mod, map, &lrobots) == 0);
+	fclose(f);
+	robot = robots_first(lrobots);
+	CHECK(robot->rstack->nentries == rstack_def_limit + 100);
+
+	/* The limit applies when running */
+	robot_reset(robot);
+	CHECK(robot_run_proc(robot, proc) == 0);
+	while (robot_error(robot) == errt_none)
+		CHECK(robot_step(robot) == 0);
+	CHECK(robot_error(robot) == errt_stack_overflow);
+	CHECK(robot->rstack->nentries == rstack_def_limit);
+
+	/* Error code is saved as is */
+	f = tmpfile();
+	CHECK(f != NULL);
+	CHECK(robots_save(lrobots, f) == 0);
+	rewind(f);
+	robots_destroy(lrobots);
+	CHECK(robots_load(f, mod, map, &lrobots) == 0);
+	fclose(f);
+	CHECK(robot_error(robots_first(lrobots)) == errt_stack_overflow);
+
+	robots_destroy(lrobots);
+	robots_destroy(robots);
+	map_destroy(map);
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Append repeat statement with a single call in its body to procedure.
+ *
+ * @param proc Procedure
+ * @param callee Called procedure
+ * @param repcnt Repeat count
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int test_repeat_call(prog_proc_t *proc, prog_proc_t *callee,
+    unsigned repcnt)
+{
+	prog_stmt_t *srep;
+	prog_stmt_t *scall;
+	int rc;
+
+	rc = prog_stmt_repeat_create(&srep);
+	if (rc != 0)
+		return rc;
+
+	srep->s.srepeat.repcnt = repcnt;
+	rc = prog_block_create(&srep->s.srepeat.body);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_stmt_call_create(callee, &scall);
+	if (rc != 0)
+		goto error;
+
+	rc = prog_block_append(srep->s.srepeat.body, scall);
+	if (rc != 0) {
+		prog_stmt_destroy(scall);
+		goto error;
+	}
+
+	rc = prog_block_append(proc->body, srep);
+	if (rc != 0)
+		goto error;
+
+	return 0;
+error:
+	prog_stmt_destroy(srep);
+	return rc;
+}
+
+/** Run procedure on a new robot and check where it ends up.
+ *
+ * @param mod Program module
+ * @param proc Procedure to run
+ * @param interpret @c true to prevent movement effects from being applied
+ * @param single @c true to execute one statement at a time
+ * @param x Expected final X coordinate
+ * @param nsteps Expected number of statements executed
+ * @return Zero on success, EIO on failure
+ */
+static int test_empty_call_run(prog_module_t *mod, prog_proc_t *proc,
+    bool interpret, bool single, int x, unsigned long nsteps)
+{
+	map_t *map;
+	robots_t *robots;
+	robot_t *robot;
+	unsigned long steps;
+	unsigned long total;
+
+	CHECK(map_create(8, 3, &map) == 0);
+	CHECK(robots_create(mod, map, &robots) == 0);
+	CHECK(robots_add(robots, 1, 1) == 0);
+
+	/* Watching any position disables movement effects */
+	if (interpret)
+		CHECK(robots_watch_pos_set(robots, 7, 0, true) == 0);
+
+	robot = robots_first(robots);
+	robot->dir = dir_east;
+	CHECK(robot_run_proc(robot, proc) == 0);
+
+	total = 0;
+	while (robot_is_busy(robot)) {
+		CHECK(robot_run(robot, single ? 1 : ULONG_MAX, &steps) == 0);
+		CHECK(single ? steps == 1 : robot_is_busy(robot) == false);
+		total += steps;
+	}
+
+	CHECK(robot_error(robot) == errt_none);
+	CHECK(robot->rstack->nentries == 0);
+	CHECK(robot->x == x && robot->y == 1);
+	CHECK(total == nsteps);
+
+	robots_destroy(robots);
+	map_destroy(map);
+	return 0;
+}
+
+/** Test calling an empty procedure.
+ *
+ * Calling an empty procedure must return immediately, no matter if
+ * the call is interpreted or its movement effect is applied.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_empty_call(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *empty;
+	prog_proc_t *pmid;
+	prog_proc_t *ptail;
+	prog_proc_t *ploop;
+	prog_proc_t *pnest;
+	int i;
+
+	CHECK(prog_module_create(&mod) == 0);
+
+	empty = test_proc(mod, "P0000001");
+	CHECK(empty != NULL);
+
+	/* Call in the middle of a procedure */
+	pmid = test_proc(mod, "P0000002");
+	CHECK(pmid != NULL);
+	CHECK(test_intr(pmid, progin_move) == 0);
+	CHECK(test_call(pmid, empty) == 0);
+	CHECK(test_intr(pmid, progin_move) == 0);
+
+	/* Tail call */
+	ptail = test_proc(mod, "P0000003");
+	CHECK(ptail != NULL);
+	CHECK(test_intr(ptail, progin_move) == 0);
+	CHECK(test_call(ptail, empty) == 0);
+
+	/* Call at the end of a loop body */
+	ploop = test_proc(mod, "P0000004");
+	CHECK(ploop != NULL);
+	CHECK(test_repeat_call(ploop, empty, 3) == 0);
+	CHECK(test_intr(ploop, progin_move) == 0);
+
+	/* Empty call returning into the caller's caller */
+	pnest = test_proc(mod, "P0000005");
+	CHECK(pnest != NULL);
+	CHECK(test_call(pnest, ptail) == 0);
+	CHECK(test_intr(pnest, progin_move) == 0);
+
+	prog_proc_changed(empty);
+
+	for (i = 0; i < 4; i++) {
+		CHECK(test_empty_call_run(mod, pmid, i & 1, i & 2, 3, 3) == 0);
+		CHECK(test_empty_call_run(mod, ptail, i & 1, i & 2, 2, 2) == 0);
+		CHECK(test_empty_call_run(mod, ploop, i & 1, i & 2, 2, 4) == 0);
+		CHECK(test_empty_call_run(mod, pnest, i & 1, i & 2, 3, 4) == 0);
+	}
+
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Test converting between statements and their linear indices.
+ *
+ * The indices must follow the body after it is rewritten.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_stmt_index(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *proc;
+	prog_stmt_t *srep;
+	prog_stmt_t *stmt;
+	unsigned index;
+	unsigned i;
+
+	CHECK(prog_module_create(&mod) == 0);
+	proc = test_proc(mod, "P0000001");
+	CHECK(proc != NULL);
+
+	/* turn_left; repeat 2 { move }; move; move; move */
+	CHECK(test_intr(proc, progin_turn_left) == 0);
+	CHECK(prog_stmt_repeat_create(&srep) == 0);
+	srep->s.srepeat.repcnt = 2;
+	CHECK(prog_block_create(&srep->s.srepeat.body) == 0);
+	CHECK(prog_stmt_intrinsic_create(progin_move, &stmt) == 0);
+	CHECK(prog_block_append(srep->s.srepeat.body, stmt) == 0);
+	CHECK(prog_block_append(proc->body, srep) == 0);
+	for (i = 0; i < 3; i++)
+		CHECK(test_intr(proc, progin_move) == 0);
+	prog_proc_changed(proc);
+
+	CHECK(prog_proc_stmt_by_index(proc, 0) == proc->body->stmts[0]);
+	CHECK(prog_proc_stmt_by_index(proc, 1) == srep);
+	CHECK(prog_proc_stmt_by_index(proc, 2) == stmt);
+	CHECK(prog_proc_stmt_by_index(proc, 3) == proc->body->stmts[2]);
+	CHECK(prog_proc_stmt_by_index(proc, 5) == proc->body->stmts[4]);
+	CHECK(prog_proc_stmt_by_index(proc, 6) == NULL);
+
+	for (i = 0; i < 6; i++) {
+		CHECK(prog_proc_get_stmt_index(proc,
+		    prog_proc_stmt_by_index(proc, i), &index) == 0);
+		CHECK(index == i);
+	}
+
+	/*
+	 * The three moves become a loop:
+	 * turn_left; repeat 2 { move }; repeat 3 { move }
+	 */
+	CHECK(progloop_extract(proc, NULL) == 0);
+	CHECK(proc->body->nstmts == 3);
+	CHECK(prog_proc_stmt_by_index(proc, 3) == proc->body->stmts[2]);
+	CHECK(proc->body->stmts[2]->stype == progst_repeat);
+	CHECK(prog_proc_stmt_by_index(proc, 4) ==
+	    proc->body->stmts[2]->s.srepeat.body->stmts[0]);
+	CHECK(prog_proc_stmt_by_index(proc, 5) == NULL);
+
+	for (i = 0; i < 5; i++) {
+		CHECK(prog_proc_get_stmt_index(proc,
+		    prog_proc_stmt_by_index(proc, i), &index) == 0);
+		CHECK(index == i);
+	}
+
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Fill procedure body for loop extraction tests.
+ *
+ * @param proc Procedure
+ * @param body Statements, one letter each: 'm' move, 'l' turn left,
+ *             'w' put white tag, 'r' call @a r, 'q' call @a q
+ * @param r Procedure called by 'r' or @c NULL
+ * @param q Procedure called by 'q' or @c NULL
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int test_loop_body(prog_proc_t *proc, const char *body,
+    prog_proc_t *r, prog_proc_t *q)
+{
+	int rc = 0;
+
+	while (*body != '\0' && rc == 0) {
+		switch (*body++) {
+		case 'm':
+			rc = test_intr(proc, progin_move);
+			break;
+		case 'l':
+			rc = test_intr(proc, progin_turn_left);
+			break;
+		case 'w':
+			rc = test_intr(proc, progin_put_white);
+			break;
+		case 'r':
+			rc = test_call(proc, r);
+			break;
+		default:
+			rc = test_call(proc, q);
+			break;
+		}
+	}
+
+	return rc;
+}
+
+/** Create module for loop extraction tests.
+ *
+ * The module contains procedures R, Q and P (the entry), in this order.
+ *
+ * @param pbody Body of P (see test_loop_body())
+ * @param qbody Body of Q
+ * @param rbody Body of R
+ * @param rmod Place to store pointer to new module
+ * @return Zero on success, EIO on failure
+ */
+static int test_loop_module(const char *pbody, const char *qbody,
+    const char *rbody, prog_module_t **rmod)
+{
+	prog_module_t *mod;
+	prog_proc_t *r, *q, *p;
+
+	CHECK(prog_module_create(&mod) == 0);
+	r = test_proc(mod, "R0000001");
+	CHECK(r != NULL);
+	q = test_proc(mod, "Q0000001");
+	CHECK(q != NULL);
+	p = test_proc(mod, "P0000001");
+	CHECK(p != NULL);
+
+	CHECK(test_loop_body(r, rbody, NULL, NULL) == 0);
+	CHECK(test_loop_body(q, qbody, r, NULL) == 0);
+	CHECK(test_loop_body(p, pbody, r, q) == 0);
+	prog_proc_changed(r);
+	prog_proc_changed(q);
+	prog_proc_changed(p);
+
+	*rmod = mod;
+	return 0;
+}
+
+/** Run procedure with loops extracted in lockstep with the original.
+ *
+ * Both copies are run one statement at a time on a 5x5 map, starting
+ * at (1, 1) facing south. Step counts, position, direction and error
+ * must agree after every step.
+ *
+ * @param pbody Body of P (see test_loop_body())
+ * @param qbody Body of Q
+ * @param rbody Body of R
+ * @param limit Robot stack limit
+ * @param rerror Place to store the error the robot stopped with
+ * @return Zero on success, EIO on failure
+ */
+static int test_loop_lockstep(const char *pbody, const char *qbody,
+    const char *rbody, unsigned limit, robot_error_t *rerror)
+{
+	prog_module_t *mod[2];
+	map_t *map[2];
+	robots_t *robots[2];
+	robot_t *robot[2];
+	unsigned long steps[2];
+	unsigned long total = 0;
+	unsigned nloops;
+	int rcs[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		CHECK(test_loop_module(pbody, qbody, rbody, &mod[i]) == 0);
+		CHECK(map_create(5, 5, &map[i]) == 0);
+		CHECK(robots_create(mod[i], map[i], &robots[i]) == 0);
+		robots_set_stack_limit(robots[i], limit);
+		CHECK(robots_add(robots[i], 1, 1) == 0);
+		robot[i] = robots_first(robots[i]);
+	}
+
+	CHECK(progloop_extract(prog_module_last(mod[1]), &nloops) == 0);
+	CHECK(nloops > 0);
+
+	for (i = 0; i < 2; i++)
+		CHECK(robot_run_proc(robot[i], prog_module_last(mod[i])) == 0);
+
+	while (robot_is_busy(robot[0]) &&
+	    robot_error(robot[0]) == errt_none) {
+		for (i = 0; i < 2; i++)
+			rcs[i] = robot_run(robot[i], 1, &steps[i]);
+
+		CHECK(rcs[0] == 0 && rcs[1] == 0);
+		CHECK(steps[0] == steps[1]);
+		CHECK(robot[0]->x == robot[1]->x);
+		CHECK(robot[0]->y == robot[1]->y);
+		CHECK(robot[0]->dir == robot[1]->dir);
+		CHECK(robot_error(robot[0]) == robot_error(robot[1]));
+		CHECK(robot_is_busy(robot[0]) == robot_is_busy(robot[1]));
+
+		total += steps[0];
+		CHECK(total < 1000);
+	}
+
+	*rerror = robot_error(robot[0]);
+
+	for (i = 0; i < 2; i++) {
+		robots_destroy(robots[i]);
+		map_destroy(map[i]);
+		prog_module_destroy(mod[i]);
+	}
+
+	return 0;
+}
+
+/** Test that extracting loops does not change execution.
+ *
+ * Errors and stack overflows must happen at the same step in the
+ * unrolled and the extracted form.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_loop_exec(void)
+{
+	robot_error_t error;
+	unsigned limit;
+
+	/* Wall hit inside a loop */
+	CHECK(test_loop_lockstep("mmmmmm", "", "", 8, &error) == 0);
+	CHECK(error == errt_hit_wall);
+	CHECK(test_loop_lockstep("qqqq", "mr", "m", 8, &error) == 0);
+	CHECK(error == errt_hit_wall);
+
+	/* Call at the end of a loop body under a small stack limit */
+	for (limit = 1; limit <= 4; limit++) {
+		CHECK(test_loop_lockstep("lqlqlq", "lr", "l", limit,
+		    &error) == 0);
+		CHECK(test_loop_lockstep("lqlqlql", "rl", "l", limit,
+		    &error) == 0);
+		CHECK(test_loop_lockstep("lqlqlq", "rl", "l", limit,
+		    &error) == 0);
+		CHECK(test_loop_lockstep("wlqlqlq", "r", "l", limit,
+		    &error) == 0);
+		CHECK(test_loop_lockstep("lmqlmq", "lr", "l", limit,
+		    &error) == 0);
+	}
+
+	/* The stack limit is hit in both forms */
+	CHECK(test_loop_lockstep("lqlqlq", "rl", "l", 1, &error) == 0);
+	CHECK(error == errt_stack_overflow);
+	CHECK(test_loop_lockstep("lqlqlq", "rl", "l", 2, &error) == 0);
+	CHECK(error == errt_none);
+
+	return 0;
+}
+
+/** Test generating procedure identifiers.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_gen_ident(void)
+{
+	prog_module_t *mod;
+	char *ident;
+	unsigned i;
+
+	CHECK(prog_module_create(&mod) == 0);
+	CHECK(test_proc(mod, "P0000001") != NULL);
+
+	for (i = 0; i < 16; i++) {
+		CHECK(prog_module_gen_ident(mod, &ident) == 0);
+		CHECK(strlen(ident) == prog_proc_id_len);
+		CHECK(prog_module_proc_by_ident(mod, ident) == NULL);
+		CHECK(test_proc(mod, ident) != NULL);
+		free(ident);
+	}
+
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Turn direction counter-clockwise.
+ *
+ * @param dir Direction
+ * @param n Number of quarter turns
+ * @return New direction
+ */
+static dir_t test_dir_ccw(dir_t dir, unsigned n)
+{
+	while (n-- > 0)
+		dir = dir_next_ccw(dir);
+	return dir;
+}
+
+/** Run robots until they stop.
+ *
+ * @param robots Robots
+ * @return Zero on success, EIO on failure
+ */
+static int test_robots_finish(robots_t *robots)
+{
+	bool active;
+	robot_error_t error;
+
+	do {
+		CHECK(robots_tick(robots, &active, &error) == 0);
+		CHECK(error == errt_none);
+	} while (active);
+
+	return 0;
+}
+
+/** Test repeating a run after procedure bodies were changed.
+ *
+ * P calls A (700 left turns), then B (10 left turns). The run is
+ * 712 steps long, with checkpoints every 256 steps.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_rerun_edit(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *p, *a, *b;
+	map_t *map;
+	robots_t *robots;
+	robot_t *robot;
+	rerun_t *rerun;
+	unsigned long steps;
+	dir_t dir0;
+	unsigned i;
+
+	CHECK(prog_module_create(&mod) == 0);
+	a = test_proc(mod, "A0000001");
+	CHECK(a != NULL);
+	for (i = 0; i < 700; i++)
+		CHECK(test_intr(a, progin_turn_left) == 0);
+	b = test_proc(mod, "B0000001");
+	CHECK(b != NULL);
+	for (i = 0; i < 10; i++)
+		CHECK(test_intr(b, progin_turn_left) == 0);
+	p = test_proc(mod, "P0000001");
+	CHECK(p != NULL);
+	CHECK(test_call(p, a) == 0);
+	CHECK(test_call(p, b) == 0);
+
+	CHECK(map_create(4, 4, &map) == 0);
+	CHECK(robots_create(mod, map, &robots) == 0);
+	CHECK(robots_add(robots, 1, 1) == 0);
+	robot = robots_first(robots);
+	dir0 = robot->dir;
+
+	CHECK(rerun_create(robots, &rerun) == 0);
+	robots_set_rerun(robots, rerun);
+
+	CHECK(robot_run_proc(robot, p) == 0);
+	CHECK(rerun_start(rerun) == 0);
+	CHECK(test_robots_finish(robots) == 0);
+	CHECK(rerun->steps == 712);
+	CHECK(robot->dir == test_dir_ccw(dir0, 2));
+
+	/* Nothing changed, repeat from the last checkpoint */
+	CHECK(rerun_resume(rerun, &steps) == 0);
+	CHECK(steps == 512);
+	CHECK(test_robots_finish(robots) == 0);
+	CHECK(robot->dir == test_dir_ccw(dir0, 2));
+
+	/* B was entered at step 702, after the last checkpoint */
+	CHECK(prog_proc_remove_stmt(b, prog_block_last(b->body)) == 0);
+	CHECK(rerun_resume(rerun, &steps) == 0);
+	CHECK(steps == 512);
+	CHECK(test_robots_finish(robots) == 0);
+	CHECK(rerun->steps == 711);
+	CHECK(robot->dir == test_dir_ccw(dir0, 1));
+
+	/* A was entered at step 1, only the start of the run precedes it */
+	CHECK(prog_proc_remove_stmt(a, prog_block_last(a->body)) == 0);
+	CHECK(rerun_resume(rerun, &steps) == 0);
+	CHECK(steps == 0);
+	CHECK(test_robots_finish(robots) == 0);
+	CHECK(rerun->steps == 710);
+	CHECK(robot->dir == dir0);
+
+	/* Procedures cannot be changed while being executed */
+	CHECK(rerun_resume(rerun, &steps) == 0);
+	CHECK(robot_is_busy(robot));
+	CHECK(prog_proc_remove_stmt(p, prog_block_last(p->body)) == EBUSY);
+
+	robots_set_rerun(robots, NULL);
+	rerun_destroy(rerun);
+	robots_destroy(robots);
+	map_destroy(map);
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Test call site tracking and deleting procedures.
+ *
+ * A procedure cannot be deleted while it is called or while a robot
+ * is due to return to it.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_delete_proc(void)
+{
+	prog_module_t *mod;
+	prog_proc_t *a, *p;
+	prog_stmt_t *call1, *call2;
+	prog_stmt_t *caller;
+	map_t *map;
+	robots_t *robots;
+	robot_t *robot;
+
+	CHECK(prog_module_create(&mod) == 0);
+	a = test_proc(mod, "A0000001");
+	CHECK(a != NULL);
+	CHECK(test_intr(a, progin_put_white) == 0);
+	CHECK(test_intr(a, progin_move) == 0);
+	p = test_proc(mod, "P0000001");
+	CHECK(p != NULL);
+	CHECK(test_call(p, a) == 0);
+	CHECK(test_call(p, a) == 0);
+	call1 = p->body->stmts[0];
+	call2 = p->body->stmts[1];
+
+	caller = prog_proc_first_caller(a);
+	CHECK(caller == call1 || caller == call2);
+	CHECK(prog_proc_next_caller(caller) ==
+	    (caller == call1 ? call2 : call1));
+	CHECK(prog_proc_next_caller(prog_proc_next_caller(caller)) == NULL);
+	CHECK(prog_proc_first_caller(p) == NULL);
+
+	CHECK(prog_proc_is_referenced(a));
+	CHECK(!prog_proc_is_referenced(p));
+	CHECK(prog_module_delete_proc(a) == EBUSY);
+
+	/* P is on the robot's stack while the robot carries out A */
+	CHECK(map_create(3, 4, &map) == 0);
+	CHECK(robots_create(mod, map, &robots) == 0);
+	CHECK(robots_add(robots, 1, 0) == 0);
+	robot = robots_first(robots);
+	CHECK(robot_run_proc(robot, p) == 0);
+	CHECK(robot_step(robot) == 0);
+	CHECK(robot_cur_proc(robot) == a);
+	CHECK(prog_proc_is_referenced(p));
+	CHECK(prog_module_delete_proc(p) == EBUSY);
+
+	CHECK(test_robots_finish(robots) == 0);
+	CHECK(!prog_proc_is_referenced(p));
+	CHECK(prog_module_delete_proc(a) == EBUSY);
+
+	/* A is deleted once the last call is gone */
+	CHECK(prog_proc_remove_stmt(p, call1) == 0);
+	CHECK(prog_proc_first_caller(a) == call2);
+	CHECK(prog_proc_next_caller(call2) == NULL);
+	CHECK(prog_module_delete_proc(a) == EBUSY);
+	CHECK(prog_proc_remove_stmt(p, call2) == 0);
+	CHECK(prog_proc_first_caller(a) == NULL);
+	CHECK(prog_module_delete_proc(a) == 0);
+	CHECK(prog_module_proc_by_ident(mod, "A0000001") == NULL);
+	CHECK(prog_module_delete_proc(p) == 0);
+	CHECK(prog_module_first(mod) == NULL);
+
+	robots_destroy(robots);
+	map_destroy(map);
+	prog_module_destroy(mod);
+	return 0;
+}
+
+/** Test undo step larger than the undo log.
+ *
+ * A step that does not fit is dropped as a whole, undo must never
+ * revert just a part of it.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_undo_cap(void)
+{
+	map_t *map;
+	undolog_t *ulog;
+	int x;
+
+	CHECK(map_create(8, 2, &map) == 0);
+	CHECK(undolog_create(map, NULL, &ulog) == 0);
+	undolog_set_max_recs(ulog, 4);
+
+	undolog_begin(ulog, 0);
+	CHECK(undolog_map_set(ulog, 0, 1, mapt_wtag) == 0);
+
+	/* Six records do not fit */
+	undolog_begin(ulog, 0);
+	for (x = 0; x < 6; x++)
+		CHECK(undolog_map_set(ulog, x, 0, mapt_wall) == 0);
+	for (x = 0; x < 6; x++)
+		CHECK(map_get(map, x, 0) == mapt_wall);
+	CHECK(!undolog_can_undo(ulog));
+
+	/* The next step is recorded again */
+	undolog_begin(ulog, 0);
+	CHECK(undolog_map_set(ulog, 7, 0, mapt_btag) == 0);
+	CHECK(undolog_undo(ulog) == 0);
+	CHECK(map_get(map, 7, 0) == mapt_none);
+	CHECK(map_get(map, 5, 0) == mapt_wall);
+	CHECK(map_get(map, 0, 1) == mapt_wtag);
+	CHECK(!undolog_can_undo(ulog));
+
+	undolog_destroy(ulog);
+	map_destroy(map);
+	return 0;
+}
+
+/** Test level solver.
+ *
+ * A wall separates the robot from the tags it has to change. The solution
+ * found with one and with several worker threads must be equally long
+ * and must turn the start map into the goal map when run.
+ *
+ * @return Zero on success, EIO on failure
+ */
+static int test_solver(void)
+{
+	static const unsigned nthreads[] = { 1, 4 };
+	prog_module_t *mod;
+	prog_proc_t *proc;
+	solver_t *solver;
+	map_t *map;
+	map_t *goal;
+	map_t *rmap;
+	robots_t *robots;
+	robot_t *robot;
+	unsigned nstmts = 0;
+	unsigned i;
+	int y;
+
+	CHECK(map_create(6, 5, &map) == 0);
+	for (y = 1; y < 4; y++)
+		map_set(map, 2, y, mapt_wall);
+	map_set(map, 4, 1, mapt_btag);
+	map_set(map, 4, 3, mapt_wtag);
+	CHECK(map_clone(map, &goal) == 0);
+	map_set(goal, 4, 1, mapt_wtag);
+	map_set(goal, 4, 3, mapt_none);
+	map_set(goal, 0, 3, mapt_gtag);
+
+	CHECK(prog_module_create(&mod) == 0);
+
+	for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+		CHECK(solver_create(map, goal, &solver) == 0);
+		solver_set_threads(solver, nthreads[i]);
+		CHECK(solver_solve(solver, 1, 1, dir_east, i == 0 ?
+		    "S0000001" : "S0000002", &proc) == 0);
+		solver_destroy(solver);
+		CHECK(prog_module_append(mod, proc) == 0);
+
+		/* Shortest solution regardless of the number of threads */
+		if (i == 0)
+			nstmts = proc->body->nstmts;
+		CHECK(proc->body->nstmts == nstmts);
+
+		CHECK(map_clone(map, &rmap) == 0);
+		CHECK(robots_create(mod, rmap, &robots) == 0);
+		CHECK(robots_add(robots, 1, 1) == 0);
+		robot = robots_first(robots);
+		robot->dir = dir_east;
+		CHECK(robot_run_proc(robot, proc) == 0);
+		CHECK(test_robots_finish(robots) == 0);
+		CHECK(map_equal(rmap, goal));
+		robots_destroy(robots);
+		map_destroy(rmap);
+	}
+
+	/* No solution within fewer steps */
+	CHECK(solver_create(map, goal, &solver) == 0);
+	solver_set_max_steps(solver, nstmts - 1);
+	CHECK(solver_solve(solver, 1, 1, dir_east, "S0000003", &proc) ==
+	    ENOENT);
+
+	/* Walls cannot be changed */
+	map_set(goal, 5, 0, mapt_wall);
+	solver_set_max_steps(solver, solver_def_max_steps);
+	CHECK(solver_solve(solver, 1, 1, dir_east, "S0000003", &proc) ==
+	    ENOENT);
+	solver_destroy(solver);
+
+	prog_module_destroy(mod);
+	map_destroy(goal);
+	map_destroy(map);
+	return 0;
+}
+
+int main(void)
+{
+	int nfail = 0;
+
+	if (test_stack_load() != 0)
+		++nfail;
+	if (test_empty_call() != 0)
+		++nfail;
+	if (test_stmt_index() != 0)
+		++nfail;
+	if (test_loop_exec() != 0)
+		++nfail;
+	if (test_gen_ident() != 0)
+		++nfail;
+	if (test_rerun_edit() != 0)
+		++nfail;
+	if (test_delete_proc() != 0)
+		++nfail;
+	if (test_undo_cap() != 0)
+		++nfail;
+	if (test_solver() != 0)
+		++nfail;
+
+	if (nfail != 0) {
+		printf("progtest: %d test(s) failed.\n", nfail);
+		return 1;
+	}
+
+	printf("progtest: All tests passed.\n");
+	return 0;
+}
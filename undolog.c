@@ -0,0 +1,605 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Undo log
+ *
+ * Records changes made by the user while editing the map or teaching
+ * the robot a new procedure, so that they can be undone and redone.
+ * Each record only holds the change itself (a run of tiles with their
+ * old and new contents, a robot added or removed, a statement appended),
+ * which makes undo and redo cost proportional to the size of the change.
+ *
+ * Records are grouped into undo steps. An undo step is started with
+ * undolog_begin(). Successive steps with the same non-zero key (such as
+ * painting the same tile type while dragging the mouse) are coalesced
+ * into one step until undolog_seal() is called. The log holds at most
+ * a fixed number of records, the oldest steps are dropped as needed.
+ *
+ * Changes are undone and redone against the current state of the world.
+ * If robots have changed it in the meantime, tiles are simply set back
+ * to their recorded contents.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+#include "robot.h"
+#include "robots.h"
+#include "undolog.h"
+
+enum {
+	/** Initial number of allocated records */
+	undolog_min_alloc = 64
+};
+
+/** Create undo log.
+ *
+ * @param map Map or @c NULL if only statement changes are recorded
+ * @param robots Robots or @c NULL if only statement changes are recorded
+ * @param rulog Place to store pointer to new undo log
+ * @return Zero on success, ENOMEM if out of memory
+ */
+int undolog_create(map_t *map, robots_t *robots, undolog_t **rulog)
+{
+	undolog_t *ulog;
+
+	ulog = calloc(1, sizeof(undolog_t));
+	if (ulog == NULL)
+		return ENOMEM;
+
+	ulog->map = map;
+	ulog->robots = robots;
+	ulog->max_recs = undolog_def_max_recs;
+	ulog->new_step = true;
+	*rulog = ulog;
+	return 0;
+}
+
+/** Destroy undo log.
+ *
+ * @param ulog Undo log
+ */
+void undolog_destroy(undolog_t *ulog)
+{
+	if (ulog == NULL)
+		return;
+
+	undolog_clear(ulog);
+	free(ulog->recs);
+	free(ulog);
+}
+
+/** Get undo log record.
+ *
+ * @param ulog Undo log
+ * @param i Index of record, counting from the oldest
+ * @return Record
+ */
+static undolog_rec_t *undolog_rec(undolog_t *ulog, unsigned i)
+{
+	return &ulog->recs[(ulog->head + i) % ulog->alloc];
+}
+
+/** Discard records that have been undone.
+ *
+ * Statements appended in those records are no longer part of any
+ * block and are destroyed.
+ *
+ * @param ulog Undo log
+ */
+static void undolog_truncate(undolog_t *ulog)
+{
+	undolog_rec_t *rec;
+	unsigned i;
+
+	for (i = ulog->ndone; i < ulog->nrecs; i++) {
+		rec = undolog_rec(ulog, i);
+		if (rec->rtype == ulr_stmt_append)
+			prog_stmt_destroy(rec->r.stmt.stmt);
+	}
+
+	ulog->nrecs = ulog->ndone;
+}
+
+/** Drop the oldest undo step.
+ *
+ * @param ulog Undo log
+ */
+static void undolog_drop_oldest(undolog_t *ulog)
+{
+	do {
+		ulog->head = (ulog->head + 1) % ulog->alloc;
+		--ulog->nrecs;
+		--ulog->ndone;
+	} while (ulog->nrecs > 0 && !undolog_rec(ulog, 0)->first);
+}
+
+/** Remove all records from undo log.
+ *
+ * @param ulog Undo log
+ */
+void undolog_clear(undolog_t *ulog)
+{
+	undolog_truncate(ulog);
+	ulog->head = 0;
+	ulog->nrecs = 0;
+	ulog->ndone = 0;
+	ulog->new_step = true;
+	ulog->discard = false;
+	ulog->key = 0;
+}
+
+/** Switch undo log to a different map and robots.
+ *
+ * The log is cleared.
+ *
+ * @param ulog Undo log
+ * @param map Map
+ * @param robots Robots
+ */
+void undolog_set_world(undolog_t *ulog, map_t *map, robots_t *robots)
+{
+	undolog_clear(ulog);
+	ulog->map = map;
+	ulog->robots = robots;
+}
+
+/** Set maximum number of records kept in undo log.
+ *
+ * @param ulog Undo log
+ * @param max_recs Maximum number of records (at least one)
+ */
+void undolog_set_max_recs(undolog_t *ulog, unsigned max_recs)
+{
+	undolog_truncate(ulog);
+	if (ulog->nrecs > max_recs) {
+		while (ulog->nrecs > max_recs)
+			undolog_drop_oldest(ulog);
+
+		/* Do not keep recording the rest of a dropped step */
+		if (ulog->nrecs == 0 && !ulog->new_step)
+			ulog->discard = true;
+	}
+
+	ulog->max_recs = max_recs;
+}
+
+/** Begin undo step.
+ *
+ * Any steps that have been undone are discarded. If @a key is non-zero
+ * and equal to the key of the previous step, and that step has not been
+ * sealed or undone, the changes are added to the previous step.
+ *
+ * @param ulog Undo log
+ * @param key Coalescing key or zero
+ */
+void undolog_begin(undolog_t *ulog, unsigned key)
+{
+	undolog_truncate(ulog);
+	if (key == 0 || key != ulog->key)
+		ulog->new_step = true;
+	ulog->key = key;
+}
+
+/** Seal the current undo step.
+ *
+ * The next step will not be coalesced with the current one.
+ *
+ * @param ulog Undo log
+ */
+void undolog_seal(undolog_t *ulog)
+{
+	ulog->key = 0;
+}
+
+/** Add record to undo log.
+ *
+ * Oldest steps are dropped to keep the number of records within
+ * @c max_recs. If the current step alone exceeds the limit, it is dropped
+ * as a whole and its remaining changes are not recorded, so that undo
+ * never reverts just a part of a step.
+ *
+ * @param ulog Undo log
+ * @param rec Record (the @c first field is filled in)
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int undolog_add(undolog_t *ulog, undolog_rec_t *rec)
+{
+	undolog_rec_t *nrecs;
+	unsigned nalloc;
+	unsigned i;
+
+	undolog_truncate(ulog);
+
+	if (ulog->new_step)
+		ulog->discard = false;
+	if (ulog->discard)
+		return 0;
+
+	if (ulog->nrecs >= ulog->max_recs) {
+		undolog_drop_oldest(ulog);
+		if (ulog->nrecs == 0 && !ulog->new_step) {
+			/* Dropped the beginning of the current step */
+			ulog->head = 0;
+			ulog->discard = true;
+			return 0;
+		}
+	}
+
+	if (ulog->nrecs >= ulog->alloc) {
+		nalloc = ulog->alloc > 0 ? 2 * ulog->alloc : undolog_min_alloc;
+		if (nalloc > ulog->max_recs)
+			nalloc = ulog->max_recs;
+
+		nrecs = calloc(nalloc, sizeof(undolog_rec_t));
+		if (nrecs == NULL)
+			return ENOMEM;
+
+		for (i = 0; i < ulog->nrecs; i++)
+			nrecs[i] = *undolog_rec(ulog, i);
+
+		free(ulog->recs);
+		ulog->recs = nrecs;
+		ulog->alloc = nalloc;
+		ulog->head = 0;
+	}
+
+	rec->first = ulog->new_step || ulog->nrecs == 0;
+	*undolog_rec(ulog, ulog->nrecs) = *rec;
+	++ulog->nrecs;
+	ulog->ndone = ulog->nrecs;
+	ulog->new_step = false;
+	return 0;
+}
+
+/** Set map tile and record the change.
+ *
+ * @param ulog Undo log
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param ttype New tile type
+ * @return Zero on success, ENOMEM if out of memory (the tile is not
+ *         changed)
+ */
+int undolog_map_set(undolog_t *ulog, int x, int y, map_tile_t ttype)
+{
+	undolog_rec_t rec;
+	map_tile_t oldt;
+	int rc;
+
+	oldt = map_get(ulog->map, x, y);
+	if (oldt == ttype)
+		return 0;
+
+	rec.rtype = ulr_map_set;
+	rec.r.tile.idx = (uint32_t) y * ulog->map->width + x;
+	rec.r.tile.len = 1;
+	rec.r.tile.oldt = (uint8_t) oldt;
+	rec.r.tile.newt = (uint8_t) ttype;
+
+	rc = undolog_add(ulog, &rec);
+	if (rc != 0)
+		return rc;
+
+	map_set(ulog->map, x, y, ttype);
+	return 0;
+}
+
+/** Set a run of map tiles in one column and record the change.
+ *
+ * One record is added for each run of tiles with the same old contents.
+ *
+ * @param ulog Undo log
+ * @param x X coordinate
+ * @param y0 Y coordinate of first tile
+ * @param y1 Y coordinate of last tile (at least @a y0)
+ * @param ttype New tile type
+ * @return Zero on success, ENOMEM if out of memory (tiles following
+ *         the last recorded run are not changed)
+ */
+int undolog_map_set_col(undolog_t *ulog, int x, int y0, int y1,
+    map_tile_t ttype)
+{
+	undolog_rec_t rec;
+	map_tile_t oldt;
+	int y, ye;
+	int rc;
+
+	y = y0;
+	while (y <= y1) {
+		oldt = map_get(ulog->map, x, y);
+		ye = y;
+		while (ye < y1 && map_get(ulog->map, x, ye + 1) == oldt)
+			++ye;
+
+		if (oldt != ttype) {
+			rec.rtype = ulr_map_set;
+			rec.r.tile.idx = (uint32_t) y * ulog->map->width + x;
+			rec.r.tile.len = ye - y + 1;
+			rec.r.tile.oldt = (uint8_t) oldt;
+			rec.r.tile.newt = (uint8_t) ttype;
+
+			rc = undolog_add(ulog, &rec);
+			if (rc != 0)
+				return rc;
+
+			map_set_col(ulog->map, x, y, ye, ttype);
+		}
+
+		y = ye + 1;
+	}
+
+	return 0;
+}
+
+/** Add robot with the specified direction.
+ *
+ * If another robot has moved to the tile in the meantime, it is left
+ * there.
+ *
+ * @param ulog Undo log
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @param dir Direction
+ * @return Zero on success, ENOMEM if out of memory
+ */
+static int undolog_robots_add(undolog_t *ulog, int x, int y, dir_t dir)
+{
+	robot_t *robot;
+	int rc;
+
+	rc = robots_add(ulog->robots, x, y);
+	if (rc == EEXIST)
+		return 0;
+	if (rc != 0)
+		return rc;
+
+	robot = robots_get(ulog->robots, x, y);
+	while (robot->dir != dir)
+		robot_turn_left(robot);
+
+	return 0;
+}
+
+/** Add robot and record the change.
+ *
+ * @param ulog Undo log
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @return Zero on success or an error code (as robots_add())
+ */
+int undolog_robot_add(undolog_t *ulog, int x, int y)
+{
+	undolog_rec_t rec;
+	int rc;
+
+	rc = robots_add(ulog->robots, x, y);
+	if (rc != 0)
+		return rc;
+
+	rec.rtype = ulr_robot_add;
+	rec.r.robot.x = x;
+	rec.r.robot.y = y;
+	rec.r.robot.dir = robots_get(ulog->robots, x, y)->dir;
+
+	rc = undolog_add(ulog, &rec);
+	if (rc != 0) {
+		robots_remove(ulog->robots, x, y);
+		return rc;
+	}
+
+	return 0;
+}
+
+/** Remove robot and record the change.
+ *
+ * If no robot is present at the specified coordinates, no action
+ * is performed.
+ *
+ * @param ulog Undo log
+ * @param x X coordinate
+ * @param y Y coordinate
+ * @return Zero on success, ENOMEM if out of memory (the robot is not
+ *         removed)
+ */
+int undolog_robot_remove(undolog_t *ulog, int x, int y)
+{
+	undolog_rec_t rec;
+	robot_t *robot;
+	int rc;
+
+	robot = robots_get(ulog->robots, x, y);
+	if (robot == NULL)
+		return 0;
+
+	rec.rtype = ulr_robot_remove;
+	rec.r.robot.x = x;
+	rec.r.robot.y = y;
+	rec.r.robot.dir = robot->dir;
+
+	rc = undolog_add(ulog, &rec);
+	if (rc != 0)
+		return rc;
+
+	robots_remove(ulog->robots, x, y);
+	return 0;
+}
+
+/** Append statement to block and record the change.
+ *
+ * While the change is undone, the statement is owned by the undo log.
+ *
+ * @param ulog Undo log
+ * @param block Block
+ * @param stmt Statement
+ * @return Zero on success, ENOMEM if out of memory (the statement is
+ *         not appended)
+ */
+int undolog_stmt_append(undolog_t *ulog, prog_block_t *block,
+    prog_stmt_t *stmt)
+{
+	undolog_rec_t rec;
+	int rc;
+
+	rc = prog_block_append(block, stmt);
+	if (rc != 0)
+		return rc;
+
+	rec.rtype = ulr_stmt_append;
+	rec.r.stmt.block = block;
+	rec.r.stmt.stmt = stmt;
+
+	rc = undolog_add(ulog, &rec);
+	if (rc != 0) {
+		prog_block_remove(stmt);
+		return rc;
+	}
+
+	return 0;
+}
+
+/** Apply record in either direction.
+ *
+ * @param ulog Undo log
+ * @param rec Record
+ * @param undo @c true to undo the change, @c false to redo it
+ * @return Zero on success or an error code
+ */
+static int undolog_rec_apply(undolog_t *ulog, undolog_rec_t *rec, bool undo)
+{
+	int x, y;
+
+	switch (rec->rtype) {
+	case ulr_map_set:
+		x = rec->r.tile.idx % ulog->map->width;
+		y = rec->r.tile.idx / ulog->map->width;
+		map_set_col(ulog->map, x, y, y + rec->r.tile.len - 1,
+		    (map_tile_t) (undo ? rec->r.tile.oldt : rec->r.tile.newt));
+		break;
+	case ulr_robot_add:
+		if (undo) {
+			robots_remove(ulog->robots, rec->r.robot.x,
+			    rec->r.robot.y);
+		} else {
+			return undolog_robots_add(ulog, rec->r.robot.x,
+			    rec->r.robot.y, rec->r.robot.dir);
+		}
+		break;
+	case ulr_robot_remove:
+		if (undo) {
+			return undolog_robots_add(ulog, rec->r.robot.x,
+			    rec->r.robot.y, rec->r.robot.dir);
+		} else {
+			robots_remove(ulog->robots, rec->r.robot.x,
+			    rec->r.robot.y);
+		}
+		break;
+	case ulr_stmt_append:
+		if (undo)
+			prog_block_remove(rec->r.stmt.stmt);
+		else
+			return prog_block_append(rec->r.stmt.block,
+			    rec->r.stmt.stmt);
+		break;
+	}
+
+	return 0;
+}
+
+/** Determine if there is an undo step that can be undone.
+ *
+ * @param ulog Undo log
+ * @return @c true iff undolog_undo() would undo something
+ */
+bool undolog_can_undo(undolog_t *ulog)
+{
+	return ulog->ndone > 0;
+}
+
+/** Determine if there is an undo step that can be redone.
+ *
+ * @param ulog Undo log
+ * @return @c true iff undolog_redo() would redo something
+ */
+bool undolog_can_redo(undolog_t *ulog)
+{
+	return ulog->ndone < ulog->nrecs;
+}
+
+/** Undo the last undo step.
+ *
+ * @param ulog Undo log
+ * @return Zero on success, ENOENT if there is nothing to undo or
+ *         an error code
+ */
+int undolog_undo(undolog_t *ulog)
+{
+	undolog_rec_t *rec;
+	int rc;
+
+	if (ulog->ndone == 0)
+		return ENOENT;
+
+	ulog->key = 0;
+
+	do {
+		rec = undolog_rec(ulog, ulog->ndone - 1);
+		rc = undolog_rec_apply(ulog, rec, true);
+		if (rc != 0)
+			return rc;
+		--ulog->ndone;
+	} while (!rec->first && ulog->ndone > 0);
+
+	return 0;
+}
+
+/** Redo the last undo step that has been undone.
+ *
+ * @param ulog Undo log
+ * @return Zero on success, ENOENT if there is nothing to redo or
+ *         an error code
+ */
+int undolog_redo(undolog_t *ulog)
+{
+	int rc;
+
+	if (ulog->ndone >= ulog->nrecs)
+		return ENOENT;
+
+	ulog->key = 0;
+
+	do {
+		rc = undolog_rec_apply(ulog, undolog_rec(ulog, ulog->ndone),
+		    false);
+		if (rc != 0)
+			return rc;
+		++ulog->ndone;
+	} while (ulog->ndone < ulog->nrecs &&
+	    !undolog_rec(ulog, ulog->ndone)->first);
+
+	return 0;
+}
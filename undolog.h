@@ -0,0 +1,143 @@
+/*
+ * Copyright 2022 Jiri Svoboda
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Undo log
+ */
+
+#ifndef UNDOLOG_H
+#define UNDOLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "dir.h"
+#include "map.h"
+#include "prog.h"
+#include "robots.h"
+
+enum {
+	/** Default maximum number of records kept in undo log */
+	undolog_def_max_recs = 16384
+};
+
+/** Undo log record type */
+typedef enum {
+	/** Map tiles changed (a run of tiles in one column) */
+	ulr_map_set,
+	/** Robot added */
+	ulr_robot_add,
+	/** Robot removed */
+	ulr_robot_remove,
+	/** Statement appended to block */
+	ulr_stmt_append
+} undolog_rtype_t;
+
+/** Undo log record.
+ *
+ * Each record describes one change in a form that allows applying it
+ * in either direction.
+ */
+typedef struct {
+	/** Record type */
+	undolog_rtype_t rtype;
+	/** @c true iff record is the first record of an undo step */
+	bool first;
+	union {
+		/** Map tile change */
+		struct {
+			/** Index of first tile (y * width + x) */
+			uint32_t idx;
+			/** Number of tiles, downwards from the first */
+			uint32_t len;
+			/** Old tile */
+			uint8_t oldt;
+			/** New tile */
+			uint8_t newt;
+		} tile;
+		/** Robot added or removed */
+		struct {
+			/** X coordinate */
+			int x;
+			/** Y coordinate */
+			int y;
+			/** Direction */
+			dir_t dir;
+		} robot;
+		/** Statement appended */
+		struct {
+			/** Block */
+			prog_block_t *block;
+			/** Statement */
+			prog_stmt_t *stmt;
+		} stmt;
+	} r;
+} undolog_rec_t;
+
+/** Undo log.
+ *
+ * Records are kept in a circular buffer, oldest first. Records before
+ * @c ndone have been applied, the rest have been undone and can be
+ * redone.
+ */
+typedef struct {
+	/** Map */
+	map_t *map;
+	/** Robots */
+	robots_t *robots;
+	/** Records */
+	undolog_rec_t *recs;
+	/** Number of allocated records */
+	unsigned alloc;
+	/** Index of oldest record */
+	unsigned head;
+	/** Number of records */
+	unsigned nrecs;
+	/** Number of applied records */
+	unsigned ndone;
+	/** Maximum number of records */
+	unsigned max_recs;
+	/** Next record starts a new undo step */
+	bool new_step;
+	/** Current undo step exceeded @c max_recs and is not recorded */
+	bool discard;
+	/** Coalescing key of the last undo step or zero */
+	unsigned key;
+} undolog_t;
+
+extern int undolog_create(map_t *, robots_t *, undolog_t **);
+extern void undolog_destroy(undolog_t *);
+extern void undolog_clear(undolog_t *);
+extern void undolog_set_world(undolog_t *, map_t *, robots_t *);
+extern void undolog_set_max_recs(undolog_t *, unsigned);
+extern void undolog_begin(undolog_t *, unsigned);
+extern void undolog_seal(undolog_t *);
+extern int undolog_map_set(undolog_t *, int, int, map_tile_t);
+extern int undolog_map_set_col(undolog_t *, int, int, int, map_tile_t);
+extern int undolog_robot_add(undolog_t *, int, int);
+extern int undolog_robot_remove(undolog_t *, int, int);
+extern int undolog_stmt_append(undolog_t *, prog_block_t *, prog_stmt_t *);
+extern bool undolog_can_undo(undolog_t *);
+extern bool undolog_can_redo(undolog_t *);
+extern int undolog_undo(undolog_t *);
+extern int undolog_redo(undolog_t *);
+
+#endif
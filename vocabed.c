@@ -33,6 +33,8 @@
 #include "icondict.h"
 #include "icondlg.h"
 #include "mapview.h"
+#include "proghash.h"
+#include "progloop.h"
 #include "progview.h"
 #include "robots.h"
 #include "vocabed.h"
@@ -90,7 +92,9 @@ static const vocabed_verb_type_t intrinsic_verbs[] = {
 static const char *vocabed_error_img_files[] = {
 	"img/error/hitwall.bmp",
 	"img/error/alreadytag.bmp",
-	"img/error/notag.bmp"
+	"img/error/notag.bmp",
+	"img/error/stackovf.bmp",
+	NULL
 };
 
 static int vocabed_add_statement_verbs(vocabed_t *);
@@ -106,27 +110,33 @@ static void vocabed_toolbar_cb(void *, int);
 static void vocabed_errordlg_cb(void *);
 static void vocabed_icondlg_accept(void *);
 static void vocabed_icondlg_repaint(void *);
+static void vocabed_progview_stmt_clicked(void *, prog_stmt_t *);
 
 static void vocabed_work_verb_selected(void *, void *);
 static void vocabed_learn_verb_selected(void *, void *);
 static void vocabed_examine_verb_selected(void *, void *);
 static void vocabed_verb_destroy(void *, void *);
+static gfx_bmp_t *vocabed_verb_icon(void *, void *);
 
 static void vocabed_robots_step(void *);
+static void vocabed_start_robots(vocabed_t *);
 
 static wordlist_cb_t vocabed_work_verbs_cb = {
 	.selected = vocabed_work_verb_selected,
-	.destroy = vocabed_verb_destroy
+	.destroy = vocabed_verb_destroy,
+	.get_icon = vocabed_verb_icon
 };
 
 static wordlist_cb_t vocabed_learn_verbs_cb = {
 	.selected = vocabed_learn_verb_selected,
-	.destroy = vocabed_verb_destroy
+	.destroy = vocabed_verb_destroy,
+	.get_icon = vocabed_verb_icon
 };
 
 static wordlist_cb_t vocabed_examine_verbs_cb = {
 	.selected = vocabed_examine_verb_selected,
-	.destroy = vocabed_verb_destroy
+	.destroy = vocabed_verb_destroy,
+	.get_icon = vocabed_verb_icon
 };
 
 static icondlg_cb_t vocabed_icondlg_cb = {
@@ -134,6 +144,10 @@ static icondlg_cb_t vocabed_icondlg_cb = {
 	.repaint = vocabed_icondlg_repaint
 };
 
+static progview_cb_t vocabed_progview_cb = {
+	.stmt_clicked = vocabed_progview_stmt_clicked
+};
+
 /** Display vocabulary editor.
  *
  * @param vocabed Vocabulary editor
@@ -210,7 +224,6 @@ static int vocabed_add_predefined_verb(vocabed_t *vocabed,
 static int vocabed_add_call_verb(vocabed_t *vocabed, prog_proc_t *proc)
 {
 	vocabed_verb_t *verb;
-	icondict_entry_t *entry;
 
 	verb = calloc(1, sizeof(vocabed_verb_t));
 	if (verb == NULL)
@@ -219,11 +232,8 @@ static int vocabed_add_call_verb(vocabed_t *vocabed, prog_proc_t *proc)
 	verb->vtype = verb_call;
 	verb->v.vcall.proc = proc;
 
-	/* Find corresponding icon */
-	entry = icondict_find(vocabed->icondict, proc->ident);
-	assert (entry != NULL);
-
-	return wordlist_add(vocabed->verbs, entry->icon->bmp, verb);
+	/* Icon is looked up when needed (vocabed_verb_icon) */
+	return wordlist_add(vocabed->verbs, NULL, verb);
 }
 
 /** Add statement verbs to the verb list.
@@ -294,6 +304,7 @@ static int vocabed_create(map_t *map, robots_t *robots, prog_module_t *prog,
 		return ENOMEM;
 
 	vocabed->icondict = icondict;
+	vocabed->extract_loops = true;
 
 	rc = gfx_timer_create(prog_step_interval, vocabed_robots_step,
 	    vocabed, &vocabed->robot_timer);
@@ -316,6 +327,7 @@ static int vocabed_create(map_t *map, robots_t *robots, prog_module_t *prog,
 		goto error;
 
 	progview_set_orig(vocabed->progview, 170, 36);
+	progview_set_cb(vocabed->progview, &vocabed_progview_cb, vocabed);
 	vocabed->progview->icon_w = 16;
 	vocabed->progview->icon_h = 16;
 	vocabed->progview->margin_x = 2;
@@ -362,6 +374,16 @@ static int vocabed_create(map_t *map, robots_t *robots, prog_module_t *prog,
 	vocabed->robots = robots;
 	vocabed->prog = prog;
 
+	rc = rerun_create(robots, &vocabed->rerun);
+	if (rc != 0)
+		goto error;
+
+	robots_set_rerun(robots, vocabed->rerun);
+
+	rc = undolog_create(NULL, NULL, &vocabed->learn_log);
+	if (rc != 0)
+		goto error;
+
 	*rvocabed = vocabed;
 	return 0;
 error:
@@ -482,7 +504,8 @@ int vocabed_load(map_t *map, robots_t *robots, prog_module_t *prog, FILE *f,
 		if (rc != 0)
 			goto error;
 
-		printf("Statements: %lu\n", list_count(&vocabed->learn_proc->body->stmts));
+		printf("Statements: %u\n",
+		    prog_block_count(vocabed->learn_proc->body));
 		progview_set_proc(vocabed->progview, vocabed->learn_proc);
 	}
 
@@ -592,6 +615,64 @@ int vocabed_save(vocabed_t *vocabed, FILE *f)
 	return 0;
 }
 
+/** Repeat the last run.
+ *
+ * Only the part of the run that could be affected by changes made to
+ * the program since is executed again.
+ *
+ * @param vocabed Vocabulary editor
+ */
+static void vocabed_rerun(vocabed_t *vocabed)
+{
+	unsigned long steps;
+	int rc;
+
+	if (vocabed->rerun == NULL || !rerun_recorded(vocabed->rerun)) {
+		printf("No run to repeat.\n");
+		return;
+	}
+
+	gfx_timer_stop(vocabed->robot_timer);
+
+	rc = rerun_resume(vocabed->rerun, &steps);
+	if (rc != 0) {
+		printf("Cannot repeat run.\n");
+		return;
+	}
+
+	printf("Repeating run from step %lu.\n", steps);
+	vocabed_start_robots(vocabed);
+	vocabed_repaint_req(vocabed);
+}
+
+/** Take back the last statement of the examined procedure.
+ *
+ * The procedure must not be executing. Repeating the last run afterwards
+ * only repeats the part of it that could be affected.
+ *
+ * @param vocabed Vocabulary editor
+ */
+static void vocabed_examine_take_back(vocabed_t *vocabed)
+{
+	prog_proc_t *proc;
+	prog_stmt_t *stmt;
+
+	proc = progview_get_proc(vocabed->progview);
+	if (proc == NULL || proc->body == NULL)
+		return;
+
+	stmt = prog_block_last(proc->body);
+	if (stmt == NULL)
+		return;
+
+	if (prog_proc_remove_stmt(proc, stmt) != 0) {
+		printf("Procedure is being executed.\n");
+		return;
+	}
+
+	vocabed_repaint_req(vocabed);
+}
+
 /** Handle key press in vocabulary editor.
  *
  * @param vocabed Vocabulary editor
@@ -599,9 +680,34 @@ int vocabed_save(vocabed_t *vocabed, FILE *f)
  */
 static void vocabed_key_press(vocabed_t *vocabed, SDL_Scancode scancode)
 {
-	(void) vocabed;
-
 	switch (scancode) {
+	case SDL_SCANCODE_SPACE:
+		/* Resume robots stopped at a breakpoint */
+		vocabed_start_robots(vocabed);
+		break;
+	case SDL_SCANCODE_R:
+		vocabed_rerun(vocabed);
+		break;
+	case SDL_SCANCODE_L:
+		vocabed->extract_loops = !vocabed->extract_loops;
+		printf("Loop extraction %s.\n", vocabed->extract_loops ?
+		    "on" : "off");
+		break;
+	case SDL_SCANCODE_Z:
+		/* Take back the last statement learned */
+		if (vocabed->state == vst_learn &&
+		    undolog_undo(vocabed->learn_log) == 0)
+			vocabed_repaint_req(vocabed);
+		break;
+	case SDL_SCANCODE_Y:
+		if (vocabed->state == vst_learn &&
+		    undolog_redo(vocabed->learn_log) == 0)
+			vocabed_repaint_req(vocabed);
+		break;
+	case SDL_SCANCODE_BACKSPACE:
+		if (vocabed->state == vst_examine)
+			vocabed_examine_take_back(vocabed);
+		break;
 	default:
 		break;
 	}
@@ -638,6 +744,8 @@ bool vocabed_event(vocabed_t *vocabed, SDL_Event *e, gfx_t *gfx)
 		return true;
 	if (wordlist_event(vocabed->verbs, e))
 		return true;
+	if (progview_event(vocabed->progview, e))
+		return true;
 
 	switch (e->type) {
 	case SDL_KEYDOWN:
@@ -718,8 +826,20 @@ static void vocabed_examine(vocabed_t *vocabed)
  */
 static void vocabed_learn_end(vocabed_t *vocabed)
 {
+	unsigned nloops;
+
 	printf("Learn end!\n");
 
+	/* Loop extraction restructures the body */
+	undolog_clear(vocabed->learn_log);
+
+	if (vocabed->extract_loops &&
+	    progloop_extract(vocabed->learn_proc, &nloops) == 0 &&
+	    nloops > 0) {
+		printf("Extracted %u loops.\n", nloops);
+		vocabed_repaint_req(vocabed);
+	}
+
 	vocabed_open_icon_dlg(vocabed);
 }
 
@@ -802,21 +922,11 @@ static void vocabed_robots_step(void *arg)
 {
 	vocabed_t *vocabed = (vocabed_t *)arg;
 	robot_t *robot;
-	bool active = false;
-	robot_error_t error = errt_none;
+	bool active;
+	robot_error_t error;
+	int rc;
 
-	robot = robots_first(vocabed->robots);
-	while (robot != NULL) {
-		if (robot_is_busy(robot) && robot_error(robot) ==
-		    errt_none) {
-			robot_step(robot);
-			active = true;
-			if (robot_error(robot) != errt_none)
-				error = robot_error(robot);
-		}
-
-		robot = robots_next(robot);
-	}
+	rc = robots_tick(vocabed->robots, &active, &error);
 
 	robot = robots_first(vocabed->robots);
 	if (robot != NULL) {
@@ -824,10 +934,11 @@ static void vocabed_robots_step(void *arg)
 		progview_set_hgl_stmt(vocabed->progview, robot_cur_stmt(robot));
 	}
 
-	if (active)
-		vocabed_repaint_req(vocabed);
-	else
+	vocabed_repaint_req(vocabed);
+	if (!active || rc != 0) {
+		/* Finished, stopped at breakpoint or cannot continue */
 		gfx_timer_stop(vocabed->robot_timer);
+	}
 
 	if (error != errt_none) {
 		gfx_timer_stop(vocabed->robot_timer);
@@ -840,7 +951,7 @@ static void vocabed_robots_step(void *arg)
  *
  * This starts moving the robots.
  */
-void vocabed_start_robots(vocabed_t *vocabed)
+static void vocabed_start_robots(vocabed_t *vocabed)
 {
 	robot_t *robot;
 
@@ -910,6 +1021,12 @@ static void vocabed_work_verb_selected(void *arg, void *earg)
 		robot = robots_next(robot);
 	}
 
+	if (verb->vtype == verb_call && vocabed->rerun != NULL) {
+		/* Record run so that it can be repeated after changes */
+		if (rerun_start(vocabed->rerun) != 0)
+			printf("Cannot record run.\n");
+	}
+
 	if (error != errt_none)
 		vocabed_open_error_dlg(vocabed, error);
 
@@ -925,6 +1042,27 @@ static void vocabed_verb_destroy(void *arg, void *earg)
 	free(verb);
 }
 
+/** Get icon for call verb.
+ *
+ * @param arg Vocabulary editor (vocabed_t *)
+ * @param earg Verb (vocabed_verb_t *)
+ * @return Icon or @c NULL if not available
+ */
+static gfx_bmp_t *vocabed_verb_icon(void *arg, void *earg)
+{
+	vocabed_t *vocabed = (vocabed_t *)arg;
+	vocabed_verb_t *verb = (vocabed_verb_t *)earg;
+	icondict_entry_t *entry;
+
+	assert(verb->vtype == verb_call);
+
+	entry = icondict_find(vocabed->icondict, verb->v.vcall.proc->ident);
+	if (entry == NULL)
+		return NULL;
+
+	return icondict_entry_bmp(entry);
+}
+
 /** Insert intrinsic statement to procedure that we are learning.
  *
  * @param vocabed Vocabulary editor
@@ -939,7 +1077,11 @@ static void vocabed_learn_intrinsic(vocabed_t *vocabed, prog_intr_type_t itype)
 	if (rc != 0)
 		return;
 
-	prog_block_append(vocabed->learn_proc->body, stmt);
+	undolog_begin(vocabed->learn_log, 0);
+	rc = undolog_stmt_append(vocabed->learn_log,
+	    vocabed->learn_proc->body, stmt);
+	if (rc != 0)
+		prog_stmt_destroy(stmt);
 }
 
 /** Insert call statement to procedure that we are learning.
@@ -956,7 +1098,11 @@ static void vocabed_learn_call(vocabed_t *vocabed, prog_proc_t *proc)
 	if (rc != 0)
 		return;
 
-	prog_block_append(vocabed->learn_proc->body, stmt);
+	undolog_begin(vocabed->learn_log, 0);
+	rc = undolog_stmt_append(vocabed->learn_log,
+	    vocabed->learn_proc->body, stmt);
+	if (rc != 0)
+		prog_stmt_destroy(stmt);
 }
 
 /** Vocabulary editor learn mode verb selected.
@@ -1079,16 +1225,35 @@ static void vocabed_icondlg_accept(void *arg)
 	vocabed_t *vocabed = (vocabed_t *)arg;
 	int rc;
 
-	rc = icondict_add(vocabed->icondict, vocabed->learn_proc->ident,
-	    vocabed->icondlg->icon);
-	if (rc != 0)
+	/*
+	 * Append new procedure to program before recording its icon so that
+	 * we never save or journal an icon without a procedure.
+	 */
+	rc = prog_module_append(vocabed->prog, vocabed->learn_proc);
+	if (rc != 0) {
 		icon_destroy(vocabed->icondlg->icon);
+		prog_proc_destroy(vocabed->learn_proc);
+	} else {
+		rc = icondict_add(vocabed->icondict,
+		    vocabed->learn_proc->ident, vocabed->icondlg->icon);
+		if (rc != 0)
+			icon_destroy(vocabed->icondlg->icon);
+
+		if (proghash_cons(vocabed->prog, NULL) == 0 &&
+		    vocabed->learn_proc->canon != vocabed->learn_proc) {
+			/*
+			 * Keeps its own icon, but shares code with
+			 * the original
+			 */
+			printf("Procedure '%s' is identical to '%s'.\n",
+			    vocabed->learn_proc->ident,
+			    vocabed->learn_proc->canon->ident);
+		}
+	}
 
 	icondlg_destroy(vocabed->icondlg);
 	vocabed->icondlg = NULL;
 
-	/* Append new procedure to program */
-	prog_module_append(vocabed->prog, vocabed->learn_proc);
 	vocabed->learn_proc = NULL;
 	progview_set_proc(vocabed->progview, NULL);
 
@@ -1110,6 +1275,47 @@ static void vocabed_icondlg_repaint(void *arg)
 	vocabed_repaint_req(vocabed);
 }
 
+/** Handle statement click in program view in vocabulary editor.
+ *
+ * Toggles breakpoint on the statement.
+ *
+ * @param arg Argument (vocabed_t *)
+ * @param stmt Statement
+ */
+static void vocabed_progview_stmt_clicked(void *arg, prog_stmt_t *stmt)
+{
+	vocabed_t *vocabed = (vocabed_t *)arg;
+
+	prog_proc_set_breakpoint(progview_get_proc(vocabed->progview), stmt,
+	    !stmt->breakpoint);
+	vocabed_repaint_req(vocabed);
+}
+
+/** Switch vocabulary editor to a different map and robots.
+ *
+ * Any running robots are stopped.
+ *
+ * @param vocabed Vocabulary editor
+ * @param map Map
+ * @param robots Robots
+ */
+void vocabed_set_world(vocabed_t *vocabed, map_t *map, robots_t *robots)
+{
+	gfx_timer_stop(vocabed->robot_timer);
+	progview_set_hgl_stmt(vocabed->progview, NULL);
+
+	/* The recorded run belongs to the old world */
+	robots_set_rerun(vocabed->robots, NULL);
+	rerun_destroy(vocabed->rerun);
+	vocabed->rerun = NULL;
+	if (rerun_create(robots, &vocabed->rerun) == 0)
+		robots_set_rerun(robots, vocabed->rerun);
+
+	vocabed->robots = robots;
+	mapview_set_world(vocabed->mapview, map, robots);
+	vocabed_repaint_req(vocabed);
+}
+
 /** Destroy vocabulary editor.
  *
  * @param vocabed Vocabulary editor
@@ -1120,6 +1326,8 @@ void vocabed_destroy(vocabed_t *vocabed)
 
 	if (vocabed->robot_timer != NULL)
 		gfx_timer_destroy(vocabed->robot_timer);
+	rerun_destroy(vocabed->rerun);
+	undolog_destroy(vocabed->learn_log);
 	if (vocabed->icondict != NULL)
 		icondict_destroy(vocabed->icondict);
 	if (vocabed->mapview != NULL)
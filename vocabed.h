@@ -33,8 +33,10 @@
 #include "mapview.h"
 #include "prog.h"
 #include "progview.h"
+#include "rerun.h"
 #include "robots.h"
 #include "toolbar.h"
+#include "undolog.h"
 #include "wordlist.h"
 
 typedef struct {
@@ -93,10 +95,16 @@ typedef struct {
 	robots_t *robots;
 	/** Robot execution timer */
 	gfx_timer_t *robot_timer;
+	/** Run recorder or @c NULL */
+	rerun_t *rerun;
 	/** Program module */
 	prog_module_t *prog;
 	/** Procedure currently learning */
 	prog_proc_t *learn_proc;
+	/** Undo log for statements of procedure currently learning */
+	undolog_t *learn_log;
+	/** Extract loops from learned procedures */
+	bool extract_loops;
 	/** Icon dictionary */
 	icondict_t *icondict;
 	/** State */
@@ -127,6 +135,7 @@ extern int vocabed_new(map_t *, robots_t *, prog_module_t *, vocabed_cb_t *,
 extern int vocabed_load(map_t *, robots_t *, prog_module_t *, FILE *,
     vocabed_cb_t *, void *, vocabed_t **);
 extern void vocabed_destroy(vocabed_t *);
+extern void vocabed_set_world(vocabed_t *, map_t *, robots_t *);
 extern void vocabed_display(vocabed_t *, gfx_t *gfx);
 extern int vocabed_save(vocabed_t *, FILE *);
 extern bool vocabed_event(vocabed_t *, SDL_Event *, gfx_t *);
@@ -94,7 +94,8 @@ void wordlist_destroy(wordlist_t *wordlist)
 /** Add new entry to wordlist.
  *
  * @param wordlist Wordlist
- * @param icon Icon
+ * @param icon Icon or @c NULL to get it using the @c get_icon callback
+ *             every time it is needed
  * @param arg User argument
  *
  * @return Zero on success, ENOMEM if out of memory
@@ -134,6 +135,24 @@ void wordlist_clear(wordlist_t *wordlist)
 	}
 }
 
+/** Get wordlist entry icon.
+ *
+ * @param entry Wordlist entry
+ * @return Icon or @c NULL if not available
+ */
+static gfx_bmp_t *wordlist_entry_icon(wordlist_entry_t *entry)
+{
+	wordlist_t *wordlist = entry->wlist;
+
+	if (entry->icon != NULL)
+		return entry->icon;
+
+	if (wordlist->cb == NULL || wordlist->cb->get_icon == NULL)
+		return NULL;
+
+	return wordlist->cb->get_icon(wordlist->arg, entry->arg);
+}
+
 /** Draw wordlist.
  *
  * @param wordlist Wordlist
@@ -142,6 +161,7 @@ void wordlist_clear(wordlist_t *wordlist)
 void wordlist_draw(wordlist_t *wordlist, gfx_t *gfx)
 {
 	wordlist_entry_t *entry;
+	gfx_bmp_t *icon;
 	int x, y;
 
 	x = wordlist->orig_x;
@@ -151,8 +171,13 @@ void wordlist_draw(wordlist_t *wordlist, gfx_t *gfx)
 	while (entry != NULL) {
 		x += wordlist_hmargin;
 
-		gfx_bmp_render(gfx, entry->icon, x, y);
-		x += entry->icon->w + wordlist_hmargin;
+		icon = wordlist_entry_icon(entry);
+		if (icon != NULL) {
+			gfx_bmp_render(gfx, icon, x, y);
+			x += icon->w;
+		}
+
+		x += wordlist_hmargin;
 
 		entry = wordlist_next(entry);
 	}
@@ -168,6 +193,7 @@ bool wordlist_event(wordlist_t *wordlist, SDL_Event *event)
 {
 	SDL_MouseButtonEvent *mbe;
 	wordlist_entry_t *entry;
+	gfx_bmp_t *icon;
 	int x, y;
 	int w, h;
 
@@ -177,8 +203,9 @@ bool wordlist_event(wordlist_t *wordlist, SDL_Event *event)
 	entry = wordlist_first(wordlist);
 	while (entry != NULL) {
 		x += wordlist_hmargin;
-		w = entry->icon->w;
-		h = entry->icon->h;
+		icon = wordlist_entry_icon(entry);
+		w = icon != NULL ? icon->w : 0;
+		h = icon != NULL ? icon->h : 0;
 
 		if (event->type == SDL_MOUSEBUTTONDOWN) {
 			mbe = (SDL_MouseButtonEvent *)event;
@@ -38,6 +38,8 @@ typedef struct {
 	void (*selected)(void *, void *);
 	/** Entry is being destroyed */
 	void (*destroy)(void *, void *);
+	/** Get icon for an entry that was added without one */
+	gfx_bmp_t *(*get_icon)(void *, void *);
 } wordlist_cb_t;
 
 /** Wordlist entry */
@@ -46,7 +48,7 @@ typedef struct {
 	struct wordlist *wlist;
 	/** Link to @c wlist->entries */
 	link_t lwlist;
-	/** Icon */
+	/** Icon or @c NULL to get it using the @c get_icon callback */
 	gfx_bmp_t *icon;
 	/** User argument */
 	void *arg;